@@ -0,0 +1,684 @@
+/*
+ * bench_adffs - the filesystem operations (adffs_oper) driven in-process
+ *
+ * Calls the FUSE handlers directly (without the kernel and a mount,
+ * see bench_fuse.h) - the same calls as FUSE makes for scripted workloads
+ * (ls -lR, cat of all files, extracting a tar archive, rm -rf).
+ * Reports throughput of each workload, latency of the operations
+ * (from the statistics of the operations) and, with glibc, the heap
+ * allocations made by the operations (see bench_malloc.h) as JSON.
+ *
+ * Can be run under perf, valgrind etc. like any other program.
+ */
+
+#include "bench_fuse.h"
+#include "bench_malloc.h"
+#include "bench_util.h"
+
+#include "adffs_log.h"
+#include "adffs_stats.h"
+#include "adffs_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_MAX_WORKLOADS     16
+#define BENCH_TAR_BLOCK         512
+
+typedef enum {
+    WORKLOAD_LS,                // ls -lR
+    WORKLOAD_CAT,               // cat of all files
+    WORKLOAD_UNTAR,             // tar xf
+    WORKLOAD_RM                 // rm -rf
+} workload_type_t;
+
+typedef struct workload {
+    workload_type_t  type;
+    const char *     spec;      // (as given)
+    const char *     arg;       // tar archive / path to remove
+    uint64_t         ns,
+                     bytes,
+                     entries,
+                     errors,
+                     mallocs;   // (by the operations)
+    adffs_op_stats_t ops [ ADFFS_OP_COUNT ];
+} workload_t;
+
+typedef struct bench_options {
+    const char * image;
+    bool         write_mode;    // (on a copy of the image)
+    unsigned     read_size,
+                 write_size;
+    const char * log_file,
+               * trace,
+               * output;
+} bench_options_t;
+
+typedef struct names {
+    char **  names;
+    unsigned n;
+} names_t;
+
+static bench_options_t opts = {
+    .image      = NULL,
+    .write_mode = false,
+    .read_size  = 131072,       // (FUSE reads with readahead)
+    .write_size = 4096,         // (FUSE 2.6 without big_writes)
+    .log_file   = NULL,
+    .trace      = NULL,
+    .output     = NULL
+};
+
+static workload_t workloads [ BENCH_MAX_WORKLOADS ];
+static unsigned nworkloads = 0;
+
+static char * buffer = NULL;
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+static bool walk ( workload_t * const w,
+                   const char * const dir );
+static bool untar ( workload_t * const w,
+                    const char * const archive );
+
+static void report_json ( FILE * const out );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    const size_t buffer_size = ( opts.read_size > opts.write_size ) ?
+        opts.read_size : opts.write_size;
+    buffer = malloc ( buffer_size );
+    if ( buffer == NULL )
+        return EXIT_FAILURE;
+
+    // modifications only on a copy of the image
+    char image_path [ 256 ] = "";
+    if ( opts.write_mode ) {
+        if ( ! bench_temp_file ( image_path, sizeof ( image_path ), "bench_adffs",
+                                 strrchr ( opts.image, '.' ) ) )
+        {
+            free ( buffer );
+            return EXIT_FAILURE;
+        }
+        if ( ! bench_copy_file ( opts.image, image_path ) ) {
+            fprintf ( stderr, "Cannot copy %s to %s\n", opts.image, image_path );
+            unlink ( image_path );
+            free ( buffer );
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE * logfile = NULL;
+    if ( opts.log_file != NULL ) {
+        logfile = adffs_log_open ( opts.log_file );
+        if ( logfile == NULL ) {
+            fprintf ( stderr, "Cannot open log file: %s\n", opts.log_file );
+            goto main_error_remove_image;
+        }
+    }
+    if ( opts.trace != NULL &&
+         ! adffs_trace_set ( opts.trace, strlen ( opts.trace ) ) )
+    {
+        fprintf ( stderr, "Invalid trace categories: %s\n", opts.trace );
+        goto main_error_close_log;
+    }
+
+    char * const path = opts.write_mode ? image_path : ( char * ) opts.image;
+    if ( ! bench_fuse_mount ( path, ! opts.write_mode, logfile ) ) {
+        fprintf ( stderr, "Cannot open the image %s\n", path );
+        goto main_error_close_log;
+    }
+
+    int status = EXIT_SUCCESS;
+    for ( unsigned i = 0 ; i < nworkloads ; i++ ) {
+        workload_t * const w = &workloads [ i ];
+        adffs_stats_reset();
+        const uint64_t start = bench_now_ns(),
+                       mallocs = bench_malloc_count();
+        bool ok = ( w->type == WORKLOAD_UNTAR ) ?
+            untar ( w, w->arg ) : walk ( w, w->arg );
+        // (rm -rf of a directory - also the directory itself)
+        if ( ok && w->type == WORKLOAD_RM && strcmp ( w->arg, "/" ) != 0 )
+            ok = ( adffs_oper.rmdir ( w->arg ) == 0 );
+        w->ns = bench_now_ns() - start;
+        w->mallocs = bench_malloc_count() - mallocs;
+        for ( unsigned op = 0 ; op < ADFFS_OP_COUNT ; op++ )
+            adffs_stats_get ( ( adffs_op_t ) op, &w->ops [ op ] );
+        if ( ! ok ) {
+            fprintf ( stderr, "Workload %s failed.\n", w->spec );
+            status = EXIT_FAILURE;
+        }
+    }
+
+    bench_fuse_unmount();
+
+    FILE * const out = ( opts.output != NULL ) ? fopen ( opts.output, "w" ) : stdout;
+    if ( out == NULL ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", opts.output, strerror ( errno ) );
+        status = EXIT_FAILURE;
+    } else {
+        report_json ( out );
+        if ( out != stdout )
+            fclose ( out );
+    }
+
+    if ( image_path [ 0 ] != '\0' )
+        unlink ( image_path );
+    free ( buffer );
+    return status;
+
+main_error_close_log:
+    if ( logfile != NULL )
+        adffs_log_close();
+
+main_error_remove_image:
+    if ( image_path [ 0 ] != '\0' )
+        unlink ( image_path );
+    free ( buffer );
+    return EXIT_FAILURE;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  bench_adffs [options] image workload...\n\n"
+             "Runs workloads calling the filesystem operations directly\n"
+             "(without mounting), prints throughput and latencies as JSON.\n\n"
+             "Workloads (run in the given order):\n"
+             "  ls           ls -lR of the whole volume\n"
+             "  cat          reading all files\n"
+             "  untar=FILE   extracting a tar archive to the root directory\n"
+             "  rm[=PATH]    rm -rf of a directory (default: all in the root)\n\n"
+             "Options:\n"
+             "  -w           read-write (on a copy of the image)\n"
+             "  -b size      size of reads (default 131072)\n"
+             "  -B size      size of writes (default 4096)\n"
+             "  -l file      log file\n"
+             "  -t list      trace categories (as -o trace=...)\n"
+             "  -o file      write the JSON to the file (default: stdout)\n"
+             "  -h           show this help\n\n" );
+}
+
+
+static bool parse_size ( const char * const str,
+                         unsigned * const   value )
+{
+    char * end;
+    errno = 0;
+    const unsigned long v = strtoul ( str, &end, 10 );
+    if ( errno != 0 || end == str || *end != '\0' || v == 0 || v > 16 * 1024 * 1024 )
+        return false;
+    *value = ( unsigned ) v;
+    return true;
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "wb:B:l:t:o:h" ) ) != -1 ) {
+        bool ok = true;
+        switch ( opt ) {
+        case 'w':
+            opts.write_mode = true;
+            break;
+        case 'b':
+            ok = parse_size ( optarg, &opts.read_size );
+            break;
+        case 'B':
+            ok = parse_size ( optarg, &opts.write_size );
+            break;
+        case 'l':
+            opts.log_file = optarg;
+            break;
+        case 't':
+            opts.trace = optarg;
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            ok = false;
+        }
+        if ( ! ok )
+            return false;
+    }
+
+    if ( optind >= argc - 1 )
+        return false;
+    opts.image = argv [ optind++ ];
+
+    for ( ; optind < argc ; optind++ ) {
+        const char * const spec = argv [ optind ];
+        if ( nworkloads == BENCH_MAX_WORKLOADS ) {
+            fprintf ( stderr, "Too many workloads (max. %u).\n", BENCH_MAX_WORKLOADS );
+            return false;
+        }
+        workload_t * const w = &workloads [ nworkloads++ ];
+        w->spec = spec;
+        w->arg  = "/";
+        if ( strcmp ( spec, "ls" ) == 0 ) {
+            w->type = WORKLOAD_LS;
+        } else if ( strcmp ( spec, "cat" ) == 0 ) {
+            w->type = WORKLOAD_CAT;
+        } else if ( strncmp ( spec, "untar=", 6 ) == 0 && spec [ 6 ] != '\0' ) {
+            w->type = WORKLOAD_UNTAR;
+            w->arg  = spec + 6;
+        } else if ( strcmp ( spec, "rm" ) == 0 ) {
+            w->type = WORKLOAD_RM;
+        } else if ( strncmp ( spec, "rm=", 3 ) == 0 && spec [ 3 ] == '/' ) {
+            w->type = WORKLOAD_RM;
+            w->arg  = spec + 3;
+        } else {
+            fprintf ( stderr, "Unknown workload: %s\n", spec );
+            return false;
+        }
+        if ( ( w->type == WORKLOAD_UNTAR || w->type == WORKLOAD_RM ) &&
+             ! opts.write_mode )
+        {
+            fprintf ( stderr, "Workload %s requires -w.\n", spec );
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*****
+ * Walking the directory tree (ls -lR, cat, rm -rf)
+ *****/
+
+static int names_filler ( void *              buf,
+                          const char *        name,
+                          const struct stat * stbuf,
+                          off_t               off )
+{
+    (void) stbuf;
+    (void) off;
+    names_t * const names = buf;
+    if ( strcmp ( name, "." ) == 0 || strcmp ( name, ".." ) == 0 )
+        return 0;
+
+    // (allocations of the benchmark - not of the operations)
+    bench_malloc_ignore ( true );
+    // (grows by powers of 2)
+    if ( ( names->n & ( names->n - 1 ) ) == 0 ) {
+        char ** const new_names = realloc ( names->names,
+                                            ( names->n == 0 ? 1 : names->n * 2 ) *
+                                            sizeof ( char * ) );
+        if ( new_names == NULL )
+            goto names_filler_error;
+        names->names = new_names;
+    }
+    if ( ( names->names [ names->n ] = strdup ( name ) ) == NULL )
+        goto names_filler_error;
+    names->n++;
+    bench_malloc_ignore ( false );
+    return 0;
+
+names_filler_error:
+    bench_malloc_ignore ( false );
+    return 1;
+}
+
+
+static void names_free ( names_t * const names )
+{
+    for ( unsigned i = 0 ; i < names->n ; i++ )
+        free ( names->names [ i ] );
+    free ( names->names );
+}
+
+
+static void join_path ( char * const       path,
+                        const size_t       size,
+                        const char * const dir,
+                        const char * const name )
+{
+    snprintf ( path, size, "%s%s%s",
+               dir, strcmp ( dir, "/" ) == 0 ? "" : "/", name );
+}
+
+
+static bool cat_file ( workload_t * const w,
+                       const char * const path )
+{
+    struct fuse_file_info finfo;
+    memset ( &finfo, 0, sizeof ( finfo ) );
+    finfo.flags = O_RDONLY;
+    if ( adffs_oper.open ( path, &finfo ) != 0 )
+        return false;
+
+    bool ok = true;
+    for ( off_t offset = 0 ; ; ) {
+        const int n = adffs_oper.read ( path, buffer, opts.read_size, offset,
+                                        &finfo );
+        if ( n < 0 ) {
+            ok = false;
+            break;
+        }
+        w->bytes += ( uint64_t ) n;
+        offset   += n;
+        if ( ( unsigned ) n < opts.read_size )
+            break;
+    }
+    adffs_oper.release ( path, &finfo );
+    return ok;
+}
+
+
+static bool walk ( workload_t * const w,
+                   const char * const dir )
+{
+    struct stat st;
+    if ( adffs_oper.getattr ( dir, &st ) != 0 || ! S_ISDIR ( st.st_mode ) )
+        return false;
+
+    names_t names = { NULL, 0 };
+    struct fuse_file_info finfo;
+    memset ( &finfo, 0, sizeof ( finfo ) );
+    if ( adffs_oper.readdir ( dir, &names, names_filler, 0, &finfo ) != 0 ) {
+        names_free ( &names );
+        return false;
+    }
+
+    bool ok = true;
+    char path [ ADFIMAGE_MAX_PATH ],
+         link [ ADFIMAGE_MAX_PATH ];
+    for ( unsigned i = 0 ; i < names.n && ok ; i++ ) {
+        join_path ( path, sizeof ( path ), dir, names.names [ i ] );
+        w->entries++;
+        if ( adffs_oper.getattr ( path, &st ) != 0 ) {
+            w->errors++;
+            continue;
+        }
+
+        if ( S_ISDIR ( st.st_mode ) ) {
+            ok = walk ( w, path );
+            if ( ok && w->type == WORKLOAD_RM && adffs_oper.rmdir ( path ) != 0 )
+                w->errors++;
+            continue;
+        }
+
+        switch ( w->type ) {
+        case WORKLOAD_LS:
+            if ( S_ISLNK ( st.st_mode ) &&
+                 adffs_oper.readlink ( path, link, sizeof ( link ) ) != 0 )
+            {
+                w->errors++;
+            }
+            break;
+        case WORKLOAD_CAT:
+            if ( S_ISREG ( st.st_mode ) && ! cat_file ( w, path ) )
+                w->errors++;
+            break;
+        case WORKLOAD_RM:
+            if ( adffs_oper.unlink ( path ) != 0 )
+                w->errors++;
+            break;
+        case WORKLOAD_UNTAR:
+            break;
+        }
+    }
+
+    names_free ( &names );
+    return ok;
+}
+
+
+/*****
+ * Extracting a tar archive (ustar)
+ *****/
+
+static uint64_t tar_number ( const char * const field,
+                             const size_t       size )
+{
+    uint64_t value = 0;
+    for ( size_t i = 0 ; i < size && field [ i ] >= '0' && field [ i ] <= '7' ; i++ )
+        value = value * 8 + ( uint64_t ) ( field [ i ] - '0' );
+    return value;
+}
+
+
+static bool tar_skip ( FILE * const   tar,
+                       const uint64_t size )
+{
+    const uint64_t blocks = ( size + BENCH_TAR_BLOCK - 1 ) / BENCH_TAR_BLOCK;
+    return fseeko ( tar, ( off_t ) ( blocks * BENCH_TAR_BLOCK ), SEEK_CUR ) == 0;
+}
+
+
+static bool untar_file ( workload_t * const  w,
+                         FILE * const        tar,
+                         const char * const  path,
+                         const mode_t        mode,
+                         const uint64_t      size,
+                         const time_t        mtime )
+{
+    struct fuse_file_info finfo;
+    memset ( &finfo, 0, sizeof ( finfo ) );
+    finfo.flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if ( adffs_oper.create ( path, mode, &finfo ) != 0 ) {
+        tar_skip ( tar, size );
+        return false;
+    }
+
+    bool ok = true;
+    for ( uint64_t offset = 0 ; offset < size && ok ; ) {
+        const size_t n = ( size - offset < opts.write_size ) ?
+            ( size_t ) ( size - offset ) : opts.write_size;
+        if ( fread ( buffer, 1, n, tar ) != n ) {
+            ok = false;
+            break;
+        }
+        const int written = adffs_oper.write ( path, buffer, n, ( off_t ) offset,
+                                               &finfo );
+        ok = ( written == ( int ) n );
+        if ( written > 0 )
+            w->bytes += ( uint64_t ) written;
+        offset += n;
+    }
+    adffs_oper.release ( path, &finfo );
+
+    // (the rest of the last block)
+    const size_t rest = ( size_t ) ( ( BENCH_TAR_BLOCK - size % BENCH_TAR_BLOCK ) %
+                                     BENCH_TAR_BLOCK );
+    if ( rest > 0 && fseeko ( tar, ( off_t ) rest, SEEK_CUR ) != 0 )
+        return false;
+
+    const struct timespec times [ 2 ] = { { mtime, 0 }, { mtime, 0 } };
+    if ( ok && adffs_oper.utimens ( path, times ) != 0 )
+        ok = false;
+    return ok;
+}
+
+
+static bool untar ( workload_t * const w,
+                    const char * const archive )
+{
+    // (allocations of the benchmark - not of the operations)
+    static char tar_buffer [ BUFSIZ ];
+    bench_malloc_ignore ( true );
+    FILE * const tar = fopen ( archive, "rb" );
+    bench_malloc_ignore ( false );
+    if ( tar == NULL ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", archive, strerror ( errno ) );
+        return false;
+    }
+    setvbuf ( tar, tar_buffer, _IOFBF, sizeof ( tar_buffer ) );
+
+    bool ok = true;
+    char header [ BENCH_TAR_BLOCK ],
+         name [ 256 ],
+         path [ ADFIMAGE_MAX_PATH ];
+    while ( fread ( header, 1, sizeof ( header ), tar ) == sizeof ( header ) ) {
+        if ( header [ 0 ] == '\0' )
+            break;      // (end of the archive)
+
+        const uint64_t size  = tar_number ( header + 124, 12 );
+        const mode_t   mode  = ( mode_t ) tar_number ( header + 100, 8 ) & 0777;
+        const time_t   mtime = ( time_t ) tar_number ( header + 136, 12 );
+        const char     type  = header [ 156 ];
+
+        // name (with the ustar prefix), without "./" and the trailing "/"
+        if ( memcmp ( header + 257, "ustar", 5 ) == 0 && header [ 345 ] != '\0' )
+            snprintf ( name, sizeof ( name ), "%.155s/%.100s", header + 345, header );
+        else
+            snprintf ( name, sizeof ( name ), "%.100s", header );
+        char * entry = name;
+        while ( strncmp ( entry, "./", 2 ) == 0 )
+            entry += 2;
+        size_t len = strlen ( entry );
+        while ( len > 0 && entry [ len - 1 ] == '/' )
+            entry [ --len ] = '\0';
+        if ( len == 0 || strcmp ( entry, "." ) == 0 ) {
+            if ( ! tar_skip ( tar, size ) ) {
+                ok = false;
+                break;
+            }
+            continue;
+        }
+        snprintf ( path, sizeof ( path ), "/%s", entry );
+
+        // (as tar - checks first if it exists)
+        struct stat st;
+        const bool exists = ( adffs_oper.getattr ( path, &st ) == 0 );
+        w->entries++;
+
+        if ( type == '5' ) {
+            if ( ! exists && adffs_oper.mkdir ( path, mode ) != 0 )
+                w->errors++;
+        } else if ( type == '0' || type == '\0' ) {
+            if ( exists && adffs_oper.unlink ( path ) != 0 )
+                w->errors++;
+            if ( ! untar_file ( w, tar, path, mode, size, mtime ) ) {
+                w->errors++;
+                if ( feof ( tar ) || ferror ( tar ) ) {
+                    ok = false;
+                    break;
+                }
+            }
+        } else {
+            // (links, devices... - not supported)
+            w->errors++;
+            if ( ! tar_skip ( tar, size ) ) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    if ( ferror ( tar ) )
+        ok = false;
+    fclose ( tar );
+    return ok;
+}
+
+
+/*****
+ * Report
+ *****/
+
+static double per_op ( const uint64_t value,
+                       const uint64_t ops )
+{
+    return ( ops > 0 ) ? ( double ) value / ( double ) ops : 0.0;
+}
+
+
+// upper bound (in microseconds) of the histogram bucket with the percentile
+static uint64_t percentile_us ( const adffs_op_stats_t * const stats,
+                                const unsigned                 percent )
+{
+    const uint64_t threshold = ( stats->count * percent + 99 ) / 100;
+    uint64_t count = 0;
+    for ( unsigned i = 0 ; i < ADFFS_STATS_BUCKETS ; i++ ) {
+        count += stats->histogram [ i ];
+        if ( count >= threshold )
+            return 1ULL << i;
+    }
+    return 1ULL << ( ADFFS_STATS_BUCKETS - 1 );
+}
+
+
+static void report_json ( FILE * const out )
+{
+    fprintf ( out, "{\n  \"image\": " );
+    bench_json_string ( out, opts.image );
+    fprintf ( out, ",\n"
+              "  \"read_size\": %u,\n"
+              "  \"write_size\": %u,\n"
+              "  \"mallocs_counted\": %s,\n"
+              "  \"workloads\": [",
+              opts.read_size, opts.write_size,
+              bench_malloc_counted() ? "true" : "false" );
+
+    for ( unsigned i = 0 ; i < nworkloads ; i++ ) {
+        const workload_t * const w = &workloads [ i ];
+        uint64_t nops = 0;
+        for ( unsigned op = 0 ; op < ADFFS_OP_COUNT ; op++ )
+            nops += w->ops [ op ].count;
+        const double secs = ( double ) w->ns / 1e9;
+
+        fprintf ( out, "%s\n    {\n      \"name\": ", i > 0 ? "," : "" );
+        bench_json_string ( out, w->spec );
+        fprintf ( out, ",\n"
+                  "      \"time_ns\": %" PRIu64 ",\n"
+                  "      \"entries\": %" PRIu64 ",\n"
+                  "      \"errors\": %" PRIu64 ",\n"
+                  "      \"ops\": %" PRIu64 ",\n"
+                  "      \"bytes\": %" PRIu64 ",\n"
+                  "      \"ops_per_s\": %.1f,\n"
+                  "      \"bytes_per_s\": %.1f,\n"
+                  "      \"mallocs\": %" PRIu64 ",\n"
+                  "      \"mallocs_per_op\": %.3f,\n"
+                  "      \"operations\": [",
+                  w->ns, w->entries, w->errors, nops, w->bytes,
+                  secs > 0 ? ( double ) nops / secs : 0.0,
+                  secs > 0 ? ( double ) w->bytes / secs : 0.0,
+                  w->mallocs, per_op ( w->mallocs, nops ) );
+
+        bool first = true;
+        for ( unsigned op = 0 ; op < ADFFS_OP_COUNT ; op++ ) {
+            const adffs_op_stats_t * const s = &w->ops [ op ];
+            if ( s->count == 0 )
+                continue;
+            fprintf ( out, "%s\n        {\n"
+                      "          \"op\": \"%s\",\n"
+                      "          \"count\": %" PRIu64 ",\n"
+                      "          \"errors\": %" PRIu64 ",\n"
+                      "          \"avg_ns\": %.1f,\n"
+                      "          \"max_ns\": %" PRIu64 ",\n"
+                      "          \"p50_us\": %" PRIu64 ",\n"
+                      "          \"p99_us\": %" PRIu64 ",\n"
+                      "          \"block_reads_per_op\": %.3f,\n"
+                      "          \"block_writes_per_op\": %.3f\n"
+                      "        }",
+                      first ? "" : ",",
+                      adffs_stats_op_name ( ( adffs_op_t ) op ),
+                      s->count, s->errors,
+                      per_op ( s->total_ns, s->count ), s->max_ns,
+                      percentile_us ( s, 50 ), percentile_us ( s, 99 ),
+                      per_op ( s->io.reads, s->count ),
+                      per_op ( s->io.writes, s->count ) );
+            first = false;
+        }
+        fprintf ( out, "\n      ]\n    }" );
+    }
+    fprintf ( out, "\n  ]\n}\n" );
+}
@@ -0,0 +1,929 @@
+/*
+ * bench_adfimage - microbenchmarks of the adfimage API
+ *
+ * Measures path lookups, changing directories, reading (sequential
+ * and random), counting directory entries and creating / writing / removing
+ * files, on a generated image (of the given type, filesystem and shape)
+ * or on a copy of an existing one. Prints the results (time and device I/O
+ * per operation, with glibc also heap allocations - see bench_malloc.h)
+ * as JSON.
+ *
+ * With a baseline (results of an earlier run, -c), fails if the block I/O
+ * per operation has grown beyond the threshold - unlike the time, it is
+ * deterministic (the same for the same options), so it can be checked
+ * in the tests (see tests/perf_adfimage.sh).
+ */
+
+#include "bench_malloc.h"
+#include "bench_util.h"
+
+#include "adfimage.h"
+#include "adffs_stats.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_IO_SIZE           4096
+#define BENCH_MAX_RESULTS       16
+#define BENCH_MAX_NAME          32
+
+typedef enum {
+    BENCH_DEV_DD,               // floppy 880K
+    BENCH_DEV_HD,               // floppy 1.76M
+    BENCH_DEV_HDF               // hardfile
+} bench_dev_type_t;
+
+typedef struct bench_options {
+    const char *     image;         // existing image (NULL - generate one)
+    bench_dev_type_t dev_type;
+    unsigned         hdf_size_mb;
+    uint8_t          fs_type;
+    unsigned         dirs,          // subdirectories in each directory
+                     depth,         // levels of subdirectories
+                     files,         // files in each directory
+                     file_size,
+                     iterations,
+                     seed;
+    bool             read_only;     // (no modification benchmarks)
+    const char *     output;        // JSON (NULL - stdout)
+    const char *     baseline;      // JSON of an earlier run (NULL - none)
+    unsigned         threshold;     // (max. growth, in %)
+} bench_options_t;
+
+typedef struct bench_tree {
+    char **    dirs;
+    unsigned   ndirs;
+    char **    files;
+    uint32_t * file_sizes;
+    unsigned   nfiles;
+    uint64_t   file_bytes;
+} bench_tree_t;
+
+typedef struct bench_result {
+    const char *     name;
+    uint64_t         ops,
+                     errors,
+                     ns,
+                     bytes,
+                     mallocs;
+    adffs_io_stats_t io;
+} bench_result_t;
+
+typedef struct baseline_result {
+    char     name [ BENCH_MAX_NAME ];
+    uint64_t errors;
+    double   reads,                 // (blocks per operation)
+             writes;
+} baseline_result_t;
+
+typedef struct baseline {
+    unsigned          dirs,
+                      files;
+    baseline_result_t results [ BENCH_MAX_RESULTS ];
+    unsigned          nresults;
+} baseline_t;
+
+typedef struct bench_mark {
+    uint64_t         ns,
+                     mallocs;
+    adffs_io_stats_t io;
+} bench_mark_t;
+
+static bench_result_t results [ BENCH_MAX_RESULTS ];
+static unsigned nresults = 0;
+
+static uint64_t rnd_state;
+
+static void usage ( void );
+
+static bool parse_options ( int               argc,
+                            char **           argv,
+                            bench_options_t * opts );
+
+static bool image_create ( const char * const            path,
+                           const bench_options_t * const opts );
+static bool image_populate ( adfimage_t * const            adf,
+                             const char * const            dir,
+                             const unsigned                level,
+                             const bench_options_t * const opts );
+
+static bool tree_scan ( adfimage_t * const adf,
+                        bench_tree_t *     tree );
+static void tree_free ( bench_tree_t * tree );
+
+static void bench_getdentry ( adfimage_t * const            adf,
+                              const bench_tree_t * const    tree,
+                              const bench_options_t * const opts );
+static void bench_chdir ( adfimage_t * const            adf,
+                          const bench_tree_t * const    tree,
+                          const bench_options_t * const opts );
+static void bench_count_dir_entries ( adfimage_t * const            adf,
+                                      const bench_tree_t * const    tree,
+                                      const bench_options_t * const opts );
+static void bench_read_seq ( adfimage_t * const            adf,
+                             const bench_tree_t * const    tree,
+                             const bench_options_t * const opts );
+static void bench_read_random ( adfimage_t * const            adf,
+                                const bench_tree_t * const    tree,
+                                const bench_options_t * const opts );
+static void bench_create_write_unlink ( adfimage_t * const            adf,
+                                        const bench_options_t * const opts );
+
+static void report_json ( FILE * const                  out,
+                          const char * const            image,
+                          const bench_tree_t * const    tree,
+                          const bench_options_t * const opts );
+
+static bool baseline_check ( const bench_tree_t * const    tree,
+                             const bench_options_t * const opts );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    bench_options_t opts = {
+        .image       = NULL,
+        .dev_type    = BENCH_DEV_DD,
+        .hdf_size_mb = 10,
+        .fs_type     = ADF_DOSFS_FFS,
+        .dirs        = 8,
+        .depth       = 1,
+        .files       = 16,
+        .file_size   = 8192,
+        .iterations  = 1000,
+        .seed        = 1,
+        .read_only   = false,
+        .output      = NULL,
+        .baseline    = NULL,
+        .threshold   = 5
+    };
+    if ( ! parse_options ( argc, argv, &opts ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    rnd_state = opts.seed + 0x9e3779b97f4a7c15ULL;     // (never 0)
+
+    // the benchmarked image is always a temporary one (generated
+    // or a copy), unless only reading
+    const char * const suffix =
+        ( opts.image != NULL ) ? strrchr ( opts.image, '.' ) :
+        ( opts.dev_type == BENCH_DEV_HDF ) ? ".hdf" : ".adf";
+    char image_path [ 256 ] = "";
+    if ( ( opts.image == NULL || ! opts.read_only ) &&
+         ! bench_temp_file ( image_path, sizeof ( image_path ),
+                             "bench_adfimage", suffix ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_FAILURE;
+    if ( opts.image == NULL ) {
+        if ( ! image_create ( image_path, &opts ) ) {
+            fprintf ( stderr, "Cannot create the image %s\n", image_path );
+            goto main_error_remove_image;
+        }
+    } else if ( ! opts.read_only ) {
+        if ( ! bench_copy_file ( opts.image, image_path ) ) {
+            fprintf ( stderr, "Cannot copy %s to %s\n", opts.image, image_path );
+            goto main_error_remove_image;
+        }
+    }
+
+    char * const path = ( image_path [ 0 ] != '\0' ) ? image_path :
+                                                       ( char * ) opts.image;
+    adfimage_t * adf = adfimage_open ( path, 0, opts.read_only, false );
+    if ( adf == NULL ) {
+        fprintf ( stderr, "Cannot open the image %s\n", path );
+        goto main_error_remove_image;
+    }
+
+    if ( opts.image == NULL ) {
+        if ( ! image_populate ( adf, "/", 0, &opts ) ) {
+            fprintf ( stderr, "Cannot populate the image %s\n", path );
+            goto main_error_close_image;
+        }
+        // (start the benchmarks with a flushed image)
+        adfimage_close ( &adf );
+        adf = adfimage_open ( path, 0, false, false );
+        if ( adf == NULL ) {
+            fprintf ( stderr, "Cannot reopen the image %s\n", path );
+            goto main_error_remove_image;
+        }
+    }
+
+    bench_tree_t tree = { 0 };
+    if ( ! tree_scan ( adf, &tree ) ) {
+        fprintf ( stderr, "Cannot scan the image %s\n", path );
+        goto main_error_free_tree;
+    }
+
+    bench_getdentry ( adf, &tree, &opts );
+    bench_chdir ( adf, &tree, &opts );
+    bench_count_dir_entries ( adf, &tree, &opts );
+    bench_read_seq ( adf, &tree, &opts );
+    bench_read_random ( adf, &tree, &opts );
+    if ( ! opts.read_only )
+        bench_create_write_unlink ( adf, &opts );
+
+    FILE * const out = ( opts.output != NULL ) ? fopen ( opts.output, "w" ) : stdout;
+    if ( out == NULL ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", opts.output, strerror ( errno ) );
+        goto main_error_free_tree;
+    }
+    report_json ( out, opts.image != NULL ? opts.image : "(generated)",
+                  &tree, &opts );
+    if ( out != stdout )
+        fclose ( out );
+    status = ( opts.baseline == NULL || baseline_check ( &tree, &opts ) ) ?
+        EXIT_SUCCESS : EXIT_FAILURE;
+
+main_error_free_tree:
+    tree_free ( &tree );
+
+main_error_close_image:
+    adfimage_close ( &adf );
+
+main_error_remove_image:
+    if ( image_path [ 0 ] != '\0' )
+        unlink ( image_path );
+    return status;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  bench_adfimage [options]\n\n"
+             "Runs microbenchmarks of the adfimage API on a generated image\n"
+             "(or on a copy of an existing one), prints the results as JSON.\n\n"
+             "Options:\n"
+             "  -i image     use (a copy of) an existing image\n"
+             "  -t type      type of the generated image: dd (default), hd, hdf\n"
+             "  -m size      size of a generated hardfile (in MiB, default 10)\n"
+             "  -f fs        filesystem: ofs, ffs (default), dircache\n"
+             "  -d dirs      subdirectories in each directory (default 8)\n"
+             "  -l levels    levels of subdirectories (default 1)\n"
+             "  -n files     files in each directory (default 16)\n"
+             "  -s size      size of the files (default 8192)\n"
+             "  -N count     operations of each benchmark (default 1000)\n"
+             "  -S seed      seed of the random paths and offsets (default 1)\n"
+             "  -r           read-only (no create / write / unlink)\n"
+             "  -o file      write the JSON to the file (default: stdout)\n"
+             "  -c file      compare the block I/O with a baseline (JSON of\n"
+             "               an earlier run), fail on a regression\n"
+             "  -T percent   max. growth of the block I/O (default 5)\n"
+             "  -h           show this help\n\n" );
+}
+
+
+static bool parse_unsigned ( const char * const str,
+                             unsigned * const   value )
+{
+    char * end;
+    errno = 0;
+    const unsigned long v = strtoul ( str, &end, 10 );
+    if ( errno != 0 || end == str || *end != '\0' || v > UINT32_MAX )
+        return false;
+    *value = ( unsigned ) v;
+    return true;
+}
+
+
+static bool parse_options ( int               argc,
+                            char **           argv,
+                            bench_options_t * opts )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "i:t:m:f:d:l:n:s:N:S:ro:c:T:h" ) ) != -1 ) {
+        bool ok = true;
+        switch ( opt ) {
+        case 'i':
+            opts->image = optarg;
+            break;
+        case 't':
+            if ( strcmp ( optarg, "dd" ) == 0 )
+                opts->dev_type = BENCH_DEV_DD;
+            else if ( strcmp ( optarg, "hd" ) == 0 )
+                opts->dev_type = BENCH_DEV_HD;
+            else if ( strcmp ( optarg, "hdf" ) == 0 )
+                opts->dev_type = BENCH_DEV_HDF;
+            else
+                ok = false;
+            break;
+        case 'm':
+            ok = parse_unsigned ( optarg, &opts->hdf_size_mb ) &&
+                opts->hdf_size_mb > 0;
+            break;
+        case 'f':
+            if ( strcmp ( optarg, "ofs" ) == 0 )
+                opts->fs_type = 0;
+            else if ( strcmp ( optarg, "ffs" ) == 0 )
+                opts->fs_type = ADF_DOSFS_FFS;
+            else if ( strcmp ( optarg, "dircache" ) == 0 )
+                opts->fs_type = ADF_DOSFS_FFS | ADF_DOSFS_INTL | ADF_DOSFS_DIRCACHE;
+            else
+                ok = false;
+            break;
+        case 'd':
+            ok = parse_unsigned ( optarg, &opts->dirs );
+            break;
+        case 'l':
+            ok = parse_unsigned ( optarg, &opts->depth );
+            break;
+        case 'n':
+            ok = parse_unsigned ( optarg, &opts->files );
+            break;
+        case 's':
+            ok = parse_unsigned ( optarg, &opts->file_size );
+            break;
+        case 'N':
+            ok = parse_unsigned ( optarg, &opts->iterations ) &&
+                opts->iterations > 0;
+            break;
+        case 'S':
+            ok = parse_unsigned ( optarg, &opts->seed );
+            break;
+        case 'r':
+            opts->read_only = true;
+            break;
+        case 'o':
+            opts->output = optarg;
+            break;
+        case 'c':
+            opts->baseline = optarg;
+            break;
+        case 'T':
+            ok = parse_unsigned ( optarg, &opts->threshold );
+            break;
+        default:
+            ok = false;
+        }
+        if ( ! ok )
+            return false;
+    }
+
+    if ( optind != argc ) {
+        fprintf ( stderr, "Unexpected argument: %s\n", argv [ optind ] );
+        return false;
+    }
+    if ( opts->image == NULL && opts->read_only ) {
+        fprintf ( stderr, "A generated image cannot be read-only.\n" );
+        return false;
+    }
+    return true;
+}
+
+
+/*****
+ * Images
+ *****/
+
+static bool image_create ( const char * const            path,
+                           const bench_options_t * const opts )
+{
+    // (ADFlib initialized only for creating - adfimage_open does it again)
+    if ( adfLibInit() != ADF_RC_OK )
+        return false;
+
+    uint32_t cylinders = 80,
+             heads     = 2,
+             sectors   = 11;
+    if ( opts->dev_type == BENCH_DEV_HD ) {
+        sectors = 22;
+    } else if ( opts->dev_type == BENCH_DEV_HDF ) {
+        // (2 heads x 32 sectors - 32 cylinders per MiB)
+        sectors   = 32;
+        cylinders = opts->hdf_size_mb * 32;
+    }
+
+    bool ok = false;
+    struct AdfDevice * const dev = adfDevCreate ( "dump", path, cylinders,
+                                                  heads, sectors );
+    if ( dev != NULL ) {
+        const ADF_RETCODE rc = ( opts->dev_type == BENCH_DEV_HDF ) ?
+            adfCreateHdFile ( dev, "bench", opts->fs_type ) :
+            adfCreateFlop ( dev, "bench", opts->fs_type );
+        ok = ( rc == ADF_RC_OK );
+        adfDevClose ( dev );
+    }
+
+    adfLibCleanUp();
+    return ok;
+}
+
+
+static void join_path ( char * const       path,
+                        const char * const dir,
+                        const char * const name )
+{
+    snprintf ( path, ADFIMAGE_MAX_PATH, "%s%s%s",
+               dir, strcmp ( dir, "/" ) == 0 ? "" : "/", name );
+}
+
+
+static bool image_populate ( adfimage_t * const            adf,
+                             const char * const            dir,
+                             const unsigned                level,
+                             const bench_options_t * const opts )
+{
+    char path [ ADFIMAGE_MAX_PATH ],
+         name [ 32 ],
+         data [ BENCH_IO_SIZE ];
+    for ( unsigned i = 0 ; i < sizeof ( data ) ; i++ )
+        data [ i ] = ( char ) ( i * 7 );
+
+    for ( unsigned i = 0 ; i < opts->files ; i++ ) {
+        snprintf ( name, sizeof ( name ), "file%u", i );
+        join_path ( path, dir, name );
+        if ( adfimage_create ( adf, path, 0644 ) != 0 )
+            return false;
+        for ( unsigned offset = 0 ; offset < opts->file_size ; ) {
+            const unsigned size = ( opts->file_size - offset < BENCH_IO_SIZE ) ?
+                opts->file_size - offset : BENCH_IO_SIZE;
+            if ( adfimage_write ( adf, path, data, size, offset ) != ( int ) size )
+                return false;
+            offset += size;
+        }
+    }
+
+    if ( level >= opts->depth )
+        return true;
+
+    for ( unsigned i = 0 ; i < opts->dirs ; i++ ) {
+        snprintf ( name, sizeof ( name ), "dir%u", i );
+        join_path ( path, dir, name );
+        if ( adfimage_mkdir ( adf, path, 0755 ) != 0 ||
+             ! image_populate ( adf, path, level + 1, opts ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*****
+ * The tree of the image (paths of all directories and files)
+ *****/
+
+static bool tree_add ( char ***           paths,
+                       unsigned *         npaths,
+                       const char * const path )
+{
+    // (grows by powers of 2)
+    if ( ( *npaths & ( *npaths - 1 ) ) == 0 ) {
+        char ** const new_paths = realloc ( *paths, ( *npaths == 0 ? 1 : *npaths * 2 ) *
+                                                    sizeof ( char * ) );
+        if ( new_paths == NULL )
+            return false;
+        *paths = new_paths;
+    }
+    if ( ( ( *paths ) [ *npaths ] = strdup ( path ) ) == NULL )
+        return false;
+    ( *npaths )++;
+    return true;
+}
+
+
+static bool tree_scan ( adfimage_t * const adf,
+                        bench_tree_t *     tree )
+{
+    if ( ! tree_add ( &tree->dirs, &tree->ndirs, "/" ) )
+        return false;
+
+    // (breadth-first - the list of directories is the queue)
+    struct AdfVolume * const vol = adf->vol;
+    char path [ ADFIMAGE_MAX_PATH ];
+    for ( unsigned d = 0 ; d < tree->ndirs ; d++ ) {
+        if ( ! adfimage_chdir ( adf, tree->dirs [ d ] ) )
+            return false;
+        struct AdfList * const list = adfGetDirEnt ( vol, vol->curDirPtr );
+        for ( struct AdfList * cell = list ; cell != NULL ; cell = cell->next ) {
+            const struct AdfEntry * const entry = cell->content;
+            join_path ( path, tree->dirs [ d ], entry->name );
+            if ( entry->type == ADF_ST_DIR ) {
+                if ( ! tree_add ( &tree->dirs, &tree->ndirs, path ) ) {
+                    adfFreeDirList ( list );
+                    return false;
+                }
+            } else if ( entry->type == ADF_ST_FILE ) {
+                const unsigned n = tree->nfiles;
+                if ( ! tree_add ( &tree->files, &tree->nfiles, path ) ) {
+                    adfFreeDirList ( list );
+                    return false;
+                }
+                if ( ( n & ( n - 1 ) ) == 0 ) {
+                    uint32_t * const sizes = realloc ( tree->file_sizes,
+                                                       ( n == 0 ? 1 : n * 2 ) *
+                                                       sizeof ( uint32_t ) );
+                    if ( sizes == NULL ) {
+                        adfFreeDirList ( list );
+                        return false;
+                    }
+                    tree->file_sizes = sizes;
+                }
+                tree->file_sizes [ n ] = entry->size;
+                tree->file_bytes += entry->size;
+            }
+        }
+        adfFreeDirList ( list );
+    }
+    return adfimage_chdir ( adf, "/" );
+}
+
+
+static void tree_free ( bench_tree_t * tree )
+{
+    for ( unsigned i = 0 ; i < tree->ndirs ; i++ )
+        free ( tree->dirs [ i ] );
+    for ( unsigned i = 0 ; i < tree->nfiles ; i++ )
+        free ( tree->files [ i ] );
+    free ( tree->dirs );
+    free ( tree->files );
+    free ( tree->file_sizes );
+    memset ( tree, 0, sizeof ( *tree ) );
+}
+
+
+/*****
+ * Measuring
+ *****/
+
+// xorshift64* (the same sequence for the same seed)
+static uint64_t rnd ( void )
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return rnd_state * 2685821657736338717ULL;
+}
+
+
+static unsigned rnd_below ( const unsigned n )
+{
+    return ( unsigned ) ( rnd() % n );
+}
+
+
+static void mark ( bench_mark_t * const m )
+{
+    adffs_stats_get_io ( &m->io );
+    m->mallocs = bench_malloc_count();
+    m->ns = bench_now_ns();
+}
+
+
+static bench_result_t * result_get ( const char * const name )
+{
+    for ( unsigned i = 0 ; i < nresults ; i++ )
+        if ( strcmp ( results [ i ].name, name ) == 0 )
+            return &results [ i ];
+    if ( nresults == BENCH_MAX_RESULTS )
+        abort();
+    results [ nresults ].name = name;
+    return &results [ nresults++ ];
+}
+
+
+// account an operation (started at the mark) to the result
+static void account ( const char * const         name,
+                      const bench_mark_t * const start,
+                      const uint64_t             bytes,
+                      const bool                 ok )
+{
+    bench_mark_t end;
+    mark ( &end );
+
+    bench_result_t * const r = result_get ( name );
+    r->ops++;
+    r->errors += ok ? 0 : 1;
+    r->ns    += end.ns - start->ns;
+    r->bytes += bytes;
+    r->mallocs += end.mallocs - start->mallocs;
+    r->io.reads         += end.io.reads - start->io.reads;
+    r->io.writes        += end.io.writes - start->io.writes;
+    r->io.bytes_read    += end.io.bytes_read - start->io.bytes_read;
+    r->io.bytes_written += end.io.bytes_written - start->io.bytes_written;
+    r->io.cache_hits    += end.io.cache_hits - start->io.cache_hits;
+    r->io.cache_misses  += end.io.cache_misses - start->io.cache_misses;
+}
+
+
+/*****
+ * Benchmarks
+ *****/
+
+static void bench_getdentry ( adfimage_t * const            adf,
+                              const bench_tree_t * const    tree,
+                              const bench_options_t * const opts )
+{
+    const unsigned npaths = tree->ndirs + tree->nfiles;
+    for ( unsigned i = 0 ; i < opts->iterations ; i++ ) {
+        const unsigned n = rnd_below ( npaths );
+        const char * const path = ( n < tree->ndirs ) ?
+            tree->dirs [ n ] : tree->files [ n - tree->ndirs ];
+        bench_mark_t start;
+        mark ( &start );
+        adfimage_dentry_t dentry = adfimage_getdentry ( adf, path );
+        account ( "getdentry", &start, 0, adfimage_dentry_valid ( &dentry ) );
+    }
+}
+
+
+static void bench_chdir ( adfimage_t * const            adf,
+                          const bench_tree_t * const    tree,
+                          const bench_options_t * const opts )
+{
+    for ( unsigned i = 0 ; i < opts->iterations ; i++ ) {
+        const char * const path = tree->dirs [ rnd_below ( tree->ndirs ) ];
+        bench_mark_t start;
+        mark ( &start );
+        const bool ok = adfimage_chdir ( adf, path );
+        account ( "chdir", &start, 0, ok );
+    }
+    adfimage_chdir ( adf, "/" );
+}
+
+
+static void bench_count_dir_entries ( adfimage_t * const            adf,
+                                      const bench_tree_t * const    tree,
+                                      const bench_options_t * const opts )
+{
+    for ( unsigned i = 0 ; i < opts->iterations ; i++ ) {
+        const char * const path = tree->dirs [ rnd_below ( tree->ndirs ) ];
+        bench_mark_t start;
+        mark ( &start );
+        const int n = adfimage_count_dir_entries ( adf, path );
+        account ( "count_dir_entries", &start, 0, n >= 0 );
+    }
+}
+
+
+static void bench_read_seq ( adfimage_t * const            adf,
+                             const bench_tree_t * const    tree,
+                             const bench_options_t * const opts )
+{
+    if ( tree->file_bytes == 0 )
+        return;
+
+    // whole files, one after another (as many times as needed)
+    char buf [ BENCH_IO_SIZE ];
+    unsigned ops = 0;
+    for ( unsigned f = 0 ; ops < opts->iterations ; f = ( f + 1 ) % tree->nfiles ) {
+        for ( uint32_t offset = 0 ;
+              offset < tree->file_sizes [ f ] && ops < opts->iterations ;
+              offset += BENCH_IO_SIZE, ops++ )
+        {
+            bench_mark_t start;
+            mark ( &start );
+            const int n = adfimage_read ( adf, tree->files [ f ], buf,
+                                          BENCH_IO_SIZE, offset );
+            account ( "read_seq", &start, n > 0 ? ( uint64_t ) n : 0, n > 0 );
+        }
+    }
+}
+
+
+static void bench_read_random ( adfimage_t * const            adf,
+                                const bench_tree_t * const    tree,
+                                const bench_options_t * const opts )
+{
+    if ( tree->file_bytes == 0 )
+        return;
+
+    char buf [ BENCH_IO_SIZE ];
+    for ( unsigned i = 0 ; i < opts->iterations ; ) {
+        const unsigned f = rnd_below ( tree->nfiles );
+        if ( tree->file_sizes [ f ] == 0 )
+            continue;
+        const uint32_t offset = rnd_below ( tree->file_sizes [ f ] );
+        bench_mark_t start;
+        mark ( &start );
+        const int n = adfimage_read ( adf, tree->files [ f ], buf,
+                                      BENCH_IO_SIZE, offset );
+        account ( "read_random", &start, n > 0 ? ( uint64_t ) n : 0, n > 0 );
+        i++;
+    }
+}
+
+
+static void bench_create_write_unlink ( adfimage_t * const            adf,
+                                        const bench_options_t * const opts )
+{
+    const unsigned file_size = ( opts->file_size > 0 ) ? opts->file_size :
+                                                         BENCH_IO_SIZE;
+    char path [ ADFIMAGE_MAX_PATH ],
+         data [ BENCH_IO_SIZE ];
+    memset ( data, 0x5a, sizeof ( data ) );
+
+    for ( unsigned i = 0 ; i < opts->iterations ; i++ ) {
+        snprintf ( path, sizeof ( path ), "/bench%u", i );
+
+        bench_mark_t start;
+        mark ( &start );
+        const bool created = ( adfimage_create ( adf, path, 0644 ) == 0 );
+        account ( "create", &start, 0, created );
+        if ( ! created )
+            continue;
+
+        for ( unsigned offset = 0 ; offset < file_size ; offset += BENCH_IO_SIZE ) {
+            const unsigned size = ( file_size - offset < BENCH_IO_SIZE ) ?
+                file_size - offset : BENCH_IO_SIZE;
+            mark ( &start );
+            const int n = adfimage_write ( adf, path, data, size, offset );
+            account ( "write", &start, n > 0 ? ( uint64_t ) n : 0,
+                      n == ( int ) size );
+        }
+
+        mark ( &start );
+        const int status = adfimage_unlink ( adf, path );
+        account ( "unlink", &start, 0, status == 0 );
+    }
+}
+
+
+/*****
+ * Report
+ *****/
+
+static double per_op ( const uint64_t value,
+                       const uint64_t ops )
+{
+    return ( ops > 0 ) ? ( double ) value / ( double ) ops : 0.0;
+}
+
+
+static void report_json ( FILE * const                  out,
+                          const char * const            image,
+                          const bench_tree_t * const    tree,
+                          const bench_options_t * const opts )
+{
+    static const char * const dev_types [] = { "dd", "hd", "hdf" };
+
+    fprintf ( out, "{\n  \"image\": {\n    \"path\": " );
+    bench_json_string ( out, image );
+    if ( opts->image == NULL ) {
+        fprintf ( out, ",\n"
+                  "    \"type\": \"%s\",\n"
+                  "    \"fs\": \"%s\"",
+                  dev_types [ opts->dev_type ],
+                  ( opts->fs_type & ADF_DOSFS_DIRCACHE ) ? "dircache" :
+                  ( opts->fs_type & ADF_DOSFS_FFS ) ? "ffs" : "ofs" );
+    }
+    fprintf ( out, ",\n"
+              "    \"dirs\": %u,\n"
+              "    \"files\": %u,\n"
+              "    \"file_bytes\": %" PRIu64 "\n"
+              "  },\n"
+              "  \"iterations\": %u,\n"
+              "  \"seed\": %u,\n"
+              "  \"mallocs_counted\": %s,\n"
+              "  \"results\": [",
+              tree->ndirs, tree->nfiles, tree->file_bytes,
+              opts->iterations, opts->seed,
+              bench_malloc_counted() ? "true" : "false" );
+
+    for ( unsigned i = 0 ; i < nresults ; i++ ) {
+        const bench_result_t * const r = &results [ i ];
+        fprintf ( out, "%s\n    {\n"
+                  "      \"name\": \"%s\",\n"
+                  "      \"ops\": %" PRIu64 ",\n"
+                  "      \"errors\": %" PRIu64 ",\n"
+                  "      \"ns_per_op\": %.1f,\n"
+                  "      \"bytes_per_op\": %.1f,\n"
+                  "      \"block_reads_per_op\": %.3f,\n"
+                  "      \"block_writes_per_op\": %.3f,\n"
+                  "      \"cache_hits_per_op\": %.3f,\n"
+                  "      \"cache_misses_per_op\": %.3f,\n"
+                  "      \"mallocs_per_op\": %.3f\n"
+                  "    }",
+                  i > 0 ? "," : "",
+                  r->name, r->ops, r->errors,
+                  per_op ( r->ns, r->ops ),
+                  per_op ( r->bytes, r->ops ),
+                  per_op ( r->io.reads, r->ops ),
+                  per_op ( r->io.writes, r->ops ),
+                  per_op ( r->io.cache_hits, r->ops ),
+                  per_op ( r->io.cache_misses, r->ops ),
+                  per_op ( r->mallocs, r->ops ) );
+    }
+    fprintf ( out, "\n  ]\n}\n" );
+}
+
+
+/*****
+ * Baseline
+ *****/
+
+static bool baseline_load ( const char * const file,
+                            baseline_t * const baseline )
+{
+    FILE * const f = fopen ( file, "r" );
+    if ( f == NULL ) {
+        fprintf ( stderr, "Cannot open the baseline %s: %s\n",
+                  file, strerror ( errno ) );
+        return false;
+    }
+
+    // (the JSON as written by report_json() - one value per line)
+    memset ( baseline, 0, sizeof ( *baseline ) );
+    baseline_result_t * r = NULL;
+    char line [ 256 ];
+    while ( fgets ( line, sizeof ( line ), f ) != NULL ) {
+        char name [ BENCH_MAX_NAME ];
+        if ( sscanf ( line, " \"name\": \"%31[^\"]\"", name ) == 1 ) {
+            if ( baseline->nresults == BENCH_MAX_RESULTS ) {
+                r = NULL;
+                continue;
+            }
+            r = &baseline->results [ baseline->nresults++ ];
+            strcpy ( r->name, name );
+        } else if ( r != NULL ) {
+            sscanf ( line, " \"errors\": %" SCNu64, &r->errors );
+            sscanf ( line, " \"block_reads_per_op\": %lf", &r->reads );
+            sscanf ( line, " \"block_writes_per_op\": %lf", &r->writes );
+        } else {
+            // (the image - before the results)
+            sscanf ( line, " \"dirs\": %u", &baseline->dirs );
+            sscanf ( line, " \"files\": %u", &baseline->files );
+        }
+    }
+    fclose ( f );
+    return true;
+}
+
+
+// (a value per operation - compared with the rounding of the JSON)
+static bool regressed ( const double   value,
+                        const double   baseline,
+                        const unsigned threshold )
+{
+    return value > baseline * ( 1.0 + threshold / 100.0 ) + 0.0005;
+}
+
+
+static double change ( const double value,
+                       const double baseline )
+{
+    return ( baseline > 0.0 ) ? ( value - baseline ) * 100.0 / baseline : 0.0;
+}
+
+
+static bool baseline_check ( const bench_tree_t * const    tree,
+                             const bench_options_t * const opts )
+{
+    baseline_t baseline;
+    if ( ! baseline_load ( opts->baseline, &baseline ) )
+        return false;
+
+    if ( baseline.dirs != tree->ndirs || baseline.files != tree->nfiles ) {
+        fprintf ( stderr, "The baseline %s is for another image (%u dirs, %u files"
+                  " - this one: %u, %u).\n", opts->baseline,
+                  baseline.dirs, baseline.files, tree->ndirs, tree->nfiles );
+        return false;
+    }
+
+    // (an empty baseline would pass anything)
+    if ( baseline.nresults == 0 ) {
+        fprintf ( stderr, "The baseline %s has no results - write it with -o"
+                  " (PERF_UPDATE_BASELINE=1 tests/perf_adfimage.sh).\n",
+                  opts->baseline );
+        return false;
+    }
+
+    bool ok = true;
+    for ( unsigned i = 0 ; i < nresults ; i++ ) {
+        const bench_result_t * const r = &results [ i ];
+        const baseline_result_t * b = NULL;
+        for ( unsigned j = 0 ; j < baseline.nresults ; j++ )
+            if ( strcmp ( baseline.results [ j ].name, r->name ) == 0 )
+                b = &baseline.results [ j ];
+        if ( b == NULL ) {
+            fprintf ( stderr, "%-20s not in the baseline  MISSING\n", r->name );
+            ok = false;
+            continue;
+        }
+
+        const double reads  = per_op ( r->io.reads, r->ops ),
+                     writes = per_op ( r->io.writes, r->ops );
+        const bool regression = r->errors > b->errors ||
+            regressed ( reads, b->reads, opts->threshold ) ||
+            regressed ( writes, b->writes, opts->threshold );
+        fprintf ( stderr, "%-20s block reads/op %.3f -> %.3f (%+.1f%%),"
+                  " writes/op %.3f -> %.3f (%+.1f%%), errors %" PRIu64
+                  " -> %" PRIu64 "%s\n",
+                  r->name, b->reads, reads, change ( reads, b->reads ),
+                  b->writes, writes, change ( writes, b->writes ),
+                  b->errors, r->errors, regression ? "  REGRESSION" : "" );
+        ok = ok && ! regression;
+    }
+
+    if ( ! ok )
+        fprintf ( stderr, "Block I/O regressed more than %u%% against %s"
+                  " (or a benchmark is missing in it).\n",
+                  opts->threshold, opts->baseline );
+    return ok;
+}
@@ -0,0 +1,185 @@
+/*
+ * bench_checksum - the block checksums: scalar vs. vectorized (adfsum.h)
+ *
+ * Sums count random blocks (and boot blocks) rounds times with each
+ * implementation supported by the CPU, checking that all give the same
+ * results. Prints the throughput of each and its speedup over the scalar
+ * loop; with -c, fails if the one selected at runtime is not faster.
+ */
+
+#include "adfsum.h"
+#include "bench_util.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct bench_options {
+    unsigned long count,
+                  rounds;
+    uint64_t      seed;
+    bool          check;
+} bench_options_t;
+
+typedef struct bench_result {
+    double   block_mbs,
+             boot_mbs;
+    uint32_t block_sum,             // (of all the sums - to compare)
+             boot_sum;
+} bench_result_t;
+
+static bench_options_t opts = {
+    .count  = 2048,                 // (1 MiB - in the caches)
+    .rounds = 1000,
+    .seed   = 1,
+    .check  = false
+};
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+static void run ( const uint8_t * const  data,
+                  bench_result_t * const result );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // (an even number of blocks - the boot blocks are 2 of them)
+    const size_t size = ( size_t ) ( opts.count & ~1UL ) * 512;
+    uint8_t * const data = malloc ( size );
+    if ( data == NULL ) {
+        fprintf ( stderr, "Out of memory.\n" );
+        return EXIT_FAILURE;
+    }
+    uint64_t x = opts.seed + 0x9e3779b97f4a7c15ULL;
+    for ( size_t i = 0 ; i < size ; i++ ) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data [ i ] = ( uint8_t ) x;
+    }
+
+    const adfsum_impl_t impls[] = { ADFSUM_SCALAR, ADFSUM_SSE2, ADFSUM_AVX2 };
+    bench_result_t scalar = { 0 };
+    double selected_speedup = 1.0;
+    bool ok = true;
+    adfsum_set_impl ( ADFSUM_AUTO );
+    const adfsum_impl_t selected = adfsum_get_impl();
+
+    printf ( "%-8s %12s %8s %12s %8s\n", "impl", "block MB/s", "speedup",
+             "boot MB/s", "speedup" );
+    for ( unsigned i = 0 ; i < sizeof ( impls ) / sizeof ( impls [ 0 ] ) ; i++ ) {
+        if ( ! adfsum_set_impl ( impls [ i ] ) )
+            continue;
+        bench_result_t result;
+        run ( data, &result );
+        if ( impls [ i ] == ADFSUM_SCALAR )
+            scalar = result;
+
+        const double block_speedup = result.block_mbs / scalar.block_mbs,
+                     boot_speedup  = result.boot_mbs / scalar.boot_mbs;
+        printf ( "%-8s %12.1f %7.2fx %12.1f %7.2fx%s\n",
+                 adfsum_impl_name ( impls [ i ] ),
+                 result.block_mbs, block_speedup, result.boot_mbs, boot_speedup,
+                 ( impls [ i ] == selected ) ? "  (selected)" : "" );
+
+        if ( result.block_sum != scalar.block_sum ||
+             result.boot_sum != scalar.boot_sum )
+        {
+            fprintf ( stderr, "%s: the sums differ from the scalar ones.\n",
+                      adfsum_impl_name ( impls [ i ] ) );
+            ok = false;
+        }
+        if ( impls [ i ] == selected )
+            selected_speedup = ( block_speedup < boot_speedup ) ? block_speedup :
+                                                                  boot_speedup;
+    }
+    free ( data );
+
+    if ( opts.check && selected != ADFSUM_SCALAR && selected_speedup <= 1.0 ) {
+        fprintf ( stderr, "%s is not faster than the scalar loop.\n",
+                  adfsum_impl_name ( selected ) );
+        ok = false;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  bench_checksum [options]\n\n"
+             "Compares the block checksums - scalar and vectorized.\n\n"
+             "Options:\n"
+             "  -n count     number of blocks (default 2048)\n"
+             "  -r rounds    number of rounds (default 1000)\n"
+             "  -S seed      seed (default 1)\n"
+             "  -c           fail if the implementation selected at runtime\n"
+             "               is not faster than the scalar one\n"
+             "  -h           show this help\n\n" );
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "n:r:S:ch" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'n':
+            opts.count = strtoul ( optarg, NULL, 10 );
+            if ( opts.count < 2 )
+                return false;
+            break;
+        case 'r':
+            opts.rounds = strtoul ( optarg, NULL, 10 );
+            if ( opts.rounds == 0 )
+                return false;
+            break;
+        case 'S':
+            opts.seed = strtoull ( optarg, NULL, 10 );
+            break;
+        case 'c':
+            opts.check = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    return ( optind == argc );
+}
+
+
+static void run ( const uint8_t * const  data,
+                  bench_result_t * const result )
+{
+    const unsigned long nblocks = opts.count & ~1UL;
+    const double        mbytes  = ( double ) nblocks * 512 * ( double ) opts.rounds /
+                                  ( 1024.0 * 1024.0 );
+
+    // (the sums accumulated - not to be optimized out)
+    uint32_t sum = 0;
+    uint64_t start = bench_now_ns();
+    for ( unsigned long r = 0 ; r < opts.rounds ; r++ )
+        for ( unsigned long i = 0 ; i < nblocks ; i++ )
+            sum += adfsum_block ( data + i * 512 );
+    result->block_mbs = mbytes / ( ( double ) ( bench_now_ns() - start ) / 1e9 );
+    result->block_sum = sum;
+
+    sum = 0;
+    start = bench_now_ns();
+    for ( unsigned long r = 0 ; r < opts.rounds ; r++ )
+        for ( unsigned long i = 0 ; i < nblocks ; i += 2 )
+            sum += adfsum_boot ( data + i * 512 );
+    result->boot_mbs = mbytes / ( ( double ) ( bench_now_ns() - start ) / 1e9 );
+    result->boot_sum = sum;
+}
@@ -0,0 +1,42 @@
+#include "bench_fuse.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static adffs_state_t state;
+static struct fuse_context context;
+
+
+struct fuse_context * fuse_get_context ( void )
+{
+    return &context;
+}
+
+
+bool bench_fuse_mount ( char * const image,
+                        const bool   read_only,
+                        FILE * const logfile )
+{
+    memset ( &state, 0, sizeof ( state ) );
+    state.logfile  = logfile;
+    state.adfimage = adfimage_open ( image, 0, read_only, false );
+    if ( state.adfimage == NULL )
+        return false;
+
+    context.uid          = getuid();
+    context.gid          = getgid();
+    context.pid          = getpid();
+    context.umask        = 022;
+    context.private_data = &state;      // (given to fuse_main())
+    struct fuse_conn_info conninfo;
+    memset ( &conninfo, 0, sizeof ( conninfo ) );
+    context.private_data = adffs_oper.init ( &conninfo );
+    return true;
+}
+
+
+void bench_fuse_unmount ( void )
+{
+    adffs_oper.destroy ( &state );
+    context.private_data = NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef BENCH_FUSE_H
+#define BENCH_FUSE_H
+
+/*
+ * "Mounting" an image for calling the FUSE handlers (adffs_oper) directly
+ *
+ * fuse_get_context() is a stub here (the programs are not linked
+ * with libfuse) giving the state of the filesystem to the handlers.
+ */
+
+#include "adffs.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// open the image and initialize the filesystem (as fuse_main())
+bool bench_fuse_mount ( char * const image,
+                        const bool   read_only,
+                        FILE * const logfile );
+
+// (as unmounting - closes the image and the log)
+void bench_fuse_unmount ( void );
+
+#endif
@@ -0,0 +1,87 @@
+#include "bench_malloc.h"
+
+#include <stddef.h>
+
+#ifdef __GLIBC__
+
+// the allocator of glibc (always available - for replacing malloc)
+extern void * __libc_malloc ( size_t size );
+extern void * __libc_calloc ( size_t nmemb,
+                              size_t size );
+extern void * __libc_realloc ( void * ptr,
+                               size_t size );
+extern void __libc_free ( void * ptr );
+
+static __thread uint64_t count  = 0;
+static __thread bool     ignore = false;
+
+
+void * malloc ( size_t size )
+{
+    if ( ! ignore )
+        count++;
+    return __libc_malloc ( size );
+}
+
+
+void * calloc ( size_t nmemb,
+                size_t size )
+{
+    if ( ! ignore )
+        count++;
+    return __libc_calloc ( nmemb, size );
+}
+
+
+void * realloc ( void * ptr,
+                 size_t size )
+{
+    if ( ! ignore )
+        count++;
+    return __libc_realloc ( ptr, size );
+}
+
+
+void free ( void * ptr )
+{
+    __libc_free ( ptr );
+}
+
+
+uint64_t bench_malloc_count ( void )
+{
+    return count;
+}
+
+
+bool bench_malloc_counted ( void )
+{
+    return true;
+}
+
+
+void bench_malloc_ignore ( const bool value )
+{
+    ignore = value;
+}
+
+#else
+
+uint64_t bench_malloc_count ( void )
+{
+    return 0;
+}
+
+
+bool bench_malloc_counted ( void )
+{
+    return false;
+}
+
+
+void bench_malloc_ignore ( const bool value )
+{
+    (void) value;
+}
+
+#endif
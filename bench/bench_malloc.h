@@ -0,0 +1,24 @@
+#ifndef BENCH_MALLOC_H
+#define BENCH_MALLOC_H
+
+/*
+ * Counting heap allocations of the benchmarks
+ *
+ * With glibc, malloc(), calloc() and realloc() (also those called by libc
+ * itself - strdup() etc. - and by ADFlib) are replaced by wrappers counting
+ * the calls of the thread, forwarding them to the allocator of glibc.
+ * Elsewhere nothing is counted (bench_malloc_counted() is false).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// allocations made by the calling thread so far
+uint64_t bench_malloc_count ( void );
+
+bool bench_malloc_counted ( void );
+
+// not counting allocations of the thread (of the benchmark itself)
+void bench_malloc_ignore ( const bool ignore );
+
+#endif
@@ -0,0 +1,322 @@
+#!/bin/bash
+#
+# End-to-end benchmark - workloads on a mounted (generated) image
+#
+# Each workload runs with a cold cache (image remounted and its pages
+# dropped from the page cache) and a warm one (run once before measuring).
+# The results (time, throughput, CPU time of fuseadf and of the workload)
+# are written as JSON, for comparing between commits.
+#
+
+FUSEADF=../src/fuseadf
+ADFGEN=../tools/adfgen
+RANDREAD=./bench_randread
+ADFEXTRACT=../tools/adfextract
+ADFBUILD=../tools/adfbuild
+RESULTS=bench_mount.json
+WORKLOADS="stat read randread copyin delete cpout extract"
+# image generated with: adfgen ${ADFGEN_OPTIONS}
+ADFGEN_OPTIONS="-t hdf -m 40 -d 4 -l 2 -n 16 -s 512-65536"
+RANDREAD_COUNT=10000
+FUSEADF_OPTIONS=""
+# (empty - the image of adfgen measured, otherwise rebuilt from the same
+# files with: adfbuild ${ADFBUILD_OPTIONS})
+ADFBUILD_OPTIONS=""
+
+WORK_DIR=""
+MNT=""
+FUSEADF_PID=""
+
+
+usage()
+{
+    cat <<EOF
+
+Usage:  bench_mount.sh [options]
+
+Mounts an image generated with adfgen (fuseadf -f) and runs the workloads,
+with a cold and a warm cache, writes the results as JSON.
+
+Options:
+  -F path      fuseadf (default: ${FUSEADF})
+  -G path      adfgen (default: ${ADFGEN})
+  -R path      bench_randread (default: ${RANDREAD})
+  -X path      adfextract (default: ${ADFEXTRACT})
+  -B path      adfbuild (default: ${ADFBUILD})
+  -g options   options of adfgen (default: "${ADFGEN_OPTIONS}")
+  -b options   rebuild the image from the same files with adfbuild
+               (contiguous layout - for comparison), with the options
+               (eg. "-t hdf -m 40" - leave space for copyin)
+  -O options   additional options of fuseadf (eg. "-o ram")
+  -w list      workloads (default: "${WORKLOADS}"):
+                 stat     - metadata storm (ls -lR, stat of all entries)
+                 read     - sequential read of all files
+                 randread - random 4 KiB reads (-n count, default ${RANDREAD_COUNT})
+                 copyin   - bulk copy of a directory tree into the image
+                 delete   - bulk delete of all files (rm -rf)
+                 cpout    - copy of all files out of the image (cp -r)
+                 extract  - the same with adfextract (without FUSE,
+                            for comparison with cpout)
+  -n count     number of random reads
+  -o file      results (default: ${RESULTS})
+  -h           show this help
+
+EOF
+}
+
+
+now_ns()
+{
+    date +%s%N
+}
+
+
+# CPU time (user, system - in ms) of a process
+cpu_ms()
+{
+    local stat tck
+    stat=( $( sed 's/.*) //' "/proc/$1/stat" ) )
+    tck=$( getconf CLK_TCK )
+    # (fields 14 and 15 - the 12th and 13th after the command)
+    echo $(( ${stat[11]} * 1000 / tck )) $(( ${stat[12]} * 1000 / tck ))
+}
+
+
+mount_image()
+{
+    "${FUSEADF}" -f ${FUSEADF_OPTIONS} "${WORK_DIR}/image.hdf" "${MNT}" \
+        > "${WORK_DIR}/fuseadf.out" 2>&1 &
+    FUSEADF_PID=$!
+    for i in $( seq 100 ) ; do
+        [ -d "${MNT}/.fuseadf" ] && return 0
+        kill -0 ${FUSEADF_PID} 2> /dev/null || break
+        sleep 0.1
+    done
+    echo "Cannot mount the image:" >&2
+    cat "${WORK_DIR}/fuseadf.out" >&2
+    return 1
+}
+
+
+unmount_image()
+{
+    [ -z "${FUSEADF_PID}" ] && return
+    fusermount -u "${MNT}"
+    wait ${FUSEADF_PID}
+    FUSEADF_PID=""
+}
+
+
+# drop the pages of the image (and of the copied tree) from the page cache
+# (all caches if possible - as root)
+drop_caches()
+{
+    sync
+    if [ -w /proc/sys/vm/drop_caches ] ; then
+        echo 3 > /proc/sys/vm/drop_caches
+        return
+    fi
+    dd if="${WORK_DIR}/image.hdf" iflag=nocache count=0 status=none
+    find "${WORK_DIR}/tree" -type f -exec \
+        dd if={} iflag=nocache count=0 status=none \;
+}
+
+
+cleanup()
+{
+    unmount_image
+    [ -n "${WORK_DIR}" ] && rm -rf "${WORK_DIR}"
+}
+
+
+# workloads - print the amount of work done (entries / bytes)
+
+workload_stat()
+{
+    ls -lR "${MNT}" > /dev/null
+    find "${MNT}" -path "${MNT}/.fuseadf" -prune -o -exec stat -c %s {} + |
+        wc -l
+}
+
+
+workload_read()
+{
+    find "${MNT}" -path "${MNT}/.fuseadf" -prune -o -type f -exec cat {} + |
+        wc -c
+}
+
+
+workload_randread()
+{
+    find "${MNT}" -path "${MNT}/.fuseadf" -prune -o -type f -print |
+        "${RANDREAD}" -n ${RANDREAD_COUNT} -b 4096 | cut -d ' ' -f 2
+}
+
+
+workload_copyin()
+{
+    cp -r "${WORK_DIR}/tree" "${MNT}/copy" && sync
+    find "${WORK_DIR}/tree" -type f -printf "%s\n" |
+        awk '{ bytes += $1 } END { print bytes }'
+}
+
+
+workload_delete()
+{
+    local n
+    n=$( find "${MNT}" -mindepth 1 -maxdepth 1 ! -name .fuseadf | wc -l )
+    find "${MNT}" -mindepth 1 -maxdepth 1 ! -name .fuseadf -exec rm -rf {} + &&
+        sync
+    echo ${n}
+}
+
+
+workload_cpout()
+{
+    rm -rf "${WORK_DIR}/out"
+    mkdir "${WORK_DIR}/out"
+    cp -r "${MNT}"/* "${WORK_DIR}/out" || return 1
+    find "${WORK_DIR}/out" -type f -printf "%s\n" |
+        awk '{ bytes += $1 } END { print bytes }'
+}
+
+
+# (the image read directly - while mounted, but not modified)
+workload_extract()
+{
+    rm -rf "${WORK_DIR}/out"
+    "${ADFEXTRACT}" -n "${WORK_DIR}/image.hdf" "${WORK_DIR}/out" > /dev/null ||
+        return 1
+    find "${WORK_DIR}/out" -type f -printf "%s\n" |
+        awk '{ bytes += $1 } END { print bytes }'
+}
+
+
+workload_unit()
+{
+    case "$1" in
+        stat|delete) echo entries ;;
+        *)           echo bytes ;;
+    esac
+}
+
+
+# run a workload (the image restored before the modifying ones),
+# the result (JSON) in RESULT
+run()
+{
+    local workload=$1 cache=$2 amount start end cpu0 cpu1 ns client
+    local TIMEFORMAT="%3U %3S"
+
+    unmount_image
+    case "${workload}" in
+        copyin|delete) cp "${WORK_DIR}/image.orig.hdf" "${WORK_DIR}/image.hdf" ;;
+    esac
+    [ "${cache}" = "cold" ] && drop_caches
+    mount_image || return 1
+    if [ "${cache}" = "warm" ] ; then
+        case "${workload}" in
+            copyin|delete)
+                # (the metadata and the copied files read before)
+                ls -lR "${MNT}" > /dev/null
+                find "${WORK_DIR}/tree" -type f -exec cat {} + > /dev/null ;;
+            *)
+                "workload_${workload}" > /dev/null ;;
+        esac
+    fi
+
+    cpu0=( $( cpu_ms ${FUSEADF_PID} ) )
+    start=$( now_ns )
+    # (the CPU time of the workload itself - user, system)
+    client=( $( { time "workload_${workload}" > "${WORK_DIR}/amount" 2>&3 ; } \
+                3>&2 2>&1 ) ) ||
+        return 1
+    amount=$( < "${WORK_DIR}/amount" )
+    end=$( now_ns )
+    cpu1=( $( cpu_ms ${FUSEADF_PID} ) )
+    ns=$(( end - start ))
+
+    RESULT="    { \"workload\": \"${workload}\", \"cache\": \"${cache}\","
+    RESULT+=" \"time_ns\": ${ns}, \"$( workload_unit ${workload} )\": ${amount},"
+    RESULT+=" \"per_s\": $( awk "BEGIN { printf \"%.1f\", ${amount} * 1e9 / ${ns} }" ),"
+    RESULT+=" \"cpu_user_ms\": $(( cpu1[0] - cpu0[0] )),"
+    RESULT+=" \"cpu_sys_ms\": $(( cpu1[1] - cpu0[1] )),"
+    RESULT+=" \"client_cpu_user_s\": ${client[0]},"
+    RESULT+=" \"client_cpu_sys_s\": ${client[1]} }"
+}
+
+
+while getopts "F:G:R:X:B:g:b:O:w:n:o:h" opt ; do
+    case "${opt}" in
+        F) FUSEADF=${OPTARG} ;;
+        G) ADFGEN=${OPTARG} ;;
+        R) RANDREAD=${OPTARG} ;;
+        X) ADFEXTRACT=${OPTARG} ;;
+        B) ADFBUILD=${OPTARG} ;;
+        g) ADFGEN_OPTIONS=${OPTARG} ;;
+        b) ADFBUILD_OPTIONS=${OPTARG} ;;
+        O) FUSEADF_OPTIONS=${OPTARG} ;;
+        w) WORKLOADS=${OPTARG} ;;
+        n) RANDREAD_COUNT=${OPTARG} ;;
+        o) RESULTS=${OPTARG} ;;
+        *) usage ; exit 1 ;;
+    esac
+done
+
+for p in "${FUSEADF}" "${ADFGEN}" "${RANDREAD}" \
+         $( [[ " ${WORKLOADS} " = *" extract "* ]] && echo "${ADFEXTRACT}" ) \
+         $( [ -n "${ADFBUILD_OPTIONS}" ] && echo "${ADFBUILD}" ) ; do
+    [ -x "${p}" ] || { echo "Not found (not built?): ${p}" >&2 ; exit 1 ; }
+done
+
+WORK_DIR=$( mktemp -d /tmp/bench_mount_XXXXXX ) || exit 1
+MNT="${WORK_DIR}/mnt"
+mkdir "${MNT}"
+trap cleanup EXIT
+
+"${ADFGEN}" ${ADFGEN_OPTIONS} "${WORK_DIR}/image.orig.hdf" > /dev/null || exit 1
+cp "${WORK_DIR}/image.orig.hdf" "${WORK_DIR}/image.hdf"
+
+# (the tree copied in - the same files as in the image)
+mount_image || exit 1
+mkdir "${WORK_DIR}/tree"
+cp -r "${MNT}"/* "${WORK_DIR}/tree" || exit 1
+
+# (the same files - written at once, with contiguous data)
+if [ -n "${ADFBUILD_OPTIONS}" ] ; then
+    unmount_image
+    rm "${WORK_DIR}/image.orig.hdf"
+    "${ADFBUILD}" ${ADFBUILD_OPTIONS} "${WORK_DIR}/tree" "${WORK_DIR}/image.orig.hdf" \
+        > /dev/null || exit 1
+    cp "${WORK_DIR}/image.orig.hdf" "${WORK_DIR}/image.hdf"
+fi
+
+# (all run before writing the results - no partial results on a failure)
+RESULTS_JSON=""
+NL=$'\n'
+for workload in ${WORKLOADS} ; do
+    for cache in cold warm ; do
+        echo "${workload} (${cache})..."
+        run ${workload} ${cache} ||
+            { echo "Workload failed: ${workload} (${cache})" >&2 ; exit 1 ; }
+        RESULTS_JSON+="${RESULTS_JSON:+,${NL}}${RESULT}"
+    done
+done
+unmount_image
+
+COMMIT=$( git -C "$( dirname "$0" )" describe --always --dirty 2> /dev/null )
+cat > "${RESULTS}" <<EOF || exit 1
+{
+  "commit": "${COMMIT}",
+  "date": "$( date -u +%Y-%m-%dT%H:%M:%SZ )",
+  "adfgen": "${ADFGEN_OPTIONS}",
+  "adfbuild": "${ADFBUILD_OPTIONS}",
+  "fuseadf": "${FUSEADF_OPTIONS}",
+  "drop_caches": "$( [ -w /proc/sys/vm/drop_caches ] && echo all || echo image )",
+  "results": [
+${RESULTS_JSON}
+  ]
+}
+EOF
+
+echo "Results written to: ${RESULTS}"
@@ -0,0 +1,229 @@
+/*
+ * bench_randread - random reads of blocks of files (for bench_mount.sh)
+ *
+ * Reads count blocks at random (block-aligned) offsets of random files
+ * (the paths given on stdin, one per line), keeping the files open.
+ * Prints the number of reads and of bytes read.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct rfile {
+    char * path;
+    off_t  size;
+    int    fd;
+} rfile_t;
+
+typedef struct bench_options {
+    unsigned long count;
+    unsigned      block_size;
+    uint64_t      seed;
+} bench_options_t;
+
+static bench_options_t opts = {
+    .count      = 10000,
+    .block_size = 4096,
+    .seed       = 1
+};
+
+static uint64_t rnd_state;
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+static bool read_file_list ( rfile_t ** const files,
+                             size_t * const   nfiles );
+
+static uint64_t rnd ( void );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    rfile_t * files = NULL;
+    size_t nfiles = 0;
+    if ( ! read_file_list ( &files, &nfiles ) )
+        return EXIT_FAILURE;
+    if ( nfiles == 0 ) {
+        fprintf ( stderr, "No (non-empty) files to read.\n" );
+        free ( files );
+        return EXIT_FAILURE;
+    }
+
+    char * const buf = malloc ( opts.block_size );
+    if ( buf == NULL ) {
+        fprintf ( stderr, "Out of memory.\n" );
+        goto main_error_free_files;
+    }
+
+    // (the files kept open - as many as allowed)
+    struct rlimit nofile;
+    size_t max_open = 256;
+    if ( getrlimit ( RLIMIT_NOFILE, &nofile ) == 0 && nofile.rlim_cur > 32 )
+        max_open = ( size_t ) nofile.rlim_cur - 16;
+    size_t nopen = 0;
+
+    rnd_state = opts.seed + 0x9e3779b97f4a7c15ULL;
+    uint64_t bytes = 0;
+    for ( unsigned long i = 0 ; i < opts.count ; i++ ) {
+        rfile_t * const f = &files [ rnd() % nfiles ];
+        if ( f->fd < 0 ) {
+            if ( nopen >= max_open ) {
+                for ( size_t j = 0 ; j < nfiles ; j++ ) {
+                    if ( files [ j ].fd >= 0 ) {
+                        close ( files [ j ].fd );
+                        files [ j ].fd = -1;
+                    }
+                }
+                nopen = 0;
+            }
+            f->fd = open ( f->path, O_RDONLY );
+            if ( f->fd < 0 ) {
+                fprintf ( stderr, "Cannot open %s: %s\n", f->path, strerror ( errno ) );
+                goto main_error_close_files;
+            }
+            nopen++;
+        }
+
+        const uint64_t nblocks = ( ( uint64_t ) f->size + opts.block_size - 1 ) /
+                                 opts.block_size;
+        const off_t offset = ( off_t ) ( ( rnd() % nblocks ) * opts.block_size );
+        const ssize_t n = pread ( f->fd, buf, opts.block_size, offset );
+        if ( n < 0 ) {
+            fprintf ( stderr, "Error reading %s at %jd: %s\n",
+                      f->path, ( intmax_t ) offset, strerror ( errno ) );
+            goto main_error_close_files;
+        }
+        bytes += ( uint64_t ) n;
+    }
+
+    printf ( "%lu %" PRIu64 "\n", opts.count, bytes );
+
+    for ( size_t i = 0 ; i < nfiles ; i++ ) {
+        if ( files [ i ].fd >= 0 )
+            close ( files [ i ].fd );
+        free ( files [ i ].path );
+    }
+    free ( files );
+    free ( buf );
+    return EXIT_SUCCESS;
+
+main_error_close_files:
+    free ( buf );
+main_error_free_files:
+    for ( size_t i = 0 ; i < nfiles ; i++ ) {
+        if ( files [ i ].fd >= 0 )
+            close ( files [ i ].fd );
+        free ( files [ i ].path );
+    }
+    free ( files );
+    return EXIT_FAILURE;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  bench_randread [options] < file_list\n\n"
+             "Reads blocks at random offsets of random files (the paths\n"
+             "given on stdin, one per line), prints the number of reads\n"
+             "and of bytes read.\n\n"
+             "Options:\n"
+             "  -n count     number of reads (default 10000)\n"
+             "  -b size      block size (default 4096)\n"
+             "  -S seed      seed (default 1)\n"
+             "  -h           show this help\n\n" );
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "n:b:S:h" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'n':
+            opts.count = strtoul ( optarg, NULL, 10 );
+            break;
+        case 'b':
+            opts.block_size = ( unsigned ) strtoul ( optarg, NULL, 10 );
+            if ( opts.block_size == 0 )
+                return false;
+            break;
+        case 'S':
+            opts.seed = strtoull ( optarg, NULL, 10 );
+            break;
+        default:
+            return false;
+        }
+    }
+    return ( optind == argc );
+}
+
+
+static bool read_file_list ( rfile_t ** const files,
+                             size_t * const   nfiles )
+{
+    size_t size = 0;
+    char * line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    while ( ( len = getline ( &line, &line_size, stdin ) ) > 0 ) {
+        if ( line [ len - 1 ] == '\n' )
+            line [ --len ] = '\0';
+        struct stat st;
+        if ( len == 0 || stat ( line, &st ) != 0 || ! S_ISREG ( st.st_mode ) ||
+             st.st_size == 0 )
+        {
+            continue;
+        }
+
+        if ( *nfiles == size ) {
+            size = ( size == 0 ) ? 256 : size * 2;
+            rfile_t * const new_files = realloc ( *files, size * sizeof ( rfile_t ) );
+            if ( new_files == NULL )
+                goto read_file_list_error;
+            *files = new_files;
+        }
+        rfile_t * const f = &( *files ) [ *nfiles ];
+        f->path = strdup ( line );
+        if ( f->path == NULL )
+            goto read_file_list_error;
+        f->size = st.st_size;
+        f->fd   = -1;
+        ( *nfiles )++;
+    }
+    free ( line );
+    return true;
+
+read_file_list_error:
+    fprintf ( stderr, "Out of memory.\n" );
+    free ( line );
+    return false;
+}
+
+
+// xorshift64* (the same sequence for the same seed)
+static uint64_t rnd ( void )
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return rnd_state * 2685821657736338717ULL;
+}
@@ -0,0 +1,453 @@
+/*
+ * bench_replay - replaying traces of the filesystem operations
+ *
+ * Replays a trace recorded with fuseadf -o record=file (see adffs_record.h)
+ * on an image, calling the FUSE handlers directly (see bench_fuse.h),
+ * as fast as possible or with the original timing. Reports the distribution
+ * of the latencies of each operation (with the recorded ones for comparison)
+ * and the results differing from the recorded ones, as JSON.
+ */
+
+#include "bench_fuse.h"
+#include "bench_util.h"
+
+#include "adffs_log.h"
+#include "adffs_record.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_IO_SIZE       ( 16 * 1024 * 1024 )
+
+typedef struct latencies {
+    uint64_t * ns;
+    size_t     n,
+               size;
+} latencies_t;
+
+typedef struct op_results {
+    latencies_t replayed,
+                recorded;
+    uint64_t    errors,
+                mismatches;         // (results other than recorded)
+} op_results_t;
+
+typedef struct bench_options {
+    const char * image,
+               * trace;
+    bool         write_mode,        // (on a copy of the image)
+                 timing;            // (original)
+    const char * log_file,
+               * output;
+} bench_options_t;
+
+static bench_options_t opts = {
+    .image      = NULL,
+    .trace      = NULL,
+    .write_mode = false,
+    .timing     = false,
+    .log_file   = NULL,
+    .output     = NULL
+};
+
+static op_results_t results [ ADFFS_OP_COUNT ];
+
+static char * buffer = NULL;
+static size_t buffer_size = 0;
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+static bool replay_trace ( FILE * const     trace,
+                           uint64_t * const nops,
+                           uint64_t * const time_ns );
+
+static void report_json ( FILE * const   out,
+                          const uint64_t nops,
+                          const uint64_t time_ns );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    FILE * const trace = fopen ( opts.trace, "rb" );
+    if ( trace == NULL ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", opts.trace, strerror ( errno ) );
+        return EXIT_FAILURE;
+    }
+    if ( ! adffs_record_read_header ( trace ) ) {
+        fprintf ( stderr, "%s is not a trace of fuseadf.\n", opts.trace );
+        fclose ( trace );
+        return EXIT_FAILURE;
+    }
+
+    // modifications only on a copy of the image
+    char image_path [ 256 ] = "";
+    if ( opts.write_mode ) {
+        if ( ! bench_temp_file ( image_path, sizeof ( image_path ), "bench_replay",
+                                 strrchr ( opts.image, '.' ) ) )
+        {
+            fclose ( trace );
+            return EXIT_FAILURE;
+        }
+        if ( ! bench_copy_file ( opts.image, image_path ) ) {
+            fprintf ( stderr, "Cannot copy %s to %s\n", opts.image, image_path );
+            goto main_error_remove_image;
+        }
+    }
+
+    FILE * logfile = NULL;
+    if ( opts.log_file != NULL ) {
+        logfile = adffs_log_open ( opts.log_file );
+        if ( logfile == NULL ) {
+            fprintf ( stderr, "Cannot open log file: %s\n", opts.log_file );
+            goto main_error_remove_image;
+        }
+    }
+
+    char * const path = opts.write_mode ? image_path : ( char * ) opts.image;
+    if ( ! bench_fuse_mount ( path, ! opts.write_mode, logfile ) ) {
+        fprintf ( stderr, "Cannot open the image %s\n", path );
+        if ( logfile != NULL )
+            adffs_log_close();
+        goto main_error_remove_image;
+    }
+
+    uint64_t nops = 0,
+             time_ns = 0;
+    int status = replay_trace ( trace, &nops, &time_ns ) ? EXIT_SUCCESS :
+                                                           EXIT_FAILURE;
+    bench_fuse_unmount();
+
+    FILE * const out = ( opts.output != NULL ) ? fopen ( opts.output, "w" ) : stdout;
+    if ( out == NULL ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", opts.output, strerror ( errno ) );
+        status = EXIT_FAILURE;
+    } else {
+        report_json ( out, nops, time_ns );
+        if ( out != stdout )
+            fclose ( out );
+    }
+
+    for ( unsigned op = 0 ; op < ADFFS_OP_COUNT ; op++ ) {
+        free ( results [ op ].replayed.ns );
+        free ( results [ op ].recorded.ns );
+    }
+    free ( buffer );
+    fclose ( trace );
+    if ( image_path [ 0 ] != '\0' )
+        unlink ( image_path );
+    return status;
+
+main_error_remove_image:
+    fclose ( trace );
+    if ( image_path [ 0 ] != '\0' )
+        unlink ( image_path );
+    return EXIT_FAILURE;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  bench_replay [options] image trace\n\n"
+             "Replays a trace of the operations (recorded with\n"
+             "fuseadf -o record=trace) on the image, prints the latencies\n"
+             "as JSON.\n\n"
+             "Options:\n"
+             "  -w           read-write (on a copy of the image)\n"
+             "  -T           with the original timing (default: as fast\n"
+             "               as possible)\n"
+             "  -l file      log file\n"
+             "  -o file      write the JSON to the file (default: stdout)\n"
+             "  -h           show this help\n\n" );
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "wTl:o:h" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'w':
+            opts.write_mode = true;
+            break;
+        case 'T':
+            opts.timing = true;
+            break;
+        case 'l':
+            opts.log_file = optarg;
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if ( optind != argc - 2 )
+        return false;
+    opts.image = argv [ optind ];
+    opts.trace = argv [ optind + 1 ];
+    return true;
+}
+
+
+/*****
+ * Replaying
+ *****/
+
+static bool latencies_add ( latencies_t * const l,
+                            const uint64_t      ns )
+{
+    if ( l->n == l->size ) {
+        const size_t size = ( l->size == 0 ) ? 1024 : l->size * 2;
+        uint64_t * const new_ns = realloc ( l->ns, size * sizeof ( uint64_t ) );
+        if ( new_ns == NULL )
+            return false;
+        l->ns   = new_ns;
+        l->size = size;
+    }
+    l->ns [ l->n++ ] = ns;
+    return true;
+}
+
+
+static bool buffer_reserve ( const uint64_t size )
+{
+    if ( size > BENCH_MAX_IO_SIZE )
+        return false;
+    if ( size <= buffer_size )
+        return true;
+    char * const new_buffer = realloc ( buffer, ( size_t ) size );
+    if ( new_buffer == NULL )
+        return false;
+    // (data written - any)
+    memset ( new_buffer + buffer_size, 0x5a, ( size_t ) size - buffer_size );
+    buffer      = new_buffer;
+    buffer_size = ( size_t ) size;
+    return true;
+}
+
+
+static int count_filler ( void *              buf,
+                          const char *        name,
+                          const struct stat * stbuf,
+                          off_t               off )
+{
+    (void) name;
+    (void) stbuf;
+    (void) off;
+    ( *( unsigned * ) buf )++;
+    return 0;
+}
+
+
+static int replay_op ( const adffs_record_entry_t * const e )
+{
+    struct fuse_file_info finfo;
+    memset ( &finfo, 0, sizeof ( finfo ) );
+
+    switch ( e->op ) {
+    case ADFFS_OP_GETATTR: {
+        struct stat st;
+        return adffs_oper.getattr ( e->path, &st );
+    }
+    case ADFFS_OP_READLINK: {
+        char link [ 1024 ];
+        return adffs_oper.readlink ( e->path, link, sizeof ( link ) );
+    }
+    case ADFFS_OP_MKDIR:
+        return adffs_oper.mkdir ( e->path, ( mode_t ) e->arg );
+    case ADFFS_OP_UNLINK:
+        return adffs_oper.unlink ( e->path );
+    case ADFFS_OP_RMDIR:
+        return adffs_oper.rmdir ( e->path );
+    case ADFFS_OP_RENAME:
+        return adffs_oper.rename ( e->path, e->path2 );
+    case ADFFS_OP_CHMOD:
+        return adffs_oper.chmod ( e->path, ( mode_t ) e->arg );
+    case ADFFS_OP_CHOWN:
+        return adffs_oper.chown ( e->path, ( uid_t ) e->offset, ( gid_t ) e->arg );
+    case ADFFS_OP_TRUNCATE:
+        return adffs_oper.truncate ( e->path, ( off_t ) e->arg );
+    case ADFFS_OP_OPEN:
+        finfo.flags = ( int ) e->arg;
+        return adffs_oper.open ( e->path, &finfo );
+    case ADFFS_OP_READ:
+        if ( ! buffer_reserve ( e->arg ) )
+            return -ENOMEM;
+        return adffs_oper.read ( e->path, buffer, ( size_t ) e->arg,
+                                 ( off_t ) e->offset, &finfo );
+    case ADFFS_OP_WRITE:
+        if ( ! buffer_reserve ( e->arg ) )
+            return -ENOMEM;
+        return adffs_oper.write ( e->path, buffer, ( size_t ) e->arg,
+                                  ( off_t ) e->offset, &finfo );
+    case ADFFS_OP_STATFS: {
+        struct statvfs stvfs;
+        return adffs_oper.statfs ( e->path, &stvfs );
+    }
+    case ADFFS_OP_RELEASE:
+        return adffs_oper.release ( e->path, &finfo );
+    case ADFFS_OP_FSYNC:
+        return adffs_oper.fsync ( e->path, ( int ) e->arg, &finfo );
+    case ADFFS_OP_READDIR: {
+        unsigned nentries = 0;
+        return adffs_oper.readdir ( e->path, &nentries, count_filler, 0, &finfo );
+    }
+    case ADFFS_OP_CREATE:
+        return adffs_oper.create ( e->path, ( mode_t ) e->arg, &finfo );
+    case ADFFS_OP_UTIMENS: {
+        const struct timespec tv [ 2 ] = {
+            { ( time_t ) e->offset, ( long ) e->arg },
+            { ( time_t ) e->offset, ( long ) e->arg }
+        };
+        return adffs_oper.utimens ( e->path, tv );
+    }
+    case ADFFS_OP_COUNT:
+        break;
+    }
+    return -ENOSYS;
+}
+
+
+static void sleep_until ( const uint64_t ns )
+{
+    const struct timespec ts = {
+        .tv_sec  = ( time_t ) ( ns / 1000000000ULL ),
+        .tv_nsec = ( long ) ( ns % 1000000000ULL )
+    };
+    while ( clock_nanosleep ( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR )
+        ;
+}
+
+
+static bool replay_trace ( FILE * const     trace,
+                           uint64_t * const nops,
+                           uint64_t * const time_ns )
+{
+    static adffs_record_entry_t entry;      // (2 paths - not on the stack)
+    memset ( &entry, 0, sizeof ( entry ) );
+
+    const uint64_t start = bench_now_ns();
+    bool eof = false;
+    while ( adffs_record_read ( trace, &entry, &eof ) ) {
+        if ( opts.timing )
+            sleep_until ( start + entry.start_ns );
+
+        const uint64_t op_start = bench_now_ns();
+        const int status = replay_op ( &entry );
+        const uint64_t op_ns = bench_now_ns() - op_start;
+
+        op_results_t * const r = &results [ entry.op ];
+        if ( ! latencies_add ( &r->replayed, op_ns ) ||
+             ! latencies_add ( &r->recorded, entry.duration_ns ) )
+        {
+            fprintf ( stderr, "Out of memory.\n" );
+            return false;
+        }
+        r->errors     += ( status < 0 ) ? 1 : 0;
+        r->mismatches += ( status != entry.status ) ? 1 : 0;
+        ( *nops )++;
+    }
+    *time_ns = bench_now_ns() - start;
+
+    if ( ! eof ) {
+        fprintf ( stderr, "Invalid trace (after %" PRIu64 " operations).\n", *nops );
+        return false;
+    }
+    return true;
+}
+
+
+/*****
+ * Report
+ *****/
+
+static int compare_ns ( const void * a,
+                        const void * b )
+{
+    const uint64_t x = *( const uint64_t * ) a,
+                   y = *( const uint64_t * ) b;
+    return ( x > y ) - ( x < y );
+}
+
+
+static void report_latencies ( FILE * const        out,
+                               const char * const  name,
+                               latencies_t * const l,
+                               const bool          last )
+{
+    qsort ( l->ns, l->n, sizeof ( uint64_t ), compare_ns );
+    uint64_t total = 0;
+    for ( size_t i = 0 ; i < l->n ; i++ )
+        total += l->ns [ i ];
+
+#define PERCENTILE( p ) ( l->ns [ ( l->n - 1 ) * ( p ) / 100 ] )
+    fprintf ( out, "          \"%s\": {\n"
+              "            \"avg_ns\": %.1f,\n"
+              "            \"p50_ns\": %" PRIu64 ",\n"
+              "            \"p90_ns\": %" PRIu64 ",\n"
+              "            \"p99_ns\": %" PRIu64 ",\n"
+              "            \"max_ns\": %" PRIu64 "\n"
+              "          }%s\n",
+              name, ( double ) total / ( double ) l->n,
+              PERCENTILE ( 50 ), PERCENTILE ( 90 ), PERCENTILE ( 99 ),
+              l->ns [ l->n - 1 ], last ? "" : "," );
+#undef PERCENTILE
+}
+
+
+static void report_json ( FILE * const   out,
+                          const uint64_t nops,
+                          const uint64_t time_ns )
+{
+    fprintf ( out, "{\n  \"image\": " );
+    bench_json_string ( out, opts.image );
+    fprintf ( out, ",\n  \"trace\": " );
+    bench_json_string ( out, opts.trace );
+    fprintf ( out, ",\n"
+              "  \"timing\": \"%s\",\n"
+              "  \"ops\": %" PRIu64 ",\n"
+              "  \"time_ns\": %" PRIu64 ",\n"
+              "  \"ops_per_s\": %.1f,\n"
+              "  \"operations\": [",
+              opts.timing ? "original" : "fast",
+              nops, time_ns,
+              time_ns > 0 ? ( double ) nops * 1e9 / ( double ) time_ns : 0.0 );
+
+    bool first = true;
+    for ( unsigned op = 0 ; op < ADFFS_OP_COUNT ; op++ ) {
+        op_results_t * const r = &results [ op ];
+        if ( r->replayed.n == 0 )
+            continue;
+        fprintf ( out, "%s\n        {\n"
+                  "          \"op\": \"%s\",\n"
+                  "          \"count\": %zu,\n"
+                  "          \"errors\": %" PRIu64 ",\n"
+                  "          \"mismatches\": %" PRIu64 ",\n",
+                  first ? "" : ",",
+                  adffs_stats_op_name ( ( adffs_op_t ) op ),
+                  r->replayed.n, r->errors, r->mismatches );
+        report_latencies ( out, "replayed", &r->replayed, false );
+        report_latencies ( out, "recorded", &r->recorded, true );
+        fprintf ( out, "        }" );
+        first = false;
+    }
+    fprintf ( out, "\n  ]\n}\n" );
+}
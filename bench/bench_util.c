@@ -0,0 +1,79 @@
+#include "bench_util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+uint64_t bench_now_ns ( void )
+{
+    struct timespec ts;
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t ) ts.tv_sec * 1000000000ULL + ( uint64_t ) ts.tv_nsec;
+}
+
+
+bool bench_temp_file ( char * const       path,
+                       const size_t       size,
+                       const char * const prefix,
+                       const char * const suffix )
+{
+    const char * const sfx = ( suffix != NULL ) ? suffix : "";
+    const int len = snprintf ( path, size, "/tmp/%s_XXXXXX%s", prefix, sfx );
+    if ( len < 0 || ( size_t ) len >= size )
+        return false;
+
+    const int fd = mkstemps ( path, ( int ) strlen ( sfx ) );
+    if ( fd < 0 ) {
+        fprintf ( stderr, "Cannot create a temporary file: %s\n",
+                  strerror ( errno ) );
+        return false;
+    }
+    close ( fd );
+    return true;
+}
+
+
+bool bench_copy_file ( const char * const src,
+                       const char * const dst )
+{
+    FILE * const in = fopen ( src, "rb" );
+    if ( in == NULL )
+        return false;
+    FILE * const out = fopen ( dst, "wb" );
+    if ( out == NULL ) {
+        fclose ( in );
+        return false;
+    }
+
+    bool ok = true;
+    char buf [ 65536 ];
+    size_t n;
+    while ( ( n = fread ( buf, 1, sizeof ( buf ), in ) ) > 0 ) {
+        if ( fwrite ( buf, 1, n, out ) != n ) {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && ! ferror ( in );
+    fclose ( in );
+    return ( fclose ( out ) == 0 ) && ok;
+}
+
+
+void bench_json_string ( FILE * const       out,
+                         const char * const str )
+{
+    fputc ( '"', out );
+    for ( const char * c = str ; *c != '\0' ; c++ ) {
+        if ( *c == '"' || *c == '\\' )
+            fprintf ( out, "\\%c", *c );
+        else if ( ( unsigned char ) *c < 0x20 )
+            fprintf ( out, "\\u%04x", ( unsigned ) *c );
+        else
+            fputc ( *c, out );
+    }
+    fputc ( '"', out );
+}
@@ -0,0 +1,30 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+/*
+ * Common parts of the benchmarks
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// monotonic time in nanoseconds
+uint64_t bench_now_ns ( void );
+
+// create an empty temporary file /tmp/<prefix>_XXXXXX<suffix>
+// (keeping the suffix - images are recognized by their extensions)
+bool bench_temp_file ( char * const       path,
+                       const size_t       size,
+                       const char * const prefix,
+                       const char * const suffix );
+
+bool bench_copy_file ( const char * const src,
+                       const char * const dst );
+
+// a string as a JSON string (quoted and escaped)
+void bench_json_string ( FILE * const       out,
+                         const char * const str );
+
+#endif
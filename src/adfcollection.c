@@ -0,0 +1,436 @@
+
+#include "adfcollection.h"
+
+#include "adffs_log.h"
+#include "adfindex.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+static const char * const image_suffixes[] = {
+    ".adf",
+    ".hdf",
+    ".adz",         // gzip-compressed
+    ".adf.gz",
+    ".hdf.gz",
+    ".dms",
+    ".zip"          // (with an image inside)
+};
+
+static adfcollection_t * collection_create ( const char * const path,
+                                             const unsigned     max_open,
+                                             const unsigned     volume,
+                                             const bool         read_only,
+                                             const bool         ignore_checksum_errors );
+
+static bool collection_add_image_file ( adfcollection_t * const collection,
+                                        const char * const      filename,
+                                        unsigned * const        nallocated );
+
+static bool collection_add_entry ( adfcollection_t * const collection,
+                                   const char * const      name,
+                                   const char * const      path,
+                                   const unsigned          volume,
+                                   unsigned * const        nallocated );
+
+static bool name_taken ( const adfcollection_t * const collection,
+                         const char * const            name );
+
+static void volume_name ( const adfcollection_t * const  collection,
+                          const struct AdfVolume * const vol,
+                          const unsigned                 volume,
+                          char * const                   name,
+                          const size_t                   name_size );
+
+static int compare_entries ( const void * const entry1,
+                             const void * const entry2 );
+
+static void lru_unlink ( adfcollection_t * const       collection,
+                         adfcollection_entry_t * const entry );
+
+static void lru_push_front ( adfcollection_t * const       collection,
+                             adfcollection_entry_t * const entry );
+
+static void close_image ( adfcollection_t * const       collection,
+                          adfcollection_entry_t * const entry );
+
+
+adfcollection_t * adfcollection_open ( const char * const dirpath,
+                                       const unsigned     max_open,
+                                       const unsigned     volume,
+                                       const bool         read_only,
+                                       const bool         ignore_checksum_errors )
+{
+    adfcollection_t * collection = collection_create ( dirpath, max_open, volume,
+                                                       read_only,
+                                                       ignore_checksum_errors );
+    if ( ! collection )
+        return NULL;
+
+    DIR * const dir = opendir ( collection->path );
+    if ( ! dir ) {
+        fprintf ( stderr, "Cannot open directory '%s'\n", collection->path );
+        adfcollection_close ( &collection );
+        return NULL;
+    }
+
+    unsigned nallocated = 0;
+    const struct dirent * dentry;
+    while ( ( dentry = readdir ( dir ) ) != NULL ) {
+        if ( ! adfcollection_is_image_filename ( dentry->d_name ) )
+            continue;
+
+        if ( ! collection_add_image_file ( collection, dentry->d_name,
+                                           &nallocated ) )
+        {
+            closedir ( dir );
+            adfcollection_close ( &collection );
+            return NULL;
+        }
+    }
+    closedir ( dir );
+
+    qsort ( collection->entries, collection->nentries,
+            sizeof ( adfcollection_entry_t ), compare_entries );
+
+    return collection;
+}
+
+
+adfcollection_t * adfcollection_open_volumes ( const char * const filename,
+                                               const unsigned     max_open,
+                                               const bool         read_only,
+                                               const bool         ignore_checksum_errors )
+{
+    adfcollection_t * collection = collection_create ( filename, max_open, 0,
+                                                       read_only,
+                                                       ignore_checksum_errors );
+    if ( ! collection )
+        return NULL;
+
+    // the device is open (and its partitions are read) only once,
+    // the volumes are mounted on first access
+    collection->dev = adfimage_dev_open ( collection->path, read_only,
+                                          ignore_checksum_errors );
+    if ( ! collection->dev ) {
+        fprintf ( stderr, "Cannot open device '%s'\n", collection->path );
+        adfcollection_close ( &collection );
+        return NULL;
+    }
+
+    unsigned nallocated = 0;
+    for ( int i = 0 ; i < collection->dev->nVol ; i++ ) {
+        char name [ ADFIMAGE_MAX_PATH ];
+        volume_name ( collection, collection->dev->volList [ i ], (unsigned) i,
+                      name, sizeof ( name ) );
+
+        if ( ! collection_add_entry ( collection, name, collection->path,
+                                      (unsigned) i, &nallocated ) )
+        {
+            adfcollection_close ( &collection );
+            return NULL;
+        }
+    }
+
+    qsort ( collection->entries, collection->nentries,
+            sizeof ( adfcollection_entry_t ), compare_entries );
+
+    return collection;
+}
+
+
+void adfcollection_close ( adfcollection_t ** collection )
+{
+    if ( ! *collection )
+        return;
+
+    adfcollection_t * const coll = *collection;
+
+    for ( unsigned i = 0 ; i < coll->nentries ; i++ ) {
+        adfcollection_entry_t * const entry = &coll->entries [ i ];
+        if ( entry->adfimage )
+            close_image ( coll, entry );
+        free ( entry->name );
+        free ( entry->path );
+    }
+    free ( coll->entries );
+
+    if ( coll->dev )
+        adfimage_dev_close ( &coll->dev );
+
+    free ( coll->path );
+    free ( coll );
+
+    *collection = NULL;
+}
+
+
+adfcollection_entry_t * adfcollection_find ( adfcollection_t * const collection,
+                                             const char * const      name,
+                                             const size_t            namelen )
+{
+    // binary search (entries are sorted by name)
+    size_t first = 0,
+           last  = collection->nentries;
+    while ( first < last ) {
+        const size_t middle = first + ( last - first ) / 2;
+        adfcollection_entry_t * const entry = &collection->entries [ middle ];
+
+        int cmp = strncmp ( name, entry->name, namelen );
+        if ( cmp == 0 && entry->name [ namelen ] != '\0' )
+            cmp = -1;   // name is a prefix of the entry's name
+
+        if ( cmp == 0 )
+            return entry;
+        if ( cmp < 0 )
+            last = middle;
+        else
+            first = middle + 1;
+    }
+    return NULL;
+}
+
+
+adfimage_t * adfcollection_get_image ( adfcollection_t * const       collection,
+                                       adfcollection_entry_t * const entry )
+{
+    if ( entry->adfimage ) {
+        // already open - just mark as the most recently used
+        lru_unlink ( collection, entry );
+        lru_push_front ( collection, entry );
+        return entry->adfimage;
+    }
+
+    // make room for the image (close the least recently used)
+    while ( collection->nopen >= collection->max_open &&
+            collection->lru_last != NULL )
+    {
+        close_image ( collection, collection->lru_last );
+    }
+
+    entry->adfimage = ( collection->dev != NULL ) ?
+        adfimage_open_volume ( collection->dev, entry->path,
+                               entry->volume, collection->read_only ) :
+        adfimage_open ( entry->path, entry->volume,
+                        collection->read_only,
+                        collection->ignore_checksum_errors );
+    if ( ! entry->adfimage ) {
+        adffs_log_info ( "adfcollection_get_image: error: cannot open image %s\n",
+                         entry->path );
+        return NULL;
+    }
+
+    // (opened by a FUSE operation - so after daemonizing)
+    if ( entry->adfimage->index != NULL )
+        adfindex_prescan_start ( entry->adfimage->index );
+
+    lru_push_front ( collection, entry );
+    collection->nopen++;
+
+    return entry->adfimage;
+}
+
+
+bool adfcollection_is_image_filename ( const char * const filename )
+{
+    const size_t namelen = strlen ( filename );
+    const unsigned nsuffixes = sizeof ( image_suffixes ) / sizeof ( char * );
+
+    for ( unsigned i = 0 ; i < nsuffixes ; i++ ) {
+        const size_t suffixlen = strlen ( image_suffixes [ i ] );
+        if ( namelen > suffixlen &&
+             strcasecmp ( filename + namelen - suffixlen,
+                          image_suffixes [ i ] ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static adfcollection_t * collection_create ( const char * const path,
+                                             const unsigned     max_open,
+                                             const unsigned     volume,
+                                             const bool         read_only,
+                                             const bool         ignore_checksum_errors )
+{
+    adfcollection_t * const collection = calloc ( 1, sizeof ( adfcollection_t ) );
+    if ( ! collection ) {
+        adffs_log_info ( "adfcollection_open: error: Cannot allocate memory "
+                         "for collection data\n" );
+        return NULL;
+    }
+
+    // images are opened on first access - after fuse has daemonized
+    // and changed the working directory, so the path must be absolute
+    collection->path = realpath ( path, NULL );
+    if ( ! collection->path ) {
+        fprintf ( stderr, "Cannot access '%s'\n", path );
+        free ( collection );
+        return NULL;
+    }
+
+    collection->max_open               = ( max_open > 0 ) ? max_open : 1;
+    collection->volume                 = volume;
+    collection->read_only              = read_only;
+    collection->ignore_checksum_errors = ignore_checksum_errors;
+
+    return collection;
+}
+
+
+static bool collection_add_image_file ( adfcollection_t * const collection,
+                                        const char * const      filename,
+                                        unsigned * const        nallocated )
+{
+    char path [ PATH_MAX ];
+    if ( snprintf ( path, sizeof ( path ), "%s/%s",
+                    collection->path, filename ) >= (int) sizeof ( path ) )
+    {
+        adffs_log_info ( "adfcollection_open: path too long, skipping: %s\n",
+                         filename );
+        return true;
+    }
+
+    // only regular files (or symlinks to them)
+    struct stat st;
+    if ( stat ( path, &st ) != 0 || ! S_ISREG ( st.st_mode ) )
+        return true;
+
+    return collection_add_entry ( collection, filename, path,
+                                  collection->volume, nallocated );
+}
+
+
+static bool collection_add_entry ( adfcollection_t * const collection,
+                                   const char * const      name,
+                                   const char * const      path,
+                                   const unsigned          volume,
+                                   unsigned * const        nallocated )
+{
+    if ( collection->nentries >= *nallocated ) {
+        const unsigned nallocated_new = ( *nallocated > 0 ) ? *nallocated * 2 : 64;
+        adfcollection_entry_t * const entries =
+            realloc ( collection->entries,
+                      nallocated_new * sizeof ( adfcollection_entry_t ) );
+        if ( ! entries ) {
+            fprintf ( stderr, "Cannot allocate memory for collection entries\n" );
+            return false;
+        }
+        collection->entries = entries;
+        *nallocated = nallocated_new;
+    }
+
+    adfcollection_entry_t * const entry = &collection->entries [ collection->nentries ];
+    memset ( entry, 0, sizeof ( adfcollection_entry_t ) );
+    entry->name   = strdup ( name );
+    entry->path   = strdup ( path );
+    entry->volume = volume;
+    if ( ! entry->name || ! entry->path ) {
+        free ( entry->name );
+        free ( entry->path );
+        fprintf ( stderr, "Cannot allocate memory for collection entries\n" );
+        return false;
+    }
+    collection->nentries++;
+
+    return true;
+}
+
+
+static int compare_entries ( const void * const entry1,
+                             const void * const entry2 )
+{
+    return strcmp ( ( ( const adfcollection_entry_t * ) entry1 )->name,
+                    ( ( const adfcollection_entry_t * ) entry2 )->name );
+}
+
+
+static void lru_unlink ( adfcollection_t * const       collection,
+                         adfcollection_entry_t * const entry )
+{
+    if ( entry->lru_prev )
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        collection->lru_first = entry->lru_next;
+
+    if ( entry->lru_next )
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        collection->lru_last = entry->lru_prev;
+
+    entry->lru_prev =
+    entry->lru_next = NULL;
+}
+
+
+static void lru_push_front ( adfcollection_t * const       collection,
+                             adfcollection_entry_t * const entry )
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = collection->lru_first;
+    if ( collection->lru_first )
+        collection->lru_first->lru_prev = entry;
+    collection->lru_first = entry;
+    if ( ! collection->lru_last )
+        collection->lru_last = entry;
+}
+
+
+static void close_image ( adfcollection_t * const       collection,
+                          adfcollection_entry_t * const entry )
+{
+    lru_unlink ( collection, entry );
+    adfimage_close ( &entry->adfimage );
+    collection->nopen--;
+}
+
+
+// name of the directory for a volume - the volume name, if valid and unique
+static bool name_taken ( const adfcollection_t * const collection,
+                         const char * const            name )
+{
+    for ( unsigned i = 0 ; i < collection->nentries ; i++ )
+        if ( strcmp ( collection->entries [ i ].name, name ) == 0 )
+            return true;
+    return false;
+}
+
+
+static void volume_name ( const adfcollection_t * const  collection,
+                          const struct AdfVolume * const vol,
+                          const unsigned                 volume,
+                          char * const                   name,
+                          const size_t                   name_size )
+{
+    char base [ ADFIMAGE_MAX_PATH ];
+    if ( vol->volName == NULL ||
+         *vol->volName == '\0' ||
+         strcmp ( vol->volName, "." ) == 0 ||
+         strcmp ( vol->volName, ".." ) == 0 )
+    {
+        snprintf ( base, sizeof ( base ), "vol%u", volume );
+    } else {
+        snprintf ( base, sizeof ( base ), "%s", vol->volName );
+        for ( char * ch = base ; *ch != '\0' ; ch++ )
+            if ( *ch == '/' )
+                *ch = '_';
+    }
+
+    // the same name as one of the previous volumes - add a suffix
+    // (until unique - also the suffixed name can be taken, eg. "A", "A.2", "A")
+    snprintf ( name, name_size, "%s", base );
+    for ( unsigned suffix = volume ;
+          name_taken ( collection, name ) &&
+              suffix <= volume + collection->nentries ;
+          suffix++ )
+    {
+        snprintf ( name, name_size, "%s.%u", base, suffix );
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef ADFCOLLECTION_H
+#define ADFCOLLECTION_H
+
+#include "adfimage.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// default max. number of images kept open at the same time
+#define ADFCOLLECTION_MAX_OPEN_DEFAULT 16
+
+typedef struct adfcollection_entry {
+    char *       name;        // name of the (sub)directory in the mountpoint
+    char *       path;        // (absolute) path of the image file
+    unsigned     volume;      // volume (partition) of the image
+    adfimage_t * adfimage;    // NULL if the image is not open
+
+    // list of open images, the most recently used first
+    struct adfcollection_entry * lru_prev,
+                               * lru_next;
+} adfcollection_entry_t;
+
+typedef struct adfcollection {
+    // directory with images or (for volumes of a single device)
+    // the image file
+    char *                  path;
+
+    // the device shared by all volumes (NULL for a directory with images)
+    struct AdfDevice *      dev;
+
+    adfcollection_entry_t * entries;      // sorted by name
+    unsigned                nentries;
+
+    adfcollection_entry_t * lru_first,
+                          * lru_last;
+    unsigned                nopen,
+                            max_open;
+
+    unsigned                volume;
+    bool                    read_only,
+                            ignore_checksum_errors;
+} adfcollection_t;
+
+
+adfcollection_t * adfcollection_open ( const char * const dirpath,
+                                       const unsigned     max_open,
+                                       const unsigned     volume,
+                                       const bool         read_only,
+                                       const bool         ignore_checksum_errors );
+
+// all volumes of a device (ie. partitions of a hard disk image)
+// as a collection
+adfcollection_t * adfcollection_open_volumes ( const char * const filename,
+                                               const unsigned     max_open,
+                                               const bool         read_only,
+                                               const bool         ignore_checksum_errors );
+
+void adfcollection_close ( adfcollection_t ** collection );
+
+adfcollection_entry_t * adfcollection_find ( adfcollection_t * const collection,
+                                             const char * const      name,
+                                             const size_t            namelen );
+
+adfimage_t * adfcollection_get_image ( adfcollection_t * const       collection,
+                                       adfcollection_entry_t * const entry );
+
+bool adfcollection_is_image_filename ( const char * const filename );
+
+#endif
@@ -0,0 +1,315 @@
+
+#include "adfdev.h"
+
+#include "adfdev_dms.h"
+#include "adfdev_gzip.h"
+#include "adfdev_ram.h"
+#include "adfdev_zip.h"
+#include "adffs_log.h"
+#include "adffs_probes.h"
+#include "adffs_stats.h"
+#include "adffs_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const adfdev_backend_t * const backends[] = {
+    &adfdev_gzip_backend,
+    &adfdev_dms_backend,
+    &adfdev_zip_backend,
+    &adfdev_ram_backend     // (not compressed images - must be the last)
+};
+
+static struct AdfDevice * adfdev_open_dev ( const char * const  name,
+                                            const AdfAccessMode mode );
+
+static ADF_RETCODE adfdev_close_dev ( struct AdfDevice * const dev );
+
+static ADF_RETCODE adfdev_read_sector ( struct AdfDevice * const dev,
+                                       const uint32_t           n,
+                                       const unsigned           size,
+                                       uint8_t * const          buf );
+
+static ADF_RETCODE adfdev_write_sector ( struct AdfDevice * const dev,
+                                        const uint32_t           n,
+                                        const unsigned           size,
+                                        const uint8_t * const    buf );
+
+static bool adfdev_is_native ( void );
+
+static ADF_RETCODE adfdev_counting_close_dev ( struct AdfDevice * const dev );
+
+static ADF_RETCODE adfdev_counting_read_sector ( struct AdfDevice * const dev,
+                                                const uint32_t           n,
+                                                const unsigned           size,
+                                                uint8_t * const          buf );
+
+static ADF_RETCODE adfdev_counting_write_sector ( struct AdfDevice * const dev,
+                                                 const uint32_t           n,
+                                                 const unsigned           size,
+                                                 const uint8_t * const    buf );
+
+static bool adfdev_counting_is_native ( void );
+
+static const adfdev_backend_t * adfdev_get_backend ( const char * const filename );
+
+static const struct AdfDeviceDriver adfdev_driver = {
+    .name        = ADFDEV_DRIVER_NAME,
+    .data        = NULL,
+    .createDev   = NULL,
+    .openDev     = adfdev_open_dev,
+    .closeDev    = adfdev_close_dev,
+    .readSector  = adfdev_read_sector,
+    .writeSector = adfdev_write_sector,
+    .isNative    = adfdev_is_native,
+    .isDevice    = adfdev_is_supported
+};
+
+// ADFlib's driver wrapped to account the I/O (only one can be wrapped -
+// in practice, it is always the one for dump files)
+static const struct AdfDeviceDriver * counted_driver = NULL;
+
+static const struct AdfDeviceDriver adfdev_counting_driver = {
+    .name        = ADFDEV_DRIVER_NAME "-counting",
+    .data        = NULL,
+    .createDev   = NULL,
+    .openDev     = NULL,
+    .closeDev    = adfdev_counting_close_dev,
+    .readSector  = adfdev_counting_read_sector,
+    .writeSector = adfdev_counting_write_sector,
+    .isNative    = adfdev_counting_is_native,
+    .isDevice    = NULL
+};
+
+
+bool adfdev_register ( void )
+{
+    return ( adfAddDeviceDriver ( &adfdev_driver ) == ADF_RC_OK );
+}
+
+
+void adfdev_unregister ( void )
+{
+    adfRemoveDeviceDriver ( &adfdev_driver );
+}
+
+
+bool adfdev_is_supported ( const char * const filename )
+{
+    return ( adfdev_get_backend ( filename ) != NULL );
+}
+
+
+bool adfdev_flush ( struct AdfDevice * const dev )
+{
+    if ( dev->drv != &adfdev_driver )
+        return true;
+
+    adfdev_t * const adfdev = ( adfdev_t * ) dev->drvData;
+    if ( adfdev->backend->flush == NULL )
+        return true;
+
+    return ( adfdev->backend->flush ( adfdev ) == ADF_RC_OK );
+}
+
+
+bool adfdev_count_io ( struct AdfDevice * const dev )
+{
+    if ( dev->drv == &adfdev_driver ||
+         dev->drv == &adfdev_counting_driver )
+    {
+        return true;
+    }
+
+    if ( counted_driver == NULL )
+        counted_driver = dev->drv;
+    else if ( counted_driver != dev->drv )
+        return false;
+
+    dev->drv = &adfdev_counting_driver;
+    return true;
+}
+
+
+bool adfdev_is_raw ( const struct AdfDevice * const dev )
+{
+    // (ADFlib's own drivers - dump files, native devices)
+    if ( dev->drv != &adfdev_driver )
+        return true;
+
+    const adfdev_t * const adfdev = ( const adfdev_t * ) dev->drvData;
+    return ( adfdev->backend == &adfdev_ram_backend );
+}
+
+
+static const adfdev_backend_t * adfdev_get_backend ( const char * const filename )
+{
+    const unsigned nbackends = sizeof ( backends ) / sizeof ( adfdev_backend_t * );
+    for ( unsigned i = 0 ; i < nbackends ; i++ ) {
+        if ( backends [ i ]->probe ( filename ) )
+            return backends [ i ];
+    }
+    return NULL;
+}
+
+
+static struct AdfDevice * adfdev_open_dev ( const char * const  name,
+                                            const AdfAccessMode mode )
+{
+    const adfdev_backend_t * const backend = adfdev_get_backend ( name );
+    if ( backend == NULL ) {
+        adffs_log_info ( "adfdev_open_dev: unsupported image: %s\n", name );
+        return NULL;
+    }
+
+    struct AdfDevice * const dev = calloc ( 1, sizeof ( struct AdfDevice ) );
+    adfdev_t * const adfdev = calloc ( 1, sizeof ( adfdev_t ) );
+    if ( dev == NULL || adfdev == NULL ) {
+        adffs_log_info ( "adfdev_open_dev: error: Cannot allocate memory\n" );
+        goto adfdev_open_dev_error_cleanup;
+    }
+
+    adfdev->backend   = backend;
+    adfdev->read_only = ( mode != ADF_ACCESS_MODE_READWRITE ||
+                          backend->write == NULL );
+
+    if ( backend->open ( adfdev, name ) != ADF_RC_OK ) {
+        adffs_log_info ( "adfdev_open_dev: error opening %s image: %s\n",
+                         backend->name, name );
+        goto adfdev_open_dev_error_cleanup;
+    }
+
+    dev->name = strdup ( name );
+    if ( dev->name == NULL ) {
+        backend->close ( adfdev );
+        goto adfdev_open_dev_error_cleanup;
+    }
+
+    dev->readOnly   = adfdev->read_only;
+    dev->sizeBlocks = (uint32_t) ( adfdev->size / ADF_DEV_BLOCK_SIZE );
+    dev->devType    =
+        ( dev->sizeBlocks == 1760 ) ? ADF_DEVTYPE_FLOPDD :
+        ( dev->sizeBlocks == 3520 ) ? ADF_DEVTYPE_FLOPHD :
+                                      ADF_DEVTYPE_HARDFILE;
+    dev->nVol       = 0;
+    dev->volList    = NULL;
+    dev->mounted    = false;
+    dev->drv        = &adfdev_driver;
+    dev->drvData    = adfdev;
+
+    return dev;
+
+adfdev_open_dev_error_cleanup:
+    free ( adfdev );
+    free ( dev );
+    return NULL;
+}
+
+
+static ADF_RETCODE adfdev_close_dev ( struct AdfDevice * const dev )
+{
+    adfdev_t * const adfdev = ( adfdev_t * ) dev->drvData;
+
+    adfdev->backend->close ( adfdev );
+    free ( adfdev );
+    free ( dev->name );
+    free ( dev );
+
+    return ADF_RC_OK;
+}
+
+
+static ADF_RETCODE adfdev_read_sector ( struct AdfDevice * const dev,
+                                       const uint32_t           n,
+                                       const unsigned           size,
+                                       uint8_t * const          buf )
+{
+    adfdev_t * const adfdev = ( adfdev_t * ) dev->drvData;
+    const uint64_t offset = (uint64_t) n * ADF_DEV_BLOCK_SIZE;
+
+    if ( offset + size > adfdev->size ) {
+        adffs_log_info ( "adfdev_read_sector: sector %u out of the image\n", n );
+        return ADF_RC_ERROR;
+    }
+
+    adffs_stats_io_read ( size );
+    adffs_trace ( ADFFS_TRACE_DEVICE, "device: read block %u (%u bytes)", n, size );
+    ADFFS_PROBE2 ( block__read__entry, n, size );
+    const ADF_RETCODE rc = adfdev->backend->read ( adfdev, offset, size, buf );
+    ADFFS_PROBE3 ( block__read__return, n, size, ( int ) rc );
+    return rc;
+}
+
+
+static ADF_RETCODE adfdev_write_sector ( struct AdfDevice * const dev,
+                                        const uint32_t           n,
+                                        const unsigned           size,
+                                        const uint8_t * const    buf )
+{
+    adfdev_t * const adfdev = ( adfdev_t * ) dev->drvData;
+    const uint64_t offset = (uint64_t) n * ADF_DEV_BLOCK_SIZE;
+
+    if ( adfdev->read_only ) {
+        adffs_log_info ( "adfdev_write_sector: read-only device\n" );
+        return ADF_RC_ERROR;
+    }
+
+    if ( offset + size > adfdev->size ) {
+        adffs_log_info ( "adfdev_write_sector: sector %u out of the image\n", n );
+        return ADF_RC_ERROR;
+    }
+
+    adffs_stats_io_write ( size );
+    adffs_trace ( ADFFS_TRACE_DEVICE, "device: write block %u (%u bytes)", n, size );
+    ADFFS_PROBE2 ( block__write__entry, n, size );
+    const ADF_RETCODE rc = adfdev->backend->write ( adfdev, offset, size, buf );
+    ADFFS_PROBE3 ( block__write__return, n, size, ( int ) rc );
+    return rc;
+}
+
+
+static bool adfdev_is_native ( void )
+{
+    return false;
+}
+
+
+static ADF_RETCODE adfdev_counting_close_dev ( struct AdfDevice * const dev )
+{
+    dev->drv = counted_driver;
+    return counted_driver->closeDev ( dev );
+}
+
+
+static ADF_RETCODE adfdev_counting_read_sector ( struct AdfDevice * const dev,
+                                                const uint32_t           n,
+                                                const unsigned           size,
+                                                uint8_t * const          buf )
+{
+    adffs_stats_io_read ( size );
+    adffs_trace ( ADFFS_TRACE_DEVICE, "device: read block %u (%u bytes)", n, size );
+    ADFFS_PROBE2 ( block__read__entry, n, size );
+    const ADF_RETCODE rc = counted_driver->readSector ( dev, n, size, buf );
+    ADFFS_PROBE3 ( block__read__return, n, size, ( int ) rc );
+    return rc;
+}
+
+
+static ADF_RETCODE adfdev_counting_write_sector ( struct AdfDevice * const dev,
+                                                 const uint32_t           n,
+                                                 const unsigned           size,
+                                                 const uint8_t * const    buf )
+{
+    adffs_stats_io_write ( size );
+    adffs_trace ( ADFFS_TRACE_DEVICE, "device: write block %u (%u bytes)", n, size );
+    ADFFS_PROBE2 ( block__write__entry, n, size );
+    const ADF_RETCODE rc = counted_driver->writeSector ( dev, n, size, buf );
+    ADFFS_PROBE3 ( block__write__return, n, size, ( int ) rc );
+    return rc;
+}
+
+
+static bool adfdev_counting_is_native ( void )
+{
+    return counted_driver->isNative();
+}
@@ -0,0 +1,73 @@
+#ifndef ADFDEV_H
+#define ADFDEV_H
+
+/*
+ * fuseadf's device driver for ADFlib
+ *
+ * Serves images which cannot be accessed by ADFlib's own drivers
+ * (eg. compressed ones). The image format is handled by a backend,
+ * chosen (probed) when the device is open.
+ */
+
+#include <adflib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADFDEV_DRIVER_NAME "fuseadf"
+
+typedef struct adfdev adfdev_t;
+
+typedef struct adfdev_backend {
+    const char * name;
+
+    // true if the backend can handle the file
+    bool        ( * probe ) ( const char * const filename );
+
+    // must set dev->data, dev->size and, if applies, dev->read_only
+    ADF_RETCODE ( * open )  ( adfdev_t * const   dev,
+                              const char * const filename );
+
+    ADF_RETCODE ( * read )  ( adfdev_t * const dev,
+                              const uint64_t   offset,
+                              const unsigned   size,
+                              uint8_t * const  buf );
+
+    // NULL for read-only backends
+    ADF_RETCODE ( * write ) ( adfdev_t * const      dev,
+                              const uint64_t        offset,
+                              const unsigned        size,
+                              const uint8_t * const buf );
+
+    // write back buffered data (NULL if nothing is buffered)
+    ADF_RETCODE ( * flush ) ( adfdev_t * const dev );
+
+    void        ( * close ) ( adfdev_t * const dev );
+} adfdev_backend_t;
+
+struct adfdev {
+    const adfdev_backend_t * backend;
+    void *                   data;        // backend's data
+    uint64_t                 size;        // (uncompressed) size of the image
+    bool                     read_only;
+};
+
+bool adfdev_register ( void );
+void adfdev_unregister ( void );
+
+// true if the file is handled by one of the backends
+bool adfdev_is_supported ( const char * const filename );
+
+// write back data buffered by the backend (if the device is handled
+// by fuseadf's driver)
+bool adfdev_flush ( struct AdfDevice * const dev );
+
+// account the I/O of a device handled by ADFlib's own driver (the I/O
+// of fuseadf's driver is always accounted) - by wrapping the driver, false
+// if it cannot be wrapped
+bool adfdev_count_io ( struct AdfDevice * const dev );
+
+// true if the image file contains the device's data as is (not compressed),
+// ie. it can be also read directly
+bool adfdev_is_raw ( const struct AdfDevice * const dev );
+
+#endif
@@ -0,0 +1,440 @@
+
+#include "adfdev_dms.h"
+
+#include "adffs_log.h"
+#include "adffs_stats.h"
+#include "adffs_trace.h"
+#include "dms_unpack.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DMS_HEADER_SIZE         56
+#define DMS_TRACK_HEADER_SIZE   20
+#define DMS_TRACKS              80          // cylinders of a disk
+#define DMS_BUFFER_SIZE         0x10000     // max. size of track data
+#define DMS_BUFFER_PADDING      16          // (the bit reader reads ahead)
+#define DMS_CACHE_TRACKS        16
+
+#define DMS_INFO_ENCRYPTED      0x0002
+
+typedef struct dms_track {
+    off_t    offset;        // of the packed data in the file
+    unsigned number;        // 80 and more - not disk data (eg. FILE_ID.DIZ)
+    uint16_t pklen1,        // size of the packed data
+             pklen2,        // size after the 1st stage of unpacking
+             unpklen,       // size of the unpacked data
+             usum,          // checksum of the unpacked data
+             dcrc;          // CRC of the packed data
+    uint8_t  flags,
+             cmode;
+} dms_track_t;
+
+typedef struct dms_cached_track {
+    unsigned  number;
+    uint8_t * data;         // NULL if the cache entry is not used
+    uint64_t  last_used;
+} dms_cached_track_t;
+
+typedef struct dms_image {
+    int                fd;
+    dms_track_t *      tracks;          // in the order stored in the file
+    unsigned           ntracks;
+    int                track_index [ DMS_TRACKS ];  // disk track -> tracks[]
+                                                    // (-1 - not in the file)
+    unsigned           track_size;
+    uint8_t *          empty_track;     // (for tracks not in the file)
+
+    dms_unpacker_t *   unpacker;
+    unsigned           next_track;      // index (in tracks[]) of the track
+                                        // the unpacker's state is valid for
+    uint8_t *          packed,
+            *          unpacked;
+
+    dms_cached_track_t cache [ DMS_CACHE_TRACKS ];
+    uint64_t           clock;
+} dms_image_t;
+
+static bool dms_probe ( const char * const filename );
+
+static ADF_RETCODE dms_open ( adfdev_t * const   dev,
+                              const char * const filename );
+
+static ADF_RETCODE dms_read ( adfdev_t * const dev,
+                              const uint64_t   offset,
+                              const unsigned   size,
+                              uint8_t * const  buf );
+
+static void dms_close ( adfdev_t * const dev );
+
+static void dms_image_free ( dms_image_t * const dms );
+
+static bool dms_read_track_headers ( dms_image_t * const dms );
+
+static const uint8_t * dms_get_track ( dms_image_t * const dms,
+                                       const unsigned      number );
+
+static bool dms_unpack ( dms_image_t * const dms,
+                         const unsigned      index );
+
+const adfdev_backend_t adfdev_dms_backend = {
+    .name  = "dms",
+    .probe = dms_probe,
+    .open  = dms_open,
+    .read  = dms_read,
+    .write = NULL,
+    .flush = NULL,
+    .close = dms_close
+};
+
+
+static inline uint16_t be16 ( const uint8_t * const p )
+{
+    return ( uint16_t ) ( p [ 0 ] << 8 | p [ 1 ] );
+}
+
+
+static bool dms_probe ( const char * const filename )
+{
+    const int fd = open ( filename, O_RDONLY );
+    if ( fd < 0 )
+        return false;
+
+    char magic [ 4 ];
+    const bool is_dms = ( read ( fd, magic, 4 ) == 4 &&
+                          memcmp ( magic, "DMS!", 4 ) == 0 );
+    close ( fd );
+    return is_dms;
+}
+
+
+static ADF_RETCODE dms_open ( adfdev_t * const   dev,
+                              const char * const filename )
+{
+    dms_image_t * const dms = calloc ( 1, sizeof ( dms_image_t ) );
+    if ( dms == NULL )
+        return ADF_RC_MALLOC;
+
+    dms->fd = open ( filename, O_RDONLY );
+    if ( dms->fd < 0 ) {
+        adffs_log_info ( "dms_open: cannot open %s: %s\n",
+                         filename, strerror ( errno ) );
+        free ( dms );
+        return ADF_RC_ERROR;
+    }
+
+    uint8_t header [ DMS_HEADER_SIZE ];
+    if ( pread ( dms->fd, header, DMS_HEADER_SIZE, 0 ) != DMS_HEADER_SIZE ||
+         memcmp ( header, "DMS!", 4 ) != 0 ||
+         be16 ( header + DMS_HEADER_SIZE - 2 ) !=
+             dms_crc16 ( header + 4, DMS_HEADER_SIZE - 6 ) )
+    {
+        adffs_log_info ( "dms_open: invalid DMS header: %s\n", filename );
+        goto dms_open_error;
+    }
+
+    if ( be16 ( header + 10 ) & DMS_INFO_ENCRYPTED ) {
+        adffs_log_info ( "dms_open: encrypted DMS files are not supported: %s\n",
+                         filename );
+        goto dms_open_error;
+    }
+
+    if ( ! dms_read_track_headers ( dms ) ) {
+        adffs_log_info ( "dms_open: no valid tracks: %s\n", filename );
+        goto dms_open_error;
+    }
+
+    dms->unpacker    = dms_unpacker_create();
+    dms->packed      = calloc ( 1, DMS_BUFFER_SIZE + DMS_BUFFER_PADDING );
+    dms->unpacked    = malloc ( DMS_BUFFER_SIZE );
+    dms->empty_track = calloc ( 1, dms->track_size );
+    if ( dms->unpacker == NULL ||
+         dms->packed == NULL ||
+         dms->unpacked == NULL ||
+         dms->empty_track == NULL )
+    {
+        adffs_log_info ( "dms_open: error: Cannot allocate memory\n" );
+        goto dms_open_error;
+    }
+    dms->next_track = 0;
+
+    dev->data      = dms;
+    dev->size      = ( uint64_t ) DMS_TRACKS * dms->track_size;
+    dev->read_only = true;
+
+    return ADF_RC_OK;
+
+dms_open_error:
+    dms_image_free ( dms );
+    return ADF_RC_ERROR;
+}
+
+
+static ADF_RETCODE dms_read ( adfdev_t * const dev,
+                              const uint64_t   offset,
+                              const unsigned   size,
+                              uint8_t * const  buf )
+{
+    dms_image_t * const dms = ( dms_image_t * ) dev->data;
+
+    uint64_t pos        = offset;
+    unsigned bytes_left = size;
+    uint8_t * bufptr    = buf;
+    while ( bytes_left > 0 ) {
+        const unsigned track          = ( unsigned ) ( pos / dms->track_size ),
+                       pos_in_track   = ( unsigned ) ( pos % dms->track_size ),
+                       track_left     = dms->track_size - pos_in_track;
+
+        const uint8_t * const data = dms_get_track ( dms, track );
+        if ( data == NULL )
+            return ADF_RC_ERROR;
+
+        const unsigned ncopy = ( track_left < bytes_left ) ? track_left : bytes_left;
+        memcpy ( bufptr, data + pos_in_track, ncopy );
+
+        pos        += ncopy;
+        bufptr     += ncopy;
+        bytes_left -= ncopy;
+    }
+
+    return ADF_RC_OK;
+}
+
+
+static void dms_close ( adfdev_t * const dev )
+{
+    dms_image_free ( ( dms_image_t * ) dev->data );
+    dev->data = NULL;
+}
+
+
+static void dms_image_free ( dms_image_t * const dms )
+{
+    if ( dms == NULL )
+        return;
+
+    for ( unsigned i = 0 ; i < DMS_CACHE_TRACKS ; i++ )
+        free ( dms->cache [ i ].data );
+    dms_unpacker_free ( &dms->unpacker );
+    free ( dms->packed );
+    free ( dms->unpacked );
+    free ( dms->empty_track );
+    free ( dms->tracks );
+    if ( dms->fd >= 0 )
+        close ( dms->fd );
+    free ( dms );
+}
+
+
+static bool dms_is_disk_track ( const dms_track_t * const track )
+{
+    return ( track->number < DMS_TRACKS && track->unpklen > 2048 );
+}
+
+
+// read (only) the headers of all tracks
+static bool dms_read_track_headers ( dms_image_t * const dms )
+{
+    for ( unsigned i = 0 ; i < DMS_TRACKS ; i++ )
+        dms->track_index [ i ] = -1;
+
+    off_t offset = DMS_HEADER_SIZE;
+    uint8_t header [ DMS_TRACK_HEADER_SIZE ];
+    while ( pread ( dms->fd, header, DMS_TRACK_HEADER_SIZE, offset ) ==
+            DMS_TRACK_HEADER_SIZE )
+    {
+        if ( header [ 0 ] != 'T' || header [ 1 ] != 'R' )
+            break;
+        if ( be16 ( header + DMS_TRACK_HEADER_SIZE - 2 ) !=
+             dms_crc16 ( header, DMS_TRACK_HEADER_SIZE - 2 ) )
+        {
+            adffs_log_info ( "dms_read_track_headers: invalid track header "
+                             "at %lld - ignoring the rest of the file\n",
+                             ( long long ) offset );
+            break;
+        }
+
+        dms_track_t * const tracks = realloc ( dms->tracks,
+            ( dms->ntracks + 1 ) * sizeof ( dms_track_t ) );
+        if ( tracks == NULL )
+            return false;
+        dms->tracks = tracks;
+
+        dms_track_t * const track = &tracks [ dms->ntracks ];
+        track->offset  = offset + DMS_TRACK_HEADER_SIZE;
+        track->number  = be16 ( header + 2 );
+        track->pklen1  = be16 ( header + 6 );
+        track->pklen2  = be16 ( header + 8 );
+        track->unpklen = be16 ( header + 10 );
+        track->flags   = header [ 12 ];
+        track->cmode   = header [ 13 ];
+        track->usum    = be16 ( header + 14 );
+        track->dcrc    = be16 ( header + 16 );
+
+        if ( dms_is_disk_track ( track ) ) {
+            // the size of the first track - for the whole disk
+            if ( dms->track_size == 0 )
+                dms->track_size = track->unpklen;
+            dms->track_index [ track->number ] = ( int ) dms->ntracks;
+        }
+
+        dms->ntracks++;
+        offset = track->offset + track->pklen1;
+    }
+
+    return ( dms->track_size > 0 &&
+             dms->track_size % ADF_DEV_BLOCK_SIZE == 0 );
+}
+
+
+// can the track be unpacked without unpacking the previous ones
+static bool dms_is_reset_point ( const dms_image_t * const dms,
+                                 const unsigned            index )
+{
+    if ( index == 0 )
+        return true;
+
+    if ( dms->tracks [ index - 1 ].flags & DMS_TRACK_FLAG_NORESET )
+        return false;
+
+    // heavy modes may use Huffman trees of the previous tracks
+    const dms_track_t * const track = &dms->tracks [ index ];
+    return ! ( ( track->cmode == DMS_CMODE_HEAVY1 ||
+                 track->cmode == DMS_CMODE_HEAVY2 ) &&
+               ! ( track->flags & DMS_TRACK_FLAG_NEWTREES ) );
+}
+
+
+static dms_cached_track_t * dms_cache_find ( dms_image_t * const dms,
+                                             const unsigned      number )
+{
+    for ( unsigned i = 0 ; i < DMS_CACHE_TRACKS ; i++ ) {
+        dms_cached_track_t * const entry = &dms->cache [ i ];
+        if ( entry->data != NULL && entry->number == number ) {
+            entry->last_used = dms->clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+static dms_cached_track_t * dms_cache_put ( dms_image_t * const       dms,
+                                            const dms_track_t * const track )
+{
+    dms_cached_track_t * entry = dms_cache_find ( dms, track->number );
+    if ( entry == NULL ) {
+        // an unused entry or the least recently used
+        for ( unsigned i = 0 ; i < DMS_CACHE_TRACKS ; i++ ) {
+            dms_cached_track_t * const candidate = &dms->cache [ i ];
+            if ( entry == NULL ||
+                 ( entry->data != NULL &&
+                   ( candidate->data == NULL ||
+                     candidate->last_used < entry->last_used ) ) )
+            {
+                entry = candidate;
+            }
+        }
+        if ( entry->data == NULL ) {
+            entry->data = malloc ( dms->track_size );
+            if ( entry->data == NULL )
+                return NULL;
+        }
+    }
+
+    const unsigned size = ( track->unpklen < dms->track_size ) ?
+        track->unpklen : dms->track_size;
+    memcpy ( entry->data, dms->unpacked, size );
+    memset ( entry->data + size, 0, dms->track_size - size );
+    entry->number    = track->number;
+    entry->last_used = dms->clock;
+    return entry;
+}
+
+
+static const uint8_t * dms_get_track ( dms_image_t * const dms,
+                                       const unsigned      number )
+{
+    dms->clock++;
+
+    const dms_cached_track_t * const cached = dms_cache_find ( dms, number );
+    if ( cached != NULL ) {
+        adffs_stats_cache_hit();
+        return cached->data;
+    }
+    adffs_stats_cache_miss();
+
+    const int index = dms->track_index [ number ];
+    if ( index < 0 )
+        return dms->empty_track;
+
+    // the first track to unpack - after a reset of the unpacker's state
+    // or the next one after the recently unpacked (if on the way)
+    unsigned first = ( unsigned ) index;
+    while ( ! dms_is_reset_point ( dms, first ) )
+        first--;
+    if ( dms->next_track > first && dms->next_track <= ( unsigned ) index )
+        first = dms->next_track;
+    else
+        dms_unpacker_reset ( dms->unpacker );
+
+    const dms_cached_track_t * entry = NULL;
+    for ( unsigned i = first ; i <= ( unsigned ) index ; i++ ) {
+        dms->next_track = dms->ntracks;     // invalid state (on error)
+        if ( ! dms_unpack ( dms, i ) )
+            return NULL;
+        dms->next_track = i + 1;
+
+        // cache also the tracks unpacked on the way
+        const dms_track_t * const track = &dms->tracks [ i ];
+        if ( dms_is_disk_track ( track ) ) {
+            entry = dms_cache_put ( dms, track );
+            if ( entry == NULL )
+                return NULL;
+        }
+    }
+
+    return entry->data;
+}
+
+
+static bool dms_unpack ( dms_image_t * const dms,
+                         const unsigned      index )
+{
+    const dms_track_t * const track = &dms->tracks [ index ];
+
+    adffs_trace ( ADFFS_TRACE_DEVICE, "dms_unpack: track %u, mode %u, flags 0x%x\n",
+                  track->number, track->cmode, track->flags );
+
+    if ( pread ( dms->fd, dms->packed, track->pklen1, track->offset ) !=
+         ( ssize_t ) track->pklen1 )
+    {
+        adffs_log_info ( "dms_unpack: error reading track %u\n", track->number );
+        return false;
+    }
+    memset ( dms->packed + track->pklen1, 0, DMS_BUFFER_PADDING );
+
+    if ( dms_crc16 ( dms->packed, track->pklen1 ) != track->dcrc ) {
+        adffs_log_info ( "dms_unpack: CRC error, track %u\n", track->number );
+        return false;
+    }
+
+    if ( ! dms_unpack_track ( dms->unpacker, dms->packed, track->pklen1,
+                              track->pklen2, track->unpklen,
+                              track->cmode, track->flags, dms->unpacked ) )
+    {
+        adffs_log_info ( "dms_unpack: error unpacking track %u (mode %u)\n",
+                         track->number, track->cmode );
+        return false;
+    }
+
+    if ( dms_checksum ( dms->unpacked, track->unpklen ) != track->usum ) {
+        adffs_log_info ( "dms_unpack: checksum error, track %u\n", track->number );
+        return false;
+    }
+
+    return true;
+}
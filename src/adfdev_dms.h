@@ -0,0 +1,17 @@
+#ifndef ADFDEV_DMS_H
+#define ADFDEV_DMS_H
+
+/*
+ * DMS (Disk Masher System) images - decompressed on demand
+ *
+ * On open, only the track headers are read. A block read decompresses
+ * the track containing it (and, if the track depends on the state left
+ * by the previous ones, also these). A limited number of decompressed
+ * tracks is cached.
+ */
+
+#include "adfdev.h"
+
+extern const adfdev_backend_t adfdev_dms_backend;
+
+#endif
@@ -0,0 +1,641 @@
+
+#include "adfdev_gzip.h"
+
+#include "adffs_log.h"
+#include "adffs_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// based on zran.c from zlib's examples (by Mark Adler)
+
+#define GZIP_WINDOW_SIZE    32768               // max. deflate distance
+#define GZIP_SPAN_MIN       ( 64 * 1024 )       // min. distance between points
+#define GZIP_POINTS_MAX     4096                // (for large images, the span
+                                                //  is increased to keep this)
+#define GZIP_INPUT_SIZE     16384
+#define GZIP_CACHE_CHUNKS   16
+
+#define GZIP_SIDECAR_SUFFIX  ".gzidx"
+#define GZIP_SIDECAR_MAGIC   "FADFGZI1"
+
+typedef struct gzip_point {
+    uint64_t out;       // offset in the uncompressed data
+    uint64_t in;        // offset in the compressed file (after the point)
+    int      bits;      // number of bits (1-7) from the byte at in - 1, or 0
+    uint8_t  window [ GZIP_WINDOW_SIZE ];   // uncompressed data before it
+} gzip_point_t;
+
+typedef struct gzip_chunk {
+    unsigned  point;    // index of the point the chunk starts at
+    uint8_t * data;     // NULL if the cache entry is not used
+    size_t    size;
+    uint64_t  last_used;
+} gzip_chunk_t;
+
+typedef struct gzip_image {
+    int            fd;
+    gzip_point_t * points;
+    unsigned       npoints;
+    uint64_t       span;
+
+    gzip_chunk_t   cache [ GZIP_CACHE_CHUNKS ];
+    uint64_t       clock;
+} gzip_image_t;
+
+static bool gzip_index_sidecar = false;
+
+static bool gzip_probe ( const char * const filename );
+
+static ADF_RETCODE gzip_open ( adfdev_t * const   dev,
+                               const char * const filename );
+
+static ADF_RETCODE gzip_read ( adfdev_t * const dev,
+                               const uint64_t   offset,
+                               const unsigned   size,
+                               uint8_t * const  buf );
+
+static void gzip_close ( adfdev_t * const dev );
+
+static bool gzip_build_index ( gzip_image_t * const gzimage,
+                               uint64_t * const     size );
+
+static bool gzip_add_point ( gzip_image_t * const  gzimage,
+                             const int             bits,
+                             const uint64_t        in,
+                             const uint64_t        out,
+                             const unsigned        left,
+                             const uint8_t * const window );
+
+static const gzip_chunk_t * gzip_get_chunk ( gzip_image_t * const gzimage,
+                                             const uint64_t       size,
+                                             const unsigned       point );
+
+static bool gzip_index_load ( gzip_image_t * const gzimage,
+                              const char * const   filename,
+                              uint64_t * const     size );
+
+static void gzip_index_save ( const gzip_image_t * const gzimage,
+                              const char * const         filename,
+                              const uint64_t             size );
+
+const adfdev_backend_t adfdev_gzip_backend = {
+    .name  = "gzip",
+    .probe = gzip_probe,
+    .open  = gzip_open,
+    .read  = gzip_read,
+    .write = NULL,
+    .flush = NULL,
+    .close = gzip_close
+};
+
+
+void adfdev_gzip_set_index_sidecar ( const bool enable )
+{
+    gzip_index_sidecar = enable;
+}
+
+
+static bool gzip_probe ( const char * const filename )
+{
+    const int fd = open ( filename, O_RDONLY );
+    if ( fd < 0 )
+        return false;
+
+    uint8_t magic [ 2 ];
+    const bool is_gzip = ( read ( fd, magic, 2 ) == 2 &&
+                           magic [ 0 ] == 0x1f &&
+                           magic [ 1 ] == 0x8b );
+    close ( fd );
+    return is_gzip;
+}
+
+
+static ADF_RETCODE gzip_open ( adfdev_t * const   dev,
+                               const char * const filename )
+{
+    gzip_image_t * const gzimage = calloc ( 1, sizeof ( gzip_image_t ) );
+    if ( gzimage == NULL )
+        return ADF_RC_MALLOC;
+
+    gzimage->fd = open ( filename, O_RDONLY );
+    if ( gzimage->fd < 0 ) {
+        adffs_log_info ( "gzip_open: cannot open %s: %s\n",
+                         filename, strerror ( errno ) );
+        free ( gzimage );
+        return ADF_RC_ERROR;
+    }
+
+    uint64_t size = 0;
+    if ( ! ( gzip_index_sidecar &&
+             gzip_index_load ( gzimage, filename, &size ) ) )
+    {
+        if ( ! gzip_build_index ( gzimage, &size ) ) {
+            adffs_log_info ( "gzip_open: invalid or corrupted gzip data: %s\n",
+                             filename );
+            close ( gzimage->fd );
+            free ( gzimage->points );
+            free ( gzimage );
+            return ADF_RC_ERROR;
+        }
+        if ( gzip_index_sidecar )
+            gzip_index_save ( gzimage, filename, size );
+    }
+
+    dev->data      = gzimage;
+    dev->size      = size;
+    dev->read_only = true;
+
+    return ADF_RC_OK;
+}
+
+
+static ADF_RETCODE gzip_read ( adfdev_t * const dev,
+                               const uint64_t   offset,
+                               const unsigned   size,
+                               uint8_t * const  buf )
+{
+    gzip_image_t * const gzimage = ( gzip_image_t * ) dev->data;
+
+    uint64_t pos        = offset;
+    unsigned bytes_left = size;
+    uint8_t * bufptr    = buf;
+    while ( bytes_left > 0 ) {
+        // find the last point before the position (binary search)
+        unsigned first = 0,
+                 last  = gzimage->npoints - 1;
+        while ( first < last ) {
+            const unsigned middle = ( first + last + 1 ) / 2;
+            if ( gzimage->points [ middle ].out <= pos )
+                first = middle;
+            else
+                last = middle - 1;
+        }
+
+        const gzip_chunk_t * const chunk = gzip_get_chunk ( gzimage, dev->size,
+                                                            first );
+        if ( chunk == NULL )
+            return ADF_RC_ERROR;
+
+        const uint64_t pos_in_chunk = pos - gzimage->points [ first ].out;
+        const uint64_t chunk_left   = chunk->size - pos_in_chunk;
+        const unsigned ncopy = ( chunk_left < bytes_left ) ?
+            (unsigned) chunk_left : bytes_left;
+        memcpy ( bufptr, chunk->data + pos_in_chunk, ncopy );
+
+        pos        += ncopy;
+        bufptr     += ncopy;
+        bytes_left -= ncopy;
+    }
+
+    return ADF_RC_OK;
+}
+
+
+static void gzip_close ( adfdev_t * const dev )
+{
+    gzip_image_t * const gzimage = ( gzip_image_t * ) dev->data;
+    if ( gzimage == NULL )
+        return;
+
+    for ( unsigned i = 0 ; i < GZIP_CACHE_CHUNKS ; i++ )
+        free ( gzimage->cache [ i ].data );
+    free ( gzimage->points );
+    close ( gzimage->fd );
+    free ( gzimage );
+    dev->data = NULL;
+}
+
+
+// decompress the whole image once, adding access points (at the ends
+// of deflate blocks) not closer to each other than the span
+static bool gzip_build_index ( gzip_image_t * const gzimage,
+                               uint64_t * const     size )
+{
+    // the span - from the size stored in the gzip trailer (which is modulo
+    // 2^32, so also take the compressed size into account)
+    struct stat st;
+    if ( fstat ( gzimage->fd, &st ) != 0 || st.st_size < 18 )
+        return false;
+
+    uint8_t isize_buf [ 4 ];
+    if ( pread ( gzimage->fd, isize_buf, 4, st.st_size - 4 ) != 4 )
+        return false;
+    uint64_t size_estimate =
+        (uint64_t) isize_buf [ 0 ]         | (uint64_t) isize_buf [ 1 ] << 8 |
+        (uint64_t) isize_buf [ 2 ] << 16   | (uint64_t) isize_buf [ 3 ] << 24;
+    if ( size_estimate < (uint64_t) st.st_size )
+        size_estimate = (uint64_t) st.st_size;
+
+    gzimage->span = size_estimate / GZIP_POINTS_MAX;
+    if ( gzimage->span < GZIP_SPAN_MIN )
+        gzimage->span = GZIP_SPAN_MIN;
+
+    z_stream strm;
+    memset ( &strm, 0, sizeof ( strm ) );
+    if ( inflateInit2 ( &strm, 32 + 15 ) != Z_OK )    // gzip header
+        return false;
+
+    uint8_t * const input  = malloc ( GZIP_INPUT_SIZE );
+    uint8_t * const window = calloc ( 1, GZIP_WINDOW_SIZE );
+    if ( input == NULL || window == NULL ) {
+        free ( input );
+        free ( window );
+        inflateEnd ( &strm );
+        return false;
+    }
+
+    uint64_t totin  = 0,
+             totout = 0,
+             last   = 0;
+    off_t    offset = 0;
+    int ret = Z_OK;
+    strm.avail_out = 0;
+    do {
+        const ssize_t nread = pread ( gzimage->fd, input, GZIP_INPUT_SIZE, offset );
+        if ( nread <= 0 ) {
+            ret = Z_DATA_ERROR;     // error or unexpected end of file
+            break;
+        }
+        offset += nread;
+        strm.avail_in = (unsigned) nread;
+        strm.next_in  = input;
+
+        do {
+            // the output is not needed - just the sliding window
+            if ( strm.avail_out == 0 ) {
+                strm.avail_out = GZIP_WINDOW_SIZE;
+                strm.next_out  = window;
+            }
+
+            totin  += strm.avail_in;
+            totout += strm.avail_out;
+            ret = inflate ( &strm, Z_BLOCK );
+            totin  -= strm.avail_in;
+            totout -= strm.avail_out;
+            if ( ret == Z_NEED_DICT )
+                ret = Z_DATA_ERROR;
+            if ( ret == Z_MEM_ERROR || ret == Z_DATA_ERROR )
+                break;
+            if ( ret == Z_STREAM_END )
+                break;
+
+            // at the end of a block (but not the last one) - all its
+            // uncompressed data delivered, and only up to 7 bits
+            // of the following consumed
+            if ( ( strm.data_type & 128 ) && ! ( strm.data_type & 64 ) &&
+                 ( totout == 0 || totout - last > gzimage->span ) )
+            {
+                if ( ! gzip_add_point ( gzimage, strm.data_type & 7,
+                                        totin, totout, strm.avail_out,
+                                        window ) )
+                {
+                    ret = Z_MEM_ERROR;
+                    break;
+                }
+                last = totout;
+            }
+        } while ( strm.avail_in != 0 );
+    } while ( ret != Z_STREAM_END &&
+              ret != Z_MEM_ERROR &&
+              ret != Z_DATA_ERROR );
+
+    inflateEnd ( &strm );
+    free ( input );
+    free ( window );
+
+    if ( ret != Z_STREAM_END || gzimage->npoints == 0 )
+        return false;
+
+    *size = totout;
+    return true;
+}
+
+
+static bool gzip_add_point ( gzip_image_t * const  gzimage,
+                             const int             bits,
+                             const uint64_t        in,
+                             const uint64_t        out,
+                             const unsigned        left,
+                             const uint8_t * const window )
+{
+    gzip_point_t * const points = realloc ( gzimage->points,
+        ( gzimage->npoints + 1 ) * sizeof ( gzip_point_t ) );
+    if ( points == NULL )
+        return false;
+    gzimage->points = points;
+
+    gzip_point_t * const point = &points [ gzimage->npoints ];
+    point->bits = bits;
+    point->in   = in;
+    point->out  = out;
+
+    // the window is circular - put it in order
+    if ( left > 0 )
+        memcpy ( point->window, window + GZIP_WINDOW_SIZE - left, left );
+    if ( left < GZIP_WINDOW_SIZE )
+        memcpy ( point->window + left, window, GZIP_WINDOW_SIZE - left );
+
+    gzimage->npoints++;
+    return true;
+}
+
+
+// get the uncompressed data between the point and the next one
+// (from the cache or decompressing it)
+static const gzip_chunk_t * gzip_get_chunk ( gzip_image_t * const gzimage,
+                                             const uint64_t       size,
+                                             const unsigned       point )
+{
+    gzimage->clock++;
+
+    gzip_chunk_t * chunk = NULL;
+    for ( unsigned i = 0 ; i < GZIP_CACHE_CHUNKS ; i++ ) {
+        gzip_chunk_t * const entry = &gzimage->cache [ i ];
+        if ( entry->data != NULL && entry->point == point ) {
+            entry->last_used = gzimage->clock;
+            adffs_stats_cache_hit();
+            return entry;
+        }
+        // an unused entry or the least recently used
+        if ( chunk == NULL ||
+             ( chunk->data != NULL &&
+               ( entry->data == NULL || entry->last_used < chunk->last_used ) ) )
+        {
+            chunk = entry;
+        }
+    }
+
+    adffs_stats_cache_miss();
+    const gzip_point_t * const start = &gzimage->points [ point ];
+    const uint64_t end = ( point + 1 < gzimage->npoints ) ?
+        gzimage->points [ point + 1 ].out : size;
+
+    free ( chunk->data );
+    chunk->size = (size_t) ( end - start->out );
+    chunk->data = malloc ( chunk->size );
+    if ( chunk->data == NULL )
+        return NULL;
+
+    z_stream strm;
+    memset ( &strm, 0, sizeof ( strm ) );
+    if ( inflateInit2 ( &strm, -15 ) != Z_OK ) {   // raw deflate
+        free ( chunk->data );
+        chunk->data = NULL;
+        return NULL;
+    }
+
+    uint8_t input [ GZIP_INPUT_SIZE ];
+    off_t offset = (off_t) start->in;
+    if ( start->bits ) {
+        uint8_t byte;
+        if ( pread ( gzimage->fd, &byte, 1, offset - 1 ) != 1 )
+            goto gzip_get_chunk_error;
+        inflatePrime ( &strm, start->bits, byte >> ( 8 - start->bits ) );
+    }
+    inflateSetDictionary ( &strm, start->window, GZIP_WINDOW_SIZE );
+
+    strm.next_out  = chunk->data;
+    strm.avail_out = (unsigned) chunk->size;
+    while ( strm.avail_out > 0 ) {
+        const ssize_t nread = pread ( gzimage->fd, input, sizeof ( input ), offset );
+        if ( nread <= 0 )
+            goto gzip_get_chunk_error;
+        offset += nread;
+
+        strm.next_in  = input;
+        strm.avail_in = (unsigned) nread;
+        const int ret = inflate ( &strm, Z_NO_FLUSH );
+        if ( ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR )
+            goto gzip_get_chunk_error;
+        if ( ret == Z_STREAM_END )
+            break;
+    }
+    if ( strm.avail_out > 0 )
+        goto gzip_get_chunk_error;
+
+    inflateEnd ( &strm );
+    chunk->point     = point;
+    chunk->last_used = gzimage->clock;
+    return chunk;
+
+gzip_get_chunk_error:
+    adffs_log_info ( "gzip_get_chunk: error decompressing data at %llu\n",
+                     (unsigned long long) start->out );
+    inflateEnd ( &strm );
+    free ( chunk->data );
+    chunk->data = NULL;
+    return NULL;
+}
+
+
+/*
+ * Index sidecar file
+ *
+ * header:  magic, endianness marker, size and mtime of the compressed file
+ *          (to detect a stale index), uncompressed size, span, no. of points
+ * points:  out, in, bits, size of the compressed window, compressed window
+ */
+
+typedef struct gzip_sidecar_header {
+    char     magic [ 8 ];
+    uint32_t endian;
+    uint32_t npoints;
+    uint64_t file_size;
+    int64_t  file_mtime_sec,
+             file_mtime_nsec;
+    uint64_t size,
+             span;
+} gzip_sidecar_header_t;
+
+typedef struct gzip_sidecar_point {
+    uint64_t out,
+             in;
+    uint32_t bits,
+             window_size;
+} gzip_sidecar_point_t;
+
+
+static char * gzip_sidecar_path ( const char * const filename )
+{
+    char * const path = malloc ( strlen ( filename ) +
+                                 sizeof ( GZIP_SIDECAR_SUFFIX ) );
+    if ( path != NULL ) {
+        strcpy ( path, filename );
+        strcat ( path, GZIP_SIDECAR_SUFFIX );
+    }
+    return path;
+}
+
+
+// a point following the previous one (NULL - the first) as built by
+// gzip_build_index(): in the files, after the previous one by more than
+// the span - the chunk between them not empty and its size fitting
+// in unsigned (avail_out)
+static bool gzip_index_point_valid ( const gzip_sidecar_point_t * const  spoint,
+                                     const gzip_point_t * const          prev,
+                                     const gzip_sidecar_header_t * const header,
+                                     const uint64_t                      file_size )
+{
+    if ( spoint->in == 0 || spoint->in > file_size ||
+         spoint->out > header->size )
+    {
+        return false;
+    }
+    if ( prev == NULL )
+        return spoint->out == 0;
+    return spoint->in > prev->in &&
+           spoint->out > prev->out &&
+           spoint->out - prev->out > header->span &&
+           spoint->out - prev->out <= UINT_MAX;
+}
+
+
+static bool gzip_index_load ( gzip_image_t * const gzimage,
+                              const char * const   filename,
+                              uint64_t * const     size )
+{
+    struct stat st;
+    if ( fstat ( gzimage->fd, &st ) != 0 )
+        return false;
+
+    char * const path = gzip_sidecar_path ( filename );
+    if ( path == NULL )
+        return false;
+    FILE * const sidecar = fopen ( path, "rb" );
+    free ( path );
+    if ( sidecar == NULL )
+        return false;
+
+    gzip_sidecar_header_t header;
+    if ( fread ( &header, sizeof ( header ), 1, sidecar ) != 1 ||
+         memcmp ( header.magic, GZIP_SIDECAR_MAGIC, 8 ) != 0 ||
+         header.endian != 1 ||
+         header.file_size != (uint64_t) st.st_size ||
+         header.file_mtime_sec != st.st_mtim.tv_sec ||
+         header.file_mtime_nsec != st.st_mtim.tv_nsec ||
+         header.npoints == 0 ||
+         header.span < GZIP_SPAN_MIN )
+    {
+        adffs_log_info ( "gzip_index_load: no valid index for %s\n", filename );
+        fclose ( sidecar );
+        return false;
+    }
+
+    gzimage->points = malloc ( header.npoints * sizeof ( gzip_point_t ) );
+    uint8_t * const window_compressed = malloc ( compressBound ( GZIP_WINDOW_SIZE ) );
+    if ( gzimage->points == NULL || window_compressed == NULL )
+        goto gzip_index_load_error;
+
+    for ( unsigned i = 0 ; i < header.npoints ; i++ ) {
+        gzip_point_t * const point = &gzimage->points [ i ];
+        gzip_sidecar_point_t spoint;
+        if ( fread ( &spoint, sizeof ( spoint ), 1, sidecar ) != 1 ||
+             spoint.bits > 7 ||
+             spoint.window_size > compressBound ( GZIP_WINDOW_SIZE ) ||
+             ! gzip_index_point_valid ( &spoint,
+                                        ( i > 0 ) ? &gzimage->points [ i - 1 ] : NULL,
+                                        &header, (uint64_t) st.st_size ) ||
+             fread ( window_compressed, spoint.window_size, 1, sidecar ) != 1 )
+        {
+            goto gzip_index_load_error;
+        }
+
+        uLongf window_size = GZIP_WINDOW_SIZE;
+        if ( uncompress ( point->window, &window_size,
+                          window_compressed, spoint.window_size ) != Z_OK ||
+             window_size != GZIP_WINDOW_SIZE )
+        {
+            goto gzip_index_load_error;
+        }
+        point->out  = spoint.out;
+        point->in   = spoint.in;
+        point->bits = (int) spoint.bits;
+    }
+    // (the last chunk - up to the end)
+    if ( header.size - gzimage->points [ header.npoints - 1 ].out > UINT_MAX )
+        goto gzip_index_load_error;
+
+    free ( window_compressed );
+    fclose ( sidecar );
+    gzimage->npoints = header.npoints;
+    gzimage->span    = header.span;
+    *size = header.size;
+    return true;
+
+gzip_index_load_error:
+    adffs_log_info ( "gzip_index_load: invalid index for %s\n", filename );
+    free ( window_compressed );
+    free ( gzimage->points );
+    gzimage->points = NULL;
+    fclose ( sidecar );
+    return false;
+}
+
+
+static void gzip_index_save ( const gzip_image_t * const gzimage,
+                              const char * const         filename,
+                              const uint64_t             size )
+{
+    struct stat st;
+    if ( fstat ( gzimage->fd, &st ) != 0 )
+        return;
+
+    char * const path = gzip_sidecar_path ( filename );
+    if ( path == NULL )
+        return;
+    FILE * const sidecar = fopen ( path, "wb" );
+    if ( sidecar == NULL ) {
+        adffs_log_info ( "gzip_index_save: cannot create %s: %s\n",
+                         path, strerror ( errno ) );
+        free ( path );
+        return;
+    }
+
+    gzip_sidecar_header_t header;
+    memset ( &header, 0, sizeof ( header ) );
+    memcpy ( header.magic, GZIP_SIDECAR_MAGIC, 8 );
+    header.endian          = 1;
+    header.npoints         = gzimage->npoints;
+    header.file_size       = (uint64_t) st.st_size;
+    header.file_mtime_sec  = st.st_mtim.tv_sec;
+    header.file_mtime_nsec = st.st_mtim.tv_nsec;
+    header.size            = size;
+    header.span            = gzimage->span;
+
+    const uLong window_bound = compressBound ( GZIP_WINDOW_SIZE );
+    uint8_t * const window_compressed = malloc ( window_bound );
+    bool ok = ( window_compressed != NULL &&
+                fwrite ( &header, sizeof ( header ), 1, sidecar ) == 1 );
+
+    for ( unsigned i = 0 ; ok && i < gzimage->npoints ; i++ ) {
+        const gzip_point_t * const point = &gzimage->points [ i ];
+        uLongf window_size = window_bound;
+        ok = ( compress2 ( window_compressed, &window_size,
+                           point->window, GZIP_WINDOW_SIZE, 9 ) == Z_OK );
+
+        gzip_sidecar_point_t spoint;
+        memset ( &spoint, 0, sizeof ( spoint ) );
+        spoint.out         = point->out;
+        spoint.in          = point->in;
+        spoint.bits        = (uint32_t) point->bits;
+        spoint.window_size = (uint32_t) window_size;
+        ok = ok &&
+            fwrite ( &spoint, sizeof ( spoint ), 1, sidecar ) == 1 &&
+            fwrite ( window_compressed, window_size, 1, sidecar ) == 1;
+    }
+    free ( window_compressed );
+
+    if ( fclose ( sidecar ) != 0 || ! ok ) {
+        adffs_log_info ( "gzip_index_save: error writing %s\n", path );
+        unlink ( path );
+    }
+    free ( path );
+}
@@ -0,0 +1,21 @@
+#ifndef ADFDEV_GZIP_H
+#define ADFDEV_GZIP_H
+
+/*
+ * gzip-compressed images (.adz, .adf.gz, ...) - random access
+ *
+ * On open, the image is decompressed once (without storing the data)
+ * to build an index of access points (with the deflate state needed
+ * to resume decompression from them). A block read then decompresses only
+ * the data between two access points (a chunk). The recently used chunks
+ * are cached.
+ */
+
+#include "adfdev.h"
+
+extern const adfdev_backend_t adfdev_gzip_backend;
+
+// save the index to (and load from) a sidecar file (<image>.gzidx)
+void adfdev_gzip_set_index_sidecar ( const bool enable );
+
+#endif
@@ -0,0 +1,426 @@
+
+#include "adfdev_ram.h"
+
+#include "adffs_log.h"
+#include "adffs_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct ram_image {
+    int                fd;          // -1 if read-only (no writing back)
+    uint8_t *          data;        // the whole image (anonymous mapping)
+    size_t             size;
+    uint64_t *         dirty;       // bitmap of modified blocks
+    uint32_t           ndirty;
+    pthread_mutex_t    lock;        // (data being modified or written back)
+    struct ram_image * next;        // on the list of open images
+} ram_image_t;
+
+static bool ram_probe ( const char * const filename );
+
+static ADF_RETCODE ram_open ( adfdev_t * const   dev,
+                              const char * const filename );
+
+static ADF_RETCODE ram_read ( adfdev_t * const dev,
+                              const uint64_t   offset,
+                              const unsigned   size,
+                              uint8_t * const  buf );
+
+static ADF_RETCODE ram_write ( adfdev_t * const      dev,
+                               const uint64_t        offset,
+                               const unsigned        size,
+                               const uint8_t * const buf );
+
+static ADF_RETCODE ram_flush ( adfdev_t * const dev );
+
+static void ram_close ( adfdev_t * const dev );
+
+static void ram_image_free ( ram_image_t * const ram );
+
+static bool ram_load ( ram_image_t * const ram );
+
+static bool ram_write_back ( ram_image_t * const ram );
+
+static void ram_list_add ( ram_image_t * const ram );
+
+static void ram_list_remove ( ram_image_t * const ram );
+
+static void * ram_writeback_thread ( void * arg );
+
+const adfdev_backend_t adfdev_ram_backend = {
+    .name  = "ram",
+    .probe = ram_probe,
+    .open  = ram_open,
+    .read  = ram_read,
+    .write = ram_write,
+    .flush = ram_flush,
+    .close = ram_close
+};
+
+static bool     ram_enabled  = false;
+static uint64_t ram_max_size = ( uint64_t ) ADFDEV_RAM_MAX_MIB_DEFAULT * 1024 * 1024;
+
+// images in memory (for the periodic writing back)
+static pthread_mutex_t ram_images_lock = PTHREAD_MUTEX_INITIALIZER;
+static ram_image_t *   ram_images      = NULL;
+
+static struct {
+    pthread_t      thread;
+    pthread_cond_t wakeup;          // (used with ram_images_lock)
+    unsigned       interval;
+    bool           running,
+                   stop;
+} writeback = {
+    .wakeup = PTHREAD_COND_INITIALIZER
+};
+
+
+void adfdev_ram_enable ( const bool     enable,
+                         const uint64_t max_size )
+{
+    ram_enabled  = enable;
+    ram_max_size = max_size;
+}
+
+
+bool adfdev_ram_writeback_start ( const unsigned interval )
+{
+    if ( writeback.running || interval == 0 )
+        return false;
+
+    writeback.interval = interval;
+    writeback.stop     = false;
+    if ( pthread_create ( &writeback.thread, NULL,
+                          ram_writeback_thread, NULL ) != 0 )
+    {
+        adffs_log_info ( "adfdev_ram_writeback_start: cannot create thread\n" );
+        return false;
+    }
+    writeback.running = true;
+    return true;
+}
+
+
+void adfdev_ram_writeback_stop ( void )
+{
+    if ( ! writeback.running )
+        return;
+
+    pthread_mutex_lock ( &ram_images_lock );
+    writeback.stop = true;
+    pthread_cond_signal ( &writeback.wakeup );
+    pthread_mutex_unlock ( &ram_images_lock );
+
+    pthread_join ( writeback.thread, NULL );
+    writeback.running = false;
+}
+
+
+static bool ram_probe ( const char * const filename )
+{
+    if ( ! ram_enabled )
+        return false;
+
+    struct stat st;
+    return ( stat ( filename, &st ) == 0 &&
+             S_ISREG ( st.st_mode ) &&
+             st.st_size > 0 &&
+             st.st_size % ADF_DEV_BLOCK_SIZE == 0 &&
+             ( uint64_t ) st.st_size <= ram_max_size );
+}
+
+
+static ADF_RETCODE ram_open ( adfdev_t * const   dev,
+                              const char * const filename )
+{
+    ram_image_t * const ram = calloc ( 1, sizeof ( ram_image_t ) );
+    if ( ram == NULL )
+        return ADF_RC_MALLOC;
+    ram->data = MAP_FAILED;
+
+    ram->fd = open ( filename, ( dev->read_only ) ? O_RDONLY : O_RDWR );
+    if ( ram->fd < 0 && ! dev->read_only &&
+         ( errno == EACCES || errno == EROFS ) )
+    {
+        ram->fd = open ( filename, O_RDONLY );
+        dev->read_only = true;
+    }
+    if ( ram->fd < 0 ) {
+        adffs_log_info ( "ram_open: cannot open %s: %s\n",
+                         filename, strerror ( errno ) );
+        free ( ram );
+        return ADF_RC_ERROR;
+    }
+
+    struct stat st;
+    if ( fstat ( ram->fd, &st ) != 0 ||
+         st.st_size <= 0 ||
+         st.st_size % ADF_DEV_BLOCK_SIZE != 0 )
+    {
+        adffs_log_info ( "ram_open: invalid image size: %s\n", filename );
+        goto ram_open_error;
+    }
+    ram->size = ( size_t ) st.st_size;
+
+    ram->data = mmap ( NULL, ram->size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    const uint32_t nblocks = ( uint32_t ) ( ram->size / ADF_DEV_BLOCK_SIZE );
+    ram->dirty = calloc ( ( nblocks + 63 ) / 64, sizeof ( uint64_t ) );
+    if ( ram->data == MAP_FAILED || ram->dirty == NULL ) {
+        adffs_log_info ( "ram_open: error: Cannot allocate memory\n" );
+        goto ram_open_error;
+    }
+
+    if ( ! ram_load ( ram ) ) {
+        adffs_log_info ( "ram_open: error reading %s: %s\n",
+                         filename, strerror ( errno ) );
+        goto ram_open_error;
+    }
+
+    // nothing will be written back
+    if ( dev->read_only ) {
+        close ( ram->fd );
+        ram->fd = -1;
+    }
+
+    pthread_mutex_init ( &ram->lock, NULL );
+    ram_list_add ( ram );
+
+    dev->data = ram;
+    dev->size = ram->size;
+
+    return ADF_RC_OK;
+
+ram_open_error:
+    ram_image_free ( ram );
+    return ADF_RC_ERROR;
+}
+
+
+static ADF_RETCODE ram_read ( adfdev_t * const dev,
+                              const uint64_t   offset,
+                              const unsigned   size,
+                              uint8_t * const  buf )
+{
+    // (data is modified only by ram_write, called by the same thread)
+    const ram_image_t * const ram = ( ram_image_t * ) dev->data;
+    memcpy ( buf, ram->data + offset, size );
+    return ADF_RC_OK;
+}
+
+
+static inline bool ram_is_dirty ( const ram_image_t * const ram,
+                                  const uint32_t            block )
+{
+    return ( ram->dirty [ block / 64 ] >> ( block % 64 ) ) & 1;
+}
+
+
+static ADF_RETCODE ram_write ( adfdev_t * const      dev,
+                               const uint64_t        offset,
+                               const unsigned        size,
+                               const uint8_t * const buf )
+{
+    ram_image_t * const ram = ( ram_image_t * ) dev->data;
+
+    pthread_mutex_lock ( &ram->lock );
+
+    memcpy ( ram->data + offset, buf, size );
+
+    const uint32_t first = ( uint32_t ) ( offset / ADF_DEV_BLOCK_SIZE ),
+                   last  = ( uint32_t ) ( ( offset + size - 1 ) / ADF_DEV_BLOCK_SIZE );
+    for ( uint32_t block = first ; block <= last ; block++ ) {
+        if ( ! ram_is_dirty ( ram, block ) ) {
+            ram->dirty [ block / 64 ] |= ( uint64_t ) 1 << ( block % 64 );
+            ram->ndirty++;
+        }
+    }
+
+    pthread_mutex_unlock ( &ram->lock );
+    return ADF_RC_OK;
+}
+
+
+static ADF_RETCODE ram_flush ( adfdev_t * const dev )
+{
+    ram_image_t * const ram = ( ram_image_t * ) dev->data;
+    if ( ram->fd < 0 )
+        return ADF_RC_OK;
+
+    pthread_mutex_lock ( &ram->lock );
+    const bool written = ram_write_back ( ram );
+    pthread_mutex_unlock ( &ram->lock );
+
+    if ( ! written || fdatasync ( ram->fd ) != 0 ) {
+        adffs_log_info ( "ram_flush: error writing back: %s\n",
+                         strerror ( errno ) );
+        return ADF_RC_ERROR;
+    }
+    return ADF_RC_OK;
+}
+
+
+static void ram_close ( adfdev_t * const dev )
+{
+    ram_image_t * const ram = ( ram_image_t * ) dev->data;
+    if ( ram == NULL )
+        return;
+
+    ram_list_remove ( ram );
+
+    if ( ram->fd >= 0 && ! ram_write_back ( ram ) )
+        adffs_log_info ( "ram_close: error writing back: %s\n",
+                         strerror ( errno ) );
+
+    pthread_mutex_destroy ( &ram->lock );
+    ram_image_free ( ram );
+    dev->data = NULL;
+}
+
+
+static void ram_image_free ( ram_image_t * const ram )
+{
+    if ( ram->data != MAP_FAILED )
+        munmap ( ram->data, ram->size );
+    free ( ram->dirty );
+    if ( ram->fd >= 0 )
+        close ( ram->fd );
+    free ( ram );
+}
+
+
+static bool ram_load ( ram_image_t * const ram )
+{
+    size_t pos = 0;
+    while ( pos < ram->size ) {
+        const ssize_t nread = pread ( ram->fd, ram->data + pos,
+                                      ram->size - pos, ( off_t ) pos );
+        if ( nread < 0 && errno == EINTR )
+            continue;
+        if ( nread <= 0 )
+            return false;
+        pos += ( size_t ) nread;
+    }
+    return true;
+}
+
+
+static bool ram_pwrite ( const int             fd,
+                         const uint8_t * const data,
+                         const size_t          size,
+                         const off_t           offset )
+{
+    size_t pos = 0;
+    while ( pos < size ) {
+        const ssize_t nwritten = pwrite ( fd, data + pos, size - pos,
+                                          offset + ( off_t ) pos );
+        if ( nwritten < 0 && errno == EINTR )
+            continue;
+        if ( nwritten <= 0 )
+            return false;
+        pos += ( size_t ) nwritten;
+    }
+    return true;
+}
+
+
+// write modified blocks to the file - in ascending order, contiguous
+// ones with a single write (must be called with ram->lock held)
+static bool ram_write_back ( ram_image_t * const ram )
+{
+    const uint32_t nblocks = ( uint32_t ) ( ram->size / ADF_DEV_BLOCK_SIZE );
+    uint32_t block = 0;
+    while ( ram->ndirty > 0 && block < nblocks ) {
+        if ( ram->dirty [ block / 64 ] >> ( block % 64 ) == 0 ) {
+            // no more modified blocks in this word
+            block = ( block / 64 + 1 ) * 64;
+            continue;
+        }
+        if ( ! ram_is_dirty ( ram, block ) ) {
+            block++;
+            continue;
+        }
+
+        uint32_t end = block + 1;
+        while ( end < nblocks && ram_is_dirty ( ram, end ) )
+            end++;
+
+        adffs_trace ( ADFFS_TRACE_DEVICE, "ram_write_back: blocks %u - %u\n",
+                      block, end - 1 );
+        const off_t offset = ( off_t ) block * ADF_DEV_BLOCK_SIZE;
+        if ( ! ram_pwrite ( ram->fd, ram->data + offset,
+                            ( size_t ) ( end - block ) * ADF_DEV_BLOCK_SIZE,
+                            offset ) )
+        {
+            return false;
+        }
+
+        for ( ; block < end ; block++ ) {
+            ram->dirty [ block / 64 ] &= ~( ( uint64_t ) 1 << ( block % 64 ) );
+            ram->ndirty--;
+        }
+    }
+    return true;
+}
+
+
+static void ram_list_add ( ram_image_t * const ram )
+{
+    pthread_mutex_lock ( &ram_images_lock );
+    ram->next  = ram_images;
+    ram_images = ram;
+    pthread_mutex_unlock ( &ram_images_lock );
+}
+
+
+static void ram_list_remove ( ram_image_t * const ram )
+{
+    pthread_mutex_lock ( &ram_images_lock );
+    for ( ram_image_t ** img = &ram_images ; *img != NULL ; img = &(*img)->next ) {
+        if ( *img == ram ) {
+            *img = ram->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock ( &ram_images_lock );
+}
+
+
+static void * ram_writeback_thread ( void * arg )
+{
+    (void) arg;
+
+    pthread_mutex_lock ( &ram_images_lock );
+    while ( ! writeback.stop ) {
+        struct timespec deadline;
+        clock_gettime ( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += writeback.interval;
+        while ( ! writeback.stop &&
+                pthread_cond_timedwait ( &writeback.wakeup, &ram_images_lock,
+                                         &deadline ) != ETIMEDOUT )
+            ;
+        if ( writeback.stop )
+            break;
+
+        for ( ram_image_t * ram = ram_images ; ram != NULL ; ram = ram->next ) {
+            if ( ram->fd < 0 )
+                continue;
+            pthread_mutex_lock ( &ram->lock );
+            if ( ! ram_write_back ( ram ) )
+                adffs_log_info ( "ram_writeback_thread: error writing back: %s\n",
+                                 strerror ( errno ) );
+            pthread_mutex_unlock ( &ram->lock );
+        }
+    }
+    pthread_mutex_unlock ( &ram_images_lock );
+
+    return NULL;
+}
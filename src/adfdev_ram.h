@@ -0,0 +1,31 @@
+#ifndef ADFDEV_RAM_H
+#define ADFDEV_RAM_H
+
+/*
+ * (Not compressed) images loaded entirely to memory
+ *
+ * When enabled, an image (not larger than the set limit) is read
+ * to an anonymous buffer on open and all reads and writes are served
+ * from that buffer. Modified blocks are written back to the file
+ * (in the order of the block numbers) on flush (fsync), on close
+ * and, if started, periodically.
+ */
+
+#include "adfdev.h"
+
+#define ADFDEV_RAM_MAX_MIB_DEFAULT      64      // max. image size (MiB)
+#define ADFDEV_RAM_WRITEBACK_DEFAULT    30      // seconds
+
+extern const adfdev_backend_t adfdev_ram_backend;
+
+// load images to memory if not larger than max_size (disabled by default)
+void adfdev_ram_enable ( const bool     enable,
+                         const uint64_t max_size );
+
+// periodic writing back of the modified blocks (of all images in memory)
+// - must be started in the process which is going to access the images
+//   (ie. not before daemonizing)
+bool adfdev_ram_writeback_start ( const unsigned interval );   // seconds
+void adfdev_ram_writeback_stop ( void );
+
+#endif
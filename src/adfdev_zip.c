@@ -0,0 +1,313 @@
+
+#include "adfdev_zip.h"
+
+#include "adffs_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define ZIP_LOCAL_HEADER_SIZE     30
+#define ZIP_CENTRAL_HEADER_SIZE   46
+#define ZIP_EOCD_SIZE             22      // end of central directory record
+#define ZIP_COMMENT_MAX           0xffff
+
+#define ZIP_METHOD_STORED         0
+#define ZIP_METHOD_DEFLATED       8
+
+#define ZIP_FLAG_ENCRYPTED        0x0001
+
+typedef struct zip_member {
+    uint16_t flags,
+             method;
+    uint32_t crc,
+             compressed_size,
+             size,
+             local_header_offset;
+} zip_member_t;
+
+typedef struct zip_image {
+    uint8_t * map;          // the archive file (NULL if unmapped)
+    size_t    map_size;
+    uint8_t * data;         // data of the member (in the map or decompressed)
+    bool      inflated;
+} zip_image_t;
+
+static bool zip_probe ( const char * const filename );
+
+static ADF_RETCODE zip_open ( adfdev_t * const   dev,
+                              const char * const filename );
+
+static ADF_RETCODE zip_read ( adfdev_t * const dev,
+                              const uint64_t   offset,
+                              const unsigned   size,
+                              uint8_t * const  buf );
+
+static void zip_close ( adfdev_t * const dev );
+
+static bool zip_find_image ( const zip_image_t * const zip,
+                             zip_member_t * const      member );
+
+static uint8_t * zip_inflate ( const uint8_t * const      data,
+                               const zip_member_t * const member );
+
+const adfdev_backend_t adfdev_zip_backend = {
+    .name  = "zip",
+    .probe = zip_probe,
+    .open  = zip_open,
+    .read  = zip_read,
+    .write = NULL,
+    .flush = NULL,
+    .close = zip_close
+};
+
+
+static inline uint16_t le16 ( const uint8_t * const p )
+{
+    return ( uint16_t ) ( p [ 0 ] | p [ 1 ] << 8 );
+}
+
+static inline uint32_t le32 ( const uint8_t * const p )
+{
+    return ( uint32_t ) p [ 0 ]         | ( uint32_t ) p [ 1 ] << 8 |
+           ( uint32_t ) p [ 2 ] << 16   | ( uint32_t ) p [ 3 ] << 24;
+}
+
+
+static bool zip_probe ( const char * const filename )
+{
+    const int fd = open ( filename, O_RDONLY );
+    if ( fd < 0 )
+        return false;
+
+    char magic [ 4 ];
+    const bool is_zip = ( read ( fd, magic, 4 ) == 4 &&
+                          memcmp ( magic, "PK\x03\x04", 4 ) == 0 );
+    close ( fd );
+    return is_zip;
+}
+
+
+static ADF_RETCODE zip_open ( adfdev_t * const   dev,
+                              const char * const filename )
+{
+    zip_image_t * const zip = calloc ( 1, sizeof ( zip_image_t ) );
+    if ( zip == NULL )
+        return ADF_RC_MALLOC;
+
+    const int fd = open ( filename, O_RDONLY );
+    if ( fd < 0 ) {
+        adffs_log_info ( "zip_open: cannot open %s: %s\n",
+                         filename, strerror ( errno ) );
+        free ( zip );
+        return ADF_RC_ERROR;
+    }
+
+    struct stat st;
+    if ( fstat ( fd, &st ) != 0 || st.st_size < ZIP_EOCD_SIZE ) {
+        close ( fd );
+        free ( zip );
+        return ADF_RC_ERROR;
+    }
+
+    zip->map_size = ( size_t ) st.st_size;
+    zip->map = mmap ( NULL, zip->map_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close ( fd );
+    if ( zip->map == MAP_FAILED ) {
+        adffs_log_info ( "zip_open: cannot map %s: %s\n",
+                         filename, strerror ( errno ) );
+        free ( zip );
+        return ADF_RC_ERROR;
+    }
+
+    zip_member_t member;
+    if ( ! zip_find_image ( zip, &member ) ) {
+        adffs_log_info ( "zip_open: no disk image found in %s\n", filename );
+        goto zip_open_error;
+    }
+
+    // the data follows the local header (which has its own name and extra
+    // field lengths)
+    const uint8_t * const local = zip->map + member.local_header_offset;
+    if ( ( size_t ) member.local_header_offset + ZIP_LOCAL_HEADER_SIZE >
+             zip->map_size ||
+         memcmp ( local, "PK\x03\x04", 4 ) != 0 )
+    {
+        adffs_log_info ( "zip_open: invalid local header in %s\n", filename );
+        goto zip_open_error;
+    }
+    const size_t data_offset = member.local_header_offset +
+        ZIP_LOCAL_HEADER_SIZE + le16 ( local + 26 ) + le16 ( local + 28 );
+    if ( data_offset > zip->map_size ||
+         member.compressed_size > zip->map_size - data_offset )
+    {
+        adffs_log_info ( "zip_open: truncated archive %s\n", filename );
+        goto zip_open_error;
+    }
+
+    if ( member.method == ZIP_METHOD_STORED ) {
+        // read directly from the mapped file
+        zip->data = zip->map + data_offset;
+    } else {
+        zip->data = zip_inflate ( zip->map + data_offset, &member );
+        if ( zip->data == NULL ) {
+            adffs_log_info ( "zip_open: cannot decompress the image in %s\n",
+                             filename );
+            goto zip_open_error;
+        }
+        zip->inflated = true;
+
+        // the archive is no longer needed
+        munmap ( zip->map, zip->map_size );
+        zip->map = NULL;
+    }
+
+    dev->data      = zip;
+    dev->size      = member.size;
+    dev->read_only = true;
+
+    return ADF_RC_OK;
+
+zip_open_error:
+    munmap ( zip->map, zip->map_size );
+    free ( zip );
+    return ADF_RC_ERROR;
+}
+
+
+static ADF_RETCODE zip_read ( adfdev_t * const dev,
+                              const uint64_t   offset,
+                              const unsigned   size,
+                              uint8_t * const  buf )
+{
+    const zip_image_t * const zip = ( zip_image_t * ) dev->data;
+    memcpy ( buf, zip->data + offset, size );
+    return ADF_RC_OK;
+}
+
+
+static void zip_close ( adfdev_t * const dev )
+{
+    zip_image_t * const zip = ( zip_image_t * ) dev->data;
+    if ( zip == NULL )
+        return;
+
+    if ( zip->inflated )
+        free ( zip->data );
+    if ( zip->map != NULL )
+        munmap ( zip->map, zip->map_size );
+    free ( zip );
+    dev->data = NULL;
+}
+
+
+static bool zip_is_image_name ( const uint8_t * const name,
+                                const size_t          namelen )
+{
+    return ( namelen > 4 &&
+             ( strncasecmp ( ( const char * ) name + namelen - 4, ".adf", 4 ) == 0 ||
+               strncasecmp ( ( const char * ) name + namelen - 4, ".hdf", 4 ) == 0 ) );
+}
+
+
+// find (in the central directory) the first disk image
+static bool zip_find_image ( const zip_image_t * const zip,
+                             zip_member_t * const      member )
+{
+    // the end of central directory record - at the end of the file,
+    // followed only by the archive's comment
+    const uint8_t * eocd = NULL;
+    const size_t search_end = ( zip->map_size - ZIP_EOCD_SIZE > ZIP_COMMENT_MAX ) ?
+        zip->map_size - ZIP_EOCD_SIZE - ZIP_COMMENT_MAX : 0;
+    for ( size_t pos = zip->map_size - ZIP_EOCD_SIZE + 1 ; pos-- > search_end ; ) {
+        if ( memcmp ( zip->map + pos, "PK\x05\x06", 4 ) == 0 ) {
+            eocd = zip->map + pos;
+            break;
+        }
+    }
+    if ( eocd == NULL )
+        return false;
+
+    const unsigned nentries  = le16 ( eocd + 10 );
+    const size_t   cd_size   = le32 ( eocd + 12 ),
+                   cd_offset = le32 ( eocd + 16 );
+    if ( cd_offset > zip->map_size || cd_size > zip->map_size - cd_offset )
+        return false;
+
+    const uint8_t * entry = zip->map + cd_offset,
+                  * const cd_end = entry + cd_size;
+    for ( unsigned i = 0 ; i < nentries ; i++ ) {
+        if ( cd_end - entry < ZIP_CENTRAL_HEADER_SIZE ||
+             memcmp ( entry, "PK\x01\x02", 4 ) != 0 )
+        {
+            return false;
+        }
+
+        const size_t namelen    = le16 ( entry + 28 ),
+                     extralen   = le16 ( entry + 30 ),
+                     commentlen = le16 ( entry + 32 ),
+                     entry_size = ZIP_CENTRAL_HEADER_SIZE + namelen +
+                                  extralen + commentlen;
+        if ( ( size_t ) ( cd_end - entry ) < entry_size )
+            return false;
+
+        member->flags               = le16 ( entry + 8 );
+        member->method              = le16 ( entry + 10 );
+        member->crc                 = le32 ( entry + 16 );
+        member->compressed_size     = le32 ( entry + 20 );
+        member->size                = le32 ( entry + 24 );
+        member->local_header_offset = le32 ( entry + 42 );
+
+        if ( zip_is_image_name ( entry + ZIP_CENTRAL_HEADER_SIZE, namelen ) &&
+             ! ( member->flags & ZIP_FLAG_ENCRYPTED ) &&
+             ( ( member->method == ZIP_METHOD_STORED &&
+                 member->compressed_size == member->size ) ||
+               member->method == ZIP_METHOD_DEFLATED ) &&
+             member->size > 0 )
+        {
+            return true;
+        }
+
+        entry += entry_size;
+    }
+
+    return false;
+}
+
+
+static uint8_t * zip_inflate ( const uint8_t * const      data,
+                               const zip_member_t * const member )
+{
+    uint8_t * const out = malloc ( member->size );
+    if ( out == NULL )
+        return NULL;
+
+    z_stream strm;
+    memset ( &strm, 0, sizeof ( strm ) );
+    if ( inflateInit2 ( &strm, -15 ) != Z_OK ) {  // raw deflate
+        free ( out );
+        return NULL;
+    }
+    strm.next_in   = ( uint8_t * ) data;
+    strm.avail_in  = member->compressed_size;
+    strm.next_out  = out;
+    strm.avail_out = member->size;
+
+    const int ret = inflate ( &strm, Z_FINISH );
+    const bool ok = ( ret == Z_STREAM_END &&
+                      strm.total_out == member->size &&
+                      crc32 ( 0, out, member->size ) == member->crc );
+    inflateEnd ( &strm );
+
+    if ( ! ok ) {
+        free ( out );
+        return NULL;
+    }
+    return out;
+}
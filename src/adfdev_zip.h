@@ -0,0 +1,15 @@
+#ifndef ADFDEV_ZIP_H
+#define ADFDEV_ZIP_H
+
+/*
+ * Images inside ZIP archives (the first *.adf or *.hdf member)
+ *
+ * A stored (not compressed) member is read directly from the mapped
+ * archive file, a deflated one is decompressed (once) to memory.
+ */
+
+#include "adfdev.h"
+
+extern const adfdev_backend_t adfdev_zip_backend;
+
+#endif
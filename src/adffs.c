@@ -2,9 +2,17 @@
 #include "adffs.h"
 
 #include "config.h"
+#include "adfdev_ram.h"
+#include "adffs_arena.h"
+#include "adffs_probes.h"
+#include "adffs_record.h"
+#include "adffs_stats.h"
+#include "adffs_trace.h"
 #include "adffs_util.h"
+#include "adfindex.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <libgen.h>
 #include <stdlib.h>
@@ -19,6 +27,45 @@
 
 #include "log.h"
 #include "adffs_log.h"
+#include "util.h"
+
+
+static int adffs_get_image ( adffs_state_t * const fs_state,
+                             const char * const    path,
+                             adfimage_t ** const   adfimage,
+                             const char ** const   image_path );
+
+static bool adffs_is_collection_root ( const adffs_state_t * const fs_state,
+                                       const char * const          path );
+
+static int adffs_getattr_collection_root ( const adffs_state_t * const fs_state,
+                                           struct stat * const         statbuf );
+
+static bool adffs_getattr_indexed ( const adfimage_t * const       adfimage,
+                                    const adfindex_entry_t * const ientry,
+                                    struct stat * const            statbuf );
+
+static int adffs_getattr_stats ( const char * const  path,
+                                 struct stat * const statbuf );
+
+typedef struct adffs_readdir_fill {
+    void *          buffer;
+    fuse_fill_dir_t filler;
+    bool            full;
+} adffs_readdir_fill_t;
+
+static bool adffs_readdir_fill ( void * const       data,
+                                 const char * const name );
+
+static char * adffs_stats_file ( const char * const path,
+                                 size_t * const     size );
+
+static uint32_t adffs_trace_alloc_start ( const adfimage_t * const adfimage );
+
+static void adffs_trace_alloc_end ( const adfimage_t * const adfimage,
+                                    const char * const       op,
+                                    const char * const       path,
+                                    const uint32_t           free_before );
 
 
 /*******************************************************
@@ -29,20 +76,26 @@ void * adffs_init ( struct fuse_conn_info * conninfo )
 {
     struct fuse_context * const context = fuse_get_context();
 
-#ifdef DEBUG_ADFFS
-    const adffs_state_t * const fs_state =
-        ( adffs_state_t * ) context->private_data;
-
-    adffs_log_info ( "\nadffs_init ( conninfo = 0x%" PRIxPTR " )\n",
-                     conninfo );
-    adffs_log_fuse_conn_info( conninfo );
-    adffs_log_fuse_context( context );
-#else
-    (void) conninfo;
-#endif
+    if ( adffs_trace_on ( ADFFS_TRACE_DEVICE ) ) {
+        adffs_log_info ( "\nadffs_init ( conninfo = 0x%" PRIxPTR " )\n",
+                         ( uintptr_t ) conninfo );
+        adffs_log_fuse_conn_info( conninfo );
+        adffs_log_fuse_context( context );
+    }
 
     adffs_util_init();
 
+    // (threads do not survive daemonizing - so started only here)
+    const adffs_state_t * const state =
+        ( adffs_state_t * ) context->private_data;
+    // (the signal thread first - SIGUSR1 blocked in the threads started after)
+    adffs_stats_signal_start ( state->logfile != NULL ? state->logfile : stderr );
+    adffs_log_async_start();
+    if ( state->ram_writeback_interval > 0 )
+        adfdev_ram_writeback_start ( state->ram_writeback_interval );
+    if ( state->adfimage != NULL && state->adfimage->index != NULL )
+        adfindex_prescan_start ( state->adfimage->index );
+
     return context->private_data;
 }
 
@@ -51,14 +104,21 @@ void adffs_destroy ( void * private_data )
 {
     adffs_state_t * const fs_state = ( adffs_state_t * ) private_data;
     
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_destroy ( userdata = 0x%" PRIxPTR " )\n",
-                     private_data );
-#endif
+    adffs_trace ( ADFFS_TRACE_DEVICE,
+                  "\nadffs_destroy ( userdata = 0x%" PRIxPTR " )\n",
+                  ( uintptr_t ) private_data );
+
+    // images are written back when closed
+    adfdev_ram_writeback_stop();
+    adffs_stats_signal_stop();
+    adffs_record_stop();
 
     if ( fs_state->adfimage )
         adfimage_close ( &fs_state->adfimage );
 
+    if ( fs_state->collection )
+        adfcollection_close ( &fs_state->collection );
+
     free ( fs_state->mountpoint );
     fs_state->mountpoint = NULL;
 
@@ -69,17 +129,14 @@ void adffs_destroy ( void * private_data )
 int adffs_statfs ( const char *     path,
                    struct statvfs * stvfs )
 {
-    (void) path;
-
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_statfs (\n"
-                     "    path  = \"%s\",\n"
-                     "    statv = 0x%" PRIxPTR " )\n",
-                     path, stvfs );
-#endif
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_statfs (\n"
+                  "    path  = \"%s\",\n"
+                  "    statv = 0x%" PRIxPTR " )\n",
+                  path, ( uintptr_t ) stvfs );
 
     stvfs->f_flag = //ST_RDONLY |
         ST_NOSUID;
@@ -87,7 +144,21 @@ int adffs_statfs ( const char *     path,
     // ^^^^ for some reason these are not available here???
     // <sys/statvfs.h>
 
-    adfimage_t * const adfimage = fs_state->adfimage;
+    if ( adffs_is_collection_root ( fs_state, path ) ) {
+        // no volume here - only the images (as directories)
+        if ( fs_state->collection->read_only )
+            stvfs->f_flag |= ST_RDONLY;
+        stvfs->f_bsize  =
+        stvfs->f_frsize = 512;
+        stvfs->f_namemax = 255;
+        return 0;
+    }
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
     struct AdfVolume * const vol = adfimage->vol;
     uint32_t blocks_free = adfCountFreeBlocks ( vol );
 
@@ -116,9 +187,8 @@ int adffs_statfs ( const char *     path,
     //stvfs->f_flag    = 0x00000002;              /* Mount flags */
     stvfs->f_namemax = 30;                        /* Maximum filename length */
 
-#ifdef DEBUG_ADFFS
-    adffs_log_statvfs( stvfs );
-#endif
+    if ( adffs_trace_on ( ADFFS_TRACE_LOOKUP ) )
+        adffs_log_statvfs( stvfs );
 
     return 0;
 }
@@ -134,15 +204,39 @@ int adffs_getattr ( const char *  path,
     adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_getattr (\n"
-                     "    path    = \"%s\",\n"
-                     "    statbuf = 0x%" PRIxPTR " )\n",
-          path, statbuf );
-#endif
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_getattr (\n"
+                  "    path    = \"%s\",\n"
+                  "    statbuf = 0x%" PRIxPTR " )\n",
+                  path, ( uintptr_t ) statbuf );
 
     memset ( statbuf, 0, sizeof ( *statbuf ) );
 
+    if ( adffs_stats_is_path ( path ) )
+        return adffs_getattr_stats ( path, statbuf );
+
+    if ( adffs_is_collection_root ( fs_state, path ) )
+        return adffs_getattr_collection_root ( fs_state, statbuf );
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    if ( adfimage->index != NULL ) {
+        const adfindex_entry_t * ientry;
+        switch ( adfindex_lookup ( adfimage->index, path, &ientry ) ) {
+        case ADFINDEX_FOUND:
+            if ( adffs_getattr_indexed ( adfimage, ientry, statbuf ) )
+                return 0;
+            break;
+        case ADFINDEX_NOT_FOUND:
+            return -ENOENT;
+        case ADFINDEX_UNKNOWN:
+            break;      // (use the on-disk metadata)
+        }
+    }
+
     const char * path_relative = path;
 
     // skip all leading '/' from the path
@@ -150,7 +244,6 @@ int adffs_getattr ( const char *  path,
     while ( *path_relative == '/' )
         path_relative++;
 
-    adfimage_t * const adfimage = fs_state->adfimage;
     adfimage_dentry_t dentry;
     if ( *path_relative == '\0' ) {
         // main directory
@@ -185,31 +278,34 @@ int adffs_getattr ( const char *  path,
         struct AdfVolume * const vol = adfimage->vol;
 
         // first, find and enter the directory where is dir. entry to check
-        char * dirpath_buf = strdup ( path );
+        // (the copies of the path released at the end of the operation)
+        char * dirpath_buf = adffs_arena_strdup ( path );
+        if ( dirpath_buf == NULL )
+            return -ENOMEM;
         char * dir_path = dirname ( dirpath_buf );
 
-#ifdef DEBUG_ADFFS
-        adffs_log_info ( "adffs_getattr(): Entering directory the directory %s.\n",
-                         dir_path );
-#endif
+        adffs_trace ( ADFFS_TRACE_LOOKUP,
+                      "adffs_getattr(): Entering directory the directory %s.\n",
+                      dir_path );
         if ( ! adfimage_chdir ( adfimage, dir_path ) ) {
             adffs_log_info ( "adffs_getattr(): Cannot chdir to the directory %s.\n",
                              dir_path );
             return -ENOENT;
         }
-        free ( dirpath_buf );
 
-#ifdef DEBUG_ADFFS
-        adffs_log_info ( "adffs_getattr(): Current directory: %s.\n",
-                         adfimage_getcwd ( adfimage ) );
-#endif
-        char * direntry_buf = strdup ( path );
+        adffs_trace ( ADFFS_TRACE_LOOKUP,
+                      "adffs_getattr(): Current directory: %s.\n",
+                      adfimage_getcwd ( adfimage ) );
+        char * direntry_buf = adffs_arena_strdup ( path );
+        if ( direntry_buf == NULL ) {
+            adfToRootDir ( vol );
+            return -ENOMEM;
+        }
         char * direntry_name = basename ( direntry_buf );
 
-#ifdef DEBUG_ADFFS
-        adffs_log_info ( "adffs_getattr(): direntry name: %s.\n",
-                         direntry_name );
-#endif
+        adffs_trace ( ADFFS_TRACE_LOOKUP,
+                      "adffs_getattr(): direntry name: %s.\n",
+                      direntry_name );
         if ( *direntry_name == '\0' ) {
             // empty name means that given path is a directory
             // to which we entered above - so we need to check
@@ -229,15 +325,21 @@ int adffs_getattr ( const char *  path,
                 ( perms & ADF_PERM_EXECUTE ? S_IXUSR | S_IXGRP | S_IXOTH : 0 );
             statbuf->st_nlink = 1;
 
-            struct AdfFile * afile = adfFileOpen ( vol, direntry_name,
-                                                   ADF_FILE_MODE_READ );
-            if ( afile ) {
-                statbuf->st_size = afile->fileHdr->byteSize;
+            if ( dentry.type == ADFVOLUME_DENTRY_FILE ) {
+                // (the size from the header block - not opening the file)
+                statbuf->st_size = dentry.adflib_entry.size;
                 statbuf->st_blocks = statbuf->st_size / 512 + 1;
             } else {
-                adffs_log_info ( "adffs_getattr(): Error opening file: %s\n", path );
+                struct AdfFile * afile = adfFileOpen ( vol, direntry_name,
+                                                       ADF_FILE_MODE_READ );
+                if ( afile ) {
+                    statbuf->st_size = afile->fileHdr->byteSize;
+                    statbuf->st_blocks = statbuf->st_size / 512 + 1;
+                } else {
+                    adffs_log_info ( "adffs_getattr(): Error opening file: %s\n", path );
+                }
+                adfFileClose ( afile );
             }
-            adfFileClose ( afile );
 
         } else if ( dentry.type == ADFVOLUME_DENTRY_DIRECTORY ||
                     dentry.type == ADFVOLUME_DENTRY_LINKDIR )
@@ -267,12 +369,10 @@ int adffs_getattr ( const char *  path,
                              path, dentry.adflib_entry.type );
         } else {
             // file/dirname not found
-            free ( direntry_buf );
             adfToRootDir ( vol );
             return -ENOENT;
         }
 
-        free ( direntry_buf );
         adfToRootDir ( vol );
     }
 
@@ -288,29 +388,27 @@ int adffs_getattr ( const char *  path,
                                               dentry.adflib_entry.mins,
                                               dentry.adflib_entry.secs );
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_getattr time:\n"
-                     "    year   = %d\n"
-                     "    month  = %d\n"
-                     "    day    = %d\n"
-                     "    hour   = %d\n"
-                     "    min    = %d\n"
-                     "    sec    = %d\n"
-                     "    time_t = %lld\n\n",
-                     dentry.adflib_entry.year,
-                     dentry.adflib_entry.month,
-                     dentry.adflib_entry.days,
-                     dentry.adflib_entry.hour,
-                     dentry.adflib_entry.mins,
-                     dentry.adflib_entry.secs,
-                     (long long) statbuf->st_ctime );
-#endif
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_getattr time:\n"
+                  "    year   = %d\n"
+                  "    month  = %d\n"
+                  "    day    = %d\n"
+                  "    hour   = %d\n"
+                  "    min    = %d\n"
+                  "    sec    = %d\n"
+                  "    time_t = %lld\n\n",
+                  dentry.adflib_entry.year,
+                  dentry.adflib_entry.month,
+                  dentry.adflib_entry.days,
+                  dentry.adflib_entry.hour,
+                  dentry.adflib_entry.mins,
+                  dentry.adflib_entry.secs,
+                  (long long) statbuf->st_ctime );
 
     statbuf->st_blksize = adfimage->fstat.st_blksize;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_stat( statbuf );
-#endif
+    if ( adffs_trace_on ( ADFFS_TRACE_LOOKUP ) )
+        adffs_log_stat( statbuf );
 
     return 0;
 }
@@ -322,29 +420,50 @@ int adffs_read ( const char *            path,
                  off_t                   offset,
                  struct fuse_file_info * finfo )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
     
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_read (\n"
-                     "    path   = \"%s\",\n"
-                     "    buf    = 0x%" PRIxPTR ",\n"
-                     "    size   = %d,\n"
-                     "    offset = %lld,\n"
-                     "    finfo  = 0x%" PRIxPTR " )\n",
-                     path, buffer, size, offset, finfo );
-#else
-    (void) finfo;
-#endif
+    adffs_trace ( ADFFS_TRACE_READ,
+                  "\nadffs_read (\n"
+                  "    path   = \"%s\",\n"
+                  "    buf    = 0x%" PRIxPTR ",\n"
+                  "    size   = %zu,\n"
+                  "    offset = %lld,\n"
+                  "    finfo  = 0x%" PRIxPTR " )\n",
+                  path, ( uintptr_t ) buffer, size, ( long long ) offset,
+                  ( uintptr_t ) finfo );
+
+    if ( adffs_stats_is_path ( path ) ) {
+        // the report taken when opened
+        const char * const report = ( const char * ) finfo->fh;
+        const size_t report_size = strlen ( report );
+        if ( offset < 0 || ( size_t ) offset >= report_size )
+            return 0;
+        const size_t nbytes = ( report_size - ( size_t ) offset < size ) ?
+            report_size - ( size_t ) offset : size;
+        memcpy ( buffer, report + offset, nbytes );
+        return ( int ) nbytes;
+    }
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    if ( adfimage->index != NULL ) {
+        const adfindex_entry_t * ientry;
+        if ( adfindex_lookup ( adfimage->index, path, &ientry ) == ADFINDEX_FOUND ) {
+            const int bytes_read = adfindex_read ( adfimage->index, adfimage->vol,
+                                                   ientry, buffer, size, offset );
+            if ( bytes_read != -ENOSYS )
+                return bytes_read;
+        }
+    }
 
-    int bytes_read = adfimage_read ( fs_state->adfimage, path,
-                                     buffer, size, offset );
+    int bytes_read = adfimage_read ( adfimage, path, buffer, size, offset );
 
-#ifdef DEBUG_ADFFS
-    //adffs_log_info ( fs_state->logfile,
-    //           "adffs_read () => %d (%s)\n", bytes_read,
-    //           size == (size_t) bytes_read ? "OK" : "READ ERROR" );
-#endif
+    adffs_trace ( ADFFS_TRACE_READ, "adffs_read () => %d (%s)\n", bytes_read,
+                  size == (size_t) bytes_read ? "OK" : "READ ERROR" );
 
     return bytes_read;
 }
@@ -356,28 +475,34 @@ int adffs_write ( const char *            path,
                   off_t                   offset,
                   struct fuse_file_info * finfo )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_write (\n"
-                     "    path   = \"%s\",\n"
-                     "    buf    = 0x%" PRIxPTR ",\n"
-                     "    size   = %d,\n"
-                     "    offset = %lld,\n"
-                     "    finfo  = 0x%" PRIxPTR " )\n",
-                     path, buffer, size, offset, finfo );
-#else
-    (void) finfo;
-#endif
-
-    int bytes_written = adfimage_write ( fs_state->adfimage, path,
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_write (\n"
+                  "    path   = \"%s\",\n"
+                  "    buf    = 0x%" PRIxPTR ",\n"
+                  "    size   = %zu,\n"
+                  "    offset = %lld,\n"
+                  "    finfo  = 0x%" PRIxPTR " )\n",
+                  path, ( uintptr_t ) buffer, size, ( long long ) offset,
+                  ( uintptr_t ) finfo );
+
+    if ( strcmp ( path, ADFFS_TRACE_PATH ) == 0 )
+        return adffs_trace_set ( buffer, size ) ? ( int ) size : -EINVAL;
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    const uint32_t free_before = adffs_trace_alloc_start ( adfimage );
+    int bytes_written = adfimage_write ( adfimage, path,
                                          ( char * ) buffer, size, offset );
+    adffs_trace_alloc_end ( adfimage, "write", path, free_before );
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "adffs_write () => %d (%s)\n", bytes_written,
-                     size == (size_t) bytes_written ? "OK" : "WRITE ERROR" );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE, "adffs_write () => %d (%s)\n", bytes_written,
+                  size == (size_t) bytes_written ? "OK" : "WRITE ERROR" );
 
     return bytes_written;
 }
@@ -389,21 +514,67 @@ int adffs_readdir ( const char *            path,
                     off_t                   offset,
                     struct fuse_file_info * finfo )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_readdir (\n"
-                     "    path   = \"%s\",\n"
-                     "    buf    = 0x%" PRIxPTR ",\n"
-                     "    filler = 0x%"  PRIxPTR ",\n"
-                     "    offset = %lld,\n"
-                     "    finfo  = 0x%" PRIxPTR " )\n",
-                     path, buffer, filler, offset, finfo );
-#else
-    (void) offset;  (void) finfo;
-#endif
-    adfimage_t * const adfimage = fs_state->adfimage;
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_readdir (\n"
+                  "    path   = \"%s\",\n"
+                  "    buf    = 0x%" PRIxPTR ",\n"
+                  "    offset = %lld,\n"
+                  "    finfo  = 0x%" PRIxPTR " )\n",
+                  path, ( uintptr_t ) buffer, ( long long ) offset,
+                  ( uintptr_t ) finfo );
+    if ( adffs_stats_is_path ( path ) ) {
+        if ( strcmp ( path, ADFFS_STATS_DIR ) != 0 )
+            return -ENOTDIR;
+        filler ( buffer, ".", NULL, 0 );
+        filler ( buffer, "..", NULL, 0 );
+        filler ( buffer, ADFFS_STATS_PATH + sizeof ( ADFFS_STATS_DIR ), NULL, 0 );
+        filler ( buffer, ADFFS_TRACE_PATH + sizeof ( ADFFS_STATS_DIR ), NULL, 0 );
+        return 0;
+    }
+
+    if ( adffs_is_collection_root ( fs_state, path ) ) {
+        // images of the collection are shown as directories
+        filler ( buffer, ".", NULL, 0 );
+        filler ( buffer, "..", NULL, 0 );
+        const adfcollection_t * const collection = fs_state->collection;
+        for ( unsigned i = 0 ; i < collection->nentries ; i++ ) {
+            if ( filler ( buffer, collection->entries [ i ].name, NULL, 0 ) ) {
+                adffs_log_info ( "adffs_readdir: filler: buffer full\n" );
+                return -EAGAIN;
+            }
+        }
+        return 0;
+    }
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    if ( adfimage->index != NULL ) {
+        const adfindex_entry_t * idir;
+        if ( adfindex_lookup ( adfimage->index, path, &idir ) == ADFINDEX_FOUND &&
+             ( idir->type == ADF_ST_ROOT || idir->type == ADF_ST_DIR ) )
+        {
+            filler ( buffer, ".", NULL, 0 );
+            filler ( buffer, "..", NULL, 0 );
+            for ( uint32_t i = 0 ; i < idir->nchildren ; i++ ) {
+                const adfindex_entry_t * const ientry =
+                    adfindex_get_child ( adfimage->index, idir, i );
+                if ( filler ( buffer, adfindex_get_name ( adfimage->index, ientry ),
+                              NULL, 0 ) )
+                {
+                    adffs_log_info ( "adffs_readdir: filler: buffer full\n" );
+                    return -EAGAIN;
+                }
+            }
+            return 0;
+        }
+    }
+
     struct AdfVolume * const vol = adfimage->vol;
     if ( ! adfimage_chdir ( adfimage, path ) ) {
         adffs_log_info ( "adffs_read(): Cannot chdir to the directory %s.\n",
@@ -415,38 +586,22 @@ int adffs_readdir ( const char *            path,
     filler ( buffer, ".", NULL, 0 );
     filler ( buffer, "..", NULL, 0 );
 
-    struct AdfList * const dentries = adfGetDirEnt ( vol, vol->curDirPtr );
-    /*if ( ! dentries ) {
-        adffs_log_info ( fs_state->logfile,
-                   "adfimage_getdentry(): Error getting dir entries,"
-                   "path %s\n", path );
-        return -ENOENT; //?
-    }*/
-
-    for ( struct AdfList * lentry = dentries ;
-          lentry ;
-          lentry = lentry->next )
-    {
-        struct AdfEntry * const dentry =
-            ( struct AdfEntry * ) lentry->content;
-        //printf (" type: %d, size: %d, name: %s, comment: %s\n",
-        //        dentry->type,
-        //        dentry->size,
-        //        dentry->name,
-        //        dentry->comment );
-        //printEntry(struct Entry* entry);
-        //printEntry ( dentry );    
-        if ( filler ( buffer, dentry->name, NULL, 0 ) ) {
-            adffs_log_info ( "adffs_readdir: filler: buffer full\n" );
-            adfToRootDir ( vol );
-            return -EAGAIN; // check what error return in such case(!)
-                            // probably something from /usr/include/asm-generic/errno-base.h (?)
-        }
+    // (the entries read one by one - not listed by ADFlib)
+    adffs_readdir_fill_t fill = {
+        .buffer = buffer,
+        .filler = filler,
+        .full   = false
+    };
+    adfimage_foreach_cwd_entry ( adfimage, adffs_readdir_fill, &fill );
+    if ( fill.full ) {
+        adffs_log_info ( "adffs_readdir: filler: buffer full\n" );
+        adfToRootDir ( vol );
+        return -EAGAIN; // check what error return in such case(!)
+                        // probably something from /usr/include/asm-generic/errno-base.h (?)
     }
 
-#ifdef DEBUG_ADFFS
-    adffs_log_fuse_file_info( finfo );
-#endif
+    if ( adffs_trace_on ( ADFFS_TRACE_LOOKUP ) )
+        adffs_log_fuse_file_info( finfo );
 
     adfToRootDir ( vol );
     return 0;
@@ -457,21 +612,24 @@ int adffs_readlink ( const char * path,
                      char *       buf,
 		     size_t       len )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_readlink (\n"
-                     "    path = \"%s\",\n"
-                     "    buf  = 0x%" PRIxPTR ",\n"
-                     "    len  = %lld,\n",
-                     path, buf, len );
-#endif
-    int status = adfimage_readlink ( fs_state->adfimage, path, buf, len );
-
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_readlink:  buf  = %s, status %d\n",
-                     buf, status );
-#endif
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_readlink (\n"
+                  "    path = \"%s\",\n"
+                  "    buf  = 0x%" PRIxPTR ",\n"
+                  "    len  = %zu )\n",
+                  path, ( uintptr_t ) buf, len );
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    status = adfimage_readlink ( adfimage, path, buf, len );
+
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_readlink:  buf  = %s, status %d\n",
+                  status == 0 ? buf : "", status );
     //strncpy ( buf, "secret.S", len );
 
     return status;
@@ -481,18 +639,23 @@ int adffs_readlink ( const char * path,
 int adffs_mkdir ( const char * dirpath,
                   mode_t       mode )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_mkdir (\n"
-                     "    dirpath = \"%s\",\n"
-                     //"    mode    = 0x%" PRIxPTR ",\n"
-                     "    mode    = %lld )\n",
-                     dirpath, mode );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_mkdir (\n"
+                  "    dirpath = \"%s\",\n"
+                  "    mode    = 0%o )\n",
+                  dirpath, ( unsigned ) mode );
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, dirpath, &adfimage, &dirpath );
+    if ( status != 0 )
+        return status;
 
-    int status = adfimage_mkdir ( fs_state->adfimage, dirpath, mode );
+    const uint32_t free_before = adffs_trace_alloc_start ( adfimage );
+    status = adfimage_mkdir ( adfimage, dirpath, mode );
+    adffs_trace_alloc_end ( adfimage, "mkdir", dirpath, free_before );
 
     return status;
 }
@@ -500,16 +663,22 @@ int adffs_mkdir ( const char * dirpath,
 
 int adffs_rmdir ( const char * dirpath )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_rmdir (\n"
-                     "    dirpath = \"%s\",\n",
-                     dirpath );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_rmdir (\n"
+                  "    dirpath = \"%s\" )\n",
+                  dirpath );
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, dirpath, &adfimage, &dirpath );
+    if ( status != 0 )
+        return status;
 
-    int status = adfimage_rmdir ( fs_state->adfimage, dirpath );
+    const uint32_t free_before = adffs_trace_alloc_start ( adfimage );
+    status = adfimage_rmdir ( adfimage, dirpath );
+    adffs_trace_alloc_end ( adfimage, "rmdir", dirpath, free_before );
 
     return status;
 }
@@ -520,31 +689,44 @@ int adffs_create ( const char *           filepath,
                    struct fuse_file_info *finfo )
 {
     (void) finfo;
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_create (\n"
-                     "    filepath = \"%s\",\n"
-                     "    mode     = %lld )\n",
-                     filepath, mode );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_create (\n"
+                  "    filepath = \"%s\",\n"
+                  "    mode     = 0%o )\n",
+                  filepath, ( unsigned ) mode );
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, filepath, &adfimage, &filepath );
+    if ( status != 0 )
+        return status;
 
-    return adfimage_create ( fs_state->adfimage, filepath, mode );
+    const uint32_t free_before = adffs_trace_alloc_start ( adfimage );
+    status = adfimage_create ( adfimage, filepath, mode );
+    adffs_trace_alloc_end ( adfimage, "create", filepath, free_before );
+    return status;
 }
 
 int adffs_unlink ( const char * filepath )
 {
-   const adffs_state_t * const fs_state =
+   adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_unlink (\n"
-                     "    filepath = \"%s\",\n",
-                     filepath );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_unlink (\n"
+                  "    filepath = \"%s\" )\n",
+                  filepath );
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, filepath, &adfimage, &filepath );
+    if ( status != 0 )
+        return status;
 
-    int status = adfimage_unlink ( fs_state->adfimage, filepath );
+    const uint32_t free_before = adffs_trace_alloc_start ( adfimage );
+    status = adfimage_unlink ( adfimage, filepath );
+    adffs_trace_alloc_end ( adfimage, "unlink", filepath, free_before );
 
     return status;
 }
@@ -554,37 +736,72 @@ int adffs_unlink ( const char * filepath )
 int adffs_open ( const char *            filepath,
                  struct fuse_file_info * finfo )
 {
-    (void) finfo;
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_open (\n"
-                     "    filepath = \"%s\",\n",
-                     filepath );
-#endif
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_open (\n"
+                  "    filepath = \"%s\", flags = 0x%x )\n",
+                  filepath, ( unsigned ) finfo->flags );
+
+    if ( adffs_stats_is_path ( filepath ) ) {
+        if ( strcmp ( filepath, ADFFS_STATS_DIR ) == 0 )
+            return -EISDIR;
+        // (only the trace categories can be changed)
+        if ( ( finfo->flags & O_ACCMODE ) != O_RDONLY &&
+             strcmp ( filepath, ADFFS_TRACE_PATH ) != 0 )
+        {
+            return -EACCES;
+        }
+
+        // (a snapshot - so that it does not change while being read)
+        size_t report_size;
+        char * const report = adffs_stats_file ( filepath, &report_size );
+        if ( report == NULL )
+            return ( strcmp ( filepath, ADFFS_STATS_PATH ) == 0 ||
+                     strcmp ( filepath, ADFFS_TRACE_PATH ) == 0 ) ? -ENOMEM : -ENOENT;
+        finfo->fh        = ( uint64_t ) ( uintptr_t ) report;
+        finfo->direct_io = 1;       // (the size changes)
+        return 0;
+    }
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, filepath, &adfimage, &filepath );
+    if ( status != 0 )
+        return status;
 
-    struct AdfFile * file = adfimage_file_open ( fs_state->adfimage,
+    struct AdfFile * file = adfimage_file_open ( adfimage,
                                                  filepath, ADF_FILE_MODE_READ );
-    int status = ( file != NULL ) ? 0 : -1;
+    status = ( file != NULL ) ? 0 : -1;
     adfimage_file_close ( file );
 
     return status;
 }
 
 
+int adffs_release ( const char *            path,
+                    struct fuse_file_info * finfo )
+{
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "\nadffs_release (\n"
+                  "    path = \"%s\" )\n", path );
+
+    // (files of images are not kept open)
+    if ( adffs_stats_is_path ( path ) )
+        free ( ( void * ) ( uintptr_t ) finfo->fh );
+    return 0;
+}
+
+
 int adffs_chmod ( const char * path,
                   mode_t       mode )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_chmod (\n"
-                     "    path = \"%s\", mode = %o\n",
-                     path, mode );
-#else
-    (void) path, (void) mode;
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_chmod (\n"
+                  "    path = \"%s\", mode = %o )\n",
+                  path, ( unsigned ) mode );
 
     // only user permissions are managed (not touching group/other)
     int perms =
@@ -592,16 +809,17 @@ int adffs_chmod ( const char * path,
         ( mode & S_IWUSR ? ADF_PERM_WRITE   : 0 ) |
         ( mode & S_IXUSR ? ADF_PERM_EXECUTE : 0 );
 
-    if ( ! adfimage_setperm( fs_state->adfimage, path, perms ) ) {
-#ifdef DEBUG_ADFFS
-        adffs_log_info( "\nadffs_chmod: error setting permissions\n" );
-#endif
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    if ( ! adfimage_setperm( adfimage, path, perms ) ) {
+        adffs_trace ( ADFFS_TRACE_WRITE, "\nadffs_chmod: error setting permissions\n" );
         return EINVAL;   // a better error here?
     }
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info( "\nadffs_chmod: permissions set\n" );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE, "\nadffs_chmod: permissions set\n" );
 
     return 0;
 }
@@ -611,15 +829,10 @@ int adffs_chown ( const char * path,
                   uid_t        uid,
                   gid_t        gid )
 {
-#ifdef DEBUG_ADFFS
-    const adffs_state_t * const fs_state =
-        ( adffs_state_t * ) fuse_get_context()->private_data;
-    adffs_log_info ( "\nadffs_chown (\n"
-                     "    path = \"%s\", uid = %u, gid = %u\n",
-                     path, uid, gid );
-#else
-    (void) path, (void) uid, (void) gid;
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_chown (\n"
+                  "    path = \"%s\", uid = %u, gid = %u )\n",
+                  path, ( unsigned ) uid, ( unsigned ) gid );
     return 0;
 }
 
@@ -627,32 +840,78 @@ int adffs_chown ( const char * path,
 int adffs_truncate ( const char * path,
                      off_t        new_size )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_truncate (\n"
-                     "    filepath = \"%s\", size = %lu )\n",
-                     path, new_size );
-#endif
-    int status = adfimage_file_truncate ( fs_state->adfimage, path,
-                                          (long unsigned) new_size );
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_truncate (\n"
+                  "    filepath = \"%s\", size = %lld )\n",
+                  path, ( long long ) new_size );
+
+    // ("echo ... > trace" truncates first)
+    if ( strcmp ( path, ADFFS_TRACE_PATH ) == 0 )
+        return 0;
+
+    adfimage_t * adfimage;
+    int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    const uint32_t free_before = adffs_trace_alloc_start ( adfimage );
+    status = adfimage_file_truncate ( adfimage, path,
+                                      (long unsigned) new_size );
+    adffs_trace_alloc_end ( adfimage, "truncate", path, free_before );
     return ( status == 0 ? 0 : -1 );
 }
 
 
+int adffs_fsync ( const char *            path,
+                  int                     datasync,
+                  struct fuse_file_info * finfo )
+{
+    adffs_state_t * const fs_state =
+        ( adffs_state_t * ) fuse_get_context()->private_data;
+
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_fsync (\n"
+                  "    path = \"%s\", datasync = %d, finfo = 0x%" PRIxPTR " )\n",
+                  path, datasync, ( uintptr_t ) finfo );
+    if ( adffs_is_collection_root ( fs_state, path ) )
+        return 0;
+
+    adfimage_t * adfimage;
+    const int status = adffs_get_image ( fs_state, path, &adfimage, &path );
+    if ( status != 0 )
+        return status;
+
+    return ( adfimage_flush ( adfimage ) ? 0 : -EIO );
+}
+
+
 int adffs_rename ( const char * src_path,
                    const char * dst_path )
 {
-    const adffs_state_t * const fs_state =
+    adffs_state_t * const fs_state =
         ( adffs_state_t * ) fuse_get_context()->private_data;
 
-#ifdef DEBUG_ADFFS
-    adffs_log_info ( "\nadffs_rename (\n"
-                     "    src_path = \"%s\", dst_path = \"%s\" )\n",
-                     src_path, dst_path );
-#endif
-    return adfimage_file_rename ( fs_state->adfimage, src_path, dst_path );
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_rename (\n"
+                  "    src_path = \"%s\", dst_path = \"%s\" )\n",
+                  src_path, dst_path );
+    adfimage_t * src_adfimage,
+               * dst_adfimage;
+    int status = adffs_get_image ( fs_state, src_path, &src_adfimage, &src_path );
+    if ( status != 0 )
+        return status;
+    status = adffs_get_image ( fs_state, dst_path, &dst_adfimage, &dst_path );
+    if ( status != 0 )
+        return status;
+
+    // (in collection mode) moving between images is not possible
+    if ( src_adfimage != dst_adfimage )
+        return -EXDEV;
+
+    return adfimage_file_rename ( src_adfimage, src_path, dst_path );
 }
 
 
@@ -660,53 +919,496 @@ int adffs_rename ( const char * src_path,
 int adffs_utimens ( const char *          path,
                     const struct timespec tv[2] )
 {
-#ifdef DEBUG_ADFFS
-    const adffs_state_t * const fs_state =
-        ( adffs_state_t * ) fuse_get_context()->private_data;
-    adffs_log_info ( "\nadffs_utimens (\n"
-                     "    path = \"%s\", timespec[0] = %u, timespec[1] = %u )\n",
-                     path, tv[0], tv[1] );
-#else
-    (void) path, (void) tv;
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "\nadffs_utimens (\n"
+                  "    path = \"%s\", atime = %lld, mtime = %lld )\n",
+                  path, ( long long ) tv[0].tv_sec, ( long long ) tv[1].tv_sec );
     return 0;
 }
 
+
+/*******************************************************
+ * Images (a single one or a collection)
+ *******************************************************/
+
+// Get the image that the path refers to and the path within that image.
+// With a single image mounted, it is simply that image and the same path;
+// in collection mode, the first component of the path is the image name.
+//
+// return value: 0 on success, negative errno on error
+static int adffs_get_image ( adffs_state_t * const fs_state,
+                             const char * const    path,
+                             adfimage_t ** const   adfimage,
+                             const char ** const   image_path )
+{
+    // (not in the image - and nothing can be created there)
+    if ( adffs_stats_is_path ( path ) )
+        return -EACCES;
+
+    if ( fs_state->collection == NULL ) {
+        *adfimage   = fs_state->adfimage;
+        *image_path = path;
+        return 0;
+    }
+
+    const char * const name     = pathstr_get_relative ( path );
+    const char * const name_end = strchr ( name, '/' );
+    const size_t       namelen  = ( name_end != NULL ) ?
+        (size_t) ( name_end - name ) : strlen ( name );
+
+    adfcollection_entry_t * const entry =
+        adfcollection_find ( fs_state->collection, name, namelen );
+    if ( entry == NULL )
+        return -ENOENT;
+
+    *adfimage = adfcollection_get_image ( fs_state->collection, entry );
+    if ( *adfimage == NULL )
+        return -EIO;
+
+    *image_path = ( name_end != NULL ) ? name_end : "/";
+    return 0;
+}
+
+
+static bool adffs_is_collection_root ( const adffs_state_t * const fs_state,
+                                       const char * const          path )
+{
+    return ( fs_state->collection != NULL &&
+             *pathstr_get_relative ( path ) == '\0' );
+}
+
+
+static int adffs_getattr_collection_root ( const adffs_state_t * const fs_state,
+                                           struct stat * const         statbuf )
+{
+    struct stat dirstat;
+    if ( stat ( fs_state->collection->path, &dirstat ) != 0 )
+        return -errno;
+
+    // images cannot be added/removed through the mountpoint
+    statbuf->st_mode = S_IFDIR |
+        S_IRUSR | S_IXUSR |
+        S_IRGRP | S_IXGRP |
+        S_IROTH | S_IXOTH;
+    statbuf->st_size  = fs_state->collection->nentries;
+    statbuf->st_nlink = 1;
+    statbuf->st_uid   = geteuid();
+    statbuf->st_gid   = getegid();
+    statbuf->st_atime = dirstat.st_atime;
+    statbuf->st_mtime = dirstat.st_mtime;
+    statbuf->st_ctime = dirstat.st_ctime;
+    statbuf->st_blksize = dirstat.st_blksize;
+
+    return 0;
+}
+
+
+// getattr with the metadata index - for entries that it describes
+// completely (not for hard links)
+static bool adffs_getattr_indexed ( const adfimage_t * const       adfimage,
+                                    const adfindex_entry_t * const ientry,
+                                    struct stat * const            statbuf )
+{
+    adfimage_dentry_t dentry = adfindex_get_dentry ( adfimage->index, ientry );
+    const int perms = adfimage_getperm ( &dentry );
+
+    if ( ientry->type == ADF_ST_ROOT ) {
+        // (as in adffs_getattr - root dir. permissions are not used)
+        statbuf->st_mode = S_IFDIR |
+            S_IRUSR | S_IXUSR | S_IWUSR |
+            S_IRGRP | S_IXGRP |
+            S_IROTH | S_IXOTH;
+        statbuf->st_size = ientry->nchildren;
+
+    } else if ( dentry.type == ADFVOLUME_DENTRY_FILE ) {
+        statbuf->st_mode = S_IFREG |
+            ( perms & ADF_PERM_READ    ? S_IRUSR | S_IRGRP | S_IROTH : 0 ) |
+            ( perms & ADF_PERM_WRITE   ? S_IWUSR : 0 ) |
+            ( perms & ADF_PERM_EXECUTE ? S_IXUSR | S_IXGRP | S_IXOTH : 0 );
+        statbuf->st_size   = ientry->size;
+        statbuf->st_blocks = statbuf->st_size / 512 + 1;
+
+    } else if ( dentry.type == ADFVOLUME_DENTRY_DIRECTORY ) {
+        statbuf->st_mode = S_IFDIR |
+            ( perms & ADF_PERM_READ    ? S_IRUSR | S_IRGRP | S_IROTH : 0 ) |
+            ( perms & ADF_PERM_WRITE   ? S_IWUSR : 0 ) |
+            S_IXUSR | S_IXGRP | S_IXOTH;
+        statbuf->st_size = ientry->nchildren;
+
+    } else if ( dentry.type == ADFVOLUME_DENTRY_SOFTLINK ) {
+        statbuf->st_mode = S_IFLNK |
+            S_IRUSR | S_IXUSR |
+            S_IRGRP | S_IXGRP |
+            S_IROTH | S_IXOTH;
+
+    } else {
+        return false;
+    }
+
+    statbuf->st_nlink = 1;
+    statbuf->st_uid   = geteuid();
+    statbuf->st_gid   = getegid();
+    statbuf->st_atime =
+    statbuf->st_mtime =
+    statbuf->st_ctime = localtime_to_time_t ( ientry->year,
+                                              ientry->month,
+                                              ientry->days,
+                                              ientry->hour,
+                                              ientry->mins,
+                                              ientry->secs );
+    statbuf->st_blksize = adfimage->fstat.st_blksize;
+
+    return true;
+}
+
+
+// the statistics (not in any image)
+static int adffs_getattr_stats ( const char * const  path,
+                                 struct stat * const statbuf )
+{
+    if ( strcmp ( path, ADFFS_STATS_DIR ) == 0 ) {
+        statbuf->st_mode  = S_IFDIR |
+            S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+        statbuf->st_nlink = 2;
+    } else if ( strcmp ( path, ADFFS_STATS_PATH ) == 0 ||
+                strcmp ( path, ADFFS_TRACE_PATH ) == 0 )
+    {
+        size_t report_size;
+        char * const report = adffs_stats_file ( path, &report_size );
+        if ( report == NULL )
+            return -ENOMEM;
+        free ( report );
+        statbuf->st_mode  = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH |
+            ( strcmp ( path, ADFFS_TRACE_PATH ) == 0 ? S_IWUSR : 0 );
+        statbuf->st_nlink = 1;
+        statbuf->st_size  = ( off_t ) report_size;
+    } else
+        return -ENOENT;
+
+    statbuf->st_uid   = geteuid();
+    statbuf->st_gid   = getegid();
+    statbuf->st_atime =
+    statbuf->st_mtime =
+    statbuf->st_ctime = time ( NULL );
+    return 0;
+}
+
+
+// the content of a file of the statistics (to free by the caller),
+// NULL on error or if there is no such file
+static char * adffs_stats_file ( const char * const path,
+                                 size_t * const     size )
+{
+    if ( strcmp ( path, ADFFS_STATS_PATH ) == 0 )
+        return adffs_stats_report ( size );
+
+    if ( strcmp ( path, ADFFS_TRACE_PATH ) == 0 ) {
+        char * const categories = malloc ( 64 );
+        if ( categories != NULL )
+            *size = adffs_trace_get ( categories, 64 );
+        return categories;
+    }
+    return NULL;
+}
+
+
+// (passing the entries of a directory to the filler of FUSE)
+static bool adffs_readdir_fill ( void * const       data,
+                                 const char * const name )
+{
+    adffs_readdir_fill_t * const fill = data;
+    fill->full = ( fill->filler ( fill->buffer, name, NULL, 0 ) != 0 );
+    return ! fill->full;
+}
+
+
+/*******************************************************
+ * Tracing allocations
+ *******************************************************/
+
+// free blocks of the volume before a modification (counted only
+// if allocations are traced - it is not cheap), to pass
+// to adffs_trace_alloc_end
+static uint32_t adffs_trace_alloc_start ( const adfimage_t * const adfimage )
+{
+    return adffs_trace_on ( ADFFS_TRACE_ALLOC ) ?
+        adfCountFreeBlocks ( adfimage->vol ) : UINT32_MAX;
+}
+
+
+static void adffs_trace_alloc_end ( const adfimage_t * const adfimage,
+                                    const char * const       op,
+                                    const char * const       path,
+                                    const uint32_t           free_before )
+{
+    if ( free_before == UINT32_MAX || ! adffs_trace_on ( ADFFS_TRACE_ALLOC ) )
+        return;
+
+    const uint32_t free_after = adfCountFreeBlocks ( adfimage->vol );
+    adffs_log_info ( "alloc: %s %s: %s%u block(s), free: %u",
+                     op, path,
+                     free_after <= free_before ? "+" : "-",
+                     free_after <= free_before ? free_before - free_after :
+                                                 free_after - free_before,
+                     free_after );
+}
+
+
+/*******************************************************
+ * Operations timed (for the statistics)
+ *******************************************************/
+
+static inline uint64_t adffs_op_start ( const adffs_op_t  op,
+                                        const char * const path )
+{
+    ADFFS_PROBE3 ( op__entry, ( int ) op, adffs_stats_op_name ( op ), path );
+    return adffs_stats_start();
+}
+
+
+// (with the arguments to record - see adffs_record.h)
+static inline int adffs_op_end_args ( const adffs_op_t   op,
+                                      const char * const path,
+                                      const char * const path2,
+                                      const uint64_t     offset,
+                                      const uint64_t     arg,
+                                      const uint64_t     start,
+                                      const int          status )
+{
+    ADFFS_PROBE4 ( op__return, ( int ) op, adffs_stats_op_name ( op ), path,
+                   status );
+    if ( adffs_record_on() )
+        adffs_record ( op, path, path2, offset, arg, start, status );
+    // (all temporary buffers of the operation)
+    adffs_arena_reset();
+    return adffs_stats_end ( op, start, status );
+}
+
+
+static inline int adffs_op_end ( const adffs_op_t   op,
+                                 const char * const path,
+                                 const uint64_t     start,
+                                 const int          status )
+{
+    return adffs_op_end_args ( op, path, NULL, 0, 0, start, status );
+}
+
+
+static int adffs_timed_getattr ( const char *  path,
+                                 struct stat * statbuf )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_GETATTR, path );
+    return adffs_op_end ( ADFFS_OP_GETATTR, path, start,
+                          adffs_getattr ( path, statbuf ) );
+}
+
+
+static int adffs_timed_readlink ( const char * path,
+                                  char *       buf,
+                                  size_t       len )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_READLINK, path );
+    return adffs_op_end ( ADFFS_OP_READLINK, path, start,
+                          adffs_readlink ( path, buf, len ) );
+}
+
+
+static int adffs_timed_mkdir ( const char * dirpath,
+                               mode_t       mode )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_MKDIR, dirpath );
+    return adffs_op_end_args ( ADFFS_OP_MKDIR, dirpath, NULL, 0, mode, start,
+                               adffs_mkdir ( dirpath, mode ) );
+}
+
+
+static int adffs_timed_unlink ( const char * filepath )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_UNLINK, filepath );
+    return adffs_op_end ( ADFFS_OP_UNLINK, filepath, start,
+                          adffs_unlink ( filepath ) );
+}
+
+
+static int adffs_timed_rmdir ( const char * dirpath )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_RMDIR, dirpath );
+    return adffs_op_end ( ADFFS_OP_RMDIR, dirpath, start,
+                          adffs_rmdir ( dirpath ) );
+}
+
+
+static int adffs_timed_rename ( const char * src_path,
+                                const char * dst_path )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_RENAME, src_path );
+    return adffs_op_end_args ( ADFFS_OP_RENAME, src_path, dst_path, 0, 0, start,
+                               adffs_rename ( src_path, dst_path ) );
+}
+
+
+static int adffs_timed_chmod ( const char * path,
+                               mode_t       mode )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_CHMOD, path );
+    return adffs_op_end_args ( ADFFS_OP_CHMOD, path, NULL, 0, mode, start,
+                               adffs_chmod ( path, mode ) );
+}
+
+
+static int adffs_timed_chown ( const char * path,
+                               uid_t        uid,
+                               gid_t        gid )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_CHOWN, path );
+    return adffs_op_end_args ( ADFFS_OP_CHOWN, path, NULL, uid, gid, start,
+                               adffs_chown ( path, uid, gid ) );
+}
+
+
+static int adffs_timed_truncate ( const char * path,
+                                  off_t        new_size )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_TRUNCATE, path );
+    return adffs_op_end_args ( ADFFS_OP_TRUNCATE, path, NULL, 0,
+                               ( uint64_t ) new_size, start,
+                               adffs_truncate ( path, new_size ) );
+}
+
+
+static int adffs_timed_open ( const char *            filepath,
+                              struct fuse_file_info * finfo )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_OPEN, filepath );
+    return adffs_op_end_args ( ADFFS_OP_OPEN, filepath, NULL, 0,
+                               ( uint64_t ) ( unsigned ) finfo->flags, start,
+                               adffs_open ( filepath, finfo ) );
+}
+
+
+static int adffs_timed_read ( const char *            path,
+                              char *                  buffer,
+                              size_t                  size,
+                              off_t                   offset,
+                              struct fuse_file_info * finfo )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_READ, path );
+    return adffs_op_end_args ( ADFFS_OP_READ, path, NULL, ( uint64_t ) offset,
+                               size, start,
+                               adffs_read ( path, buffer, size, offset, finfo ) );
+}
+
+
+static int adffs_timed_write ( const char *            path,
+                               const char *            buffer,
+                               size_t                  size,
+                               off_t                   offset,
+                               struct fuse_file_info * finfo )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_WRITE, path );
+    return adffs_op_end_args ( ADFFS_OP_WRITE, path, NULL, ( uint64_t ) offset,
+                               size, start,
+                               adffs_write ( path, buffer, size, offset, finfo ) );
+}
+
+
+static int adffs_timed_statfs ( const char *     path,
+                                struct statvfs * stvfs )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_STATFS, path );
+    return adffs_op_end ( ADFFS_OP_STATFS, path, start,
+                          adffs_statfs ( path, stvfs ) );
+}
+
+
+static int adffs_timed_release ( const char *            path,
+                                 struct fuse_file_info * finfo )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_RELEASE, path );
+    return adffs_op_end ( ADFFS_OP_RELEASE, path, start,
+                          adffs_release ( path, finfo ) );
+}
+
+
+static int adffs_timed_fsync ( const char *            path,
+                               int                     datasync,
+                               struct fuse_file_info * finfo )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_FSYNC, path );
+    return adffs_op_end_args ( ADFFS_OP_FSYNC, path, NULL, 0,
+                               ( uint64_t ) ( unsigned ) datasync, start,
+                               adffs_fsync ( path, datasync, finfo ) );
+}
+
+
+static int adffs_timed_readdir ( const char *            path,
+                                 void *                  buffer,
+                                 fuse_fill_dir_t         filler,
+                                 off_t                   offset,
+                                 struct fuse_file_info * finfo )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_READDIR, path );
+    return adffs_op_end ( ADFFS_OP_READDIR, path, start,
+                          adffs_readdir ( path, buffer, filler, offset, finfo ) );
+}
+
+
+static int adffs_timed_create ( const char *            filepath,
+                                mode_t                  mode,
+                                struct fuse_file_info * finfo )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_CREATE, filepath );
+    return adffs_op_end_args ( ADFFS_OP_CREATE, filepath, NULL, 0, mode, start,
+                               adffs_create ( filepath, mode, finfo ) );
+}
+
+
+static int adffs_timed_utimens ( const char *          path,
+                                 const struct timespec tv[2] )
+{
+    const uint64_t start = adffs_op_start ( ADFFS_OP_UTIMENS, path );
+    return adffs_op_end_args ( ADFFS_OP_UTIMENS, path, NULL,
+                               ( uint64_t ) tv [ 1 ].tv_sec,
+                               ( uint64_t ) tv [ 1 ].tv_nsec, start,
+                               adffs_utimens ( path, tv ) );
+}
+
+
 // struct fuse_operations: /usr/include/fuse/fuse.h
 struct fuse_operations adffs_oper = {
-    .getattr    = adffs_getattr,
-    .readlink   = adffs_readlink,
+    .getattr    = adffs_timed_getattr,
+    .readlink   = adffs_timed_readlink,
     .getdir     = NULL,       // deprecated
     .mknod      = NULL,
-    .mkdir      = adffs_mkdir,
-    .unlink     = adffs_unlink,
-    .rmdir      = adffs_rmdir,
+    .mkdir      = adffs_timed_mkdir,
+    .unlink     = adffs_timed_unlink,
+    .rmdir      = adffs_timed_rmdir,
     .symlink    = NULL,
-    .rename     = adffs_rename,
+    .rename     = adffs_timed_rename,
     .link       = NULL,
-    .chmod      = adffs_chmod,
-    .chown      = adffs_chown,
-    .truncate   = adffs_truncate,
+    .chmod      = adffs_timed_chmod,
+    .chown      = adffs_timed_chown,
+    .truncate   = adffs_timed_truncate,
     .utime      = NULL,
-    .open       = adffs_open,
-    .read       = adffs_read,
-    .write      = adffs_write,
-    .statfs     = adffs_statfs,
+    .open       = adffs_timed_open,
+    .read       = adffs_timed_read,
+    .write      = adffs_timed_write,
+    .statfs     = adffs_timed_statfs,
     .flush      = NULL,
-    .release    = NULL,
-    .fsync      = NULL,
+    .release    = adffs_timed_release,
+    .fsync      = adffs_timed_fsync,
     .opendir    = NULL,
-    .readdir    = adffs_readdir,
+    .readdir    = adffs_timed_readdir,
     .releasedir = NULL,
-    .fsyncdir   = NULL,
+    .fsyncdir   = adffs_timed_fsync,
     .init       = adffs_init,
     .destroy    = adffs_destroy,
     .access     = NULL,
-    .create     = adffs_create,
+    .create     = adffs_timed_create,
     .ftruncate  = NULL,
     .fgetattr   = NULL,
     .lock       = NULL,
-    .utimens    = adffs_utimens,
+    .utimens    = adffs_timed_utimens,
     .bmap       = NULL,
     .ioctl      = NULL,
     .poll       = NULL,
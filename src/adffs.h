@@ -4,19 +4,21 @@
 
 #include "adffs_fuse_api.h"
 //#include "adflib.h"
+#include "adfcollection.h"
 #include "adfimage.h"
 #include <stdio.h>
 
-//#define DEBUG_ADFFS 1
-
 //
 // adffs state
 //
 typedef
 struct adffs_state {
-    char *       mountpoint;
-    adfimage_t * adfimage;
-    FILE *       logfile;
+    char *            mountpoint;
+    adfimage_t *      adfimage;
+    adfcollection_t * collection;     // NULL if a single image is mounted
+    FILE *            logfile;
+    unsigned          ram_writeback_interval;   // seconds, 0 - no periodic
+                                                // writing back
 } adffs_state_t;
 
 static inline struct adffs_state * adffs_get_state(void)
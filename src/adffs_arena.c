@@ -0,0 +1,94 @@
+#include "adffs_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADFFS_ARENA_ALIGN       ( sizeof ( max_align_t ) )
+
+// memory taken from the heap (when the buffer is full)
+typedef struct adffs_arena_chunk {
+    struct adffs_arena_chunk * prev;
+    size_t                     size,
+                               used;
+    max_align_t                data [];
+} adffs_arena_chunk_t;
+
+static __thread struct {
+    adffs_arena_chunk_t * chunk;        // the last one (NULL - none)
+    size_t                used;         // (of the buffer)
+    max_align_t           buffer [ ADFFS_ARENA_SIZE / sizeof ( max_align_t ) ];
+} arena;
+
+
+void * adffs_arena_alloc ( const size_t size )
+{
+    if ( size > SIZE_MAX / 2 )
+        return NULL;
+    const size_t aligned = ( size + ADFFS_ARENA_ALIGN - 1 ) &
+                           ~( ADFFS_ARENA_ALIGN - 1 );
+
+    if ( arena.chunk == NULL ) {
+        if ( aligned <= sizeof ( arena.buffer ) - arena.used ) {
+            void * const ptr = ( uint8_t * ) arena.buffer + arena.used;
+            arena.used += aligned;
+            return ptr;
+        }
+    } else if ( aligned <= arena.chunk->size - arena.chunk->used ) {
+        void * const ptr = ( uint8_t * ) arena.chunk->data + arena.chunk->used;
+        arena.chunk->used += aligned;
+        return ptr;
+    }
+
+    // (at least of the size of the buffer - not to allocate often)
+    const size_t chunk_size = ( aligned > sizeof ( arena.buffer ) ) ?
+        aligned : sizeof ( arena.buffer );
+    adffs_arena_chunk_t * const chunk =
+        malloc ( sizeof ( adffs_arena_chunk_t ) + chunk_size );
+    if ( chunk == NULL )
+        return NULL;
+    chunk->prev = arena.chunk;
+    chunk->size = chunk_size;
+    chunk->used = aligned;
+    arena.chunk = chunk;
+    return chunk->data;
+}
+
+
+char * adffs_arena_strdup ( const char * const str )
+{
+    const size_t size = strlen ( str ) + 1;
+    char * const copy = adffs_arena_alloc ( size );
+    if ( copy != NULL )
+        memcpy ( copy, str, size );
+    return copy;
+}
+
+
+adffs_arena_mark_t adffs_arena_mark ( void )
+{
+    return ( adffs_arena_mark_t ) {
+        .chunk = arena.chunk,
+        .used  = ( arena.chunk != NULL ) ? arena.chunk->used : arena.used
+    };
+}
+
+
+void adffs_arena_release ( const adffs_arena_mark_t mark )
+{
+    while ( arena.chunk != NULL && arena.chunk != mark.chunk ) {
+        adffs_arena_chunk_t * const prev = arena.chunk->prev;
+        free ( arena.chunk );
+        arena.chunk = prev;
+    }
+    if ( arena.chunk != NULL )
+        arena.chunk->used = mark.used;
+    else
+        arena.used = ( mark.chunk == NULL ) ? mark.used : 0;
+}
+
+
+void adffs_arena_reset ( void )
+{
+    adffs_arena_release ( ( adffs_arena_mark_t ) { .chunk = NULL, .used = 0 } );
+}
@@ -0,0 +1,39 @@
+#ifndef ADFFS_ARENA_H
+#define ADFFS_ARENA_H
+
+/*
+ * Per-request memory (a bump arena of the calling thread)
+ *
+ * Temporary buffers of a filesystem operation (copies of paths, names
+ * of directories...) are taken from a buffer of the thread - without heap
+ * allocations - and released all at once: at the end of each operation
+ * (adffs_arena_reset(), by the handlers in adffs.c) or, in functions used
+ * also outside the handlers (adfimage_*), back to a mark taken at their
+ * start.
+ *
+ * Allocations not fitting into the buffer are taken from the heap
+ * (and freed with the release).
+ */
+
+#include <stddef.h>
+
+#define ADFFS_ARENA_SIZE        16384   // (the buffer of each thread)
+
+typedef struct adffs_arena_mark {
+    void * chunk;                       // (NULL - the buffer)
+    size_t used;
+} adffs_arena_mark_t;
+
+// memory valid until released (aligned as malloc()), NULL if out of memory
+void * adffs_arena_alloc ( const size_t size );
+
+char * adffs_arena_strdup ( const char * const str );
+
+// the current state - to release all allocated later
+adffs_arena_mark_t adffs_arena_mark ( void );
+void adffs_arena_release ( const adffs_arena_mark_t mark );
+
+// release everything allocated by the thread
+void adffs_arena_reset ( void );
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "adffs.h"
 #include "log.h"
+#include "log_async.h"
 
 #include <errno.h>
 #include <inttypes.h>
@@ -15,6 +16,7 @@
 #include <sys/stat.h>
 
 static FILE * flog = NULL;
+static bool async_enabled = true;
 
 FILE * adffs_log_open ( const char * const log_file_path )
 {
@@ -24,7 +26,21 @@ FILE * adffs_log_open ( const char * const log_file_path )
 
 void adffs_log_close ( void )
 {
+    log_async_stop();
     log_close ( flog );
+    flog = NULL;
+}
+
+void adffs_log_async_enable ( const bool enable )
+{
+    async_enabled = enable;
+}
+
+bool adffs_log_async_start ( void )
+{
+    if ( flog == NULL || ! async_enabled )
+        return false;
+    return log_async_start ( flog );
 }
 
 void adffs_log_info ( const char * const format, ... )
@@ -34,7 +50,17 @@ void adffs_log_info ( const char * const format, ... )
 
     va_list ap;
     va_start ( ap, format );
-    vlog_info ( flog, format, ap );
+    if ( log_async_is_running() ) {
+        // (if the ring is full, the message is dropped - and counted;
+        //  written synchronously only if the writer has been stopped meanwhile)
+        va_list ap_copy;
+        va_copy ( ap_copy, ap );
+        if ( ! log_async_vinfo ( format, ap_copy ) && ! log_async_is_running() )
+            vlog_info ( flog, format, ap );
+        va_end ( ap_copy );
+    } else {
+        vlog_info ( flog, format, ap );
+    }
     va_end ( ap );
 }
 
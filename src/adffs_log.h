@@ -3,11 +3,17 @@
 #define ADFFS_LOG_H
 
 #include "adffs_fuse_api.h"
+#include <stdbool.h>
 #include <stdio.h>
 
 FILE * adffs_log_open ( const char * const log_file_path );
 void adffs_log_close ( void );
 
+// writing the log asynchronously (enabled by default) - by a thread started
+// with adffs_log_async_start (after daemonizing, ie. in adffs_init)
+void adffs_log_async_enable ( const bool enable );
+bool adffs_log_async_start ( void );
+
 void adffs_log_info ( const char * const format, ... );
 
 void adffs_log_stat    ( const struct stat * const    ststat );
@@ -0,0 +1,56 @@
+#ifndef ADFFS_PROBES_H
+#define ADFFS_PROBES_H
+
+/*
+ * USDT probes (static tracepoints for perf, bpftrace, SystemTap...)
+ *
+ * Built only with FUSEADF_USDT defined (configure --enable-usdt or cmake
+ * -DFUSEADF_USDT=ON, needs sys/sdt.h) - otherwise they are not there at all.
+ * With them, a disabled probe is a single nop.
+ *
+ * Provider "fuseadf", probes (arguments):
+ *   op__entry          (op number, op name, path)
+ *   op__return         (op number, op name, path, result - >= 0 or -errno)
+ *   chdir__entry       (path)
+ *   chdir__return      (path, result - 1 ok, 0 failed)
+ *   getdentry__entry   (path)
+ *   getdentry__return  (path, entry type, header block)
+ *   block__read__entry    (block, size)
+ *   block__read__return   (block, size, result - 0 ok)
+ *   block__write__entry   (block, size)
+ *   block__write__return  (block, size, result - 0 ok)
+ *
+ * eg.:
+ *   bpftrace -e 'usdt:./fuseadf:block__read__entry { @[arg0] = count(); }'
+ */
+
+#ifdef FUSEADF_USDT
+
+#include <sys/sdt.h>
+
+#define ADFFS_PROBE1( name, a1 )                    \
+    STAP_PROBE1 ( fuseadf, name, a1 )
+#define ADFFS_PROBE2( name, a1, a2 )                \
+    STAP_PROBE2 ( fuseadf, name, a1, a2 )
+#define ADFFS_PROBE3( name, a1, a2, a3 )            \
+    STAP_PROBE3 ( fuseadf, name, a1, a2, a3 )
+#define ADFFS_PROBE4( name, a1, a2, a3, a4 )        \
+    STAP_PROBE4 ( fuseadf, name, a1, a2, a3, a4 )
+
+#else
+
+// (arguments not evaluated - only "used")
+#define ADFFS_PROBE1( name, a1 )                    \
+    do { (void) sizeof ( a1 ); } while ( 0 )
+#define ADFFS_PROBE2( name, a1, a2 )                \
+    do { (void) sizeof ( a1 ); (void) sizeof ( a2 ); } while ( 0 )
+#define ADFFS_PROBE3( name, a1, a2, a3 )            \
+    do { (void) sizeof ( a1 ); (void) sizeof ( a2 );  \
+         (void) sizeof ( a3 ); } while ( 0 )
+#define ADFFS_PROBE4( name, a1, a2, a3, a4 )        \
+    do { (void) sizeof ( a1 ); (void) sizeof ( a2 );  \
+         (void) sizeof ( a3 ); (void) sizeof ( a4 ); } while ( 0 )
+
+#endif
+
+#endif
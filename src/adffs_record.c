@@ -0,0 +1,211 @@
+#include "adffs_record.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// (a record - at most 1 + 6 varints of 10 bytes and 2 paths)
+#define ADFFS_RECORD_MAX_SIZE   ( 1 + 6 * 10 + 2 * ADFFS_RECORD_MAX_PATH )
+
+bool adffs_recording = false;
+
+static struct adffs_record_state {
+    FILE *          trace;
+    uint64_t        last_ns;        // start of the last record
+    bool            started;
+    pthread_mutex_t lock;
+    uint8_t         buf [ ADFFS_RECORD_MAX_SIZE ];
+} record = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+
+static inline uint64_t now_ns ( void )
+{
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( uint64_t ) now.tv_sec * 1000000000 + ( uint64_t ) now.tv_nsec;
+}
+
+
+/*****
+ * Recording
+ *****/
+
+bool adffs_record_start ( const char * const filename )
+{
+    if ( record.trace != NULL )
+        return false;
+
+    record.trace = fopen ( filename, "wb" );
+    if ( record.trace == NULL )
+        return false;
+    // (flushed - nothing left in the buffer when forking to daemonize)
+    if ( fwrite ( ADFFS_RECORD_MAGIC, 1, 8, record.trace ) != 8 ||
+         fflush ( record.trace ) != 0 )
+    {
+        fclose ( record.trace );
+        record.trace = NULL;
+        return false;
+    }
+    record.started = false;
+    __atomic_store_n ( &adffs_recording, true, __ATOMIC_RELAXED );
+    return true;
+}
+
+
+void adffs_record_stop ( void )
+{
+    pthread_mutex_lock ( &record.lock );
+    if ( record.trace != NULL ) {
+        __atomic_store_n ( &adffs_recording, false, __ATOMIC_RELAXED );
+        fclose ( record.trace );
+        record.trace = NULL;
+    }
+    pthread_mutex_unlock ( &record.lock );
+}
+
+
+static size_t put_varint ( uint8_t * const buf,
+                           uint64_t        value )
+{
+    size_t len = 0;
+    while ( value >= 0x80 ) {
+        buf [ len++ ] = ( uint8_t ) ( value | 0x80 );
+        value >>= 7;
+    }
+    buf [ len++ ] = ( uint8_t ) value;
+    return len;
+}
+
+
+static size_t put_string ( uint8_t * const    buf,
+                           const char * const str )
+{
+    size_t len = ( str != NULL ) ? strlen ( str ) : 0;
+    if ( len >= ADFFS_RECORD_MAX_PATH )
+        len = ADFFS_RECORD_MAX_PATH - 1;
+    const size_t n = put_varint ( buf, len );
+    if ( len > 0 )
+        memcpy ( buf + n, str, len );
+    return n + len;
+}
+
+
+void adffs_record ( const adffs_op_t   op,
+                    const char * const path,
+                    const char * const path2,
+                    const uint64_t     offset,
+                    const uint64_t     arg,
+                    const uint64_t     start_ns,
+                    const int          status )
+{
+    const uint64_t end_ns = now_ns();
+
+    pthread_mutex_lock ( &record.lock );
+    if ( record.trace == NULL ) {
+        pthread_mutex_unlock ( &record.lock );
+        return;
+    }
+    if ( ! record.started ) {
+        record.last_ns = start_ns;
+        record.started = true;
+    }
+
+    // (operations can end in different order than started - a delta
+    // can be "negative", the start is kept monotonic)
+    const uint64_t start = ( start_ns > record.last_ns ) ? start_ns : record.last_ns;
+    const int64_t  s     = status;
+    uint8_t * const buf = record.buf;
+    size_t len = 0;
+    buf [ len++ ] = ( uint8_t ) op;
+    len += put_varint ( buf + len, start - record.last_ns );
+    len += put_varint ( buf + len, end_ns - start_ns );
+    len += put_varint ( buf + len, ( ( uint64_t ) s << 1 ) ^ ( uint64_t ) ( s >> 63 ) );
+    len += put_varint ( buf + len, offset );
+    len += put_varint ( buf + len, arg );
+    len += put_string ( buf + len, path );
+    len += put_string ( buf + len, path2 );
+    record.last_ns = start;
+
+    if ( fwrite ( buf, 1, len, record.trace ) != len ) {
+        // (stop on an error - a partial record would break the trace)
+        __atomic_store_n ( &adffs_recording, false, __ATOMIC_RELAXED );
+        fclose ( record.trace );
+        record.trace = NULL;
+    }
+    pthread_mutex_unlock ( &record.lock );
+}
+
+
+/*****
+ * Reading
+ *****/
+
+static bool get_varint ( FILE * const     trace,
+                         uint64_t * const value )
+{
+    *value = 0;
+    for ( unsigned shift = 0 ; shift < 64 ; shift += 7 ) {
+        const int c = fgetc ( trace );
+        if ( c == EOF )
+            return false;
+        *value |= ( uint64_t ) ( c & 0x7f ) << shift;
+        if ( ( c & 0x80 ) == 0 )
+            return true;
+    }
+    return false;
+}
+
+
+static bool get_string ( FILE * const trace,
+                         char * const str )
+{
+    uint64_t len;
+    if ( ! get_varint ( trace, &len ) || len >= ADFFS_RECORD_MAX_PATH )
+        return false;
+    if ( len > 0 && fread ( str, 1, ( size_t ) len, trace ) != len )
+        return false;
+    str [ len ] = '\0';
+    return true;
+}
+
+
+bool adffs_record_read_header ( FILE * const trace )
+{
+    char magic [ 8 ];
+    return ( fread ( magic, 1, sizeof ( magic ), trace ) == sizeof ( magic ) &&
+             memcmp ( magic, ADFFS_RECORD_MAGIC, sizeof ( magic ) ) == 0 );
+}
+
+
+bool adffs_record_read ( FILE * const                 trace,
+                         adffs_record_entry_t * const entry,
+                         bool * const                 eof )
+{
+    *eof = false;
+    const int op = fgetc ( trace );
+    if ( op == EOF ) {
+        *eof = ! ferror ( trace );
+        return false;
+    }
+    if ( op >= ADFFS_OP_COUNT )
+        return false;
+    entry->op = ( adffs_op_t ) op;
+
+    uint64_t delta, status;
+    if ( ! get_varint ( trace, &delta ) ||
+         ! get_varint ( trace, &entry->duration_ns ) ||
+         ! get_varint ( trace, &status ) ||
+         ! get_varint ( trace, &entry->offset ) ||
+         ! get_varint ( trace, &entry->arg ) ||
+         ! get_string ( trace, entry->path ) ||
+         ! get_string ( trace, entry->path2 ) )
+    {
+        return false;
+    }
+    // (the start relative to the previous entry - read with the same one)
+    entry->start_ns += delta;
+    entry->status = ( int64_t ) ( status >> 1 ) ^ - ( int64_t ) ( status & 1 );
+    return true;
+}
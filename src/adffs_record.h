@@ -0,0 +1,80 @@
+#ifndef ADFFS_RECORD_H
+#define ADFFS_RECORD_H
+
+/*
+ * Recording the filesystem operations (to replay them later)
+ *
+ * Each operation (with its arguments, result and timing) is appended
+ * to a binary trace file, which can be replayed on any image with
+ * bench/bench_replay (also with the original timing).
+ *
+ * Format: the header (ADFFS_RECORD_MAGIC, 8 bytes), then the records:
+ *   op (1 byte),
+ *   start (ns since the previous record started),
+ *   duration (ns),
+ *   status (zigzag-encoded),
+ *   offset, arg,
+ *   length of path, path, length of path2, path2
+ * with all numbers as unsigned LEB128 varints.
+ *
+ * The arguments (offset / arg) of the operations:
+ *   read, write   - offset / size
+ *   truncate      - - / new size
+ *   open          - - / flags
+ *   mkdir, chmod, create - - / mode
+ *   chown         - uid / gid
+ *   fsync         - - / datasync
+ *   utimens       - mtime (s) / mtime (ns)
+ *   rename        - path2 is the destination
+ */
+
+#include "adffs_stats.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ADFFS_RECORD_MAGIC      "FADFREC1"
+#define ADFFS_RECORD_MAX_PATH   4096
+
+typedef struct adffs_record_entry {
+    adffs_op_t op;
+    uint64_t   start_ns,        // (since the start of recording)
+               duration_ns;
+    int64_t    status;
+    uint64_t   offset,
+               arg;
+    char       path  [ ADFFS_RECORD_MAX_PATH ],
+               path2 [ ADFFS_RECORD_MAX_PATH ];
+} adffs_record_entry_t;
+
+// recording (the file opened - before daemonizing)
+bool adffs_record_start ( const char * const filename );
+void adffs_record_stop ( void );
+
+extern bool adffs_recording;
+
+static inline bool adffs_record_on ( void )
+{
+    return __builtin_expect (
+        __atomic_load_n ( &adffs_recording, __ATOMIC_RELAXED ), 0 );
+}
+
+// record an operation (started at the time returned by adffs_stats_start)
+void adffs_record ( const adffs_op_t   op,
+                    const char * const path,
+                    const char * const path2,
+                    const uint64_t     offset,
+                    const uint64_t     arg,
+                    const uint64_t     start_ns,
+                    const int          status );
+
+// reading a trace - false on error or at the end (then *eof set);
+// the entries must be read to the same structure, zeroed before the first
+// (start_ns is a sum of the deltas)
+bool adffs_record_read_header ( FILE * const trace );
+bool adffs_record_read ( FILE * const                 trace,
+                         adffs_record_entry_t * const entry,
+                         bool * const                 eof );
+
+#endif
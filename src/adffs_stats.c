@@ -0,0 +1,355 @@
+#include "adffs_stats.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// (updated by the FUSE thread, read by the thread dumping the report -
+//  so all accesses are atomic, but without ordering)
+static adffs_op_stats_t op_stats [ ADFFS_OP_COUNT ];
+
+static const char * const op_names [ ADFFS_OP_COUNT ] = {
+    [ ADFFS_OP_GETATTR  ] = "getattr",
+    [ ADFFS_OP_READLINK ] = "readlink",
+    [ ADFFS_OP_MKDIR    ] = "mkdir",
+    [ ADFFS_OP_UNLINK   ] = "unlink",
+    [ ADFFS_OP_RMDIR    ] = "rmdir",
+    [ ADFFS_OP_RENAME   ] = "rename",
+    [ ADFFS_OP_CHMOD    ] = "chmod",
+    [ ADFFS_OP_CHOWN    ] = "chown",
+    [ ADFFS_OP_TRUNCATE ] = "truncate",
+    [ ADFFS_OP_OPEN     ] = "open",
+    [ ADFFS_OP_READ     ] = "read",
+    [ ADFFS_OP_WRITE    ] = "write",
+    [ ADFFS_OP_STATFS   ] = "statfs",
+    [ ADFFS_OP_RELEASE  ] = "release",
+    [ ADFFS_OP_FSYNC    ] = "fsync",
+    [ ADFFS_OP_READDIR  ] = "readdir",
+    [ ADFFS_OP_CREATE   ] = "create",
+    [ ADFFS_OP_UTIMENS  ] = "utimens"
+};
+
+// device I/O of the thread - and at the start of its current operation
+static __thread adffs_io_stats_t io_thread,
+                                 io_op_start;
+
+static pthread_t signal_thread;
+static bool      signal_thread_started = false;
+static bool      signal_thread_stop    = false;
+static FILE *    signal_out            = NULL;
+
+static void * adffs_stats_signal_thread ( void * arg );
+
+
+static inline uint64_t load ( const uint64_t * const value )
+{
+    return __atomic_load_n ( value, __ATOMIC_RELAXED );
+}
+
+
+const char * adffs_stats_op_name ( const adffs_op_t op )
+{
+    return op_names [ op ];
+}
+
+
+static inline uint64_t now_ns ( void )
+{
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( uint64_t ) now.tv_sec * 1000000000 + ( uint64_t ) now.tv_nsec;
+}
+
+
+uint64_t adffs_stats_start ( void )
+{
+    io_op_start = io_thread;
+    return now_ns();
+}
+
+
+int adffs_stats_end ( const adffs_op_t op,
+                      const uint64_t   start,
+                      const int        status )
+{
+    const uint64_t time_ns = now_ns() - start,
+                   time_us = time_ns / 1000;
+
+    // <1us, then powers of 2 (in microseconds)
+    unsigned bucket = ( time_us == 0 ) ?
+        0 : 64 - ( unsigned ) __builtin_clzll ( time_us );
+    if ( bucket >= ADFFS_STATS_BUCKETS )
+        bucket = ADFFS_STATS_BUCKETS - 1;
+
+    adffs_op_stats_t * const stats = &op_stats [ op ];
+    __atomic_fetch_add ( &stats->count, 1, __ATOMIC_RELAXED );
+    if ( status < 0 )
+        __atomic_fetch_add ( &stats->errors, 1, __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &stats->total_ns, time_ns, __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &stats->histogram [ bucket ], 1, __ATOMIC_RELAXED );
+    if ( time_ns > load ( &stats->max_ns ) )
+        __atomic_store_n ( &stats->max_ns, time_ns, __ATOMIC_RELAXED );
+
+    adffs_io_stats_t * const io = &stats->io;
+    __atomic_fetch_add ( &io->reads, io_thread.reads - io_op_start.reads,
+                         __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &io->writes, io_thread.writes - io_op_start.writes,
+                         __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &io->bytes_read,
+                         io_thread.bytes_read - io_op_start.bytes_read,
+                         __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &io->bytes_written,
+                         io_thread.bytes_written - io_op_start.bytes_written,
+                         __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &io->cache_hits,
+                         io_thread.cache_hits - io_op_start.cache_hits,
+                         __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &io->cache_misses,
+                         io_thread.cache_misses - io_op_start.cache_misses,
+                         __ATOMIC_RELAXED );
+
+    return status;
+}
+
+
+void adffs_stats_get ( const adffs_op_t         op,
+                       adffs_op_stats_t * const stats )
+{
+    const adffs_op_stats_t * const current = &op_stats [ op ];
+    stats->count    = load ( &current->count );
+    stats->errors   = load ( &current->errors );
+    stats->total_ns = load ( &current->total_ns );
+    stats->max_ns   = load ( &current->max_ns );
+    for ( unsigned i = 0 ; i < ADFFS_STATS_BUCKETS ; i++ )
+        stats->histogram [ i ] = load ( &current->histogram [ i ] );
+
+    stats->io.reads         = load ( &current->io.reads );
+    stats->io.writes        = load ( &current->io.writes );
+    stats->io.bytes_read    = load ( &current->io.bytes_read );
+    stats->io.bytes_written = load ( &current->io.bytes_written );
+    stats->io.cache_hits    = load ( &current->io.cache_hits );
+    stats->io.cache_misses  = load ( &current->io.cache_misses );
+}
+
+
+void adffs_stats_reset ( void )
+{
+    memset ( op_stats, 0, sizeof ( op_stats ) );
+}
+
+
+void adffs_stats_io_read ( const unsigned size )
+{
+    io_thread.reads++;
+    io_thread.bytes_read += size;
+}
+
+
+void adffs_stats_io_write ( const unsigned size )
+{
+    io_thread.writes++;
+    io_thread.bytes_written += size;
+}
+
+
+void adffs_stats_cache_hit ( void )
+{
+    io_thread.cache_hits++;
+}
+
+
+void adffs_stats_cache_miss ( void )
+{
+    io_thread.cache_misses++;
+}
+
+
+void adffs_stats_get_io ( adffs_io_stats_t * const io )
+{
+    *io = io_thread;
+}
+
+
+// (appending to a growing buffer)
+static bool report_add ( char ** const      report,
+                         size_t * const     size,
+                         size_t * const     max,
+                         const char * const format,
+                         ... ) __attribute__ ( ( format ( printf, 4, 5 ) ) );
+
+static bool report_add ( char ** const      report,
+                         size_t * const     size,
+                         size_t * const     max,
+                         const char * const format,
+                         ... )
+{
+    while ( true ) {
+        va_list ap;
+        va_start ( ap, format );
+        const int len = vsnprintf ( *report + *size, *max - *size, format, ap );
+        va_end ( ap );
+        if ( len < 0 )
+            return false;
+        if ( *size + ( size_t ) len < *max ) {
+            *size += ( size_t ) len;
+            return true;
+        }
+
+        char * const new_report = realloc ( *report, *max * 2 );
+        if ( new_report == NULL )
+            return false;
+        *report = new_report;
+        *max   *= 2;
+    }
+}
+
+
+char * adffs_stats_report ( size_t * const size )
+{
+    size_t max = 4096;
+    char * report = malloc ( max );
+    if ( report == NULL )
+        return NULL;
+    *size = 0;
+
+    bool ok = report_add ( &report, size, &max,
+                           "%-10s %10s %8s %12s %10s %10s\n",
+                           "operation", "count", "errors",
+                           "total_ms", "avg_us", "max_us" );
+
+    adffs_op_stats_t stats [ ADFFS_OP_COUNT ];
+    for ( unsigned op = 0 ; op < ADFFS_OP_COUNT && ok ; op++ ) {
+        adffs_stats_get ( ( adffs_op_t ) op, &stats [ op ] );
+        const adffs_op_stats_t * const s = &stats [ op ];
+        ok = report_add ( &report, size, &max,
+                          "%-10s %10llu %8llu %12.3f %10.1f %10.1f\n",
+                          op_names [ op ],
+                          ( unsigned long long ) s->count,
+                          ( unsigned long long ) s->errors,
+                          ( double ) s->total_ns / 1e6,
+                          ( s->count > 0 ) ?
+                              ( double ) s->total_ns / ( double ) s->count / 1e3 : 0.0,
+                          ( double ) s->max_ns / 1e3 );
+    }
+
+    // latency histograms (only non-empty buckets)
+    ok = ok && report_add ( &report, size, &max, "\nlatency (us):\n" );
+    for ( unsigned op = 0 ; op < ADFFS_OP_COUNT && ok ; op++ ) {
+        if ( stats [ op ].count == 0 )
+            continue;
+        ok = report_add ( &report, size, &max, "%-10s", op_names [ op ] );
+        for ( unsigned i = 0 ; i < ADFFS_STATS_BUCKETS && ok ; i++ ) {
+            if ( stats [ op ].histogram [ i ] == 0 )
+                continue;
+            ok = ( i < ADFFS_STATS_BUCKETS - 1 ) ?
+                report_add ( &report, size, &max, " <%lu:%llu", 1UL << i,
+                             ( unsigned long long ) stats [ op ].histogram [ i ] ) :
+                report_add ( &report, size, &max, " >=%lu:%llu", 1UL << ( i - 1 ),
+                             ( unsigned long long ) stats [ op ].histogram [ i ] );
+        }
+        ok = ok && report_add ( &report, size, &max, "\n" );
+    }
+
+    // device I/O (only of the operations done)
+    ok = ok && report_add ( &report, size, &max,
+                            "\n%-10s %10s %10s %12s %12s %10s %10s %10s\n",
+                            "device_io", "reads", "writes", "kB_read",
+                            "kB_written", "hits", "misses", "reads/op" );
+    for ( unsigned op = 0 ; op < ADFFS_OP_COUNT && ok ; op++ ) {
+        const adffs_op_stats_t * const s = &stats [ op ];
+        if ( s->count == 0 )
+            continue;
+        ok = report_add ( &report, size, &max,
+                          "%-10s %10llu %10llu %12.1f %12.1f %10llu %10llu %10.1f\n",
+                          op_names [ op ],
+                          ( unsigned long long ) s->io.reads,
+                          ( unsigned long long ) s->io.writes,
+                          ( double ) s->io.bytes_read / 1024.0,
+                          ( double ) s->io.bytes_written / 1024.0,
+                          ( unsigned long long ) s->io.cache_hits,
+                          ( unsigned long long ) s->io.cache_misses,
+                          ( double ) s->io.reads / ( double ) s->count );
+    }
+
+    if ( ! ok ) {
+        free ( report );
+        return NULL;
+    }
+    return report;
+}
+
+
+bool adffs_stats_is_path ( const char * const path )
+{
+    return ( strncmp ( path, ADFFS_STATS_DIR, sizeof ( ADFFS_STATS_DIR ) - 1 ) == 0 &&
+             ( path [ sizeof ( ADFFS_STATS_DIR ) - 1 ] == '\0' ||
+               path [ sizeof ( ADFFS_STATS_DIR ) - 1 ] == '/' ) );
+}
+
+
+bool adffs_stats_signal_start ( FILE * const out )
+{
+    if ( signal_thread_started )
+        return true;
+
+    // (SIGUSR1 blocked in this thread and all started after - so that
+    //  it is received only by sigwait in the dumping thread)
+    sigset_t set;
+    sigemptyset ( &set );
+    sigaddset ( &set, SIGUSR1 );
+    if ( pthread_sigmask ( SIG_BLOCK, &set, NULL ) != 0 )
+        return false;
+
+    signal_out         = out;
+    signal_thread_stop = false;
+    if ( pthread_create ( &signal_thread, NULL,
+                          adffs_stats_signal_thread, NULL ) != 0 )
+    {
+        return false;
+    }
+    signal_thread_started = true;
+    return true;
+}
+
+
+void adffs_stats_signal_stop ( void )
+{
+    if ( ! signal_thread_started )
+        return;
+
+    __atomic_store_n ( &signal_thread_stop, true, __ATOMIC_RELEASE );
+    pthread_kill ( signal_thread, SIGUSR1 );
+    pthread_join ( signal_thread, NULL );
+    signal_thread_started = false;
+}
+
+
+static void * adffs_stats_signal_thread ( void * arg )
+{
+    (void) arg;
+
+    sigset_t set;
+    sigemptyset ( &set );
+    sigaddset ( &set, SIGUSR1 );
+
+    while ( true ) {
+        int sig;
+        if ( sigwait ( &set, &sig ) != 0 ||
+             __atomic_load_n ( &signal_thread_stop, __ATOMIC_ACQUIRE ) )
+        {
+            break;
+        }
+
+        size_t size;
+        char * const report = adffs_stats_report ( &size );
+        if ( report != NULL ) {
+            fprintf ( signal_out, "\nfuseadf statistics:\n%s", report );
+            fflush ( signal_out );
+            free ( report );
+        }
+    }
+    return NULL;
+}
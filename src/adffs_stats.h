@@ -0,0 +1,100 @@
+#ifndef ADFFS_STATS_H
+#define ADFFS_STATS_H
+
+/*
+ * Statistics of the filesystem operations
+ *
+ * Counters, errors and latency histograms (log2 buckets, in microseconds)
+ * of each operation, available as a (read-only) virtual file
+ * (ADFFS_STATS_PATH) and dumped on SIGUSR1.
+ *
+ * Also the device I/O (block reads and writes, hits and misses of the caches
+ * of compressed images), counted per thread and accounted to the operation
+ * in progress.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ADFFS_STATS_DIR         "/.fuseadf"
+#define ADFFS_STATS_PATH        ADFFS_STATS_DIR "/stats"
+
+#define ADFFS_STATS_BUCKETS     26      // <1us, <2us, <4us, ..., >=16s
+
+typedef enum {
+    ADFFS_OP_GETATTR,
+    ADFFS_OP_READLINK,
+    ADFFS_OP_MKDIR,
+    ADFFS_OP_UNLINK,
+    ADFFS_OP_RMDIR,
+    ADFFS_OP_RENAME,
+    ADFFS_OP_CHMOD,
+    ADFFS_OP_CHOWN,
+    ADFFS_OP_TRUNCATE,
+    ADFFS_OP_OPEN,
+    ADFFS_OP_READ,
+    ADFFS_OP_WRITE,
+    ADFFS_OP_STATFS,
+    ADFFS_OP_RELEASE,
+    ADFFS_OP_FSYNC,
+    ADFFS_OP_READDIR,
+    ADFFS_OP_CREATE,
+    ADFFS_OP_UTIMENS,
+    ADFFS_OP_COUNT
+} adffs_op_t;
+
+typedef struct adffs_io_stats {
+    uint64_t reads,             // (of blocks)
+             writes,
+             bytes_read,
+             bytes_written,
+             cache_hits,
+             cache_misses;
+} adffs_io_stats_t;
+
+typedef struct adffs_op_stats {
+    uint64_t         count,
+                     errors,
+                     total_ns,
+                     max_ns,
+                     histogram [ ADFFS_STATS_BUCKETS ];
+    adffs_io_stats_t io;
+} adffs_op_stats_t;
+
+const char * adffs_stats_op_name ( const adffs_op_t op );
+
+// time of the start of an operation (to pass to adffs_stats_end)
+uint64_t adffs_stats_start ( void );
+
+// account the operation, returns its status (for convenience)
+int adffs_stats_end ( const adffs_op_t op,
+                      const uint64_t   start,
+                      const int        status );
+
+void adffs_stats_get ( const adffs_op_t         op,
+                       adffs_op_stats_t * const stats );
+
+void adffs_stats_reset ( void );
+
+// device I/O (done by the calling thread)
+void adffs_stats_io_read ( const unsigned size );
+void adffs_stats_io_write ( const unsigned size );
+void adffs_stats_cache_hit ( void );
+void adffs_stats_cache_miss ( void );
+
+// all device I/O done so far by the calling thread
+void adffs_stats_get_io ( adffs_io_stats_t * const io );
+
+// the report (as in the virtual file) - to free by the caller, NULL on error
+char * adffs_stats_report ( size_t * const size );
+
+bool adffs_stats_is_path ( const char * const path );
+
+// dumping the report to the file on SIGUSR1 - must be started
+// in the process which is going to be signalled (ie. not before
+// daemonizing) and before starting other threads
+bool adffs_stats_signal_start ( FILE * const out );
+void adffs_stats_signal_stop ( void );
+
+#endif
@@ -0,0 +1,116 @@
+#include "adffs_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+unsigned adffs_trace_categories = 0;
+
+static const struct {
+    const char * name;
+    unsigned     category;
+} categories [] = {
+    { "lookup", ADFFS_TRACE_LOOKUP },
+    { "read",   ADFFS_TRACE_READ   },
+    { "write",  ADFFS_TRACE_WRITE  },
+    { "alloc",  ADFFS_TRACE_ALLOC  },
+    { "device", ADFFS_TRACE_DEVICE },
+    { "all",    ADFFS_TRACE_ALL    },
+    { "none",   0                  }
+};
+
+#define NCATEGORIES ( sizeof ( categories ) / sizeof ( categories [ 0 ] ) )
+
+static const char * const separators = ", \t\r\n";
+
+
+bool adffs_trace_set ( const char * const spec,
+                       const size_t       len )
+{
+    unsigned enabled = __atomic_load_n ( &adffs_trace_categories,
+                                         __ATOMIC_RELAXED );
+    bool replaced = false,
+         named    = false;
+
+    size_t pos = 0;
+    while ( pos < len ) {
+        if ( strchr ( separators, spec [ pos ] ) != NULL ) {
+            pos++;
+            continue;
+        }
+
+        const char op = ( spec [ pos ] == '+' || spec [ pos ] == '-' ) ?
+            spec [ pos++ ] : '\0';
+        size_t name_len = 0;
+        while ( pos + name_len < len &&
+                strchr ( separators, spec [ pos + name_len ] ) == NULL )
+        {
+            name_len++;
+        }
+
+        unsigned i;
+        for ( i = 0 ; i < NCATEGORIES ; i++ ) {
+            if ( strlen ( categories [ i ].name ) == name_len &&
+                 strncmp ( spec + pos, categories [ i ].name, name_len ) == 0 )
+            {
+                break;
+            }
+        }
+        if ( i == NCATEGORIES )
+            return false;
+
+        if ( op == '+' ) {
+            enabled |= categories [ i ].category;
+        } else if ( op == '-' ) {
+            enabled &= ~categories [ i ].category;
+        } else {
+            // (a list - replaces the enabled categories)
+            if ( ! replaced ) {
+                enabled  = 0;
+                replaced = true;
+            }
+            enabled |= categories [ i ].category;
+        }
+        pos += name_len;
+        named = true;
+    }
+
+    // (no names at all - disable everything)
+    if ( ! named )
+        enabled = 0;
+
+    __atomic_store_n ( &adffs_trace_categories, enabled, __ATOMIC_RELAXED );
+    return true;
+}
+
+
+size_t adffs_trace_get ( char * const buf,
+                         const size_t size )
+{
+    const unsigned enabled = __atomic_load_n ( &adffs_trace_categories,
+                                               __ATOMIC_RELAXED );
+    size_t len = 0;
+    buf [ 0 ] = '\0';
+    for ( unsigned i = 0 ; i < NCATEGORIES ; i++ ) {
+        // (only the single categories)
+        const unsigned category = categories [ i ].category;
+        if ( category == 0 || ( category & ( category - 1 ) ) != 0 ||
+             ( enabled & category ) == 0 )
+        {
+            continue;
+        }
+        const int n = snprintf ( buf + len, size - len, "%s%s",
+                                 len > 0 ? "," : "", categories [ i ].name );
+        if ( n < 0 || ( size_t ) n >= size - len )
+            break;
+        len += ( size_t ) n;
+    }
+    if ( len == 0 ) {
+        const int n = snprintf ( buf, size, "none" );
+        len = ( n > 0 && ( size_t ) n < size ) ? ( size_t ) n : 0;
+    }
+    if ( len + 1 < size ) {
+        buf [ len++ ] = '\n';
+        buf [ len ] = '\0';
+    }
+    return len;
+}
@@ -0,0 +1,56 @@
+#ifndef ADFFS_TRACE_H
+#define ADFFS_TRACE_H
+
+/*
+ * Tracing (to the log)
+ *
+ * Categories of trace messages enabled and disabled at runtime - with
+ * the mount option trace=... or through the (writable) virtual file
+ * ADFFS_TRACE_PATH. A disabled category costs only a test of a global mask.
+ */
+
+#include "adffs_log.h"
+#include "adffs_stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ADFFS_TRACE_PATH        ADFFS_STATS_DIR "/trace"
+
+typedef enum {
+    ADFFS_TRACE_LOOKUP = 1 << 0,    // getattr, readdir, open, path lookups
+    ADFFS_TRACE_READ   = 1 << 1,    // reading file data
+    ADFFS_TRACE_WRITE  = 1 << 2,    // all modifications
+    ADFFS_TRACE_ALLOC  = 1 << 3,    // blocks allocated / freed by modifications
+    ADFFS_TRACE_DEVICE = 1 << 4,    // mounting, reading / writing blocks
+    ADFFS_TRACE_ALL    = ( 1 << 5 ) - 1
+} adffs_trace_category_t;
+
+// enabled categories (a mask) - use adffs_trace_on()
+extern unsigned adffs_trace_categories;
+
+static inline bool adffs_trace_on ( const unsigned category )
+{
+    return __builtin_expect (
+        ( __atomic_load_n ( &adffs_trace_categories, __ATOMIC_RELAXED ) &
+          category ) != 0, 0 );
+}
+
+#define adffs_trace( category, ... )                \
+    do {                                            \
+        if ( adffs_trace_on ( category ) )          \
+            adffs_log_info ( __VA_ARGS__ );         \
+    } while ( 0 )
+
+// set the categories from a list of names (separated with commas, spaces
+// or newlines), also "all" and "none" - with '+' or '-' before a name,
+// the category is enabled / disabled (instead of setting the whole list)
+bool adffs_trace_set ( const char * const spec,
+                       const size_t       len );
+
+// names of the enabled categories (separated with commas, ending
+// with a newline), returns the length
+size_t adffs_trace_get ( char * const buf,
+                         const size_t size );
+
+#endif
@@ -1,7 +1,12 @@
 
 #include "adfimage.h"
 
+#include "adfdev.h"
+#include "adffs_arena.h"
 #include "adffs_log.h"
+#include "adffs_probes.h"
+#include "adffs_trace.h"
+#include "adfindex.h"
 
 #include <adf_raw.h>
 #include <errno.h>
@@ -13,8 +18,6 @@
 
 #include "util.h"
 
-//#define DEBUG_ADFIMAGE 1
-
 static struct AdfDevice *
     mount_dev ( char * const adf_filename,
                 const bool   read_only );
@@ -27,28 +30,117 @@ static struct AdfVolume *
 static void append_dir ( adfimage_t * const adfimage,
                          const char * const dir );
 
+static adfimage_dentry_t find_dentry ( adfimage_t * const adfimage,
+                                       const char * const pathname );
+
+static void entry_from_block ( const struct AdfEntryBlock * const block,
+                               const ADF_SECTNUM                  sector,
+                               struct AdfEntry * const            entry );
+
+static int file_rename ( adfimage_t * const adfimage,
+                         const char * const src_pathstr,
+                         const char * const dst_pathstr );
+
+static bool change_dir ( adfimage_t * const adfimage,
+                         const char *       path );
+
 static bool isBlockAllocationBitmapValid ( struct AdfVolume * const vol );
 
+static bool adflib_init ( const bool ignore_checksum_errors );
+static void adflib_cleanup ( void );
+
 
 adfimage_t * adfimage_open ( char * const filename,
                              unsigned int volume,
                              bool         read_only,
                              const bool   ignore_checksum_errors )
 {
-    if ( adfLibInit() != ADF_RC_OK )
+    struct AdfDevice * dev = adfimage_dev_open ( filename, read_only,
+                                                 ignore_checksum_errors );
+    if ( ! dev )
         return NULL;
 
-    adfEnvSetFct ( adffs_log_info, adffs_log_info, adffs_log_info, NULL );
-    adfEnvSetProperty ( ADF_PR_IGNORE_CHECKSUM_ERRORS, ignore_checksum_errors );
+    adfimage_t * const adfimage = adfimage_open_volume ( dev, filename,
+                                                         volume, read_only );
+    if ( ! adfimage ) {
+        adfimage_dev_close ( &dev );
+        return NULL;
+    }
+    adfimage->dev_owner = true;
+
+    return adfimage;
+}
+
+
+void adfimage_close ( adfimage_t ** adfimage )
+{
+    if ( ! *adfimage )
+        return;
+    
+    // Note: no freeing adfimage->filename
+    //       ( as it points to string from argv[] )
+
+    adfindex_close ( &(*adfimage)->index );
+
+    if ( (*adfimage)->vol )
+        adfVolUnMount ( (*adfimage)->vol );
+
+    if ( (*adfimage)->dev_owner )
+        adfimage_dev_close ( &(*adfimage)->dev );
+    
+    free ( *adfimage );
+    *adfimage = NULL;
+}
+
+
+bool adfimage_flush ( adfimage_t * const adfimage )
+{
+    return adfdev_flush ( adfimage->dev );
+}
+
+
+struct AdfDevice * adfimage_dev_open ( char * const filename,
+                                       const bool   read_only,
+                                       const bool   ignore_checksum_errors )
+{
+    if ( ! adflib_init ( ignore_checksum_errors ) )
+        return NULL;
 
     struct AdfDevice * const dev = mount_dev ( filename, read_only );
     if ( ! dev ) {
-        goto adfimage_open_error_cleanup_adflib;
+        adflib_cleanup();
+        return NULL;
     }
 
+    return dev;
+}
+
+
+void adfimage_dev_close ( struct AdfDevice ** dev )
+{
+    if ( ! *dev )
+        return;
+
+    adfDevUnMount ( *dev );
+    adfDevClose ( *dev );
+    *dev = NULL;
+
+    adflib_cleanup();
+}
+
+
+adfimage_t * adfimage_open_volume ( struct AdfDevice * const dev,
+                                    char * const             filename,
+                                    unsigned int             volume,
+                                    bool                     read_only )
+{
+    // (eg. compressed images are always read-only)
+    if ( dev->readOnly )
+        read_only = true;
+
     struct AdfVolume * const vol = mount_volume ( dev, volume, read_only );
     if ( ! vol ) {
-        goto adfimage_open_error_cleanup_dev;
+        return NULL;
     }
 
     if ( ( ! read_only ) &&
@@ -56,77 +148,78 @@ adfimage_t * adfimage_open ( char * const filename,
     {
         adffs_log_info ( "adfimage_open: error: invalid bitmap, "
                          "cannot mount read-write volume %s\n", vol->volName );
-        goto adfimage_open_error_cleanup_vol;
+        goto adfimage_open_volume_error_cleanup_vol;
     }
 
     adfimage_t * const adfimage = malloc ( sizeof ( adfimage_t ) );
     if ( ! adfimage ) {
         adffs_log_info ( "adfimage_open: error: Cannot allocate memory for adfimage data\n" );
-        goto adfimage_open_error_cleanup_vol;
+        goto adfimage_open_volume_error_cleanup_vol;
     }
 
     adfimage->filename = filename;
     adfimage->dev = dev;
+    adfimage->dev_owner = false;
     adfimage->vol = vol;
     strcpy ( adfimage->cwd, "/" );
     
     stat ( adfimage->filename, &adfimage->fstat );
 
-#ifdef DEBUG_ADFIMAGE
-    const char
-        * const devinfo = adfDevGetInfo( dev ),
-        * const volinfo = adfVolGetInfo( dev );
-    adffs_log_info( "\n%s: %s\n%s\n", __func__, devinfo, volinfo );
-    free( devinfo );
-    free( volinfo );
-#endif
+    // (the index is valid only as long as the volume is not modified)
+    adfimage->index = ( vol->readOnly && adfindex_is_enabled() ) ?
+        adfindex_open ( vol, filename, volume, &adfimage->fstat ) : NULL;
+
+    if ( adffs_trace_on ( ADFFS_TRACE_DEVICE ) ) {
+        char * const volinfo = adfVolGetInfo( vol );
+        adffs_log_info( "\n%s: %s, volume %u:\n%s\n", __func__, filename, volume,
+                        volinfo != NULL ? volinfo : "" );
+        free( volinfo );
+    }
 
     return adfimage;
 
-adfimage_open_error_cleanup_vol:
+adfimage_open_volume_error_cleanup_vol:
     adfVolUnMount( vol );
-
-adfimage_open_error_cleanup_dev:
-    adfDevUnMount( dev );
-    adfDevClose( dev );
-
-adfimage_open_error_cleanup_adflib:
-    adfLibCleanUp();
     return NULL;
 }
 
 
-void adfimage_close ( adfimage_t ** adfimage )
+int adfimage_foreach_cwd_entry ( adfimage_t * const        adfimage,
+                                 const adfimage_entry_fn_t fn,
+                                 void * const              data )
 {
-    if ( ! *adfimage )
-        return;
-    
-    // Note: no freeing adfimage->filename
-    //       ( as it points to string from argv[] )
-
-    if ( (*adfimage)->vol )
-        adfVolUnMount ( (*adfimage)->vol );
-
-    if ( (*adfimage)->dev ) {
-        adfDevUnMount ( (*adfimage)->dev );
-        adfDevClose ( (*adfimage)->dev );
-    }
-    
-    free ( *adfimage );
-    *adfimage = NULL;
-
-    adfLibCleanUp();
-}
-
+    struct AdfVolume * const vol = adfimage->vol;
+    struct AdfEntryBlock dir;
+    if ( adfReadEntryBlock ( vol, vol->curDirPtr, &dir ) != ADF_RC_OK )
+        return -1;
 
-static int adflist_count_entries ( const struct AdfList * const list )
-{
+    // (the entries read one by one, in the order of adfGetDirEnt() - but
+    //  without building its list; the count limited in case of a loop
+    //  in a hash chain)
+    const int max_entries = vol->lastBlock - vol->firstBlock + 1;
     int nentries = 0;
-    for ( const struct AdfList * cell = list;
-          cell != NULL;
-          cell = cell->next )
-    {
-        nentries++;
+    for ( unsigned i = 0 ; i < ADF_HT_SIZE ; i++ ) {
+        ADF_SECTNUM sector = dir.hashTable [ i ];
+        while ( sector != 0 ) {
+            struct AdfEntryBlock entry;
+            if ( nentries == max_entries ||
+                 adfReadEntryBlock ( vol, sector, &entry ) != ADF_RC_OK )
+            {
+                return -1;
+            }
+            nentries++;
+
+            if ( fn != NULL ) {
+                const unsigned namelen = ( entry.nameLen < ADF_MAXNAMELEN ) ?
+                    entry.nameLen : ADF_MAXNAMELEN;
+                char name [ ADF_MAXNAMELEN + 1 ];
+                memcpy ( name, entry.name, namelen );
+                name [ namelen ] = '\0';
+                if ( ! fn ( data, name ) )
+                    return nentries;
+            }
+            sector = entry.nextSameHash;
+        }
     }
     return nentries;
 }
@@ -134,11 +227,8 @@ static int adflist_count_entries ( const struct AdfList * const list )
 
 int adfimage_count_cwd_entries ( adfimage_t * const adfimage )
 {
-    struct AdfVolume * const vol = adfimage->vol;
-    struct AdfList * const list = adfGetDirEnt ( vol, vol->curDirPtr );
-    int nentries = adflist_count_entries ( list );
-    adfFreeDirList ( list );
-    return nentries;
+    const int nentries = adfimage_foreach_cwd_entry ( adfimage, NULL, NULL );
+    return ( nentries > 0 ) ? nentries : 0;
 }
 
 
@@ -194,9 +284,8 @@ adfimage_dentry_t adfimage_get_root_dentry ( adfimage_t * const adfimage )
     if ( adfReadRootBlock ( vol, (unsigned) vol->rootBlock, &rootBlock ) != ADF_RC_OK )
         return adf_dentry;
 
-    if ( adfEntBlock2Entry ( ( struct AdfEntryBlock * ) &rootBlock,
-                             &adf_dentry.adflib_entry ) != ADF_RC_OK )
-        return adf_dentry;
+    entry_from_block ( ( struct AdfEntryBlock * ) &rootBlock, vol->rootBlock,
+                       &adf_dentry.adflib_entry );
 
     if ( adf_dentry.adflib_entry.type == ADF_ST_ROOT ) {
         adf_dentry.type = ADFVOLUME_DENTRY_DIRECTORY;
@@ -209,32 +298,24 @@ adfimage_dentry_t adfimage_get_root_dentry ( adfimage_t * const adfimage )
 }
 
 
-static struct AdfEntry * adflib_list_find ( struct AdfList * const dentries,
-                                            const char * const  entry_name )
+adfimage_dentry_t adfimage_getdentry ( adfimage_t * const adfimage,
+                                       const char * const pathname )
 {
-    for ( struct AdfList * lentry = dentries ;
-          lentry ;
-          lentry = lentry->next )
-    {
-        struct AdfEntry * const dentry =
-            ( struct AdfEntry * ) lentry->content;
-        //printf (" type: %d, size: %d, name: %s, comment: %s\n",
-        //        dentry->type,
-        //        dentry->size,
-        //        dentry->name,
-        //        dentry->comment );
-        //printEntry(struct Entry* entry);
-        //printEntry ( dentry );
-
-        if ( strcmp ( dentry->name, entry_name ) == 0 ) {
-            return dentry;
-        }
-    }
-    return NULL;
+    ADFFS_PROBE1 ( getdentry__entry, pathname );
+    const adfimage_dentry_t dentry = find_dentry ( adfimage, pathname );
+    ADFFS_PROBE3 ( getdentry__return, pathname, ( int ) dentry.type,
+                   ( int ) dentry.adflib_entry.sector );
+
+    adffs_trace ( ADFFS_TRACE_LOOKUP,
+                  "adfimage_getdentry ( '%s' ) => type %d, sector %d",
+                  pathname, dentry.type,
+                  dentry.type != ADFVOLUME_DENTRY_NONE ?
+                      dentry.adflib_entry.sector : -1 );
+    return dentry;
 }
 
 
-adfimage_dentry_t adfimage_getdentry ( adfimage_t * const adfimage,
+static adfimage_dentry_t find_dentry ( adfimage_t * const adfimage,
                                        const char * const pathname )
 {
     assert ( adfimage != NULL );
@@ -251,79 +332,122 @@ adfimage_dentry_t adfimage_getdentry ( adfimage_t * const adfimage,
         .type = ADFVOLUME_DENTRY_NONE
     };
 
+    const adffs_arena_mark_t mark = adffs_arena_mark();
     path_t * path = path_create ( pathname );
-    if ( path == NULL )
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
         return adf_dentry;
+    }
 
     // change the directory first (if necessary)
     char * cwd = NULL;
     if ( strlen ( path->dirpath ) > 0 ) {
-        cwd = strdup ( adfimage->cwd );
+        cwd = adffs_arena_strdup ( adfimage->cwd );
         adfimage_chdir ( adfimage, path->dirpath );
     }
 
     struct AdfVolume * const vol = adfimage->vol;
 
-    // get directory list entries (for current directory)
-    struct AdfList * const dentries = adfGetDirEnt ( vol, vol->curDirPtr );
-    if ( ! dentries ) {
-        adffs_log_info ( "adfimage_getdentry(): Error getting dir entries,"
+    // find the entry by the hash of its name (without listing the directory)
+    struct AdfEntryBlock dir,
+                         entry;
+    ADF_SECTNUM nUpdSect;
+    ADF_SECTNUM sector = -1;
+    if ( adfReadEntryBlock ( vol, vol->curDirPtr, &dir ) != ADF_RC_OK ) {
+        adffs_log_info ( "adfimage_getdentry(): Error reading the directory,"
                          "filename %s\n", pathname );
-        free ( path );
-        return adf_dentry;
+    } else {
+        sector = adfNameToEntryBlk ( vol, dir.hashTable, path->entryname,
+                                     &entry, &nUpdSect );
+        // (ADFlib compares the names ignoring case)
+        if ( sector > 0 &&
+             ( entry.nameLen != strlen ( path->entryname ) ||
+               strncmp ( entry.name, path->entryname, entry.nameLen ) != 0 ) )
+        {
+            sector = -1;
+        }
     }
 
-    // find entry in the list
-    struct AdfEntry * const dentry = adflib_list_find ( dentries, path->entryname );
-    free ( path );
-
-    if ( dentry ) {
-        adf_dentry.adflib_entry = *dentry;
+    if ( sector > 0 ) {
+        entry_from_block ( &entry, sector, &adf_dentry.adflib_entry );
 
         // regular file
-        if ( dentry->type == ADF_ST_FILE ) {
+        if ( entry.secType == ADF_ST_FILE ) {
             adf_dentry.type = ADFVOLUME_DENTRY_FILE;
         }
 
         // directory
-        else if ( dentry->type == ADF_ST_ROOT ||
-                  dentry->type == ADF_ST_DIR )
+        else if ( entry.secType == ADF_ST_ROOT ||
+                  entry.secType == ADF_ST_DIR )
         {
             adf_dentry.type = ADFVOLUME_DENTRY_DIRECTORY;
         }
 
         // "hard" file link
-        else if ( dentry->type == ADF_ST_LFILE ) {
+        else if ( entry.secType == ADF_ST_LFILE ) {
             adf_dentry.type = ADFVOLUME_DENTRY_LINKFILE;
         }
 
         // "hard" directory link
-        else if ( dentry->type == ADF_ST_LDIR ) {
+        else if ( entry.secType == ADF_ST_LDIR ) {
             adf_dentry.type = ADFVOLUME_DENTRY_LINKDIR;
         }
 
         // softlink
-        else if ( dentry->type == ADF_ST_LSOFT ) {
+        else if ( entry.secType == ADF_ST_LSOFT ) {
             adf_dentry.type = ADFVOLUME_DENTRY_SOFTLINK;
         }
 
         else {
             adffs_log_info ( "adfimage_getdentry(): pathname '%s' has unsupported "
-                             "type: %d, \n", pathname, dentry->type );
+                             "type: %d, \n", pathname, entry.secType );
             adf_dentry.type = ADFVOLUME_DENTRY_UNKNOWN;
         }
     }
-    adfListFree ( dentries );
 
     // go back to the working directory (if necessary)
-    if ( cwd ) {
+    if ( cwd )
         adfimage_chdir ( adfimage, cwd );
-        free ( cwd );
-    }
 
+    adffs_arena_release ( mark );
     return adf_dentry;
 }
 
+
+// an entry from its header block (as ADFlib's adfEntBlock2Entry does, but
+// without the name and the comment - not to allocate them)
+static void entry_from_block ( const struct AdfEntryBlock * const block,
+                               const ADF_SECTNUM                  sector,
+                               struct AdfEntry * const            entry )
+{
+    memset ( entry, 0, sizeof ( *entry ) );
+    entry->type   = block->secType;
+    entry->sector = sector;
+    entry->parent = block->parent;
+    entry->access = -1;
+
+    adfDays2Date ( block->days, &entry->year, &entry->month, &entry->days );
+    entry->hour = block->mins / 60;
+    entry->mins = block->mins % 60;
+    entry->secs = block->ticks / 50;
+
+    switch ( block->secType ) {
+    case ADF_ST_DIR:
+        entry->access = block->access;
+        break;
+    case ADF_ST_FILE:
+        entry->access = block->access;
+        entry->size   = ( uint32_t ) block->byteSize;
+        break;
+    case ADF_ST_LFILE:
+    case ADF_ST_LDIR:
+        entry->real = block->realEntry;
+        break;
+    default:
+        break;
+    }
+}
+
 int adfimage_getperm( adfimage_dentry_t * const dentry )
 {
     return
@@ -374,6 +498,16 @@ const char * adfimage_getcwd ( const adfimage_t * const adfimage )
 
 bool adfimage_chdir ( adfimage_t * const adfimage,
                       const char *       path )
+{
+    ADFFS_PROBE1 ( chdir__entry, path );
+    const bool changed = change_dir ( adfimage, path );
+    ADFFS_PROBE2 ( chdir__return, path, ( int ) changed );
+    return changed;
+}
+
+
+static bool change_dir ( adfimage_t * const adfimage,
+                         const char *       path )
 {
     struct AdfVolume * const vol = adfimage->vol;
 
@@ -391,25 +525,34 @@ bool adfimage_chdir ( adfimage_t * const adfimage,
         // no need to chdir(".")
         return true;
 
-    char * dir_path = strdup ( path );
+    const adffs_arena_mark_t mark = adffs_arena_mark();
+    char * dir_path = adffs_arena_strdup ( path );
+    if ( dir_path == NULL )
+        return false;
     char * dir = dir_path;
     char * dir_end;
     while ( *dir && ( dir_end = strchr ( dir, '/' ) ) ) {
         *dir_end = '\0';
         if ( adfChangeDir ( vol, ( char * ) dir ) != ADF_RC_OK ) {
-            free ( dir_path );
+            adffs_trace ( ADFFS_TRACE_LOOKUP, "adfimage_chdir ( '%s' ): no '%s' in '%s'",
+                          path, dir, adfimage->cwd );
+            adffs_arena_release ( mark );
             return false;
         }
         append_dir ( adfimage, dir );
         dir = dir_end + 1;
     }
     if ( adfChangeDir ( vol, ( char * ) dir ) != ADF_RC_OK ) {
-        free ( dir_path );
+        adffs_trace ( ADFFS_TRACE_LOOKUP, "adfimage_chdir ( '%s' ): no '%s' in '%s'",
+                      path, dir, adfimage->cwd );
+        adffs_arena_release ( mark );
         return false;
     }
     append_dir ( adfimage, dir );
 
-    free ( dir_path );
+    adffs_arena_release ( mark );
+    adffs_trace ( ADFFS_TRACE_LOOKUP, "adfimage_chdir ( '%s' ) => '%s'",
+                  path, adfimage->cwd );
     return true;
 }
 
@@ -418,20 +561,22 @@ struct AdfFile * adfimage_file_open ( adfimage_t * const adfimage,
                                       const char *       pathstr,
                                       const AdfFileMode  mode )
 {
+    const adffs_arena_mark_t mark = adffs_arena_mark();
     path_t * path = path_create ( pathstr );
-    if ( path == NULL )
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
         return NULL;
+    }
 
     // if necessary (file path is not in the main dir) - enter the directory
     // with the file to read
     char * cwd = NULL;
     if ( strlen ( path->dirpath ) > 0 ) {
-        cwd = strdup ( adfimage->cwd );
+        cwd = adffs_arena_strdup ( adfimage->cwd );
         if ( ! adfimage_chdir ( adfimage, path->dirpath ) ) {
             //adffs_log_info ( "adffs_read(): Cannot chdir to the directory %s.\n",
             //           dir_path );
-            free ( cwd );
-            free ( path );
+            adffs_arena_release ( mark );
             return NULL;
         }
     }
@@ -439,18 +584,17 @@ struct AdfFile * adfimage_file_open ( adfimage_t * const adfimage,
     // open the file
     struct AdfVolume * const vol = adfimage->vol;
     struct AdfFile * file = adfFileOpen ( vol, path->entryname, mode );
-    free ( path );
     if ( file == NULL ) {
         //adffs_log_info ( "Error opening file: %s\n", path );
+        adffs_arena_release ( mark );
         return NULL;
     }
 
     // go back to the working directory (if necessary)
-    if ( cwd ) {
+    if ( cwd )
         adfimage_chdir ( adfimage, cwd );
-        free ( cwd );
-    }
 
+    adffs_arena_release ( mark );
     return file;
 }
 
@@ -467,20 +611,22 @@ int adfimage_read ( adfimage_t * const adfimage,
                     size_t             size,
                     off_t              offset )
 {
+    const adffs_arena_mark_t mark = adffs_arena_mark();
     path_t * path = path_create ( pathstr );
-    if ( path == NULL )
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
         return -EINVAL; //-ENOENT;
+    }
 
     // if necessary (file path is not in the main dir) - enter the directory
     // with the file to read
     char * cwd = NULL;
     if ( strlen ( path->dirpath ) > 0 ) {
-        cwd = strdup ( adfimage->cwd );
+        cwd = adffs_arena_strdup ( adfimage->cwd );
         if ( ! adfimage_chdir ( adfimage, path->dirpath ) ) {
             //adffs_log_info ( "adffs_read(): Cannot chdir to the directory %s.\n",
             //           dir_path );
-            free ( cwd );
-            free ( path );
+            adffs_arena_release ( mark );
             return -ENOENT;
         }
     }
@@ -489,9 +635,9 @@ int adfimage_read ( adfimage_t * const adfimage,
     struct AdfVolume * const vol = adfimage->vol;
     struct AdfFile * file = adfFileOpen ( vol, path->entryname,
                                           ADF_FILE_MODE_READ );
-    free ( path );
     if ( file == NULL ) {
         //adffs_log_info ( "Error opening file: %s\n", path );
+        adffs_arena_release ( mark );
         return -ENOENT;
     }
 
@@ -506,11 +652,10 @@ int adfimage_read ( adfimage_t * const adfimage,
     adfFileClose ( file );
 
     // go back to the working directory (if necessary)
-    if ( cwd ) {
+    if ( cwd )
         adfimage_chdir ( adfimage, cwd );
-        free ( cwd );
-    }
 
+    adffs_arena_release ( mark );
     return bytes_read;
 }
 
@@ -521,20 +666,22 @@ int adfimage_write ( adfimage_t * const adfimage,
                      size_t             size,
                      off_t              offset )
 {
+    const adffs_arena_mark_t mark = adffs_arena_mark();
     path_t * path = path_create ( pathstr );
-    if ( path == NULL )
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
         return -EINVAL; //-ENOENT;
+    }
 
     // if necessary (file path is not in the main dir) - enter the directory
     // with the file to read
     char * cwd = NULL;
     if ( strlen ( path->dirpath ) > 0 ) {
-        cwd = strdup ( adfimage->cwd );
+        cwd = adffs_arena_strdup ( adfimage->cwd );
         if ( ! adfimage_chdir ( adfimage, path->dirpath ) ) {
             //adffs_log_info ( "adffs_read(): Cannot chdir to the directory %s.\n",
             //           dir_path );
-            free ( cwd );
-            free ( path );
+            adffs_arena_release ( mark );
             return -ENOENT;
         }
     }
@@ -543,9 +690,9 @@ int adfimage_write ( adfimage_t * const adfimage,
     struct AdfVolume * const vol = adfimage->vol;
     struct AdfFile * file = adfFileOpen ( vol, path->entryname,
                                           ADF_FILE_MODE_WRITE );
-    free ( path );
     if ( file == NULL ) {
         //adffs_log_info ( "Error opening file: %s\n", path );
+        adffs_arena_release ( mark );
         return -ENOENT;  // ?
     }
 
@@ -560,11 +707,10 @@ int adfimage_write ( adfimage_t * const adfimage,
     adfFileClose ( file );
 
     // go back to the working directory (if necessary)
-    if ( cwd ) {
+    if ( cwd )
         adfimage_chdir ( adfimage, cwd );
-        free ( cwd );
-    }
 
+    adffs_arena_release ( mark );
     return bytes_written;
 }
 
@@ -577,20 +723,22 @@ int adfimage_readlink ( adfimage_t * const adfimage,
 {
     int status = 0;
 
+    const adffs_arena_mark_t mark = adffs_arena_mark();
     path_t * path = path_create ( pathstr );
-    if ( path == NULL )
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
         return -EINVAL; //-ENOENT;
+    }
 
     // if necessary (file path is not in the main dir) - enter the directory
     // with the file to read
     char * cwd = NULL;
     if ( strlen ( path->dirpath ) > 0 ) {
-        cwd = strdup ( adfimage->cwd );
+        cwd = adffs_arena_strdup ( adfimage->cwd );
         if ( ! adfimage_chdir ( adfimage, path->dirpath ) ) {
             //adffs_log_info ( "adffs_readlink(): Cannot chdir to the directory %s.\n",
             //           dir_path );
-            free ( cwd );
-            free ( path );
+            adffs_arena_release ( mark );
             return -1;
         }
     }
@@ -646,11 +794,9 @@ int adfimage_readlink ( adfimage_t * const adfimage,
     }
 
 readlink_cleanup:
-    free ( path );
-    if ( cwd ) {
+    if ( cwd )
         adfimage_chdir ( adfimage, cwd );
-        free ( cwd );
-    }
+    adffs_arena_release ( mark );
 
     //strncpy ( buffer, "secret.S", len_max );
     return status;
@@ -680,21 +826,22 @@ int adfimage_mkdir ( adfimage_t * const adfimage,
     adfToRootDir ( vol );
 
     // first, find and enter the directory where the new should be created
-    char * dirpath_buf = strdup ( path_relative );
-    char * dir_path = dirname ( dirpath_buf );
+    const adffs_arena_mark_t mark = adffs_arena_mark();
+    path_t * const path = path_create ( path_relative );
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
+        return -ENOMEM;
+    }
 
-    if ( ! adfimage_chdir ( adfimage, dir_path ) ) {
+    if ( ! adfimage_chdir ( adfimage, path->dirpath ) ) {
+        adffs_arena_release ( mark );
         return -ENOENT;  // ENOTDIR / EINVAL / ?
     }
-    free ( dirpath_buf );
-
-    char * dir_name_buf = strdup ( path_relative );
-    char * dir_name = basename ( dir_name_buf );
 
     //ADF_RETCODE adfCreateDir(struct Volume* vol, ADF_SECTNUM nParent, char* name);
-    ADF_RETCODE status = adfCreateDir ( vol, vol->curDirPtr, ( char * ) dir_name );
+    ADF_RETCODE status = adfCreateDir ( vol, vol->curDirPtr, path->entryname );
 
-    free ( dir_name_buf );
+    adffs_arena_release ( mark );
     adfToRootDir ( vol );
 
     return status;
@@ -722,21 +869,22 @@ static int adfimage_remove_entry ( adfimage_t * const adfimage,
     adfToRootDir ( vol );
 
     // find and enter the directory where is the direntry (directory) to remove
-    char * dirpath_buf = strdup ( path_relative );
-    char * dir_path = dirname ( dirpath_buf );
+    const adffs_arena_mark_t mark = adffs_arena_mark();
+    path_t * const path = path_create ( path_relative );
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
+        return -ENOMEM;
+    }
 
-    if ( ! adfimage_chdir ( adfimage, dir_path ) ) {
+    if ( ! adfimage_chdir ( adfimage, path->dirpath ) ) {
+        adffs_arena_release ( mark );
         return -ENOENT;  // ENOTDIR / EINVAL / ?
     }
-    free ( dirpath_buf );
-
-    char * dir_name_buf = strdup ( path_relative );
-    char * dir_name = basename ( dir_name_buf );
 
     //ADF_RETCODE adfRemoveEntry(struct Volume *vol, ADF_SECTNUM pSect, char *name)
-    ADF_RETCODE status = adfRemoveEntry ( vol, vol->curDirPtr, dir_name );
+    ADF_RETCODE status = adfRemoveEntry ( vol, vol->curDirPtr, path->entryname );
 
-    free ( dir_name_buf );
+    adffs_arena_release ( mark );
     adfToRootDir ( vol );
 
     return status;
@@ -789,24 +937,24 @@ int adfimage_create ( adfimage_t * const adfimage,
     adfToRootDir ( vol );
 
     // first, find and enter the directory where the new should be created
-    char * dirpath_buf = strdup ( path_relative );
-    char * dir_path = dirname ( dirpath_buf );
+    const adffs_arena_mark_t mark = adffs_arena_mark();
+    path_t * const path = path_create ( path_relative );
+    if ( path == NULL ) {
+        adffs_arena_release ( mark );
+        return -ENOMEM;
+    }
 
-    if ( ! adfimage_chdir ( adfimage, dir_path ) ) {
-        free ( dirpath_buf );
+    if ( ! adfimage_chdir ( adfimage, path->dirpath ) ) {
+        adffs_arena_release ( mark );
         return -ENOENT;  // ENOTDIR / EINVAL / ?
     }
-    free ( dirpath_buf );
-
-    char * file_name_buf = strdup ( path_relative );
-    char * file_name = basename ( file_name_buf );
 
     //ADF_RETCODE adfCreateDir(struct Volume* vol, ADF_SECTNUM nParent, char* name);
     struct AdfFileHeaderBlock fhdr;
     int status = ( adfCreateFile ( vol, vol->curDirPtr,
-                                   ( char * ) file_name, &fhdr ) == ADF_RC_OK ) ?
+                                   path->entryname, &fhdr ) == ADF_RC_OK ) ?
         0 : -1;
-    free ( file_name_buf );
+    adffs_arena_release ( mark );
     adfToRootDir ( vol );
 
     return status;
@@ -836,13 +984,22 @@ int adfimage_file_rename ( adfimage_t * const adfimage,
                            const char * const src_pathstr,
                            const char * const dst_pathstr )
 {
+    const adffs_arena_mark_t mark = adffs_arena_mark();
+    const int status = file_rename ( adfimage, src_pathstr, dst_pathstr );
+    adffs_arena_release ( mark );
+    return status;
+}
+
+
+static int file_rename ( adfimage_t * const adfimage,
+                         const char * const src_pathstr,
+                         const char * const dst_pathstr )
+{
 
-#ifdef DEBUG_ADFIMAGE
     if ( src_pathstr == NULL || dst_pathstr == NULL )
         return -EINVAL;
-    adffs_log_info ( "adfimage_file_rename (. '%s',  '%s')\n",
-                     src_pathstr, dst_pathstr );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE, "adfimage_file_rename (. '%s',  '%s')\n",
+                  src_pathstr, dst_pathstr );
 
     path_t * const src_path = path_create ( src_pathstr );
     path_t * const dst_path = path_create ( dst_pathstr );
@@ -854,23 +1011,21 @@ int adfimage_file_rename ( adfimage_t * const adfimage,
         return -EINVAL;
     }
 
-#ifdef DEBUG_ADFIMAGE
-    adffs_log_info ( "adfimage_file_rename,   src: dir '%s', entry '%s'\n"
-                     "                        dst: dir '%s', entry '%s'\n",
-                     src_path->dirpath, src_path->entryname,
-                     dst_path->dirpath, dst_path->entryname );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "adfimage_file_rename,   src: dir '%s', entry '%s'\n"
+                  "                        dst: dir '%s', entry '%s'\n",
+                  src_path->dirpath, src_path->entryname,
+                  dst_path->dirpath, dst_path->entryname );
 
     // convert (FUSE to AmigaDOS) and sanitize paths
     pathstr_fuse2amigados ( src_path->dirpath );
     pathstr_fuse2amigados ( dst_path->dirpath );
 
-#ifdef DEBUG_ADFIMAGE
-    adffs_log_info ( "adfimage_file_rename 2, src: dir '%s', entry '%s'\n"
-                     "                        dst: dir '%s', entry '%s'\n",
-                     src_path->dirpath, src_path->entryname,
-                     dst_path->dirpath, dst_path->entryname );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "adfimage_file_rename 2, src: dir '%s', entry '%s'\n"
+                  "                        dst: dir '%s', entry '%s'\n",
+                  src_path->dirpath, src_path->entryname,
+                  dst_path->dirpath, dst_path->entryname );
 
     // get and check parent entry for source
     adfimage_dentry_t src_parent_entry =
@@ -929,22 +1084,19 @@ int adfimage_file_rename ( adfimage_t * const adfimage,
     }
     //assert ( dst_parent_sector > 1 );   // not in bootblock...
 
-#ifdef DEBUG_ADFIMAGE
-    adffs_log_info ( "adfimage_file_rename: calling adfRenameEntry (\n"
-                     "   ... , old parent sect: %d\n"
-                     "         old name       : %s\n"
-                     "   ... , new parent sect: %d\n"
-                     "         new name       : %s\n",
-                     src_parent_sector, src_path->entryname,
-                     dst_parent_sector, dst_path->entryname );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE,
+                  "adfimage_file_rename: calling adfRenameEntry (\n"
+                  "   ... , old parent sect: %d\n"
+                  "         old name       : %s\n"
+                  "   ... , new parent sect: %d\n"
+                  "         new name       : %s\n",
+                  src_parent_sector, src_path->entryname,
+                  dst_parent_sector, dst_path->entryname );
 
     ADF_RETCODE rc = adfRenameEntry ( adfimage->vol,
                                       src_parent_sector, src_path->entryname,
                                       dst_parent_sector, dst_path->entryname );
-#ifdef DEBUG_ADFIMAGE
-    adffs_log_info ( "adfimage_file_rename: adfRenameEntry() => %d\n", rc );
-#endif
+    adffs_trace ( ADFFS_TRACE_WRITE, "adfimage_file_rename: adfRenameEntry() => %d\n", rc );
     return ( rc == ADF_RC_OK ? 0 : -1 );
 }
 
@@ -974,19 +1126,21 @@ static struct AdfDevice *
                 const bool   read_only )
 {
     // mount device (ie. image file)
-#ifdef DEBUG_ADFIMAGE
-    printf ("Mounting file: %s\n", adf_filename );
-#endif
-
-    struct AdfDevice * const dev =
-        adfDevOpen ( adf_filename,
-                     read_only ? ADF_ACCESS_MODE_READONLY :
-                                 ADF_ACCESS_MODE_READWRITE );
+    adffs_trace ( ADFFS_TRACE_DEVICE, "Mounting file: %s", adf_filename );
+
+    // images not supported by ADFlib itself (eg. compressed)
+    // are handled by fuseadf's device driver
+    const AdfAccessMode mode = read_only ? ADF_ACCESS_MODE_READONLY :
+                                           ADF_ACCESS_MODE_READWRITE;
+    struct AdfDevice * const dev = adfdev_is_supported ( adf_filename ) ?
+        adfDevOpenWithDriver ( ADFDEV_DRIVER_NAME, adf_filename, mode ) :
+        adfDevOpen ( adf_filename, mode );
     if ( dev == NULL ) {
         fprintf ( stderr, "Error opening file/device '%s'\n",
                     adf_filename );
         return NULL;
     }
+    adfdev_count_io ( dev );
 
     ADF_RETCODE rc = adfDevMount ( dev );
     if ( rc != ADF_RC_OK ) {
@@ -995,16 +1149,13 @@ static struct AdfDevice *
         return NULL;
     }
 
-#ifdef DEBUG_ADFIMAGE
-    const char
-        * const devinfo = adfDevGetInfo( dev ),
-        * const volinfo = adfVolGetInfo( dev );
-    adffs_log_info( "\n%s: Mounted device info:\n%s\n%s\n",
-                    __func__, devinfo, volinfo );
-    free( devinfo );
-    free( volinfo );
-
-#endif
+    if ( adffs_trace_on ( ADFFS_TRACE_DEVICE ) ) {
+        char * const devinfo = adfDevGetInfo( dev );
+        adffs_log_info( "\n%s: Mounted device info (driver %s):\n%s\n",
+                        __func__, dev->drv->name,
+                        devinfo != NULL ? devinfo : "" );
+        free( devinfo );
+    }
 
     return dev;
 }
@@ -1015,9 +1166,7 @@ struct AdfVolume *
                    bool                     read_only )
 {
     // mount volume (volume/partition number, for floppies always 0 (?))
-#ifdef DEBUG_ADFIMAGE
-    printf ("\nMounting volume (partition) %d\n", partition );
-#endif
+    adffs_trace ( ADFFS_TRACE_DEVICE, "Mounting volume (partition) %u", partition );
     struct AdfVolume * const vol =
         adfVolMount ( dev, (int) partition,
                       read_only ? ADF_ACCESS_MODE_READONLY :
@@ -1027,10 +1176,6 @@ struct AdfVolume *
         return NULL;
     }
 
-#ifdef DEBUG_ADFIMAGE
-    adfVolInfo ( vol );
-#endif
-
     return vol;
 }
 
@@ -1057,3 +1202,35 @@ static bool isBlockAllocationBitmapValid ( struct AdfVolume * const vol )
     //printf ("root block read, name %s\n", root.diskName );
     return ( root.bmFlag == ADF_BM_VALID );
 }
+
+
+// ADFlib is initialized once for all open images (there can be many
+// of them open at the same time, eg. in collection mode)
+static unsigned adflib_nusers = 0;
+
+static bool adflib_init ( const bool ignore_checksum_errors )
+{
+    if ( adflib_nusers == 0 ) {
+        if ( adfLibInit() != ADF_RC_OK )
+            return false;
+        if ( ! adfdev_register() ) {
+            adfLibCleanUp();
+            return false;
+        }
+        adfEnvSetFct ( adffs_log_info, adffs_log_info, adffs_log_info, NULL );
+    }
+    adfEnvSetProperty ( ADF_PR_IGNORE_CHECKSUM_ERRORS, ignore_checksum_errors );
+    adflib_nusers++;
+    return true;
+}
+
+static void adflib_cleanup ( void )
+{
+    if ( adflib_nusers == 0 )
+        return;
+    adflib_nusers--;
+    if ( adflib_nusers == 0 ) {
+        adfdev_unregister();
+        adfLibCleanUp();
+    }
+}
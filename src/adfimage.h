@@ -16,9 +16,13 @@ typedef struct adfimage {
 
     struct AdfDevice * dev;
     struct AdfVolume * vol;
+    bool               dev_owner;   // false if the device is shared with
+                                    // other volumes (closed separately)
 
     struct stat fstat;
 
+    struct adfindex * index;        // metadata index (NULL if not used)
+
     char cwd [ ADFIMAGE_MAX_PATH ];
 
 //    FILE * logfile;
@@ -33,6 +37,22 @@ adfimage_t * adfimage_open ( char * const filename,
 //void adfimage_close ( adfimage_t * const adfimage );
 void adfimage_close ( adfimage_t ** adfimage );
 
+// write back data of the image buffered in memory (if any)
+bool adfimage_flush ( adfimage_t * const adfimage );
+
+// opening a device and (separately) its volumes - to have
+// many volumes of the same device open at the same time
+struct AdfDevice * adfimage_dev_open ( char * const filename,
+                                       const bool   read_only,
+                                       const bool   ignore_checksum_errors );
+
+void adfimage_dev_close ( struct AdfDevice ** dev );
+
+adfimage_t * adfimage_open_volume ( struct AdfDevice * const dev,
+                                    char * const             filename,
+                                    unsigned int             volume,
+                                    bool                     read_only );
+
 enum {
     ADFVOLUME_DENTRY_NONE,
     ADFVOLUME_DENTRY_FILE,
@@ -57,9 +77,21 @@ typedef struct adfimage_dentry {
     int type;
     //int size;
     struct AdfEntry adflib_entry;   // entry as returned by ADFlib
+                                    // (without the name and the comment)
     // ...
 } adfimage_dentry_t;
 
+// called for each entry of a directory, false to stop
+typedef bool ( * adfimage_entry_fn_t ) ( void * const       data,
+                                         const char * const name );
+
+// the entries of the current directory (read one by one - without
+// allocations); returns the number of entries (up to the one stopping)
+// or -1 on error
+int adfimage_foreach_cwd_entry ( adfimage_t * const        adfimage,
+                                 const adfimage_entry_fn_t fn,
+                                 void * const              data );
+
 int adfimage_count_cwd_entries ( adfimage_t * const adfimage );
 
 int adfimage_count_dir_entries ( adfimage_t * const adfimage,
@@ -0,0 +1,1209 @@
+
+#include "adfindex.h"
+
+#include "adfdev.h"
+#include "adffs_log.h"
+#include "adffs_trace.h"
+#include "adfsum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define ADFINDEX_MAGIC      "FADFMIX1"
+#define ADFINDEX_SUFFIX     ".adfidx"
+
+struct adfindex_prescan;
+
+struct adfindex {
+    adfindex_entry_t * entries;     // [ 0 ] - the root directory
+    uint32_t           nentries,
+                       entries_max;
+    int32_t *          blocks;      // block maps of all files
+    uint32_t           nblocks,
+                       blocks_max;
+    char *             names;
+    uint32_t           names_size,
+                       names_max;
+
+    // the data above can be used only when ready (it is filled
+    // by the prescan running in the background)
+    pthread_mutex_t          lock;
+    bool                     ready;
+    struct adfindex_prescan * prescan;  // NULL if not prescanned
+};
+
+/*
+ * Index file
+ *
+ * header:  magic, endianness marker, size and mtime of the image, volume,
+ *          hash of the root block (to detect a stale index), array sizes
+ * data:    entries, blocks, names
+ */
+typedef struct adfindex_file_header {
+    char     magic [ 8 ];
+    uint32_t endian,
+             volume;
+    uint64_t file_size;
+    int64_t  file_mtime_sec,
+             file_mtime_nsec;
+    uint32_t root_hash,
+             nentries,
+             nblocks,
+             names_size;
+} adfindex_file_header_t;
+
+/*
+ * Prescan - the index built in the background by a pool of threads,
+ * reading the header blocks directly from the image file (so that
+ * the reads are done in parallel, without using ADFlib)
+ */
+typedef struct adfindex_prescan_item {
+    adfindex_entry_t entry;
+    char             name [ ADF_MAXNAMELEN + 1 ];
+    int32_t *        blocks;        // block map (of a file)
+    uint32_t         dir;           // of a subdirectory (UINT32_MAX - none)
+} adfindex_prescan_item_t;
+
+typedef struct adfindex_prescan_dir {
+    int32_t                   sector;
+    adfindex_prescan_item_t * items;    // entries of the directory
+    uint32_t                  nitems;
+} adfindex_prescan_dir_t;
+
+typedef struct adfindex_prescan {
+    int                      fd;
+    uint64_t                 offset;        // of the volume in the image file
+    int32_t                  last_block;    // (of the volume)
+    unsigned                 datablock_size,
+                             nthreads;
+    char *                   path;          // of the index file (NULL - not
+    adfindex_file_header_t   key;           //  saved)
+
+    pthread_t                thread;
+    bool                     started;
+
+    // directories to scan (the root first)
+    pthread_mutex_t          lock;
+    pthread_cond_t           cond;
+    adfindex_prescan_dir_t * dirs;
+    uint32_t                 ndirs,
+                             dirs_max,
+                             next_dir,      // the next one to scan
+                             pending,       // not scanned yet
+                             nitems;
+    bool                     cancel,
+                             failed;
+} adfindex_prescan_t;
+
+typedef bool ( * adfindex_read_block_fn ) ( void * const    ctx,
+                                            const int32_t   sector,
+                                            uint8_t * const buf );
+
+static bool     adfindex_enabled         = false;
+static unsigned adfindex_prescan_threads = 0;
+
+static adfindex_t * adfindex_new ( void );
+
+static adfindex_t * adfindex_build ( struct AdfVolume * const vol );
+
+static bool adfindex_add_block_map ( adfindex_t * const       index,
+                                     struct AdfVolume * const vol,
+                                     const uint32_t           entry );
+
+static bool adfindex_get_block_map ( const adfindex_read_block_fn read_block,
+                                     void * const                 ctx,
+                                     const uint8_t * const        header,
+                                     const uint32_t               nblocks,
+                                     int32_t * const              blocks );
+
+static adfindex_prescan_t * adfindex_prescan_new ( struct AdfVolume * const vol,
+                                                   const char * const       filename );
+
+static void adfindex_prescan_free ( adfindex_prescan_t * const prescan );
+
+static void * adfindex_prescan_thread ( void * arg );
+
+static adfindex_t * adfindex_load ( const char * const                   path,
+                                    const adfindex_file_header_t * const key );
+
+static void adfindex_save ( const adfindex_t * const             index,
+                            const char * const                   path,
+                            const adfindex_file_header_t * const key );
+
+static void adfindex_free ( adfindex_t * const index );
+
+
+void adfindex_enable ( const bool enable )
+{
+    adfindex_enabled = enable;
+}
+
+
+void adfindex_set_prescan ( const unsigned nthreads )
+{
+    adfindex_prescan_threads = nthreads;
+}
+
+
+bool adfindex_is_enabled ( void )
+{
+    return ( adfindex_enabled || adfindex_prescan_threads > 0 );
+}
+
+
+static bool adfindex_is_ready ( const adfindex_t * const index )
+{
+    pthread_mutex_lock ( ( pthread_mutex_t * ) &index->lock );
+    const bool ready = index->ready;
+    pthread_mutex_unlock ( ( pthread_mutex_t * ) &index->lock );
+    return ready;
+}
+
+
+static inline uint32_t be32 ( const uint8_t * const p )
+{
+    return ( uint32_t ) p [ 0 ] << 24 | ( uint32_t ) p [ 1 ] << 16 |
+           ( uint32_t ) p [ 2 ] << 8  | ( uint32_t ) p [ 3 ];
+}
+
+
+static bool adfindex_read_block ( struct AdfVolume * const vol,
+                                  const int32_t            sector,
+                                  uint8_t * const          buf )
+{
+    if ( sector <= 0 || sector > vol->lastBlock - vol->firstBlock )
+        return false;
+    return ( adfDevReadBlock ( vol->dev,
+                               ( uint32_t ) ( vol->firstBlock + sector ),
+                               512, buf ) == ADF_RC_OK );
+}
+
+
+static bool adfindex_read_vol_block ( void * const    vol,
+                                      const int32_t   sector,
+                                      uint8_t * const buf )
+{
+    return adfindex_read_block ( ( struct AdfVolume * ) vol, sector, buf );
+}
+
+
+adfindex_t * adfindex_open ( struct AdfVolume * const  vol,
+                             const char * const        filename,
+                             const unsigned            volume,
+                             const struct stat * const fstat )
+{
+    // the key - to check if the index file matches the volume
+    uint8_t root [ 512 ];
+    if ( ! adfindex_read_block ( vol, vol->rootBlock, root ) )
+        return NULL;
+
+    adfindex_file_header_t key;
+    memset ( &key, 0, sizeof ( key ) );
+    memcpy ( key.magic, ADFINDEX_MAGIC, 8 );
+    key.endian          = 1;
+    key.volume          = volume;
+    key.file_size       = ( uint64_t ) fstat->st_size;
+    key.file_mtime_sec  = fstat->st_mtim.tv_sec;
+    key.file_mtime_nsec = fstat->st_mtim.tv_nsec;
+    key.root_hash       = ( uint32_t ) crc32 ( 0, root, 512 );
+
+    // <image>.<volume>.adfidx
+    const size_t path_size = strlen ( filename ) + 12 + sizeof ( ADFINDEX_SUFFIX );
+    char * const path = malloc ( path_size );
+    if ( path == NULL )
+        return NULL;
+    snprintf ( path, path_size, "%s.%u" ADFINDEX_SUFFIX, filename, volume );
+
+    adfindex_t * index = adfindex_enabled ? adfindex_load ( path, &key ) : NULL;
+    if ( index != NULL ) {
+        free ( path );
+        return index;
+    }
+
+    // (prescanning needs the image data as is - not compressed)
+    if ( adfindex_prescan_threads > 0 && adfdev_is_raw ( vol->dev ) ) {
+        index = adfindex_new();
+        if ( index == NULL ||
+             ( index->prescan = adfindex_prescan_new ( vol, filename ) ) == NULL )
+        {
+            adfindex_free ( index );
+            free ( path );
+            return NULL;
+        }
+        if ( adfindex_enabled ) {
+            index->prescan->path = path;
+            index->prescan->key  = key;
+        } else
+            free ( path );
+        return index;
+    }
+
+    adffs_log_info ( "adfindex_open: no valid index for %s, volume %u - "
+                     "building it\n", filename, volume );
+    index = adfindex_build ( vol );
+    if ( index != NULL && adfindex_enabled )
+        adfindex_save ( index, path, &key );
+
+    free ( path );
+    return index;
+}
+
+
+void adfindex_close ( adfindex_t ** const index )
+{
+    adfindex_t * const idx = *index;
+    if ( idx != NULL && idx->prescan != NULL && idx->prescan->started ) {
+        adfindex_prescan_t * const prescan = idx->prescan;
+        pthread_mutex_lock ( &prescan->lock );
+        prescan->cancel = true;
+        pthread_cond_broadcast ( &prescan->cond );
+        pthread_mutex_unlock ( &prescan->lock );
+        pthread_join ( prescan->thread, NULL );
+    }
+    adfindex_free ( idx );
+    *index = NULL;
+}
+
+
+bool adfindex_prescan_start ( adfindex_t * const index )
+{
+    adfindex_prescan_t * const prescan = index->prescan;
+    if ( prescan == NULL || prescan->started )
+        return true;
+
+    if ( pthread_create ( &prescan->thread, NULL,
+                          adfindex_prescan_thread, index ) != 0 )
+    {
+        adffs_log_info ( "adfindex_prescan_start: cannot start the prescan\n" );
+        return false;
+    }
+    prescan->started = true;
+    return true;
+}
+
+
+bool adfindex_prescan_wait ( adfindex_t * const index )
+{
+    adfindex_prescan_t * const prescan = index->prescan;
+    if ( prescan != NULL && prescan->started ) {
+        pthread_join ( prescan->thread, NULL );
+        prescan->started = false;
+    }
+    return adfindex_is_ready ( index );
+}
+
+
+adfindex_lookup_status_t adfindex_lookup ( const adfindex_t * const         index,
+                                           const char * const               path,
+                                           const adfindex_entry_t ** const entry )
+{
+    if ( ! adfindex_is_ready ( index ) )
+        return ADFINDEX_UNKNOWN;
+
+    const adfindex_entry_t * dir = &index->entries [ 0 ];
+    const char * name = path;
+    while ( true ) {
+        while ( *name == '/' )
+            name++;
+        if ( *name == '\0' ) {
+            *entry = dir;
+            return ADFINDEX_FOUND;
+        }
+
+        if ( dir->type == ADF_ST_LDIR )
+            return ADFINDEX_UNKNOWN;
+        if ( dir->type != ADF_ST_ROOT && dir->type != ADF_ST_DIR )
+            return ADFINDEX_NOT_FOUND;
+
+        const char * const name_end = strchr ( name, '/' );
+        const size_t namelen = ( name_end != NULL ) ?
+            ( size_t ) ( name_end - name ) : strlen ( name );
+
+        const adfindex_entry_t * child = NULL;
+        for ( uint32_t i = 0 ; i < dir->nchildren ; i++ ) {
+            const adfindex_entry_t * const c = adfindex_get_child ( index, dir, i );
+            const char * const cname = adfindex_get_name ( index, c );
+            if ( strncmp ( cname, name, namelen ) == 0 && cname [ namelen ] == '\0' ) {
+                child = c;
+                break;
+            }
+        }
+        if ( child == NULL )
+            return ADFINDEX_NOT_FOUND;
+
+        dir   = child;
+        name += namelen;
+    }
+}
+
+
+const char * adfindex_get_name ( const adfindex_t * const       index,
+                                 const adfindex_entry_t * const entry )
+{
+    return index->names + entry->name;
+}
+
+
+const adfindex_entry_t * adfindex_get_child ( const adfindex_t * const       index,
+                                              const adfindex_entry_t * const dir,
+                                              const uint32_t                 i )
+{
+    return &index->entries [ dir->first_child + i ];
+}
+
+
+const int32_t * adfindex_get_blocks ( const adfindex_t * const       index,
+                                      const adfindex_entry_t * const entry )
+{
+    if ( entry->type != ADF_ST_FILE || entry->nblocks == 0 )
+        return NULL;
+    return &index->blocks [ entry->first_block ];
+}
+
+
+adfimage_dentry_t adfindex_get_dentry ( const adfindex_t * const       index,
+                                        const adfindex_entry_t * const entry )
+{
+    adfimage_dentry_t dentry;
+    memset ( &dentry, 0, sizeof ( dentry ) );
+
+    switch ( entry->type ) {
+    case ADF_ST_FILE:   dentry.type = ADFVOLUME_DENTRY_FILE;      break;
+    case ADF_ST_ROOT:
+    case ADF_ST_DIR:    dentry.type = ADFVOLUME_DENTRY_DIRECTORY; break;
+    case ADF_ST_LFILE:  dentry.type = ADFVOLUME_DENTRY_LINKFILE;  break;
+    case ADF_ST_LDIR:   dentry.type = ADFVOLUME_DENTRY_LINKDIR;   break;
+    case ADF_ST_LSOFT:  dentry.type = ADFVOLUME_DENTRY_SOFTLINK;  break;
+    default:            dentry.type = ADFVOLUME_DENTRY_UNKNOWN;
+    }
+
+    struct AdfEntry * const aentry = &dentry.adflib_entry;
+    aentry->type   = entry->type;
+    aentry->name   = ( char * ) adfindex_get_name ( index, entry );
+    aentry->sector = entry->sector;
+    aentry->size   = entry->size;
+    aentry->access = entry->access;
+    aentry->year   = entry->year;
+    aentry->month  = entry->month;
+    aentry->days   = entry->days;
+    aentry->hour   = entry->hour;
+    aentry->mins   = entry->mins;
+    aentry->secs   = entry->secs;
+
+    return dentry;
+}
+
+
+int adfindex_read ( const adfindex_t * const       index,
+                    struct AdfVolume * const       vol,
+                    const adfindex_entry_t * const entry,
+                    char * const                   buffer,
+                    const size_t                   size,
+                    const off_t                    offset )
+{
+    if ( entry->type != ADF_ST_FILE ||
+         ( entry->nblocks == 0 && entry->size > 0 ) )
+        return -ENOSYS;
+
+    if ( offset < 0 || ( uint64_t ) offset >= entry->size )
+        return 0;
+
+    const size_t   nbytes = ( ( uint64_t ) offset + size > entry->size ) ?
+        entry->size - ( size_t ) offset : size;
+    const unsigned block_data_size = vol->datablockSize;
+    const bool     ofs = ( block_data_size != 512 );   // (data blocks with
+                                                       //  a header)
+    uint8_t block [ 512 ];
+    size_t pos = 0;
+    while ( pos < nbytes ) {
+        const uint64_t file_pos      = ( uint64_t ) offset + pos;
+        const uint32_t block_index   = ( uint32_t ) ( file_pos / block_data_size ),
+                       pos_in_block  = ( uint32_t ) ( file_pos % block_data_size );
+
+        if ( ! adfindex_read_block ( vol, index->blocks [ entry->first_block +
+                                                          block_index ], block ) ||
+             ( ofs && be32 ( block ) != ADF_T_DATA ) )
+        {
+            adffs_log_info ( "adfindex_read: error reading data block %u "
+                             "of %s\n", block_index,
+                             adfindex_get_name ( index, entry ) );
+            return -EIO;
+        }
+
+        const size_t ncopy = ( block_data_size - pos_in_block < nbytes - pos ) ?
+            block_data_size - pos_in_block : nbytes - pos;
+        memcpy ( buffer + pos, block + ( ofs ? 24 : 0 ) + pos_in_block, ncopy );
+        pos += ncopy;
+    }
+
+    return ( int ) nbytes;
+}
+
+
+/*
+ * Building the index
+ */
+
+static bool adfindex_reserve ( void ** const      array,
+                               uint32_t * const   max,
+                               const uint32_t     needed,
+                               const size_t       item_size )
+{
+    if ( needed <= *max )
+        return true;
+
+    uint32_t new_max = ( *max > 0 ) ? *max : 64;
+    while ( new_max < needed )
+        new_max *= 2;
+    void * const new_array = realloc ( *array, new_max * item_size );
+    if ( new_array == NULL )
+        return false;
+    *array = new_array;
+    *max   = new_max;
+    return true;
+}
+
+
+static bool adfindex_add_name ( adfindex_t * const index,
+                                const char * const name,
+                                uint32_t * const   offset )
+{
+    const uint32_t len = ( uint32_t ) strlen ( name ) + 1;
+    if ( ! adfindex_reserve ( ( void ** ) &index->names, &index->names_max,
+                              index->names_size + len, 1 ) )
+        return false;
+    memcpy ( index->names + index->names_size, name, len );
+    *offset = index->names_size;
+    index->names_size += len;
+    return true;
+}
+
+
+static adfindex_t * adfindex_new ( void )
+{
+    adfindex_t * const index = calloc ( 1, sizeof ( adfindex_t ) );
+    if ( index == NULL )
+        return NULL;
+    pthread_mutex_init ( &index->lock, NULL );
+    return index;
+}
+
+
+static bool adfindex_append_entry ( adfindex_t * const             index,
+                                    const adfindex_entry_t * const entry,
+                                    const char * const             name )
+{
+    if ( ! adfindex_reserve ( ( void ** ) &index->entries, &index->entries_max,
+                              index->nentries + 1, sizeof ( adfindex_entry_t ) ) )
+        return false;
+
+    adfindex_entry_t * const new_entry = &index->entries [ index->nentries ];
+    *new_entry = *entry;
+    if ( ! adfindex_add_name ( index, name, &new_entry->name ) )
+        return false;
+
+    index->nentries++;
+    return true;
+}
+
+
+static bool adfindex_add_entry ( adfindex_t * const            index,
+                                 const struct AdfEntry * const aentry )
+{
+    adfindex_entry_t entry_data;
+    adfindex_entry_t * const entry = &entry_data;
+    memset ( entry, 0, sizeof ( adfindex_entry_t ) );
+    entry->type   = aentry->type;
+    entry->sector = aentry->sector;
+    entry->access = aentry->access;
+    entry->size   = aentry->size;
+    entry->year   = aentry->year;
+    entry->month  = aentry->month;
+    entry->days   = aentry->days;
+    entry->hour   = aentry->hour;
+    entry->mins   = aentry->mins;
+    entry->secs   = aentry->secs;
+
+    return adfindex_append_entry ( index, entry,
+                                   aentry->name != NULL ? aentry->name : "" );
+}
+
+
+// walk the whole directory tree (breadth-first - so that children
+// of each directory are stored one after another)
+static adfindex_t * adfindex_build ( struct AdfVolume * const vol )
+{
+    adfindex_t * const index = adfindex_new();
+    if ( index == NULL )
+        return NULL;
+
+    struct AdfList * const tree = adfGetRDirEnt ( vol, vol->rootBlock, true );
+    struct AdfList ** lists = NULL;     // children of the entries
+    uint32_t lists_max = 0;
+
+    // the root directory
+    struct AdfRootBlock root_block;
+    struct AdfEntry root;
+    memset ( &root, 0, sizeof ( root ) );
+    if ( adfReadRootBlock ( vol, ( uint32_t ) vol->rootBlock,
+                            &root_block ) != ADF_RC_OK ||
+         adfEntBlock2Entry ( ( struct AdfEntryBlock * ) &root_block,
+                             &root ) != ADF_RC_OK )
+    {
+        goto adfindex_build_error;
+    }
+    root.type   = ADF_ST_ROOT;
+    root.sector = vol->rootBlock;
+    const bool root_added = adfindex_add_entry ( index, &root );
+    free ( root.name );
+    free ( root.comment );
+    if ( ! root_added ||
+         ! adfindex_reserve ( ( void ** ) &lists, &lists_max, 1,
+                              sizeof ( struct AdfList * ) ) )
+    {
+        goto adfindex_build_error;
+    }
+    lists [ 0 ] = tree;
+
+    for ( uint32_t i = 0 ; i < index->nentries ; i++ ) {
+        index->entries [ i ].first_child = index->nentries;
+        for ( struct AdfList * cell = lists [ i ] ; cell != NULL ; cell = cell->next ) {
+            if ( ! adfindex_add_entry ( index, ( struct AdfEntry * ) cell->content ) ||
+                 ! adfindex_reserve ( ( void ** ) &lists, &lists_max, index->nentries,
+                                      sizeof ( struct AdfList * ) ) )
+            {
+                goto adfindex_build_error;
+            }
+            lists [ index->nentries - 1 ] = cell->subdir;
+            index->entries [ i ].nchildren++;
+        }
+    }
+
+    for ( uint32_t i = 0 ; i < index->nentries ; i++ ) {
+        if ( index->entries [ i ].type == ADF_ST_FILE &&
+             ! adfindex_add_block_map ( index, vol, i ) )
+        {
+            adffs_log_info ( "adfindex_build: no block map for %s\n",
+                             adfindex_get_name ( index, &index->entries [ i ] ) );
+        }
+    }
+
+    adffs_trace ( ADFFS_TRACE_LOOKUP, "adfindex_build: %u entries, %u blocks\n",
+                  index->nentries, index->nblocks );
+
+    free ( lists );
+    adfFreeDirList ( tree );
+    index->ready = true;
+    return index;
+
+adfindex_build_error:
+    adffs_log_info ( "adfindex_build: error building the index\n" );
+    free ( lists );
+    adfFreeDirList ( tree );
+    adfindex_free ( index );
+    return NULL;
+}
+
+
+static bool adfindex_add_block_map ( adfindex_t * const       index,
+                                     struct AdfVolume * const vol,
+                                     const uint32_t           entry )
+{
+    const uint32_t size    = index->entries [ entry ].size,
+                   nblocks = ( size + vol->datablockSize - 1 ) / vol->datablockSize;
+    if ( nblocks == 0 )
+        return true;
+
+    uint8_t header [ 512 ];
+    if ( ! adfindex_read_block ( vol, index->entries [ entry ].sector, header ) ||
+         ! adfindex_reserve ( ( void ** ) &index->blocks, &index->blocks_max,
+                              index->nblocks + nblocks, sizeof ( int32_t ) ) ||
+         ! adfindex_get_block_map ( adfindex_read_vol_block, vol, header,
+                                    nblocks, index->blocks + index->nblocks ) )
+    {
+        return false;
+    }
+
+    index->entries [ entry ].first_block = index->nblocks;
+    index->entries [ entry ].nblocks     = nblocks;
+    index->nblocks += nblocks;
+    return true;
+}
+
+
+// data blocks of a file - from the file header and the extension blocks
+static bool adfindex_get_block_map ( const adfindex_read_block_fn read_block,
+                                     void * const                 ctx,
+                                     const uint8_t * const        header,
+                                     const uint32_t               nblocks,
+                                     int32_t * const              blocks )
+{
+    if ( be32 ( header ) != ADF_T_HEADER ||
+         ! adfsum_is_valid ( header ) )
+    {
+        return false;
+    }
+
+    uint8_t         ext [ 512 ];
+    const uint8_t * table = header;
+    uint32_t        n = 0;
+    while ( true ) {
+        // (stored from the end of the table)
+        for ( unsigned i = 0 ; i < ADF_MAX_DATABLK && n < nblocks ; i++ ) {
+            blocks [ n ] = ( int32_t ) be32 ( table + 24 +
+                                              4 * ( ADF_MAX_DATABLK - 1 - i ) );
+            if ( blocks [ n ] <= 0 )
+                return false;
+            n++;
+        }
+        if ( n == nblocks )
+            return true;
+
+        const int32_t extension = ( int32_t ) be32 ( table + 512 - 8 );
+        if ( ! read_block ( ctx, extension, ext ) ||
+             be32 ( ext ) != ADF_T_LIST )
+        {
+            return false;
+        }
+        table = ext;
+    }
+}
+
+
+/*
+ * Prescan
+ */
+
+static bool adfindex_prescan_read_block ( void * const    ctx,
+                                          const int32_t   sector,
+                                          uint8_t * const buf )
+{
+    const adfindex_prescan_t * const prescan = ( adfindex_prescan_t * ) ctx;
+    if ( sector <= 0 || sector > prescan->last_block )
+        return false;
+    return ( pread ( prescan->fd, buf, 512,
+                     ( off_t ) ( prescan->offset + ( uint64_t ) sector * 512 ) ) == 512 );
+}
+
+
+static adfindex_prescan_t * adfindex_prescan_new ( struct AdfVolume * const vol,
+                                                   const char * const       filename )
+{
+    adfindex_prescan_t * const prescan = calloc ( 1, sizeof ( adfindex_prescan_t ) );
+    if ( prescan == NULL )
+        return NULL;
+
+    // (opened now - the image path may be relative and the process
+    //  changes its working directory when daemonizing)
+    prescan->fd = open ( filename, O_RDONLY );
+    if ( prescan->fd < 0 ) {
+        adffs_log_info ( "adfindex_prescan_new: cannot open %s: %s\n",
+                         filename, strerror ( errno ) );
+        free ( prescan );
+        return NULL;
+    }
+    prescan->offset         = ( uint64_t ) vol->firstBlock * 512;
+    prescan->last_block     = vol->lastBlock - vol->firstBlock;
+    prescan->datablock_size = ( unsigned ) vol->datablockSize;
+    prescan->nthreads       = adfindex_prescan_threads;
+
+    pthread_mutex_init ( &prescan->lock, NULL );
+    pthread_cond_init ( &prescan->cond, NULL );
+    prescan->dirs = malloc ( 64 * sizeof ( adfindex_prescan_dir_t ) );
+    if ( prescan->dirs == NULL ) {
+        adfindex_prescan_free ( prescan );
+        return NULL;
+    }
+    prescan->dirs_max = 64;
+    prescan->dirs [ 0 ] = ( adfindex_prescan_dir_t ) { .sector = vol->rootBlock };
+    prescan->ndirs   = 1;
+    prescan->pending = 1;
+    return prescan;
+}
+
+
+static void adfindex_prescan_free ( adfindex_prescan_t * const prescan )
+{
+    if ( prescan == NULL )
+        return;
+    for ( uint32_t i = 0 ; i < prescan->ndirs ; i++ ) {
+        for ( uint32_t j = 0 ; j < prescan->dirs [ i ].nitems ; j++ )
+            free ( prescan->dirs [ i ].items [ j ].blocks );
+        free ( prescan->dirs [ i ].items );
+    }
+    free ( prescan->dirs );
+    free ( prescan->path );
+    if ( prescan->fd >= 0 )
+        close ( prescan->fd );
+    pthread_cond_destroy ( &prescan->cond );
+    pthread_mutex_destroy ( &prescan->lock );
+    free ( prescan );
+}
+
+
+// an entry from its header block (as ADFlib's adfEntBlock2Entry does)
+static bool adfindex_prescan_parse_entry ( adfindex_prescan_t * const      prescan,
+                                           const uint8_t * const           block,
+                                           const int32_t                   sector,
+                                           adfindex_prescan_item_t * const item )
+{
+    memset ( item, 0, sizeof ( adfindex_prescan_item_t ) );
+    item->dir = UINT32_MAX;
+
+    // (the header_key of the root block is 0 - not its sector)
+    const int32_t type = ( int32_t ) be32 ( block + 512 - 4 );
+    if ( be32 ( block ) != ADF_T_HEADER ||
+         ( type != ADF_ST_ROOT && ( int32_t ) be32 ( block + 4 ) != sector ) ||
+         ! adfsum_is_valid ( block ) )
+    {
+        adffs_log_info ( "adfindex_prescan: invalid header block %d\n", sector );
+        return false;
+    }
+
+    adfindex_entry_t * const entry = &item->entry;
+    entry->type   = type;
+    entry->sector = sector;
+    entry->access = -1;
+
+    const unsigned namelen = ( block [ 0x1b0 ] < ADF_MAXNAMELEN ) ?
+        block [ 0x1b0 ] : ADF_MAXNAMELEN;
+    memcpy ( item->name, block + 0x1b1, namelen );
+    item->name [ namelen ] = '\0';
+
+    int year, month, days;
+    adfDays2Date ( ( int32_t ) be32 ( block + 0x1a4 ), &year, &month, &days );
+    const int32_t mins  = ( int32_t ) be32 ( block + 0x1a8 ),
+                  ticks = ( int32_t ) be32 ( block + 0x1ac );
+    entry->year  = year;
+    entry->month = month;
+    entry->days  = days;
+    entry->hour  = mins / 60;
+    entry->mins  = mins % 60;
+    entry->secs  = ticks / 50;
+
+    switch ( entry->type ) {
+    case ADF_ST_ROOT:
+    case ADF_ST_LFILE:
+    case ADF_ST_LDIR:
+    case ADF_ST_LSOFT:
+        return true;
+
+    case ADF_ST_DIR:
+        entry->access = ( int32_t ) be32 ( block + 0x140 );
+        return true;
+
+    case ADF_ST_FILE:
+        break;
+
+    default:
+        adffs_log_info ( "adfindex_prescan: unknown entry type %d "
+                         "in block %d\n", entry->type, sector );
+        return false;
+    }
+
+    entry->access = ( int32_t ) be32 ( block + 0x140 );
+    entry->size   = be32 ( block + 0x144 );
+
+    const uint32_t nblocks = ( entry->size + prescan->datablock_size - 1 ) /
+        prescan->datablock_size;
+    if ( nblocks == 0 )
+        return true;
+    if ( nblocks > ( uint32_t ) prescan->last_block )
+        return false;
+
+    item->blocks = malloc ( nblocks * sizeof ( int32_t ) );
+    if ( item->blocks == NULL ||
+         ! adfindex_get_block_map ( adfindex_prescan_read_block, prescan,
+                                    block, nblocks, item->blocks ) )
+    {
+        // (left to the on-disk metadata)
+        adffs_log_info ( "adfindex_prescan: no block map for %s\n", item->name );
+        free ( item->blocks );
+        item->blocks = NULL;
+        return true;
+    }
+    entry->nblocks = nblocks;
+    return true;
+}
+
+
+// add a subdirectory to scan (by any of the threads)
+static bool adfindex_prescan_add_dir ( adfindex_prescan_t * const      prescan,
+                                       adfindex_prescan_item_t * const item )
+{
+    pthread_mutex_lock ( &prescan->lock );
+    const bool ok = adfindex_reserve ( ( void ** ) &prescan->dirs, &prescan->dirs_max,
+                                       prescan->ndirs + 1,
+                                       sizeof ( adfindex_prescan_dir_t ) );
+    if ( ok ) {
+        prescan->dirs [ prescan->ndirs ] =
+            ( adfindex_prescan_dir_t ) { .sector = item->entry.sector };
+        item->dir = prescan->ndirs++;
+        prescan->pending++;
+        pthread_cond_signal ( &prescan->cond );
+    }
+    pthread_mutex_unlock ( &prescan->lock );
+    return ok;
+}
+
+
+// read the entries of a directory (following the chains of its hash table)
+static bool adfindex_prescan_dir ( adfindex_prescan_t * const        prescan,
+                                   const int32_t                     sector,
+                                   adfindex_prescan_item_t ** const  items,
+                                   uint32_t * const                  nitems )
+{
+    uint8_t dir_block [ 512 ],
+            block [ 512 ];
+    if ( ! adfindex_prescan_read_block ( prescan, sector, dir_block ) ||
+         be32 ( dir_block ) != ADF_T_HEADER ||
+         ! adfsum_is_valid ( dir_block ) )
+    {
+        adffs_log_info ( "adfindex_prescan: invalid directory block %d\n", sector );
+        return false;
+    }
+
+    uint32_t items_max = 0;
+    for ( unsigned i = 0 ; i < ADF_HT_SIZE ; i++ ) {
+        int32_t next = ( int32_t ) be32 ( dir_block + 24 + 4 * i );
+        while ( next != 0 ) {
+            pthread_mutex_lock ( &prescan->lock );
+            const bool stop = prescan->cancel || prescan->failed ||
+                // (a loop in a damaged filesystem)
+                ++prescan->nitems > ( uint32_t ) prescan->last_block;
+            pthread_mutex_unlock ( &prescan->lock );
+            if ( stop ||
+                 ! adfindex_prescan_read_block ( prescan, next, block ) ||
+                 ! adfindex_reserve ( ( void ** ) items, &items_max, *nitems + 1,
+                                      sizeof ( adfindex_prescan_item_t ) ) )
+            {
+                return false;
+            }
+
+            adfindex_prescan_item_t * const item = &( *items ) [ *nitems ];
+            if ( ! adfindex_prescan_parse_entry ( prescan, block, next, item ) ) {
+                return false;
+            }
+            ( *nitems )++;
+
+            if ( item->entry.type == ADF_ST_DIR &&
+                 ! adfindex_prescan_add_dir ( prescan, item ) )
+            {
+                return false;
+            }
+            next = ( int32_t ) be32 ( block + 512 - 16 );
+        }
+    }
+    return true;
+}
+
+
+static void * adfindex_prescan_worker ( void * arg )
+{
+    adfindex_prescan_t * const prescan = ( adfindex_prescan_t * ) arg;
+
+    pthread_mutex_lock ( &prescan->lock );
+    while ( true ) {
+        while ( prescan->next_dir == prescan->ndirs && prescan->pending > 0 &&
+                ! prescan->cancel && ! prescan->failed )
+        {
+            pthread_cond_wait ( &prescan->cond, &prescan->lock );
+        }
+        if ( prescan->next_dir == prescan->ndirs ||
+             prescan->cancel || prescan->failed )
+        {
+            break;
+        }
+
+        const uint32_t dir    = prescan->next_dir++;
+        const int32_t  sector = prescan->dirs [ dir ].sector;
+        pthread_mutex_unlock ( &prescan->lock );
+
+        adfindex_prescan_item_t * items = NULL;
+        uint32_t nitems = 0;
+        const bool ok = adfindex_prescan_dir ( prescan, sector, &items, &nitems );
+
+        // (the array of directories might have been reallocated meanwhile)
+        pthread_mutex_lock ( &prescan->lock );
+        prescan->dirs [ dir ].items  = items;
+        prescan->dirs [ dir ].nitems = nitems;
+        if ( ! ok )
+            prescan->failed = true;
+        prescan->pending--;
+        if ( prescan->pending == 0 || prescan->failed )
+            pthread_cond_broadcast ( &prescan->cond );
+    }
+    pthread_cond_broadcast ( &prescan->cond );
+    pthread_mutex_unlock ( &prescan->lock );
+    return NULL;
+}
+
+
+// put the scanned directories together - in the same order as adfindex_build
+static bool adfindex_prescan_assemble ( adfindex_t * const               index,
+                                        const adfindex_prescan_t * const prescan )
+{
+    uint8_t root_block [ 512 ];
+    adfindex_prescan_item_t root;
+    if ( ! adfindex_prescan_read_block ( ( void * ) prescan,
+                                         prescan->dirs [ 0 ].sector, root_block ) ||
+         ! adfindex_prescan_parse_entry ( ( adfindex_prescan_t * ) prescan,
+                                          root_block, prescan->dirs [ 0 ].sector,
+                                          &root ) ||
+         root.entry.type != ADF_ST_ROOT ||
+         ! adfindex_append_entry ( index, &root.entry, root.name ) )
+    {
+        return false;
+    }
+
+    // the scanned directory of each entry (of a directory)
+    uint32_t * dirs = NULL,
+               dirs_max = 0;
+    if ( ! adfindex_reserve ( ( void ** ) &dirs, &dirs_max, 1, sizeof ( uint32_t ) ) )
+        return false;
+    dirs [ 0 ] = 0;
+
+    for ( uint32_t i = 0 ; i < index->nentries ; i++ ) {
+        index->entries [ i ].first_child = index->nentries;
+        if ( dirs [ i ] == UINT32_MAX )
+            continue;
+
+        const adfindex_prescan_dir_t * const dir = &prescan->dirs [ dirs [ i ] ];
+        for ( uint32_t j = 0 ; j < dir->nitems ; j++ ) {
+            const adfindex_prescan_item_t * const item = &dir->items [ j ];
+            adfindex_entry_t entry = item->entry;
+            if ( entry.nblocks > 0 ) {
+                if ( ! adfindex_reserve ( ( void ** ) &index->blocks, &index->blocks_max,
+                                          index->nblocks + entry.nblocks,
+                                          sizeof ( int32_t ) ) )
+                {
+                    free ( dirs );
+                    return false;
+                }
+                memcpy ( index->blocks + index->nblocks, item->blocks,
+                         entry.nblocks * sizeof ( int32_t ) );
+                entry.first_block = index->nblocks;
+                index->nblocks += entry.nblocks;
+            }
+
+            if ( ! adfindex_append_entry ( index, &entry, item->name ) ||
+                 ! adfindex_reserve ( ( void ** ) &dirs, &dirs_max, index->nentries,
+                                      sizeof ( uint32_t ) ) )
+            {
+                free ( dirs );
+                return false;
+            }
+            dirs [ index->nentries - 1 ] = item->dir;
+            index->entries [ i ].nchildren++;
+        }
+    }
+
+    free ( dirs );
+    return true;
+}
+
+
+static void * adfindex_prescan_thread ( void * arg )
+{
+    adfindex_t * const         index   = ( adfindex_t * ) arg;
+    adfindex_prescan_t * const prescan = index->prescan;
+
+    pthread_t workers [ ADFINDEX_PRESCAN_THREADS_MAX ];
+    const unsigned nthreads = ( prescan->nthreads < ADFINDEX_PRESCAN_THREADS_MAX ) ?
+        prescan->nthreads : ADFINDEX_PRESCAN_THREADS_MAX;
+    unsigned nworkers = 0;
+    while ( nworkers < nthreads &&
+            pthread_create ( &workers [ nworkers ], NULL,
+                             adfindex_prescan_worker, prescan ) == 0 )
+    {
+        nworkers++;
+    }
+    if ( nworkers == 0 )
+        adfindex_prescan_worker ( prescan );
+    for ( unsigned i = 0 ; i < nworkers ; i++ )
+        pthread_join ( workers [ i ], NULL );
+
+    if ( prescan->cancel )
+        return NULL;
+
+    adfindex_t * const built = adfindex_new();
+    if ( prescan->failed || built == NULL ||
+         ! adfindex_prescan_assemble ( built, prescan ) )
+    {
+        // (the on-disk metadata is used)
+        adffs_log_info ( "adfindex_prescan: error building the index\n" );
+        adfindex_free ( built );
+        return NULL;
+    }
+
+    adffs_trace ( ADFFS_TRACE_LOOKUP, "adfindex_prescan: %u entries, %u blocks, %u threads\n",
+                  built->nentries, built->nblocks, nworkers );
+
+    pthread_mutex_lock ( &index->lock );
+    index->entries    = built->entries;
+    index->nentries   = built->nentries;
+    index->blocks     = built->blocks;
+    index->nblocks    = built->nblocks;
+    index->names      = built->names;
+    index->names_size = built->names_size;
+    index->ready      = true;
+    pthread_mutex_unlock ( &index->lock );
+
+    built->entries = NULL;
+    built->blocks  = NULL;
+    built->names   = NULL;
+    adfindex_free ( built );
+
+    if ( prescan->path != NULL )
+        adfindex_save ( index, prescan->path, &prescan->key );
+    return NULL;
+}
+
+
+static void adfindex_free ( adfindex_t * const index )
+{
+    if ( index == NULL )
+        return;
+    adfindex_prescan_free ( index->prescan );
+    pthread_mutex_destroy ( &index->lock );
+    free ( index->entries );
+    free ( index->blocks );
+    free ( index->names );
+    free ( index );
+}
+
+
+/*
+ * Index file
+ */
+
+// check that the loaded data is consistent (not to follow invalid
+// offsets of a damaged file)
+static bool adfindex_is_valid ( const adfindex_t * const index )
+{
+    if ( index->nentries == 0 ||
+         index->entries [ 0 ].type != ADF_ST_ROOT ||
+         index->names_size == 0 ||
+         index->names [ index->names_size - 1 ] != '\0' )
+    {
+        return false;
+    }
+
+    for ( uint32_t i = 0 ; i < index->nentries ; i++ ) {
+        const adfindex_entry_t * const entry = &index->entries [ i ];
+        if ( entry->name >= index->names_size ||
+             ( entry->nchildren > 0 &&
+               ( entry->first_child <= i ||
+                 entry->first_child > index->nentries ||
+                 entry->nchildren > index->nentries - entry->first_child ) ) ||
+             entry->first_block > index->nblocks ||
+             entry->nblocks > index->nblocks - entry->first_block )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static adfindex_t * adfindex_load ( const char * const                   path,
+                                    const adfindex_file_header_t * const key )
+{
+    FILE * const file = fopen ( path, "rb" );
+    if ( file == NULL )
+        return NULL;
+
+    adfindex_file_header_t header;
+    if ( fread ( &header, sizeof ( header ), 1, file ) != 1 ||
+         memcmp ( header.magic, key->magic, 8 ) != 0 ||
+         header.endian != key->endian ||
+         header.volume != key->volume ||
+         header.file_size != key->file_size ||
+         header.file_mtime_sec != key->file_mtime_sec ||
+         header.file_mtime_nsec != key->file_mtime_nsec ||
+         header.root_hash != key->root_hash )
+    {
+        adffs_log_info ( "adfindex_load: stale index %s\n", path );
+        fclose ( file );
+        return NULL;
+    }
+
+    adfindex_t * const index = adfindex_new();
+    if ( index == NULL ) {
+        fclose ( file );
+        return NULL;
+    }
+    index->nentries   = index->entries_max = header.nentries;
+    index->nblocks    = index->blocks_max  = header.nblocks;
+    index->names_size = index->names_max   = header.names_size;
+    index->entries = malloc ( header.nentries * sizeof ( adfindex_entry_t ) + 1 );
+    index->blocks  = malloc ( header.nblocks * sizeof ( int32_t ) + 1 );
+    index->names   = malloc ( header.names_size + 1 );
+
+    const bool ok =
+        index->entries != NULL &&
+        index->blocks != NULL &&
+        index->names != NULL &&
+        fread ( index->entries, sizeof ( adfindex_entry_t ),
+                header.nentries, file ) == header.nentries &&
+        fread ( index->blocks, sizeof ( int32_t ),
+                header.nblocks, file ) == header.nblocks &&
+        fread ( index->names, 1, header.names_size, file ) == header.names_size &&
+        adfindex_is_valid ( index );
+    fclose ( file );
+
+    if ( ! ok ) {
+        adffs_log_info ( "adfindex_load: invalid index %s\n", path );
+        adfindex_free ( index );
+        return NULL;
+    }
+    index->ready = true;
+    return index;
+}
+
+
+static void adfindex_save ( const adfindex_t * const             index,
+                            const char * const                   path,
+                            const adfindex_file_header_t * const key )
+{
+    // written to a temporary file first - to never leave a partial index
+    const size_t tmp_path_size = strlen ( path ) + 5;
+    char * const tmp_path = malloc ( tmp_path_size );
+    if ( tmp_path == NULL )
+        return;
+    snprintf ( tmp_path, tmp_path_size, "%s.tmp", path );
+
+    FILE * const file = fopen ( tmp_path, "wb" );
+    if ( file == NULL ) {
+        adffs_log_info ( "adfindex_save: cannot create %s: %s\n",
+                         tmp_path, strerror ( errno ) );
+        free ( tmp_path );
+        return;
+    }
+
+    adfindex_file_header_t header = *key;
+    header.nentries   = index->nentries;
+    header.nblocks    = index->nblocks;
+    header.names_size = index->names_size;
+
+    bool ok =
+        fwrite ( &header, sizeof ( header ), 1, file ) == 1 &&
+        fwrite ( index->entries, sizeof ( adfindex_entry_t ),
+                 index->nentries, file ) == index->nentries &&
+        fwrite ( index->blocks, sizeof ( int32_t ),
+                 index->nblocks, file ) == index->nblocks &&
+        fwrite ( index->names, 1, index->names_size, file ) == index->names_size;
+    ok = ( fclose ( file ) == 0 ) && ok;
+
+    if ( ! ok || rename ( tmp_path, path ) != 0 ) {
+        adffs_log_info ( "adfindex_save: error writing %s\n", path );
+        unlink ( tmp_path );
+    }
+    free ( tmp_path );
+}
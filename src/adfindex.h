@@ -0,0 +1,111 @@
+#ifndef ADFINDEX_H
+#define ADFINDEX_H
+
+/*
+ * Metadata index of a (read-only) volume
+ *
+ * The whole directory tree (names, sectors, sizes, dates, protection
+ * flags) and the data block maps of files, built once by walking
+ * the volume and kept in a file (<image>.<volume>.adfidx), so that
+ * on the next mount it is just loaded instead of reading the metadata
+ * from the image again.
+ *
+ * The index file is keyed by the size and mtime of the image and a hash
+ * of the volume's root block - if any of these differs, the index is
+ * stale and it is rebuilt from the on-disk metadata.
+ *
+ * With the prescan, the index is built in the background by a pool
+ * of threads, reading the header blocks of directories and files directly
+ * from the image (in parallel); until it is done, lookups are left
+ * to the on-disk metadata.
+ *
+ * Hard links are not followed - lookups through them (and of their
+ * attributes) are left to the on-disk metadata.
+ */
+
+#include "adfimage.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADFINDEX_PRESCAN_THREADS_DEFAULT    4
+#define ADFINDEX_PRESCAN_THREADS_MAX        32
+
+typedef struct adfindex_entry {
+    uint32_t name;                  // offset in the names
+    int32_t  type,                  // ADF_ST_*
+             sector,
+             access;
+    uint32_t size;                  // of a file (in bytes)
+    int32_t  year, month, days,
+             hour, mins, secs;
+    uint32_t first_child,           // (children of a directory are stored
+             nchildren,             //  one after another)
+             first_block,           // data blocks of a file
+             nblocks;               // (0 with size > 0 - no block map)
+} adfindex_entry_t;
+
+typedef struct adfindex adfindex_t;
+
+typedef enum {
+    ADFINDEX_FOUND,
+    ADFINDEX_NOT_FOUND,
+    ADFINDEX_UNKNOWN                // (eg. the path goes through a hard link)
+} adfindex_lookup_status_t;
+
+// keep indexes of read-only volumes in files (disabled by default)
+void adfindex_enable ( const bool enable );
+
+// build indexes of read-only volumes in the background with nthreads
+// threads (0 - disabled, the default)
+void adfindex_set_prescan ( const unsigned nthreads );
+
+// true if indexes are used (kept in files or prescanned)
+bool adfindex_is_enabled ( void );
+
+// load the index of the volume (or, if there is no valid index file, build
+// it - now or, if prescanning, in the background), NULL on error
+adfindex_t * adfindex_open ( struct AdfVolume * const  vol,
+                             const char * const        filename,
+                             const unsigned            volume,
+                             const struct stat * const fstat );
+
+void adfindex_close ( adfindex_t ** const index );
+
+// start building the index in the background (if prescanning) - must be
+// called in the process which is going to use it (ie. not before daemonizing)
+bool adfindex_prescan_start ( adfindex_t * const index );
+
+// wait for the prescan to finish, true if the index is ready
+bool adfindex_prescan_wait ( adfindex_t * const index );
+
+adfindex_lookup_status_t adfindex_lookup ( const adfindex_t * const         index,
+                                           const char * const               path,
+                                           const adfindex_entry_t ** const entry );
+
+const char * adfindex_get_name ( const adfindex_t * const       index,
+                                 const adfindex_entry_t * const entry );
+
+const adfindex_entry_t * adfindex_get_child ( const adfindex_t * const       index,
+                                              const adfindex_entry_t * const dir,
+                                              const uint32_t                 i );
+
+// the data block map of a file - sectors (relative to the volume)
+// of its entry->nblocks data blocks, NULL if it has no block map
+const int32_t * adfindex_get_blocks ( const adfindex_t * const       index,
+                                      const adfindex_entry_t * const entry );
+
+// the entry as a dentry (of adfimage)
+adfimage_dentry_t adfindex_get_dentry ( const adfindex_t * const       index,
+                                        const adfindex_entry_t * const entry );
+
+// read file data using the block map (the number of bytes read or
+// negative errno; -ENOSYS if the file has no block map)
+int adfindex_read ( const adfindex_t * const       index,
+                    struct AdfVolume * const       vol,
+                    const adfindex_entry_t * const entry,
+                    char * const                   buffer,
+                    const size_t                   size,
+                    const off_t                    offset );
+
+#endif
@@ -0,0 +1,304 @@
+
+#include "adfsum.h"
+
+#include <stddef.h>
+
+#if defined ( __x86_64__ ) || defined ( __i386__ )
+#define ADFSUM_X86
+#include <immintrin.h>
+#endif
+
+// (the sums of nlongs - a multiple of 16 - big-endian longwords)
+typedef struct adfsum_kernels {
+    uint32_t ( * sum )   ( const uint8_t * const data,
+                           const unsigned        nlongs );
+    uint64_t ( * sum64 ) ( const uint8_t * const data,
+                           const unsigned        nlongs );
+} adfsum_kernels_t;
+
+static uint32_t adfsum_sum_scalar ( const uint8_t * const data,
+                                    const unsigned        nlongs );
+
+static uint64_t adfsum_sum64_scalar ( const uint8_t * const data,
+                                      const unsigned        nlongs );
+
+#ifdef ADFSUM_X86
+static uint32_t adfsum_sum_sse2 ( const uint8_t * const data,
+                                  const unsigned        nlongs );
+
+static uint64_t adfsum_sum64_sse2 ( const uint8_t * const data,
+                                    const unsigned        nlongs );
+
+static uint32_t adfsum_sum_avx2 ( const uint8_t * const data,
+                                  const unsigned        nlongs );
+
+static uint64_t adfsum_sum64_avx2 ( const uint8_t * const data,
+                                    const unsigned        nlongs );
+#endif
+
+static const adfsum_kernels_t adfsum_kernels[] = {
+    [ ADFSUM_AUTO ]   = { NULL, NULL },
+    [ ADFSUM_SCALAR ] = { adfsum_sum_scalar, adfsum_sum64_scalar },
+#ifdef ADFSUM_X86
+    [ ADFSUM_SSE2 ]   = { adfsum_sum_sse2, adfsum_sum64_sse2 },
+    [ ADFSUM_AVX2 ]   = { adfsum_sum_avx2, adfsum_sum64_avx2 }
+#else
+    [ ADFSUM_SSE2 ]   = { NULL, NULL },
+    [ ADFSUM_AVX2 ]   = { NULL, NULL }
+#endif
+};
+
+// (selected on the first use - by any thread, all select the same)
+static adfsum_impl_t adfsum_impl = ADFSUM_AUTO;
+
+
+bool adfsum_is_supported ( const adfsum_impl_t impl )
+{
+    switch ( impl ) {
+    case ADFSUM_AUTO:
+    case ADFSUM_SCALAR:
+        return true;
+#ifdef ADFSUM_X86
+    case ADFSUM_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports ( "sse2" );
+    case ADFSUM_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports ( "avx2" );
+#endif
+    default:
+        return false;
+    }
+}
+
+
+bool adfsum_set_impl ( const adfsum_impl_t impl )
+{
+    if ( ! adfsum_is_supported ( impl ) )
+        return false;
+    const adfsum_impl_t selected = ( impl != ADFSUM_AUTO ) ? impl :
+        adfsum_is_supported ( ADFSUM_AVX2 ) ? ADFSUM_AVX2 :
+        adfsum_is_supported ( ADFSUM_SSE2 ) ? ADFSUM_SSE2 :
+                                              ADFSUM_SCALAR;
+    __atomic_store_n ( &adfsum_impl, selected, __ATOMIC_RELAXED );
+    return true;
+}
+
+
+adfsum_impl_t adfsum_get_impl ( void )
+{
+    adfsum_impl_t impl = __atomic_load_n ( &adfsum_impl, __ATOMIC_RELAXED );
+    if ( impl == ADFSUM_AUTO ) {
+        adfsum_set_impl ( ADFSUM_AUTO );
+        impl = __atomic_load_n ( &adfsum_impl, __ATOMIC_RELAXED );
+    }
+    return impl;
+}
+
+
+const char * adfsum_impl_name ( const adfsum_impl_t impl )
+{
+    switch ( impl ) {
+    case ADFSUM_AUTO:   return "auto";
+    case ADFSUM_SCALAR: return "scalar";
+    case ADFSUM_SSE2:   return "sse2";
+    case ADFSUM_AVX2:   return "avx2";
+    }
+    return "?";
+}
+
+
+uint32_t adfsum_block ( const uint8_t * const block )
+{
+    return adfsum_kernels [ adfsum_get_impl() ].sum ( block, 128 );
+}
+
+
+uint32_t adfsum_boot ( const uint8_t * const boot )
+{
+    // (the carries added back at the end - the same as after each addition)
+    uint64_t sum = adfsum_kernels [ adfsum_get_impl() ].sum64 ( boot, 256 );
+    while ( sum >> 32 )
+        sum = ( sum & 0xffffffff ) + ( sum >> 32 );
+    return ( uint32_t ) sum;
+}
+
+
+static inline void adfsum_put_be32 ( uint8_t * const p,
+                                     const uint32_t  value )
+{
+    p [ 0 ] = ( uint8_t ) ( value >> 24 );
+    p [ 1 ] = ( uint8_t ) ( value >> 16 );
+    p [ 2 ] = ( uint8_t ) ( value >> 8 );
+    p [ 3 ] = ( uint8_t ) value;
+}
+
+
+void adfsum_set ( uint8_t * const block,
+                  const unsigned  offset )
+{
+    adfsum_put_be32 ( block + offset, 0 );
+    adfsum_put_be32 ( block + offset, - adfsum_block ( block ) );
+}
+
+
+void adfsum_set_boot ( uint8_t * const boot )
+{
+    adfsum_put_be32 ( boot + 4, 0 );
+    adfsum_put_be32 ( boot + 4, ~ adfsum_boot ( boot ) );
+}
+
+
+/*****
+ * Scalar
+ *****/
+
+static inline uint32_t be32 ( const uint8_t * const p )
+{
+    return ( uint32_t ) p [ 0 ] << 24 | ( uint32_t ) p [ 1 ] << 16 |
+           ( uint32_t ) p [ 2 ] << 8  | ( uint32_t ) p [ 3 ];
+}
+
+
+static uint32_t adfsum_sum_scalar ( const uint8_t * const data,
+                                    const unsigned        nlongs )
+{
+    uint32_t sum = 0;
+    for ( unsigned i = 0 ; i < nlongs ; i++ )
+        sum += be32 ( data + 4 * i );
+    return sum;
+}
+
+
+static uint64_t adfsum_sum64_scalar ( const uint8_t * const data,
+                                      const unsigned        nlongs )
+{
+    uint64_t sum = 0;
+    for ( unsigned i = 0 ; i < nlongs ; i++ )
+        sum += be32 ( data + 4 * i );
+    return sum;
+}
+
+
+#ifdef ADFSUM_X86
+
+/*****
+ * SSE2 (no byte shuffle - the bytes swapped with 16-bit shuffles and shifts)
+ *****/
+
+__attribute__ (( target ( "sse2" ) ))
+static inline __m128i adfsum_bswap32_sse2 ( __m128i v )
+{
+    v = _mm_shufflelo_epi16 ( v, 0xb1 );
+    v = _mm_shufflehi_epi16 ( v, 0xb1 );
+    return _mm_or_si128 ( _mm_slli_epi16 ( v, 8 ), _mm_srli_epi16 ( v, 8 ) );
+}
+
+
+__attribute__ (( target ( "sse2" ) ))
+static uint32_t adfsum_sum_sse2 ( const uint8_t * const data,
+                                  const unsigned        nlongs )
+{
+    __m128i sum0 = _mm_setzero_si128(),
+            sum1 = _mm_setzero_si128();
+    for ( unsigned i = 0 ; i < nlongs * 4 ; i += 32 ) {
+        sum0 = _mm_add_epi32 ( sum0, adfsum_bswap32_sse2 (
+            _mm_loadu_si128 ( ( const __m128i * ) ( data + i ) ) ) );
+        sum1 = _mm_add_epi32 ( sum1, adfsum_bswap32_sse2 (
+            _mm_loadu_si128 ( ( const __m128i * ) ( data + i + 16 ) ) ) );
+    }
+    sum0 = _mm_add_epi32 ( sum0, sum1 );
+    sum0 = _mm_add_epi32 ( sum0, _mm_shuffle_epi32 ( sum0, 0x4e ) );
+    sum0 = _mm_add_epi32 ( sum0, _mm_shuffle_epi32 ( sum0, 0xb1 ) );
+    return ( uint32_t ) _mm_cvtsi128_si32 ( sum0 );
+}
+
+
+__attribute__ (( target ( "sse2" ) ))
+static uint64_t adfsum_sum64_sse2 ( const uint8_t * const data,
+                                    const unsigned        nlongs )
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = zero,
+            sum1 = zero;
+    for ( unsigned i = 0 ; i < nlongs * 4 ; i += 16 ) {
+        const __m128i v = adfsum_bswap32_sse2 (
+            _mm_loadu_si128 ( ( const __m128i * ) ( data + i ) ) );
+        sum0 = _mm_add_epi64 ( sum0, _mm_unpacklo_epi32 ( v, zero ) );
+        sum1 = _mm_add_epi64 ( sum1, _mm_unpackhi_epi32 ( v, zero ) );
+    }
+    sum0 = _mm_add_epi64 ( sum0, sum1 );
+    sum0 = _mm_add_epi64 ( sum0, _mm_unpackhi_epi64 ( sum0, sum0 ) );
+#ifdef __x86_64__
+    return ( uint64_t ) _mm_cvtsi128_si64 ( sum0 );
+#else
+    uint64_t sum;
+    _mm_storel_epi64 ( ( __m128i * ) &sum, sum0 );
+    return sum;
+#endif
+}
+
+
+/*****
+ * AVX2
+ *****/
+
+__attribute__ (( target ( "avx2" ) ))
+static inline __m256i adfsum_bswap32_avx2 ( const __m256i v )
+{
+    const __m256i mask = _mm256_setr_epi8 ( 3, 2, 1, 0, 7, 6, 5, 4,
+                                            11, 10, 9, 8, 15, 14, 13, 12,
+                                            3, 2, 1, 0, 7, 6, 5, 4,
+                                            11, 10, 9, 8, 15, 14, 13, 12 );
+    return _mm256_shuffle_epi8 ( v, mask );
+}
+
+
+__attribute__ (( target ( "avx2" ) ))
+static uint32_t adfsum_sum_avx2 ( const uint8_t * const data,
+                                  const unsigned        nlongs )
+{
+    __m256i sum0 = _mm256_setzero_si256(),
+            sum1 = _mm256_setzero_si256();
+    for ( unsigned i = 0 ; i < nlongs * 4 ; i += 64 ) {
+        sum0 = _mm256_add_epi32 ( sum0, adfsum_bswap32_avx2 (
+            _mm256_loadu_si256 ( ( const __m256i * ) ( data + i ) ) ) );
+        sum1 = _mm256_add_epi32 ( sum1, adfsum_bswap32_avx2 (
+            _mm256_loadu_si256 ( ( const __m256i * ) ( data + i + 32 ) ) ) );
+    }
+    sum0 = _mm256_add_epi32 ( sum0, sum1 );
+    __m128i sum = _mm_add_epi32 ( _mm256_castsi256_si128 ( sum0 ),
+                                  _mm256_extracti128_si256 ( sum0, 1 ) );
+    sum = _mm_add_epi32 ( sum, _mm_shuffle_epi32 ( sum, 0x4e ) );
+    sum = _mm_add_epi32 ( sum, _mm_shuffle_epi32 ( sum, 0xb1 ) );
+    return ( uint32_t ) _mm_cvtsi128_si32 ( sum );
+}
+
+
+__attribute__ (( target ( "avx2" ) ))
+static uint64_t adfsum_sum64_avx2 ( const uint8_t * const data,
+                                    const unsigned        nlongs )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum0 = zero,
+            sum1 = zero;
+    for ( unsigned i = 0 ; i < nlongs * 4 ; i += 32 ) {
+        const __m256i v = adfsum_bswap32_avx2 (
+            _mm256_loadu_si256 ( ( const __m256i * ) ( data + i ) ) );
+        sum0 = _mm256_add_epi64 ( sum0, _mm256_unpacklo_epi32 ( v, zero ) );
+        sum1 = _mm256_add_epi64 ( sum1, _mm256_unpackhi_epi32 ( v, zero ) );
+    }
+    sum0 = _mm256_add_epi64 ( sum0, sum1 );
+    __m128i sum = _mm_add_epi64 ( _mm256_castsi256_si128 ( sum0 ),
+                                  _mm256_extracti128_si256 ( sum0, 1 ) );
+    sum = _mm_add_epi64 ( sum, _mm_unpackhi_epi64 ( sum, sum ) );
+#ifdef __x86_64__
+    return ( uint64_t ) _mm_cvtsi128_si64 ( sum );
+#else
+    uint64_t total;
+    _mm_storel_epi64 ( ( __m128i * ) &total, sum );
+    return total;
+#endif
+}
+
+#endif
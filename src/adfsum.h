@@ -0,0 +1,59 @@
+#ifndef ADFSUM_H
+#define ADFSUM_H
+
+/*
+ * Checksums of Amiga blocks
+ *
+ * The checksum of a (metadata) block is set so that the sum of all its
+ * 128 big-endian longwords is 0; the checksum of the boot blocks (1024
+ * bytes) - so that their sum with the carries wrapped around (added back)
+ * is 0xffffffff.
+ *
+ * The sums are vectorized (SSE2, AVX2 - selected at runtime by the CPU),
+ * with a scalar fallback.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    ADFSUM_AUTO,            // (the fastest supported)
+    ADFSUM_SCALAR,
+    ADFSUM_SSE2,
+    ADFSUM_AVX2
+} adfsum_impl_t;
+
+// select the implementation, false if not supported by the CPU
+bool adfsum_set_impl ( const adfsum_impl_t impl );
+
+adfsum_impl_t adfsum_get_impl ( void );
+
+bool adfsum_is_supported ( const adfsum_impl_t impl );
+
+const char * adfsum_impl_name ( const adfsum_impl_t impl );
+
+// the sum of the longwords of a block (512 bytes)
+uint32_t adfsum_block ( const uint8_t * const block );
+
+// the sum of the longwords of the boot blocks (1024 bytes), the carries
+// wrapped around
+uint32_t adfsum_boot ( const uint8_t * const boot );
+
+static inline bool adfsum_is_valid ( const uint8_t * const block )
+{
+    return ( adfsum_block ( block ) == 0 );
+}
+
+static inline bool adfsum_is_boot_valid ( const uint8_t * const boot )
+{
+    return ( adfsum_boot ( boot ) == 0xffffffff );
+}
+
+// set the checksum of a block (at the offset: 20 - most blocks, 0 - bitmap)
+void adfsum_set ( uint8_t * const block,
+                  const unsigned  offset );
+
+// set the checksum of the boot blocks (at the offset 4)
+void adfsum_set_boot ( uint8_t * const boot );
+
+#endif
@@ -0,0 +1,786 @@
+
+#include "adfverify.h"
+
+#include "adfcollection.h"
+#include "adfdev.h"
+#include "adffs_log.h"
+#include "adfsum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ADFVERIFY_BITMAP_PAGE       ( 127 * 4 )     // (bytes of a bitmap block)
+#define ADFVERIFY_BITMAP_BITS       ( ADFVERIFY_BITMAP_PAGE * 8 )
+
+typedef enum {
+    ADFVERIFY_DIR,
+    ADFVERIFY_FILE
+} adfverify_item_type_t;
+
+typedef struct adfverify_item {
+    adfverify_item_type_t type;
+    int32_t               sector;
+} adfverify_item_t;
+
+typedef struct adfverify {
+    struct AdfVolume *          vol;
+    const adfverify_options_t * options;
+    adfverify_report_t *        report;
+
+    int                         fd;             // (-1 - read through ADFlib)
+    uint64_t                    offset;         // of the volume (in the image)
+    int32_t                     last_block;
+    unsigned                    datablock_size;
+    bool                        ofs,
+                                intl,
+                                dircache;
+    pthread_mutex_t             adflib_lock;
+
+    uint32_t *                  reached;        // (a bit per block)
+
+    // directories and files to check (the root first)
+    pthread_mutex_t             lock;
+    pthread_cond_t              cond;
+    adfverify_item_t *          items;
+    uint32_t                    nitems,
+                                items_max,
+                                next_item,
+                                pending;
+    bool                        failed;         // (out of memory)
+} adfverify_t;
+
+static bool adfverify_claim ( adfverify_t * const verify,
+                              const int32_t       sector,
+                              const int32_t       from );
+
+static bool adfverify_read_block ( adfverify_t * const verify,
+                                   const int32_t       sector,
+                                   uint8_t * const     buf );
+
+static void * adfverify_worker ( void * arg );
+
+static bool adfverify_read_bitmap ( adfverify_t * const   verify,
+                                    const uint8_t * const root,
+                                    uint8_t ** const      bitmap );
+
+static void adfverify_compare_bitmap ( adfverify_t * const   verify,
+                                       const uint8_t * const bitmap );
+
+
+static inline uint32_t be32 ( const uint8_t * const p )
+{
+    return ( uint32_t ) p [ 0 ] << 24 | ( uint32_t ) p [ 1 ] << 16 |
+           ( uint32_t ) p [ 2 ] << 8  | ( uint32_t ) p [ 3 ];
+}
+
+
+static inline void adfverify_count ( uint64_t * const counter )
+{
+    __atomic_fetch_add ( counter, 1, __ATOMIC_RELAXED );
+}
+
+
+// count an error (of the counter) and list it
+static void adfverify_error ( const adfverify_t * const verify,
+                              uint64_t * const          counter,
+                              const int32_t             sector,
+                              const char * const        format,
+                              ... )
+{
+    adfverify_count ( counter );
+    if ( verify->options->errors == NULL )
+        return;
+
+    FILE * const out = verify->options->errors;
+    va_list ap;
+    va_start ( ap, format );
+    flockfile ( out );
+    fprintf ( out, "  block %d: ", sector );
+    vfprintf ( out, format, ap );
+    fputc ( '\n', out );
+    funlockfile ( out );
+    va_end ( ap );
+}
+
+
+bool adfverify_volume ( struct AdfVolume * const          vol,
+                        const char * const                filename,
+                        const adfverify_options_t * const options,
+                        adfverify_report_t * const        report )
+{
+    struct timespec start, end;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+    memset ( report, 0, sizeof ( adfverify_report_t ) );
+
+    adfverify_t verify = {
+        .vol            = vol,
+        .options        = options,
+        .report         = report,
+        .fd             = -1,
+        .offset         = ( uint64_t ) vol->firstBlock * 512,
+        .last_block     = vol->lastBlock - vol->firstBlock,
+        .datablock_size = ( unsigned ) vol->datablockSize,
+        .ofs            = ! adfDosFsIsFFS ( vol->fs.type ),
+        // (DIRCACHE implies the international hashing)
+        .intl           = adfDosFsIsINTL ( vol->fs.type ) ||
+                          adfDosFsHasDIRCACHE ( vol->fs.type ),
+        .dircache       = adfDosFsHasDIRCACHE ( vol->fs.type )
+    };
+    if ( verify.last_block < 2 )
+        return false;
+
+    unsigned nthreads = options->nthreads;
+    if ( adfdev_is_raw ( vol->dev ) ) {
+        verify.fd = open ( filename, O_RDONLY );
+        if ( verify.fd < 0 )
+            adffs_log_info ( "adfverify_volume: cannot open %s: %s\n",
+                             filename, strerror ( errno ) );
+    }
+    if ( verify.fd < 0 )
+        nthreads = 1;       // (the reads are serialized anyway)
+    if ( nthreads > ADFVERIFY_THREADS_MAX )
+        nthreads = ADFVERIFY_THREADS_MAX;
+
+    bool ok = false;
+    pthread_mutex_init ( &verify.adflib_lock, NULL );
+    pthread_mutex_init ( &verify.lock, NULL );
+    pthread_cond_init ( &verify.cond, NULL );
+    verify.reached = calloc ( ( size_t ) verify.last_block / 32 + 1, sizeof ( uint32_t ) );
+    verify.items   = malloc ( 64 * sizeof ( adfverify_item_t ) );
+    if ( verify.reached == NULL || verify.items == NULL )
+        goto adfverify_volume_error_free;
+    verify.items_max = 64;
+
+    // the root block and the bitmap (read first - blocks reached from both
+    // the tree and the bitmap are reported by the tree)
+    uint8_t root [ 512 ];
+    const int32_t root_sector = vol->rootBlock;
+    uint8_t * bitmap = NULL;
+    if ( ! adfverify_claim ( &verify, root_sector, 0 ) ) {
+        ok = true;
+        goto adfverify_volume_error_free;
+    }
+    if ( ! adfverify_read_block ( &verify, root_sector, root ) ||
+         be32 ( root ) != ADF_T_HEADER ||
+         ( int32_t ) be32 ( root + 512 - 4 ) != ADF_ST_ROOT )
+    {
+        // (nothing more can be checked)
+        adfverify_error ( &verify, &report->structure_errors, root_sector,
+                          "not a root block" );
+        ok = true;
+        goto adfverify_volume_error_free;
+    }
+    adfverify_count ( &report->blocks );
+    if ( ! adfsum_is_valid ( root ) )
+        adfverify_error ( &verify, &report->checksum_errors, root_sector,
+                          "checksum error" );
+    if ( ! adfverify_read_bitmap ( &verify, root, &bitmap ) )
+        goto adfverify_volume_error_free;
+
+    // the tree
+    verify.items [ 0 ] = ( adfverify_item_t ) { .type   = ADFVERIFY_DIR,
+                                                .sector = root_sector };
+    verify.nitems  = 1;
+    verify.pending = 1;
+
+    pthread_t threads [ ADFVERIFY_THREADS_MAX ];
+    unsigned started = 0;
+    while ( started < nthreads &&
+            pthread_create ( &threads [ started ], NULL, adfverify_worker, &verify ) == 0 )
+    {
+        started++;
+    }
+    if ( started == 0 )
+        adfverify_worker ( &verify );
+    for ( unsigned i = 0 ; i < started ; i++ )
+        pthread_join ( threads [ i ], NULL );
+    report->nthreads = ( started > 0 ) ? started : 1;
+
+    if ( ! verify.failed ) {
+        adfverify_compare_bitmap ( &verify, bitmap );
+        ok = true;
+    }
+    free ( bitmap );
+
+adfverify_volume_error_free:
+    free ( verify.items );
+    free ( verify.reached );
+    pthread_cond_destroy ( &verify.cond );
+    pthread_mutex_destroy ( &verify.lock );
+    pthread_mutex_destroy ( &verify.adflib_lock );
+    if ( verify.fd >= 0 )
+        close ( verify.fd );
+
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    report->secs = ( double ) ( end.tv_sec - start.tv_sec ) +
+                   ( double ) ( end.tv_nsec - start.tv_nsec ) / 1e9;
+    return ok;
+}
+
+
+bool adfverify_is_clean ( const adfverify_report_t * const report )
+{
+    return ( report->checksum_errors == 0 &&
+             report->structure_errors == 0 &&
+             report->bitmap_errors == 0 );
+}
+
+
+void adfverify_print_report ( FILE * const                     out,
+                              const char * const               name,
+                              const adfverify_report_t * const report )
+{
+    fprintf ( out, "%s: %s - %" PRIu64 " directories, %" PRIu64 " files, "
+              "%" PRIu64 " links, %" PRIu64 " metadata blocks, %" PRIu64 " data blocks; "
+              "%" PRIu64 " checksum errors, %" PRIu64 " structure errors, "
+              "%" PRIu64 " bitmap errors, %" PRIu64 " lost blocks (%.3f s, %u threads)\n",
+              name, adfverify_is_clean ( report ) ? "OK" : "ERRORS",
+              report->dirs, report->files, report->links, report->blocks,
+              report->data_blocks, report->checksum_errors, report->structure_errors,
+              report->bitmap_errors, report->lost_blocks, report->secs,
+              report->nthreads );
+}
+
+
+// (a volume opened by the caller - not checked if not open)
+static bool adfverify_image ( adfimage_t * const                adfimage,
+                              const char * const                name,
+                              const adfverify_options_t * const options,
+                              FILE * const                      out )
+{
+    if ( adfimage == NULL ) {
+        fprintf ( out, "%s: cannot open\n", name );
+        return false;
+    }
+
+    adfverify_report_t report;
+    const bool ok = adfverify_volume ( adfimage->vol, adfimage->filename,
+                                       options, &report );
+    if ( ! ok )
+        fprintf ( out, "%s: cannot verify (out of memory?)\n", name );
+    else
+        adfverify_print_report ( out, name, &report );
+    return ( ok && adfverify_is_clean ( &report ) );
+}
+
+
+bool adfverify_images ( char * const                      path,
+                        const unsigned                    volume,
+                        const bool                        all_volumes,
+                        const adfverify_options_t * const options,
+                        FILE * const                      out )
+{
+    struct stat st;
+    const bool is_dir = ( stat ( path, &st ) == 0 && S_ISDIR ( st.st_mode ) );
+    if ( ! is_dir && ! all_volumes ) {
+        // (checksum errors are to be reported - not to stop opening)
+        adfimage_t * adfimage = adfimage_open ( path, volume, true, true );
+        const bool clean = adfverify_image ( adfimage, path, options, out );
+        if ( adfimage != NULL )
+            adfimage_close ( &adfimage );
+        return clean;
+    }
+
+    adfcollection_t * collection = is_dir ?
+        adfcollection_open ( path, 1, volume, true, true ) :
+        adfcollection_open_volumes ( path, 1, true, true );
+    if ( collection == NULL ) {
+        fprintf ( out, "%s: cannot open\n", path );
+        return false;
+    }
+
+    // (each image opened by itself - not through the collection, which
+    //  would start the prescan of its index)
+    bool clean = true;
+    for ( unsigned i = 0 ; i < collection->nentries ; i++ ) {
+        const adfcollection_entry_t * const entry = &collection->entries [ i ];
+        adfimage_t * adfimage = ( collection->dev != NULL ) ?
+            adfimage_open_volume ( collection->dev, entry->path,
+                                   entry->volume, true ) :
+            adfimage_open ( entry->path, entry->volume, true, true );
+
+        char name [ PATH_MAX ];
+        snprintf ( name, sizeof ( name ), "%s/%s", path, entry->name );
+        if ( ! adfverify_image ( adfimage, name, options, out ) )
+            clean = false;
+        if ( adfimage != NULL )
+            adfimage_close ( &adfimage );
+    }
+    adfcollection_close ( &collection );
+    return clean;
+}
+
+
+/*****
+ * Reading the blocks
+ *****/
+
+static bool adfverify_read_block ( adfverify_t * const verify,
+                                   const int32_t       sector,
+                                   uint8_t * const     buf )
+{
+    if ( verify->fd >= 0 )
+        return ( pread ( verify->fd, buf, 512, ( off_t ) ( verify->offset +
+                         ( uint64_t ) sector * 512 ) ) == 512 );
+
+    // (through ADFlib - not thread-safe)
+    struct AdfVolume * const vol = verify->vol;
+    pthread_mutex_lock ( &verify->adflib_lock );
+    const bool ok = ( adfDevReadBlock ( vol->dev,
+                                        ( uint32_t ) ( vol->firstBlock + sector ),
+                                        512, buf ) == ADF_RC_OK );
+    pthread_mutex_unlock ( &verify->adflib_lock );
+    return ok;
+}
+
+
+// mark the block (referenced by the block from) as used, false (reported)
+// if it is out of the volume or already used
+static bool adfverify_claim ( adfverify_t * const verify,
+                              const int32_t       sector,
+                              const int32_t       from )
+{
+    if ( sector < 2 || sector > verify->last_block ) {
+        adfverify_error ( verify, &verify->report->structure_errors, from,
+                          "reference to block %d (out of the volume)", sector );
+        return false;
+    }
+
+    const uint32_t bit = 1u << ( sector % 32 );
+    if ( __atomic_fetch_or ( &verify->reached [ sector / 32 ], bit,
+                             __ATOMIC_RELAXED ) & bit )
+    {
+        adfverify_error ( verify, &verify->report->structure_errors, sector,
+                          "used more than once (cross-linked, also from block %d)",
+                          from );
+        return false;
+    }
+    return true;
+}
+
+
+// read a metadata block of the type (with its own sector as the key
+// and, if not 0, the parent at the offset of the headers), false (reported)
+// if it cannot be read or is not such block - a checksum error is only
+// reported (the block is still followed)
+static bool adfverify_read_meta ( adfverify_t * const verify,
+                                  const int32_t       sector,
+                                  const uint32_t      type,
+                                  const int32_t       parent,
+                                  uint8_t * const     block )
+{
+    adfverify_report_t * const report = verify->report;
+    if ( ! adfverify_read_block ( verify, sector, block ) ) {
+        adfverify_error ( verify, &report->structure_errors, sector, "cannot be read" );
+        return false;
+    }
+    adfverify_count ( &report->blocks );
+
+    if ( be32 ( block ) != type || ( int32_t ) be32 ( block + 4 ) != sector ) {
+        adfverify_error ( verify, &report->structure_errors, sector,
+                          "not a block of type %u (type %u, key %d)",
+                          type, be32 ( block ), ( int32_t ) be32 ( block + 4 ) );
+        return false;
+    }
+    if ( ! adfsum_is_valid ( block ) )
+        adfverify_error ( verify, &report->checksum_errors, sector, "checksum error" );
+
+    // (directory caches - the parent at the 3rd longword)
+    const int32_t block_parent = ( int32_t ) be32 ( block +
+        ( ( type == ADF_T_DIRC ) ? 8 : 512 - 12 ) );
+    if ( parent != 0 && block_parent != parent )
+        adfverify_error ( verify, &report->structure_errors, sector,
+                          "parent %d (instead of %d)", block_parent, parent );
+    return true;
+}
+
+
+/*****
+ * The tree
+ *****/
+
+// add a directory or a file to check (by any of the threads)
+static void adfverify_add ( adfverify_t * const         verify,
+                            const adfverify_item_type_t type,
+                            const int32_t               sector )
+{
+    pthread_mutex_lock ( &verify->lock );
+    if ( verify->nitems == verify->items_max ) {
+        adfverify_item_t * const items = realloc ( verify->items,
+            2 * verify->items_max * sizeof ( adfverify_item_t ) );
+        if ( items == NULL ) {
+            verify->failed = true;
+            pthread_cond_broadcast ( &verify->cond );
+            pthread_mutex_unlock ( &verify->lock );
+            return;
+        }
+        verify->items      = items;
+        verify->items_max *= 2;
+    }
+    verify->items [ verify->nitems++ ] =
+        ( adfverify_item_t ) { .type = type, .sector = sector };
+    verify->pending++;
+    pthread_cond_signal ( &verify->cond );
+    pthread_mutex_unlock ( &verify->lock );
+}
+
+
+// an entry of the directory (found in its hash table at the position)
+static void adfverify_entry ( adfverify_t * const   verify,
+                              const int32_t         dir,
+                              const unsigned        hash,
+                              const int32_t         sector,
+                              const uint8_t * const block )
+{
+    adfverify_report_t * const report = verify->report;
+
+    const unsigned namelen = block [ 0x1b0 ];
+    char name [ ADF_MAXNAMELEN + 1 ];
+    if ( namelen == 0 || namelen > ADF_MAXNAMELEN ) {
+        adfverify_error ( verify, &report->structure_errors, sector,
+                          "name length %u", namelen );
+    } else {
+        memcpy ( name, block + 0x1b1, namelen );
+        name [ namelen ] = '\0';
+        if ( adfGetHashValue ( ( const uint8_t * ) name, verify->intl ) != hash )
+            adfverify_error ( verify, &report->structure_errors, sector,
+                              "%s in the hash chain %u of directory %d",
+                              name, hash, dir );
+    }
+
+    const int32_t type = ( int32_t ) be32 ( block + 512 - 4 );
+    switch ( type ) {
+    case ADF_ST_DIR:
+        adfverify_count ( &report->dirs );
+        adfverify_add ( verify, ADFVERIFY_DIR, sector );
+        break;
+
+    case ADF_ST_FILE:
+        adfverify_count ( &report->files );
+        adfverify_add ( verify, ADFVERIFY_FILE, sector );
+        break;
+
+    case ADF_ST_LFILE:
+    case ADF_ST_LDIR: {
+        // (the entry linked - checked in its own directory)
+        adfverify_count ( &report->links );
+        const int32_t real = ( int32_t ) be32 ( block + 0x1d4 );
+        if ( real < 2 || real > verify->last_block )
+            adfverify_error ( verify, &report->structure_errors, sector,
+                              "hard link to block %d (out of the volume)", real );
+        break;
+    }
+
+    case ADF_ST_LSOFT:
+        adfverify_count ( &report->links );
+        break;
+
+    default:
+        adfverify_error ( verify, &report->structure_errors, sector,
+                          "secondary type %d", type );
+    }
+}
+
+
+// the directory cache blocks of a directory (DIRCACHE volumes)
+static void adfverify_dircache ( adfverify_t * const verify,
+                                 const int32_t       dir,
+                                 int32_t             next )
+{
+    uint8_t block [ 512 ];
+    int32_t from = dir;
+    while ( next != 0 &&
+            adfverify_claim ( verify, next, from ) &&
+            adfverify_read_meta ( verify, next, ADF_T_DIRC, dir, block ) )
+    {
+        from = next;
+        next = ( int32_t ) be32 ( block + 16 );
+    }
+}
+
+
+static void adfverify_dir ( adfverify_t * const verify,
+                            const int32_t       sector )
+{
+    uint8_t dir_block [ 512 ],
+            block [ 512 ];
+    // (checked when it was reached)
+    if ( ! adfverify_read_block ( verify, sector, dir_block ) )
+        return;
+
+    for ( unsigned i = 0 ; i < ADF_HT_SIZE ; i++ ) {
+        int32_t next = ( int32_t ) be32 ( dir_block + 24 + 4 * i ),
+                from = sector;
+        // (a chain stops at a block used already - so also at a loop)
+        while ( next != 0 &&
+                adfverify_claim ( verify, next, from ) &&
+                adfverify_read_meta ( verify, next, ADF_T_HEADER, sector, block ) )
+        {
+            adfverify_entry ( verify, sector, i, next, block );
+            from = next;
+            next = ( int32_t ) be32 ( block + 512 - 16 );
+        }
+    }
+
+    if ( verify->dircache )
+        adfverify_dircache ( verify, sector, ( int32_t ) be32 ( dir_block + 512 - 8 ) );
+}
+
+
+// an OFS data block (the seq-th of the file)
+static void adfverify_data_block ( adfverify_t * const verify,
+                                   const int32_t       file,
+                                   const int32_t       sector,
+                                   const uint32_t      seq )
+{
+    adfverify_report_t * const report = verify->report;
+    uint8_t block [ 512 ];
+    if ( ! adfverify_read_block ( verify, sector, block ) ) {
+        adfverify_error ( verify, &report->structure_errors, sector, "cannot be read" );
+        return;
+    }
+    if ( be32 ( block ) != ADF_T_DATA ||
+         ( int32_t ) be32 ( block + 4 ) != file ||
+         be32 ( block + 8 ) != seq ||
+         be32 ( block + 12 ) > verify->datablock_size )
+    {
+        adfverify_error ( verify, &report->structure_errors, sector,
+                          "not the data block %u of file %d", seq, file );
+        return;
+    }
+    if ( ! adfsum_is_valid ( block ) )
+        adfverify_error ( verify, &report->checksum_errors, sector, "checksum error" );
+}
+
+
+// the block map of a file (its header, extension blocks and data blocks)
+static void adfverify_file ( adfverify_t * const verify,
+                             const int32_t       sector )
+{
+    adfverify_report_t * const report = verify->report;
+    uint8_t header [ 512 ],
+            ext [ 512 ];
+    if ( ! adfverify_read_block ( verify, sector, header ) )
+        return;
+
+    const uint32_t size    = be32 ( header + 0x144 ),
+                   needed  = ( uint32_t ) ( ( ( uint64_t ) size +
+                                              verify->datablock_size - 1 ) /
+                                            verify->datablock_size );
+    const uint8_t * table  = header;
+    int32_t         from   = sector;
+    uint32_t        nblocks = 0;
+    while ( true ) {
+        const uint32_t high_seq = be32 ( table + 8 );
+        if ( high_seq > ADF_HT_SIZE ) {
+            adfverify_error ( verify, &report->structure_errors, from,
+                              "%u block pointers", high_seq );
+            return;
+        }
+        // (the data blocks - from the end of the table)
+        for ( uint32_t i = 0 ; i < high_seq ; i++ ) {
+            const int32_t data = ( int32_t ) be32 ( table + 24 + 4 * ( ADF_HT_SIZE - 1 - i ) );
+            nblocks++;
+            if ( ! adfverify_claim ( verify, data, from ) )
+                continue;
+            adfverify_count ( &report->data_blocks );
+            if ( verify->ofs && verify->options->data_blocks )
+                adfverify_data_block ( verify, sector, data, nblocks );
+        }
+
+        const int32_t next = ( int32_t ) be32 ( table + 512 - 8 );
+        if ( next == 0 )
+            break;
+        if ( ! adfverify_claim ( verify, next, from ) ||
+             ! adfverify_read_meta ( verify, next, ADF_T_LIST, sector, ext ) )
+        {
+            return;
+        }
+        table = ext;
+        from  = next;
+    }
+
+    if ( nblocks != needed )
+        adfverify_error ( verify, &report->structure_errors, sector,
+                          "%u data blocks for %u bytes (instead of %u)",
+                          nblocks, size, needed );
+}
+
+
+static void * adfverify_worker ( void * arg )
+{
+    adfverify_t * const verify = ( adfverify_t * ) arg;
+
+    pthread_mutex_lock ( &verify->lock );
+    while ( true ) {
+        while ( verify->next_item == verify->nitems && verify->pending > 0 &&
+                ! verify->failed )
+        {
+            pthread_cond_wait ( &verify->cond, &verify->lock );
+        }
+        if ( verify->next_item == verify->nitems || verify->failed )
+            break;
+
+        const adfverify_item_t item = verify->items [ verify->next_item++ ];
+        pthread_mutex_unlock ( &verify->lock );
+
+        if ( item.type == ADFVERIFY_DIR )
+            adfverify_dir ( verify, item.sector );
+        else
+            adfverify_file ( verify, item.sector );
+
+        pthread_mutex_lock ( &verify->lock );
+        verify->pending--;
+        if ( verify->pending == 0 )
+            pthread_cond_broadcast ( &verify->cond );
+    }
+    pthread_cond_broadcast ( &verify->cond );
+    pthread_mutex_unlock ( &verify->lock );
+    return NULL;
+}
+
+
+/*****
+ * The bitmap
+ *****/
+
+// read the bitmap blocks (listed in the root block and its extension
+// blocks) to one buffer - their contents without the checksums
+static bool adfverify_read_bitmap ( adfverify_t * const   verify,
+                                    const uint8_t * const root,
+                                    uint8_t ** const      bitmap )
+{
+    adfverify_report_t * const report = verify->report;
+    const int32_t  root_sector = verify->vol->rootBlock;
+    const uint32_t nbitmap = ( ( uint32_t ) verify->last_block - 1 +
+                               ADFVERIFY_BITMAP_BITS - 1 ) /
+                             ADFVERIFY_BITMAP_BITS;
+
+    // (no bitmap block read - all blocks free)
+    *bitmap = malloc ( nbitmap * ADFVERIFY_BITMAP_PAGE );
+    if ( *bitmap == NULL )
+        return false;
+    memset ( *bitmap, 0xff, nbitmap * ADFVERIFY_BITMAP_PAGE );
+
+    if ( ( int32_t ) be32 ( root + 0x138 ) != -1 )
+        adfverify_error ( verify, &report->bitmap_errors, root_sector,
+                          "the bitmap is marked as not valid" );
+
+    uint8_t        ext [ 512 ],
+                   block [ 512 ];
+    const uint8_t * pointers = root + 0x13c;
+    unsigned       npointers = 25;
+    int32_t        from      = root_sector,
+                   next_ext  = ( int32_t ) be32 ( root + 0x1a0 );
+    for ( uint32_t i = 0 ; i < nbitmap ; i++ ) {
+        if ( npointers == 0 ) {
+            // (the pointers continue in an extension block)
+            if ( next_ext == 0 ) {
+                adfverify_error ( verify, &report->bitmap_errors, from,
+                                  "%u bitmap blocks missing", nbitmap - i );
+                break;
+            }
+            if ( ! adfverify_claim ( verify, next_ext, from ) )
+                break;
+            if ( ! adfverify_read_block ( verify, next_ext, ext ) ) {
+                adfverify_error ( verify, &report->structure_errors, next_ext,
+                                  "cannot be read" );
+                break;
+            }
+            adfverify_count ( &report->blocks );
+            pointers  = ext;
+            npointers = 127;
+            from      = next_ext;
+            next_ext  = ( int32_t ) be32 ( ext + 512 - 4 );
+        }
+
+        const int32_t sector = ( int32_t ) be32 ( pointers );
+        pointers += 4;
+        npointers--;
+        if ( sector == 0 ) {
+            adfverify_error ( verify, &report->bitmap_errors, from,
+                              "bitmap block %u missing", i );
+            continue;
+        }
+        if ( ! adfverify_claim ( verify, sector, from ) )
+            continue;
+        if ( ! adfverify_read_block ( verify, sector, block ) ) {
+            adfverify_error ( verify, &report->structure_errors, sector,
+                              "cannot be read" );
+            continue;
+        }
+        adfverify_count ( &report->blocks );
+        if ( ! adfsum_is_valid ( block ) )
+            adfverify_error ( verify, &report->checksum_errors, sector,
+                              "checksum error (bitmap)" );
+        memcpy ( *bitmap + i * ADFVERIFY_BITMAP_PAGE, block + 4, ADFVERIFY_BITMAP_PAGE );
+    }
+    return true;
+}
+
+
+// list a range of blocks (last - the end, exclusive) with an error
+static void adfverify_range ( const adfverify_t * const verify,
+                              uint64_t * const          counter,
+                              const int32_t             first,
+                              const int32_t             last,
+                              const char * const        what )
+{
+    const uint64_t n = ( uint64_t ) ( last - first );
+    __atomic_fetch_add ( counter, n, __ATOMIC_RELAXED );
+    if ( verify->options->errors == NULL )
+        return;
+    if ( n == 1 )
+        fprintf ( verify->options->errors, "  block %d: %s\n", first, what );
+    else
+        fprintf ( verify->options->errors, "  blocks %d-%d: %s\n",
+                  first, last - 1, what );
+}
+
+
+// (a block - used if it is reached, free if its bit is set)
+static void adfverify_compare_bitmap ( adfverify_t * const   verify,
+                                       const uint8_t * const bitmap )
+{
+    adfverify_report_t * const report = verify->report;
+    int32_t error_start = -1,
+            lost_start  = -1;
+    for ( int32_t sector = 2 ; sector <= verify->last_block + 1 ; sector++ ) {
+        bool error = false,
+             lost  = false;
+        if ( sector <= verify->last_block ) {
+            const uint32_t bit     = ( uint32_t ) sector - 2,
+                           page    = bit / ADFVERIFY_BITMAP_BITS,
+                           in_page = bit % ADFVERIFY_BITMAP_BITS;
+            const bool is_free = ( be32 ( bitmap + page * ADFVERIFY_BITMAP_PAGE +
+                                          in_page / 32 * 4 ) >> ( in_page % 32 ) ) & 1,
+                       is_used = ( verify->reached [ sector / 32 ] >> ( sector % 32 ) ) & 1;
+            error = ( is_used && is_free );
+            lost  = ( ! is_used && ! is_free );
+        }
+
+        if ( error && error_start < 0 )
+            error_start = sector;
+        if ( ! error && error_start >= 0 ) {
+            adfverify_range ( verify, &report->bitmap_errors, error_start, sector,
+                              "used, marked as free in the bitmap" );
+            error_start = -1;
+        }
+        if ( lost && lost_start < 0 )
+            lost_start = sector;
+        if ( ! lost && lost_start >= 0 ) {
+            adfverify_range ( verify, &report->lost_blocks, lost_start, sector,
+                              "marked as used in the bitmap, not reachable" );
+            lost_start = -1;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef ADFVERIFY_H
+#define ADFVERIFY_H
+
+/*
+ * Verifying volumes (a fast, read-only fsck)
+ *
+ * The metadata of a volume - the root block, the headers of all entries,
+ * the file extension blocks, the directory caches and the bitmap - is
+ * read with a pool of threads (directories and files taken from a shared
+ * queue), checking the checksums, the types and keys of the blocks
+ * and the links between them (parents, hash chains). Every block reached
+ * is marked as used (a block reached twice is cross-linked), then
+ * the bitmap is compared with the blocks reached.
+ *
+ * Images which cannot be read directly (compressed) are read through
+ * ADFlib (by one thread).
+ */
+
+#include "adfimage.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ADFVERIFY_THREADS_DEFAULT   4
+#define ADFVERIFY_THREADS_MAX       32
+
+typedef struct adfverify_options {
+    unsigned nthreads;
+    bool     data_blocks;           // check also the data blocks (OFS)
+    FILE *   errors;                // list the errors (NULL - only count)
+} adfverify_options_t;
+
+typedef struct adfverify_report {
+    uint64_t dirs,
+             files,
+             links,
+             blocks,                // metadata blocks checked
+             data_blocks,           // data blocks of the files
+             checksum_errors,
+             structure_errors,      // (types, keys, links, cross-links)
+             bitmap_errors,         // (used blocks marked as free)
+             lost_blocks;           // (marked as used, not reachable)
+    unsigned nthreads;
+    double   secs;
+} adfverify_report_t;
+
+// verify the volume, false if it cannot be done (the report - not complete)
+bool adfverify_volume ( struct AdfVolume * const          vol,
+                        const char * const                filename,
+                        const adfverify_options_t * const options,
+                        adfverify_report_t * const        report );
+
+// true if no errors were found (lost blocks are only a warning)
+bool adfverify_is_clean ( const adfverify_report_t * const report );
+
+void adfverify_print_report ( FILE * const                     out,
+                              const char * const               name,
+                              const adfverify_report_t * const report );
+
+// verify the volume of the image (all its volumes or, for a directory,
+// all images it contains), printing the reports to out - true if all
+// could be opened and are clean
+bool adfverify_images ( char * const                      path,
+                        const unsigned                    volume,
+                        const bool                        all_volumes,
+                        const adfverify_options_t * const options,
+                        FILE * const                      out );
+
+#endif
@@ -0,0 +1,872 @@
+
+#include "dms_unpack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The decompressors are based on xDMS (public domain)
+// by Andre Rodrigues de la Rocha.
+
+#define DMS_TEXT_SIZE      0x4000
+#define DMS_STAGE_SIZE     0x10000
+
+#define QUICK_BITMASK      0x00ff
+#define MEDIUM_BITMASK     0x3fff
+#define DEEP_BITMASK       0x3fff
+#define HEAVY1_BITMASK     0x0fff
+#define HEAVY2_BITMASK     0x1fff
+
+// deep (adaptive Huffman, as in LZHUF)
+#define DEEP_F             60                              // lookahead
+#define DEEP_THRESHOLD     2
+#define DEEP_N_CHAR        ( 256 - DEEP_THRESHOLD + DEEP_F )
+#define DEEP_T             ( DEEP_N_CHAR * 2 - 1 )         // table size
+#define DEEP_R             ( DEEP_T - 1 )                  // root
+#define DEEP_MAX_FREQ      0x8000
+
+// heavy (static Huffman, as in LHA)
+#define HEAVY_NC           510
+#define HEAVY_NPT          20
+#define HEAVY_N1           510
+#define HEAVY_OFFSET       253
+
+typedef struct dms_bitreader {
+    const uint8_t * in,
+                  * end;
+    uint32_t        bitbuf;
+    unsigned        bitcount;
+} dms_bitreader_t;
+
+struct dms_unpacker {
+    uint8_t  text [ DMS_TEXT_SIZE ];    // dictionary (shared by all modes)
+    uint16_t quick_text_loc,
+             medium_text_loc,
+             deep_text_loc,
+             heavy_text_loc;
+
+    bool     deep_tables_init;
+    uint16_t deep_freq [ DEEP_T + 1 ],
+             deep_prnt [ DEEP_T + DEEP_N_CHAR ],
+             deep_son  [ DEEP_T ];
+
+    uint16_t heavy_left  [ 2 * HEAVY_NC - 1 ],
+             heavy_right [ 2 * HEAVY_NC - 1 + 9 ];
+    uint8_t  heavy_c_len  [ HEAVY_NC ],
+             heavy_pt_len [ HEAVY_NPT ];
+    uint16_t heavy_c_table  [ 4096 ],
+             heavy_pt_table [ 256 ];
+    uint16_t heavy_lastlen,
+             heavy_np;
+
+    dms_bitreader_t bits;
+
+    uint8_t  stage [ DMS_STAGE_SIZE ];  // output of the 1st stage (before RLE)
+};
+
+// state of building a Huffman decoding table
+typedef struct dms_table_builder {
+    dms_unpacker_t * unpacker;
+    const uint8_t *  bitlen;
+    uint16_t *       table;
+    int              c;
+    unsigned         n,
+                     table_size,
+                     len,
+                     depth,
+                     maxdepth,
+                     avail,
+                     codeword,
+                     bit;
+    bool             error;
+} dms_table_builder_t;
+
+static const uint8_t dms_d_code [ 256 ] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+    0x02, 0x02, 0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04,
+    0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x07, 0x07, 0x07, 0x07,
+    0x07, 0x07, 0x07, 0x07, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x0a, 0x0a, 0x0a, 0x0a,
+    0x0a, 0x0a, 0x0a, 0x0a, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0d, 0x0d, 0x0d, 0x0d, 0x0e, 0x0e, 0x0e, 0x0e,
+    0x0f, 0x0f, 0x0f, 0x0f, 0x10, 0x10, 0x10, 0x10, 0x11, 0x11, 0x11, 0x11,
+    0x12, 0x12, 0x12, 0x12, 0x13, 0x13, 0x13, 0x13, 0x14, 0x14, 0x14, 0x14,
+    0x15, 0x15, 0x15, 0x15, 0x16, 0x16, 0x16, 0x16, 0x17, 0x17, 0x17, 0x17,
+    0x18, 0x18, 0x19, 0x19, 0x1a, 0x1a, 0x1b, 0x1b, 0x1c, 0x1c, 0x1d, 0x1d,
+    0x1e, 0x1e, 0x1f, 0x1f, 0x20, 0x20, 0x21, 0x21, 0x22, 0x22, 0x23, 0x23,
+    0x24, 0x24, 0x25, 0x25, 0x26, 0x26, 0x27, 0x27, 0x28, 0x28, 0x29, 0x29,
+    0x2a, 0x2a, 0x2b, 0x2b, 0x2c, 0x2c, 0x2d, 0x2d, 0x2e, 0x2e, 0x2f, 0x2f,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+    0x3c, 0x3d, 0x3e, 0x3f
+};
+
+static const uint8_t dms_d_len [ 256 ] = {
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04,
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05,
+    0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+    0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+    0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+    0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+    0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,
+    0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,
+    0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,
+    0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08
+};
+
+
+static bool dms_unpack_rle ( const uint8_t * const in,
+                             const size_t          insize,
+                             uint8_t * const       out,
+                             const size_t          outsize );
+
+static bool dms_unpack_quick ( dms_unpacker_t * const u,
+                               const uint8_t * const  in,
+                               const size_t           insize,
+                               uint8_t * const        out,
+                               const size_t           outsize );
+
+static bool dms_unpack_medium ( dms_unpacker_t * const u,
+                                const uint8_t * const  in,
+                                const size_t           insize,
+                                uint8_t * const        out,
+                                const size_t           outsize );
+
+static bool dms_unpack_deep ( dms_unpacker_t * const u,
+                              const uint8_t * const  in,
+                              const size_t           insize,
+                              uint8_t * const        out,
+                              const size_t           outsize );
+
+static bool dms_unpack_heavy ( dms_unpacker_t * const u,
+                               const uint8_t * const  in,
+                               const size_t           insize,
+                               const uint8_t          flags,
+                               uint8_t * const        out,
+                               const size_t           outsize );
+
+
+dms_unpacker_t * dms_unpacker_create ( void )
+{
+    dms_unpacker_t * const unpacker = calloc ( 1, sizeof ( dms_unpacker_t ) );
+    if ( unpacker != NULL )
+        dms_unpacker_reset ( unpacker );
+    return unpacker;
+}
+
+
+void dms_unpacker_free ( dms_unpacker_t ** unpacker )
+{
+    free ( *unpacker );
+    *unpacker = NULL;
+}
+
+
+void dms_unpacker_reset ( dms_unpacker_t * const unpacker )
+{
+    unpacker->quick_text_loc   = 251;
+    unpacker->medium_text_loc  = 0x3fbe;
+    unpacker->heavy_text_loc   = 0;
+    unpacker->deep_text_loc    = 0x3fc4;
+    unpacker->deep_tables_init = false;
+    memset ( unpacker->text, 0, DMS_TEXT_SIZE );
+}
+
+
+bool dms_unpack_track ( dms_unpacker_t * const unpacker,
+                        const uint8_t * const  packed,
+                        const uint16_t         pklen1,
+                        const uint16_t         pklen2,
+                        const uint16_t         unpklen,
+                        const uint8_t          cmode,
+                        const uint8_t          flags,
+                        uint8_t * const        out )
+{
+    bool ok;
+    switch ( cmode ) {
+    case DMS_CMODE_NOCOMP:
+        ok = ( pklen1 >= unpklen );
+        if ( ok )
+            memcpy ( out, packed, unpklen );
+        break;
+
+    case DMS_CMODE_SIMPLE:
+        ok = dms_unpack_rle ( packed, pklen1, out, unpklen );
+        break;
+
+    case DMS_CMODE_QUICK:
+        ok = dms_unpack_quick ( unpacker, packed, pklen1,
+                                unpacker->stage, pklen2 ) &&
+             dms_unpack_rle ( unpacker->stage, pklen2, out, unpklen );
+        break;
+
+    case DMS_CMODE_MEDIUM:
+        ok = dms_unpack_medium ( unpacker, packed, pklen1,
+                                 unpacker->stage, pklen2 ) &&
+             dms_unpack_rle ( unpacker->stage, pklen2, out, unpklen );
+        break;
+
+    case DMS_CMODE_DEEP:
+        ok = dms_unpack_deep ( unpacker, packed, pklen1,
+                               unpacker->stage, pklen2 ) &&
+             dms_unpack_rle ( unpacker->stage, pklen2, out, unpklen );
+        break;
+
+    case DMS_CMODE_HEAVY1:
+    case DMS_CMODE_HEAVY2: {
+        // heavy 1 uses 4KiB dictionary, heavy 2 - 8KiB
+        const uint8_t heavy_flags = ( cmode == DMS_CMODE_HEAVY1 ) ?
+            ( uint8_t ) ( flags & 7 ) : ( uint8_t ) ( flags | 8 );
+        ok = dms_unpack_heavy ( unpacker, packed, pklen1, heavy_flags,
+                                unpacker->stage, pklen2 );
+        if ( ok ) {
+            if ( flags & DMS_TRACK_FLAG_RLE )
+                ok = dms_unpack_rle ( unpacker->stage, pklen2, out, unpklen );
+            else if ( ( ok = ( pklen2 >= unpklen ) ) )
+                memcpy ( out, unpacker->stage, unpklen );
+        }
+        break;
+    }
+
+    default:
+        ok = false;
+    }
+
+    if ( ! ( flags & DMS_TRACK_FLAG_NORESET ) )
+        dms_unpacker_reset ( unpacker );
+
+    return ok;
+}
+
+
+// CRC-16 (polynomial 0xa001, reflected)
+uint16_t dms_crc16 ( const uint8_t * const data,
+                     const size_t          size )
+{
+    uint16_t crc = 0;
+    for ( size_t i = 0 ; i < size ; i++ ) {
+        crc ^= data [ i ];
+        for ( unsigned bit = 0 ; bit < 8 ; bit++ )
+            crc = ( crc & 1 ) ? ( uint16_t ) ( ( crc >> 1 ) ^ 0xa001 ) :
+                                ( uint16_t ) ( crc >> 1 );
+    }
+    return crc;
+}
+
+
+uint16_t dms_checksum ( const uint8_t * const data,
+                        const size_t          size )
+{
+    uint16_t sum = 0;
+    for ( size_t i = 0 ; i < size ; i++ )
+        sum = ( uint16_t ) ( sum + data [ i ] );
+    return sum;
+}
+
+
+/*
+ * Bit reader (MSB first)
+ */
+
+static inline void bits_drop ( dms_bitreader_t * const bits,
+                               unsigned                n )
+{
+    if ( n > bits->bitcount )   // (corrupted data)
+        n = bits->bitcount;
+    bits->bitcount -= n;
+    bits->bitbuf   &= ( 1u << bits->bitcount ) - 1;
+    while ( bits->bitcount < 16 ) {
+        // past the end of the data - zeros
+        const uint8_t byte = ( bits->in < bits->end ) ? *bits->in++ : 0;
+        bits->bitbuf    = ( bits->bitbuf << 8 ) | byte;
+        bits->bitcount += 8;
+    }
+}
+
+static inline uint16_t bits_get ( const dms_bitreader_t * const bits,
+                                  const unsigned                n )
+{
+    return ( uint16_t ) ( bits->bitbuf >> ( bits->bitcount - n ) );
+}
+
+static void bits_init ( dms_bitreader_t * const bits,
+                        const uint8_t * const   in,
+                        const size_t            insize )
+{
+    bits->in       = in;
+    bits->end      = in + insize;
+    bits->bitbuf   = 0;
+    bits->bitcount = 0;
+    bits_drop ( bits, 0 );
+}
+
+
+/*
+ * RLE (0x90 - escape byte)
+ */
+
+static bool dms_unpack_rle ( const uint8_t * const in,
+                             const size_t          insize,
+                             uint8_t * const       out,
+                             const size_t          outsize )
+{
+    const uint8_t * inptr        = in,
+                  * const inend  = in + insize;
+    uint8_t       * outptr       = out,
+                  * const outend = out + outsize;
+
+    while ( outptr < outend ) {
+        if ( inptr >= inend )
+            return false;
+        const uint8_t a = *inptr++;
+        if ( a != 0x90 ) {
+            *outptr++ = a;
+            continue;
+        }
+
+        if ( inptr >= inend )
+            return false;
+        const uint8_t b = *inptr++;
+        if ( b == 0 ) {
+            *outptr++ = a;
+            continue;
+        }
+
+        // a repeated byte
+        if ( inptr >= inend )
+            return false;
+        const uint8_t value = *inptr++;
+        size_t n = b;
+        if ( b == 0xff ) {
+            if ( inend - inptr < 2 )
+                return false;
+            n = ( size_t ) ( inptr [ 0 ] << 8 | inptr [ 1 ] );
+            inptr += 2;
+        }
+        if ( n > ( size_t ) ( outend - outptr ) )
+            return false;
+        memset ( outptr, value, n );
+        outptr += n;
+    }
+    return true;
+}
+
+
+/*
+ * Quick (LZ77 with 256 bytes dictionary)
+ */
+
+static bool dms_unpack_quick ( dms_unpacker_t * const u,
+                               const uint8_t * const  in,
+                               const size_t           insize,
+                               uint8_t * const        out,
+                               const size_t           outsize )
+{
+    dms_bitreader_t * const bits = &u->bits;
+    bits_init ( bits, in, insize );
+
+    uint8_t       * outptr       = out,
+                  * const outend = out + outsize;
+    while ( outptr < outend ) {
+        if ( bits_get ( bits, 1 ) ) {
+            bits_drop ( bits, 1 );
+            *outptr++ = u->text [ u->quick_text_loc++ & QUICK_BITMASK ] =
+                ( uint8_t ) bits_get ( bits, 8 );
+            bits_drop ( bits, 8 );
+        } else {
+            bits_drop ( bits, 1 );
+            unsigned len = bits_get ( bits, 2 ) + 2u;
+            bits_drop ( bits, 2 );
+            uint16_t pos = ( uint16_t ) ( u->quick_text_loc - bits_get ( bits, 8 ) - 1 );
+            bits_drop ( bits, 8 );
+            while ( len-- > 0 && outptr < outend )
+                *outptr++ = u->text [ u->quick_text_loc++ & QUICK_BITMASK ] =
+                    u->text [ pos++ & QUICK_BITMASK ];
+        }
+    }
+    u->quick_text_loc = ( uint16_t ) ( ( u->quick_text_loc + 5 ) & QUICK_BITMASK );
+    return true;
+}
+
+
+/*
+ * Medium (LZ77 with 16KiB dictionary, static codes for positions)
+ */
+
+static bool dms_unpack_medium ( dms_unpacker_t * const u,
+                                const uint8_t * const  in,
+                                const size_t           insize,
+                                uint8_t * const        out,
+                                const size_t           outsize )
+{
+    dms_bitreader_t * const bits = &u->bits;
+    bits_init ( bits, in, insize );
+
+    uint8_t       * outptr       = out,
+                  * const outend = out + outsize;
+    while ( outptr < outend ) {
+        if ( bits_get ( bits, 1 ) ) {
+            bits_drop ( bits, 1 );
+            *outptr++ = u->text [ u->medium_text_loc++ & MEDIUM_BITMASK ] =
+                ( uint8_t ) bits_get ( bits, 8 );
+            bits_drop ( bits, 8 );
+        } else {
+            bits_drop ( bits, 1 );
+            unsigned c = bits_get ( bits, 8 );
+            bits_drop ( bits, 8 );
+            unsigned len = dms_d_code [ c ] + 3u;
+            unsigned nbits = dms_d_len [ c ];
+            c = ( ( c << nbits ) | bits_get ( bits, nbits ) ) & 0xff;
+            bits_drop ( bits, nbits );
+            nbits = dms_d_len [ c ];
+            c = ( unsigned ) ( dms_d_code [ c ] << 8 ) |
+                ( ( ( c << nbits ) | bits_get ( bits, nbits ) ) & 0xff );
+            bits_drop ( bits, nbits );
+
+            uint16_t pos = ( uint16_t ) ( u->medium_text_loc - c - 1 );
+            while ( len-- > 0 && outptr < outend )
+                *outptr++ = u->text [ u->medium_text_loc++ & MEDIUM_BITMASK ] =
+                    u->text [ pos++ & MEDIUM_BITMASK ];
+        }
+    }
+    u->medium_text_loc = ( uint16_t ) ( ( u->medium_text_loc + 66 ) & MEDIUM_BITMASK );
+    return true;
+}
+
+
+/*
+ * Deep (LZ77 with 16KiB dictionary, adaptive Huffman codes)
+ */
+
+static void deep_init_tables ( dms_unpacker_t * const u )
+{
+    for ( unsigned i = 0 ; i < DEEP_N_CHAR ; i++ ) {
+        u->deep_freq [ i ] = 1;
+        u->deep_son [ i ] = ( uint16_t ) ( i + DEEP_T );
+        u->deep_prnt [ i + DEEP_T ] = ( uint16_t ) i;
+    }
+    for ( unsigned i = 0, j = DEEP_N_CHAR ; j <= DEEP_R ; i += 2, j++ ) {
+        u->deep_freq [ j ] = ( uint16_t ) ( u->deep_freq [ i ] +
+                                            u->deep_freq [ i + 1 ] );
+        u->deep_son [ j ] = ( uint16_t ) i;
+        u->deep_prnt [ i ] = u->deep_prnt [ i + 1 ] = ( uint16_t ) j;
+    }
+    u->deep_freq [ DEEP_T ] = 0xffff;
+    u->deep_prnt [ DEEP_R ] = 0;
+    u->deep_tables_init = true;
+}
+
+
+// rebuild the tree (halving the frequencies)
+static void deep_reconstruct ( dms_unpacker_t * const u )
+{
+    uint16_t * const freq = u->deep_freq,
+             * const prnt = u->deep_prnt,
+             * const son  = u->deep_son;
+
+    // collect the leaves in the first half of the table
+    unsigned j = 0;
+    for ( unsigned i = 0 ; i < DEEP_T ; i++ ) {
+        if ( son [ i ] >= DEEP_T ) {
+            freq [ j ] = ( uint16_t ) ( ( freq [ i ] + 1 ) / 2 );
+            son [ j ] = son [ i ];
+            j++;
+        }
+    }
+
+    // connect the sons
+    for ( unsigned i = 0, k, f ; j < DEEP_T ; i += 2, j++ ) {
+        f = freq [ j ] = ( uint16_t ) ( freq [ i ] + freq [ i + 1 ] );
+        for ( k = j - 1 ; f < freq [ k ] ; k-- )
+            ;
+        k++;
+        const size_t nmove = ( j - k ) * sizeof ( uint16_t );
+        memmove ( &freq [ k + 1 ], &freq [ k ], nmove );
+        freq [ k ] = ( uint16_t ) f;
+        memmove ( &son [ k + 1 ], &son [ k ], nmove );
+        son [ k ] = ( uint16_t ) i;
+    }
+
+    // connect the parents
+    for ( unsigned i = 0 ; i < DEEP_T ; i++ ) {
+        const unsigned k = son [ i ];
+        if ( k >= DEEP_T )
+            prnt [ k ] = ( uint16_t ) i;
+        else
+            prnt [ k ] = prnt [ k + 1 ] = ( uint16_t ) i;
+    }
+}
+
+
+// increment the frequency of the code and update the tree
+static void deep_update ( dms_unpacker_t * const u,
+                          const unsigned         code )
+{
+    uint16_t * const freq = u->deep_freq,
+             * const prnt = u->deep_prnt,
+             * const son  = u->deep_son;
+
+    if ( freq [ DEEP_R ] == DEEP_MAX_FREQ )
+        deep_reconstruct ( u );
+
+    unsigned c = prnt [ code + DEEP_T ];
+    do {
+        const unsigned k = ++freq [ c ];
+
+        // if the order is disturbed - exchange the nodes
+        unsigned l = c + 1;
+        if ( k > freq [ l ] ) {
+            while ( k > freq [ ++l ] )
+                ;
+            l--;
+            freq [ c ] = freq [ l ];
+            freq [ l ] = ( uint16_t ) k;
+
+            const unsigned i = son [ c ];
+            prnt [ i ] = ( uint16_t ) l;
+            if ( i < DEEP_T )
+                prnt [ i + 1 ] = ( uint16_t ) l;
+
+            const unsigned j = son [ l ];
+            son [ l ] = ( uint16_t ) i;
+            prnt [ j ] = ( uint16_t ) c;
+            if ( j < DEEP_T )
+                prnt [ j + 1 ] = ( uint16_t ) c;
+            son [ c ] = ( uint16_t ) j;
+
+            c = l;
+        }
+    } while ( ( c = prnt [ c ] ) != 0 );    // up to the root
+}
+
+
+static unsigned deep_decode_char ( dms_unpacker_t * const u )
+{
+    dms_bitreader_t * const bits = &u->bits;
+
+    // from the root to a leaf
+    unsigned c = u->deep_son [ DEEP_R ];
+    while ( c < DEEP_T ) {
+        c = u->deep_son [ c + bits_get ( bits, 1 ) ];
+        bits_drop ( bits, 1 );
+    }
+    c -= DEEP_T;
+    deep_update ( u, c );
+    return c;
+}
+
+
+static unsigned deep_decode_position ( dms_unpacker_t * const u )
+{
+    dms_bitreader_t * const bits = &u->bits;
+
+    unsigned i = bits_get ( bits, 8 );
+    bits_drop ( bits, 8 );
+    const unsigned c = ( unsigned ) dms_d_code [ i ] << 8;
+    const unsigned nbits = dms_d_len [ i ];
+    i = ( ( i << nbits ) | bits_get ( bits, nbits ) ) & 0xff;
+    bits_drop ( bits, nbits );
+    return c | i;
+}
+
+
+static bool dms_unpack_deep ( dms_unpacker_t * const u,
+                              const uint8_t * const  in,
+                              const size_t           insize,
+                              uint8_t * const        out,
+                              const size_t           outsize )
+{
+    bits_init ( &u->bits, in, insize );
+    if ( ! u->deep_tables_init )
+        deep_init_tables ( u );
+
+    uint8_t       * outptr       = out,
+                  * const outend = out + outsize;
+    while ( outptr < outend ) {
+        const unsigned c = deep_decode_char ( u );
+        if ( c < 256 ) {
+            *outptr++ = u->text [ u->deep_text_loc++ & DEEP_BITMASK ] =
+                ( uint8_t ) c;
+        } else {
+            unsigned len = c - 255 + DEEP_THRESHOLD;
+            uint16_t pos = ( uint16_t ) ( u->deep_text_loc -
+                                          deep_decode_position ( u ) - 1 );
+            while ( len-- > 0 && outptr < outend )
+                *outptr++ = u->text [ u->deep_text_loc++ & DEEP_BITMASK ] =
+                    u->text [ pos++ & DEEP_BITMASK ];
+        }
+    }
+    u->deep_text_loc = ( uint16_t ) ( ( u->deep_text_loc + 60 ) & DEEP_BITMASK );
+    return true;
+}
+
+
+/*
+ * Heavy (LZ77 with 4 or 8KiB dictionary, static Huffman codes)
+ */
+
+static unsigned heavy_make_subtable ( dms_table_builder_t * const tb )
+{
+    unsigned i = 0;
+    if ( tb->error )
+        return 0;
+
+    if ( tb->len == tb->depth ) {
+        while ( ++tb->c < ( int ) tb->n ) {
+            if ( tb->bitlen [ tb->c ] == tb->len ) {
+                i = tb->codeword;
+                tb->codeword += tb->bit;
+                if ( tb->codeword > tb->table_size ) {
+                    tb->error = true;
+                    return 0;
+                }
+                while ( i < tb->codeword )
+                    tb->table [ i++ ] = ( uint16_t ) tb->c;
+                return ( unsigned ) tb->c;
+            }
+        }
+        tb->c = -1;
+        tb->len++;
+        tb->bit >>= 1;
+    }
+
+    tb->depth++;
+    if ( tb->depth < tb->maxdepth ) {
+        ( void ) heavy_make_subtable ( tb );
+        ( void ) heavy_make_subtable ( tb );
+    } else if ( tb->depth > 32 ) {
+        tb->error = true;
+        return 0;
+    } else {
+        if ( ( i = tb->avail++ ) >= 2 * tb->n - 1 ) {
+            tb->error = true;
+            return 0;
+        }
+        tb->unpacker->heavy_left [ i ]  = ( uint16_t ) heavy_make_subtable ( tb );
+        tb->unpacker->heavy_right [ i ] = ( uint16_t ) heavy_make_subtable ( tb );
+        if ( tb->codeword >= tb->table_size ) {
+            tb->error = true;
+            return 0;
+        }
+        if ( tb->depth == tb->maxdepth )
+            tb->table [ tb->codeword++ ] = ( uint16_t ) i;
+    }
+    tb->depth--;
+    return i;
+}
+
+
+static bool heavy_make_table ( dms_unpacker_t * const u,
+                               const unsigned         nchar,
+                               const uint8_t * const  bitlen,
+                               const unsigned         tablebits,
+                               uint16_t * const       table )
+{
+    dms_table_builder_t tb = {
+        .unpacker   = u,
+        .bitlen     = bitlen,
+        .table      = table,
+        .c          = -1,
+        .n          = nchar,
+        .table_size = 1u << tablebits,
+        .len        = 1,
+        .depth      = 1,
+        .maxdepth   = tablebits + 1,
+        .avail      = nchar,
+        .codeword   = 0,
+        .bit        = ( 1u << tablebits ) / 2,
+        .error      = false
+    };
+
+    heavy_make_subtable ( &tb );    // left subtree
+    heavy_make_subtable ( &tb );    // right subtree
+    return ( ! tb.error && tb.codeword == tb.table_size );
+}
+
+
+static bool heavy_read_tree_c ( dms_unpacker_t * const u )
+{
+    dms_bitreader_t * const bits = &u->bits;
+
+    const unsigned n = bits_get ( bits, 9 );
+    bits_drop ( bits, 9 );
+    if ( n > HEAVY_NC )
+        return false;
+
+    if ( n > 0 ) {
+        for ( unsigned i = 0 ; i < n ; i++ ) {
+            u->heavy_c_len [ i ] = ( uint8_t ) bits_get ( bits, 5 );
+            bits_drop ( bits, 5 );
+        }
+        memset ( &u->heavy_c_len [ n ], 0, HEAVY_NC - n );
+        return heavy_make_table ( u, HEAVY_NC, u->heavy_c_len, 12,
+                                  u->heavy_c_table );
+    }
+
+    // only one code
+    const uint16_t code = bits_get ( bits, 9 );
+    bits_drop ( bits, 9 );
+    if ( code >= HEAVY_NC )
+        return false;
+    memset ( u->heavy_c_len, 0, HEAVY_NC );
+    for ( unsigned i = 0 ; i < 4096 ; i++ )
+        u->heavy_c_table [ i ] = code;
+    return true;
+}
+
+
+static bool heavy_read_tree_p ( dms_unpacker_t * const u )
+{
+    dms_bitreader_t * const bits = &u->bits;
+
+    const unsigned n = bits_get ( bits, 5 );
+    bits_drop ( bits, 5 );
+    if ( n > u->heavy_np )
+        return false;
+
+    if ( n > 0 ) {
+        for ( unsigned i = 0 ; i < n ; i++ ) {
+            u->heavy_pt_len [ i ] = ( uint8_t ) bits_get ( bits, 4 );
+            bits_drop ( bits, 4 );
+        }
+        memset ( &u->heavy_pt_len [ n ], 0, u->heavy_np - n );
+        return heavy_make_table ( u, u->heavy_np, u->heavy_pt_len, 8,
+                                  u->heavy_pt_table );
+    }
+
+    // only one code
+    const uint16_t code = bits_get ( bits, 5 );
+    bits_drop ( bits, 5 );
+    if ( code >= u->heavy_np )
+        return false;
+    memset ( u->heavy_pt_len, 0, u->heavy_np );
+    for ( unsigned i = 0 ; i < 256 ; i++ )
+        u->heavy_pt_table [ i ] = code;
+    return true;
+}
+
+
+// returns HEAVY_NC on error
+static unsigned heavy_decode_c ( dms_unpacker_t * const u )
+{
+    dms_bitreader_t * const bits = &u->bits;
+
+    unsigned j = u->heavy_c_table [ bits_get ( bits, 12 ) ];
+    if ( j < HEAVY_N1 ) {
+        bits_drop ( bits, u->heavy_c_len [ j ] );
+        return j;
+    }
+
+    // longer than 12 bits
+    bits_drop ( bits, 12 );
+    const unsigned i = bits_get ( bits, 16 );
+    unsigned mask = 0x8000;
+    do {
+        j = ( i & mask ) ? u->heavy_right [ j ] : u->heavy_left [ j ];
+        mask >>= 1;
+    } while ( j >= HEAVY_N1 && j < 2 * HEAVY_NC - 1 && mask != 0 );
+    if ( j >= HEAVY_NC || u->heavy_c_len [ j ] < 12 )
+        return HEAVY_NC;
+    bits_drop ( bits, u->heavy_c_len [ j ] - 12u );
+    return j;
+}
+
+
+// returns UINT16_MAX + 1 on error
+static unsigned heavy_decode_p ( dms_unpacker_t * const u )
+{
+    dms_bitreader_t * const bits = &u->bits;
+    const unsigned np = u->heavy_np;
+
+    unsigned j = u->heavy_pt_table [ bits_get ( bits, 8 ) ];
+    if ( j < np ) {
+        bits_drop ( bits, u->heavy_pt_len [ j ] );
+    } else {
+        // longer than 8 bits
+        bits_drop ( bits, 8 );
+        const unsigned i = bits_get ( bits, 16 );
+        unsigned mask = 0x8000;
+        do {
+            j = ( i & mask ) ? u->heavy_right [ j ] : u->heavy_left [ j ];
+            mask >>= 1;
+        } while ( j >= np && j < 2 * HEAVY_NC - 1 && mask != 0 );
+        if ( j >= np || u->heavy_pt_len [ j ] < 8 )
+            return UINT16_MAX + 1u;
+        bits_drop ( bits, u->heavy_pt_len [ j ] - 8u );
+    }
+
+    // the last code - repeat the previous position
+    if ( j != np - 1 ) {
+        if ( j > 0 ) {
+            const unsigned nbits = j - 1;
+            j = bits_get ( bits, nbits ) | ( 1u << nbits );
+            bits_drop ( bits, nbits );
+        }
+        u->heavy_lastlen = ( uint16_t ) j;
+    }
+    return u->heavy_lastlen;
+}
+
+
+static bool dms_unpack_heavy ( dms_unpacker_t * const u,
+                               const uint8_t * const  in,
+                               const size_t           insize,
+                               const uint8_t          flags,
+                               uint8_t * const        out,
+                               const size_t           outsize )
+{
+    uint16_t bitmask;
+    if ( flags & 8 ) {
+        u->heavy_np = 15;
+        bitmask = HEAVY2_BITMASK;
+    } else {
+        u->heavy_np = 14;
+        bitmask = HEAVY1_BITMASK;
+    }
+
+    bits_init ( &u->bits, in, insize );
+    if ( flags & DMS_TRACK_FLAG_NEWTREES ) {
+        if ( ! heavy_read_tree_c ( u ) ||
+             ! heavy_read_tree_p ( u ) )
+        {
+            return false;
+        }
+    }
+
+    uint8_t       * outptr       = out,
+                  * const outend = out + outsize;
+    while ( outptr < outend ) {
+        const unsigned c = heavy_decode_c ( u );
+        if ( c >= HEAVY_NC )
+            return false;
+        if ( c < 256 ) {
+            *outptr++ = u->text [ u->heavy_text_loc++ & bitmask ] = ( uint8_t ) c;
+        } else {
+            const unsigned p = heavy_decode_p ( u );
+            if ( p > UINT16_MAX )
+                return false;
+            unsigned len = c - HEAVY_OFFSET;
+            uint16_t pos = ( uint16_t ) ( u->heavy_text_loc - p - 1 );
+            while ( len-- > 0 && outptr < outend )
+                *outptr++ = u->text [ u->heavy_text_loc++ & bitmask ] =
+                    u->text [ pos++ & bitmask ];
+        }
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef DMS_UNPACK_H
+#define DMS_UNPACK_H
+
+/*
+ * Decompression of DMS (Disk Masher System) track data
+ *
+ * The decompressors keep their state (dictionary, Huffman trees) between
+ * tracks - a track packed with flag DMS_TRACK_FLAG_NORESET (of the previous
+ * track) set can be unpacked only after the previous one.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// compression modes
+#define DMS_CMODE_NOCOMP   0
+#define DMS_CMODE_SIMPLE   1
+#define DMS_CMODE_QUICK    2
+#define DMS_CMODE_MEDIUM   3
+#define DMS_CMODE_DEEP     4
+#define DMS_CMODE_HEAVY1   5
+#define DMS_CMODE_HEAVY2   6
+
+// track flags
+#define DMS_TRACK_FLAG_NORESET   0x01   // keep the state for the next track
+#define DMS_TRACK_FLAG_NEWTREES  0x02   // (heavy) Huffman trees included
+#define DMS_TRACK_FLAG_RLE       0x04   // (heavy) RLE applied
+
+typedef struct dms_unpacker dms_unpacker_t;
+
+dms_unpacker_t * dms_unpacker_create ( void );
+
+void dms_unpacker_free ( dms_unpacker_t ** unpacker );
+
+// initial state (for the first track, or after a track without
+// the no-reset flag)
+void dms_unpacker_reset ( dms_unpacker_t * const unpacker );
+
+// unpacks track data (of size unpklen) to out
+bool dms_unpack_track ( dms_unpacker_t * const unpacker,
+                        const uint8_t * const  packed,
+                        const uint16_t         pklen1,
+                        const uint16_t         pklen2,
+                        const uint16_t         unpklen,
+                        const uint8_t          cmode,
+                        const uint8_t          flags,
+                        uint8_t * const        out );
+
+uint16_t dms_crc16 ( const uint8_t * const data,
+                     const size_t          size );
+
+uint16_t dms_checksum ( const uint8_t * const data,
+                        const size_t          size );
+
+#endif
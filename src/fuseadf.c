@@ -2,21 +2,39 @@
 #include "config.h"
 #include "adffs.h"
 
+#include "adfdev_gzip.h"
+#include "adfdev_ram.h"
 #include "adffs_log.h"
+#include "adffs_record.h"
+#include "adffs_trace.h"
+#include "adfindex.h"
+#include "adfverify.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 typedef struct cmdline_options_s {
     char *       adf_filename;
     char *       mount_point;
     unsigned int adf_volume;
+    unsigned int max_open_images;
+    bool         all_volumes;
     bool         write_mode;
     bool         single_threaded_fuse_mode_set;
     char *       logging_file;
+    bool         sync_log;
+    char *       record_file;
     bool         ignore_checksum_errors;
+    bool         gzip_index;
+    bool         metadata_index;
+    unsigned int prescan_threads;
+    unsigned int verify_threads;
+    bool         ram;
+    unsigned int ram_max_mib,
+                 ram_writeback_interval;
     bool         help,
                  version;
 } cmdline_options_t;
@@ -27,6 +45,9 @@ bool parse_args (  int *               argc,
                    char **             argv,
                    cmdline_options_t * options );
 
+bool parse_mount_options ( char * const        mount_options,
+                           cmdline_options_t * options );
+
 void drop_arg ( int *   argc,
                 char ** argv,
                 int     index );
@@ -91,6 +112,7 @@ int main ( int    argc,
     }
 
     struct adffs_state adffs_data;
+    memset ( &adffs_data, 0, sizeof ( adffs_data ) );
 
     // open logfile
     if ( options.logging_file ) {
@@ -100,6 +122,116 @@ int main ( int    argc,
             exit ( EXIT_FAILURE );
         }
         printf ( "fuseadf logging file: %s\n", options.logging_file );
+        adffs_log_async_enable ( ! options.sync_log );
+    }
+
+    // record the operations (to replay them later)
+    if ( options.record_file ) {
+        if ( ! adffs_record_start ( options.record_file ) ) {
+            fprintf ( stderr, "Cannot open the trace file: %s\n",
+                      options.record_file );
+            adffs_log_close();
+            exit ( EXIT_FAILURE );
+        }
+        printf ( "fuseadf recording operations to: %s\n", options.record_file );
+    }
+
+    // gzip-compressed images - keep the index (of access points) in a file
+    adfdev_gzip_set_index_sidecar ( options.gzip_index );
+
+    // verify the volume(s) before mounting (before the metadata indexes
+    // are enabled - the images are opened only for verifying)
+    if ( options.verify_threads > 0 ) {
+        const adfverify_options_t verify_options = {
+            .nthreads    = options.verify_threads,
+            .data_blocks = false,
+            .errors      = stdout
+        };
+        if ( ! adfverify_images ( options.adf_filename, options.adf_volume,
+                                  options.all_volumes, &verify_options, stdout ) &&
+             ! options.ignore_checksum_errors )
+        {
+            fprintf ( stderr, "Errors found - not mounting (use -i to mount anyway).\n" );
+            adffs_log_close();
+            exit ( EXIT_FAILURE );
+        }
+    }
+
+    // read-only volumes - keep the metadata (directory tree) in a file
+    adfindex_enable ( options.metadata_index );
+    adfindex_set_prescan ( options.prescan_threads );
+
+    // (not compressed) images loaded entirely to memory
+    adfdev_ram_enable ( options.ram,
+                        ( uint64_t ) options.ram_max_mib * 1024 * 1024 );
+    if ( options.ram )
+        adffs_data.ram_writeback_interval = options.ram_writeback_interval;
+
+    // a directory given instead of an image - mount all images it contains
+    struct stat adf_filename_stat;
+    if ( stat ( options.adf_filename, &adf_filename_stat ) == 0 &&
+         S_ISDIR ( adf_filename_stat.st_mode ) )
+    {
+        if ( options.all_volumes ) {
+            fprintf ( stderr, "Option -a cannot be used with a directory of images.\n" );
+            adffs_log_close();
+            exit ( EXIT_FAILURE );
+        }
+
+        printf ( "Opening image collection: %s, volume: %d, mode: %s, "
+                 "max. open images: %u\n",
+                 options.adf_filename,
+                 options.adf_volume,
+                 ( options.write_mode ) ? "read-write" : "read-only",
+                 options.max_open_images );
+
+        adffs_data.collection = adfcollection_open ( options.adf_filename,
+                                                     options.max_open_images,
+                                                     options.adf_volume,
+                                                     ! options.write_mode,
+                                                     options.ignore_checksum_errors );
+        if ( adffs_data.collection == NULL ) {
+            fprintf ( stderr, "Cannot open image collection: %s - aborting...\n",
+                      options.adf_filename );
+            adffs_log_close();
+            exit ( EXIT_FAILURE );
+        }
+        printf ( "Images found: %u\n", adffs_data.collection->nentries );
+        adffs_data.mountpoint = options.mount_point;
+
+        return fuse_main ( argc, (char **) argv, &adffs_oper, &adffs_data );
+    }
+
+    // all volumes of the image - each in its own directory
+    if ( options.all_volumes ) {
+        printf ( "Opening all volumes of image: %s, mode: %s\n",
+                 options.adf_filename,
+                 ( options.write_mode ) ? "read-write" : "read-only" );
+
+        adffs_data.collection = adfcollection_open_volumes ( options.adf_filename,
+                                                             options.max_open_images,
+                                                             ! options.write_mode,
+                                                             options.ignore_checksum_errors );
+        if ( adffs_data.collection == NULL ) {
+            fprintf ( stderr, "Cannot open volumes of image: %s - aborting...\n",
+                      options.adf_filename );
+            adffs_log_close();
+            exit ( EXIT_FAILURE );
+        }
+
+        const adfcollection_t * const collection = adffs_data.collection;
+        for ( unsigned i = 0 ; i < collection->nentries ; i++ )
+            printf ( "Volume %u: %s\n", collection->entries [ i ].volume,
+                     collection->entries [ i ].name );
+        adffs_data.mountpoint = options.mount_point;
+
+        if ( options.write_mode == true &&
+             collection->dev->readOnly == true )
+        {
+            printf ("Note: image opened in read-only mode.\n");
+        }
+
+        return fuse_main ( argc, (char **) argv, &adffs_oper, &adffs_data );
     }
 
     // open adf image
@@ -128,15 +260,11 @@ int main ( int    argc,
     }
 
     // pass control to FUSE
-#ifdef DEBUG_ADFFS
-    fprintf ( stderr, "-> fuse_main()\n" );
-#endif
+    adffs_trace ( ADFFS_TRACE_DEVICE, "-> fuse_main()" );
 
     int fuse_status = fuse_main ( argc, (char **) argv, &adffs_oper, &adffs_data );
 
-#ifdef DEBUG_ADFFS
-    fprintf ( stderr, "fuse_main -> %d\n", fuse_status );
-#endif
+    adffs_trace ( ADFFS_TRACE_DEVICE, "fuse_main -> %d", fuse_status );
 
     return fuse_status;
 }
@@ -146,20 +274,63 @@ void usage( void )
 {
     fprintf ( stderr,
               "Mount an ADF's volume and access its data in userspace (with FUSE).\n\n"
-              "Usage:\tfuseadf [-f] [-d] [-i] [-p partition] [-l logging_file]\n"
-              "                diskimage_adf mount_point\n\n"
+              "Usage:\tfuseadf [-f] [-d] [-i] [-p partition | -a] [-l logging_file]\n"
+              "                [-m max_open_images] diskimage_adf mount_point\n\n"
+              "  If diskimage_adf is a directory, all images (*.adf, *.hdf, *.adz,\n"
+              "  *.adf.gz, *.hdf.gz, *.dms, *.zip) it contains are mounted\n"
+              "  (as subdirectories of the mount_point).\n\n"
+              "  gzip-compressed, DMS and zipped images are supported (read-only).\n\n"
               "Options:\n"
               "    -p partition - partition/volume number (0-10), default: 0\n"
+              "    -a           - mount all volumes/partitions (as subdirectories\n"
+              "                   named as the volumes)\n"
+              "    -m max_open  - max. number of images open at the same time\n"
+              "                   (when mounting a directory), default: %u\n"
               "    -l logfile   - enable logging and (optionally) specify logging file,\n"
               "                   default log file: fuseadf.log\n"
               "    -i           - ignore checksum errors (default: do not ignore!)\n"
-              "    -V           - show version\n\n"
+              "    -V           - show version\n"
+              "    -o gzindex   - save the index of a gzip-compressed image in a file\n"
+              "                   (image_name.gzidx) and use it when opening next time\n"
+              "    -o metaindex - save the metadata (directory tree) of a read-only\n"
+              "                   volume in a file (image_name.N.adfidx) and use it\n"
+              "                   when mounting next time\n"
+              "    -o prescan[=N] - build the metadata index of a read-only volume\n"
+              "                   in the background right after mounting, reading\n"
+              "                   the image with N threads (default: %u, max. %u)\n"
+              "    -o ram       - load (not compressed) images entirely to memory,\n"
+              "                   modified blocks are written back on fsync, unmount\n"
+              "                   and periodically\n"
+              "    -o ram_max=N - max. size (in MiB) of an image loaded to memory,\n"
+              "                   default: %u\n"
+              "    -o ram_writeback=N - interval (in seconds) of writing back\n"
+              "                   the modified blocks (0 - only on fsync and unmount),\n"
+              "                   default: %u\n"
+              "    -o verify[=N] - verify the volume(s) before mounting (checksums\n"
+              "                   of the metadata blocks, the bitmap) with N threads\n"
+              "                   (default: %u, max. %u), not mounting if errors\n"
+              "                   are found (unless -i is given)\n"
+              "    -o synclog   - write the log synchronously (by default, the messages\n"
+              "                   are written out by a background thread)\n"
+              "    -o trace=C1+C2... - trace (to the log) categories of operations:\n"
+              "                   lookup, read, write, alloc, device or all\n"
+              "                   (changed at runtime by writing to mount_point%s)\n"
+              "    -o record=file - record the operations to the file (a binary trace,\n"
+              "                   can be replayed with bench_replay)\n\n"
               "  FUSE options (for details see FUSE documentation):\n"
               "    -o mount_options -  list of mount options (ie. 'ro' for read-only mount)\n"
               "                     -  (see: man fusermount)\n"
               "    -f               -  run in foreground (do not daemonize)\n"
               "    -d               -  run in foreground with more verbose (debug) info\n"
-              "    -s               -  single-threaded (enforced - no need to provide it)\n" );
+              "    -s               -  single-threaded (enforced - no need to provide it)\n",
+              ADFCOLLECTION_MAX_OPEN_DEFAULT,
+              ADFINDEX_PRESCAN_THREADS_DEFAULT,
+              ADFINDEX_PRESCAN_THREADS_MAX,
+              ADFDEV_RAM_MAX_MIB_DEFAULT,
+              ADFDEV_RAM_WRITEBACK_DEFAULT,
+              ADFVERIFY_THREADS_DEFAULT,
+              ADFVERIFY_THREADS_MAX,
+              ADFFS_TRACE_PATH );
 }
 
 
@@ -171,9 +342,13 @@ bool parse_args ( int *               argc,
     memset ( options, 0, sizeof ( cmdline_options_t ) );
     options->write_mode             = true;
     options->ignore_checksum_errors = false;
+    options->max_open_images        = ADFCOLLECTION_MAX_OPEN_DEFAULT;
+    options->ram_max_mib            = ADFDEV_RAM_MAX_MIB_DEFAULT;
+    options->ram_writeback_interval = ADFDEV_RAM_WRITEBACK_DEFAULT;
     
     //const char * valid_options = "p:l::o:dshvwquzV";
-    const char * valid_options = "p:l::o:fdshiwV";
+    const char * valid_options = "p:m:al::o:fdshiwV";
+    bool volume_set = false;
     int opt;
     while ( ( opt = getopt ( *argc, argv, valid_options ) ) != -1 ) {
         //printf ( "optind %d, opt %c, optarg %s\n", optind, ( char ) opt, optarg );
@@ -193,11 +368,32 @@ bool parse_args ( int *               argc,
                           options->adf_volume );
                 return false;
             }
+            volume_set = true;
+            optind -= 2;
+            drop_args ( argc, argv, optind, 2 );
+            continue;
+        }
+
+        case 'm': {
+            // max. number of open images (collection mode)
+            char * endptr = NULL;
+            options->max_open_images = ( unsigned int ) strtoul ( optarg, &endptr, 10 );
+            if ( endptr == optarg || options->max_open_images < 1 ) {
+                fprintf ( stderr, "Incorrect max. number of open images.\n" );
+                return false;
+            }
             optind -= 2;
             drop_args ( argc, argv, optind, 2 );
             continue;
         }
 
+        case 'a': {
+            options->all_volumes = true;
+            optind--;
+            drop_arg ( argc, argv, optind );
+            continue;
+        }
+
         case 'l': {
             if ( optarg ) {
                 options->logging_file = optarg;
@@ -230,8 +426,15 @@ bool parse_args ( int *               argc,
             //case 'V':
             continue;
         case 'o':
-            if ( strcmp ( optarg, "ro" ) == 0 )
-                options->write_mode = false;
+            if ( ! parse_mount_options ( optarg, options ) )
+                return false;
+            if ( *optarg == '\0' ) {
+                // only fuseadf's options given - nothing to pass to FUSE
+                // ("-o options" or "-ooptions")
+                const int nargs = ( argv [ optind - 1 ] == optarg ) ? 2 : 1;
+                optind -= nargs;
+                drop_args ( argc, argv, optind, nargs );
+            }
             continue;
 
         case 'h':   // check what it is for in FUSE (for now use as "help")
@@ -251,6 +454,11 @@ bool parse_args ( int *               argc,
         }
     }
 
+    if ( volume_set && options->all_volumes ) {
+        fprintf ( stderr, "Options -p and -a cannot be used together.\n" );
+        return false;
+    }
+
     if ( optind != *argc - 2 )
         return false;
 
@@ -262,6 +470,136 @@ bool parse_args ( int *               argc,
     return true;
 }
 
+// handle fuseadf's own mount options (removing them from the list,
+// which is passed to FUSE)
+bool parse_mount_options ( char * const        mount_options,
+                           cmdline_options_t * options )
+{
+    char * const opts = strdup ( mount_options );
+    if ( opts == NULL )
+        return false;
+
+    mount_options [ 0 ] = '\0';
+    char * saveptr = NULL;
+    for ( char * opt = strtok_r ( opts, ",", &saveptr ) ;
+          opt != NULL ;
+          opt = strtok_r ( NULL, ",", &saveptr ) )
+    {
+        if ( strncmp ( opt, "trace=", 6 ) == 0 ) {
+            // (separated with '+' - a comma separates the mount options)
+            for ( char * c = opt + 6 ; *c != '\0' ; c++ )
+                if ( *c == '+' )
+                    *c = ',';
+            if ( ! adffs_trace_set ( opt + 6, strlen ( opt + 6 ) ) ) {
+                fprintf ( stderr, "Incorrect trace categories.\n" );
+                free ( opts );
+                return false;
+            }
+            continue;
+        }
+
+        if ( strncmp ( opt, "record=", 7 ) == 0 && opt [ 7 ] != '\0' ) {
+            free ( options->record_file );
+            options->record_file = strdup ( opt + 7 );
+            continue;
+        }
+
+        if ( strcmp ( opt, "synclog" ) == 0 ) {
+            options->sync_log = true;
+            continue;
+        }
+
+        if ( strcmp ( opt, "gzindex" ) == 0 ) {
+            options->gzip_index = true;
+            continue;
+        }
+
+        if ( strcmp ( opt, "metaindex" ) == 0 ) {
+            options->metadata_index = true;
+            continue;
+        }
+
+        if ( strcmp ( opt, "prescan" ) == 0 ) {
+            if ( options->prescan_threads == 0 )
+                options->prescan_threads = ADFINDEX_PRESCAN_THREADS_DEFAULT;
+            continue;
+        }
+
+        if ( strncmp ( opt, "prescan=", 8 ) == 0 ) {
+            char * endptr = NULL;
+            options->prescan_threads = ( unsigned int ) strtoul ( opt + 8, &endptr, 10 );
+            if ( endptr == opt + 8 || *endptr != '\0' ||
+                 options->prescan_threads < 1 ||
+                 options->prescan_threads > ADFINDEX_PRESCAN_THREADS_MAX )
+            {
+                fprintf ( stderr, "Incorrect number of prescan threads.\n" );
+                free ( opts );
+                return false;
+            }
+            continue;
+        }
+
+        if ( strcmp ( opt, "verify" ) == 0 ) {
+            if ( options->verify_threads == 0 )
+                options->verify_threads = ADFVERIFY_THREADS_DEFAULT;
+            continue;
+        }
+
+        if ( strncmp ( opt, "verify=", 7 ) == 0 ) {
+            char * endptr = NULL;
+            options->verify_threads = ( unsigned int ) strtoul ( opt + 7, &endptr, 10 );
+            if ( endptr == opt + 7 || *endptr != '\0' ||
+                 options->verify_threads < 1 ||
+                 options->verify_threads > ADFVERIFY_THREADS_MAX )
+            {
+                fprintf ( stderr, "Incorrect number of verify threads.\n" );
+                free ( opts );
+                return false;
+            }
+            continue;
+        }
+
+        if ( strcmp ( opt, "ram" ) == 0 ) {
+            options->ram = true;
+            continue;
+        }
+
+        if ( strncmp ( opt, "ram_max=", 8 ) == 0 ) {
+            char * endptr = NULL;
+            options->ram_max_mib = ( unsigned int ) strtoul ( opt + 8, &endptr, 10 );
+            if ( endptr == opt + 8 || *endptr != '\0' || options->ram_max_mib < 1 ) {
+                fprintf ( stderr, "Incorrect max. size of an image in memory.\n" );
+                free ( opts );
+                return false;
+            }
+            continue;
+        }
+
+        if ( strncmp ( opt, "ram_writeback=", 14 ) == 0 ) {
+            char * endptr = NULL;
+            options->ram_writeback_interval =
+                ( unsigned int ) strtoul ( opt + 14, &endptr, 10 );
+            if ( endptr == opt + 14 || *endptr != '\0' ) {
+                fprintf ( stderr, "Incorrect interval of writing back.\n" );
+                free ( opts );
+                return false;
+            }
+            continue;
+        }
+
+        if ( strcmp ( opt, "ro" ) == 0 )
+            options->write_mode = false;
+
+        // not fuseadf's option - leave it for FUSE
+        if ( mount_options [ 0 ] != '\0' )
+            strcat ( mount_options, "," );
+        strcat ( mount_options, opt );
+    }
+
+    free ( opts );
+    return true;
+}
+
 // delete an argument from argv at index
 void drop_arg ( int * argc, char ** argv, int index )
 {
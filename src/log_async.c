@@ -0,0 +1,215 @@
+
+#include "log_async.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_ASYNC_BATCH_SIZE    ( 64 * 1024 )
+#define LOG_ASYNC_IDLE_WAIT_MS  100
+
+// a record of the ring - "seq" (the bounded MPMC queue by D. Vyukov):
+// == position - free for the producer of this position,
+// == position + 1 - written, ready for the consumer
+typedef struct log_record {
+    uint64_t seq;
+    unsigned len;
+    char     text [ LOG_ASYNC_RECORD_SIZE ];
+} log_record_t;
+
+static struct log_async {
+    log_record_t    records [ LOG_ASYNC_RECORDS ];
+    uint64_t        tail,               // next position to write (producers)
+                    head,               // next position to read (the thread)
+                    dropped,
+                    dropped_reported;
+    FILE *          flog;
+    bool            running,
+                    stopping,
+                    idle;               // the thread is (going to be) waiting
+    pthread_t       thread;
+    pthread_mutex_t lock;               // (only for waking up the thread)
+    pthread_cond_t  wakeup;
+    char            batch [ LOG_ASYNC_BATCH_SIZE ];
+} log_async = {
+    .lock   = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER
+};
+
+static void * log_async_thread ( void * arg );
+
+static bool log_async_is_empty ( void );
+
+
+bool log_async_start ( FILE * const flog )
+{
+    if ( flog == NULL || log_async.running )
+        return false;
+
+    for ( unsigned i = 0 ; i < LOG_ASYNC_RECORDS ; i++ )
+        log_async.records [ i ].seq = i;
+    log_async.head = log_async.tail = 0;
+    log_async.dropped = log_async.dropped_reported = 0;
+    log_async.flog     = flog;
+    log_async.stopping = false;
+    log_async.idle     = false;
+
+    // (the writer never handles signals - they are left to the other
+    //  threads, eg. SIGUSR1 to the one dumping the statistics)
+    sigset_t all, saved;
+    sigfillset ( &all );
+    pthread_sigmask ( SIG_BLOCK, &all, &saved );
+    const int rc = pthread_create ( &log_async.thread, NULL, log_async_thread, NULL );
+    pthread_sigmask ( SIG_SETMASK, &saved, NULL );
+    if ( rc != 0 )
+        return false;
+
+    __atomic_store_n ( &log_async.running, true, __ATOMIC_RELEASE );
+    return true;
+}
+
+
+void log_async_stop ( void )
+{
+    if ( ! log_async.running )
+        return;
+
+    __atomic_store_n ( &log_async.running, false, __ATOMIC_RELEASE );
+
+    pthread_mutex_lock ( &log_async.lock );
+    log_async.stopping = true;
+    pthread_cond_signal ( &log_async.wakeup );
+    pthread_mutex_unlock ( &log_async.lock );
+
+    pthread_join ( log_async.thread, NULL );
+}
+
+
+bool log_async_is_running ( void )
+{
+    return __atomic_load_n ( &log_async.running, __ATOMIC_ACQUIRE );
+}
+
+
+bool log_async_vinfo ( const char * const format,
+                       va_list            ap )
+{
+    if ( ! log_async_is_running() )
+        return false;
+
+    // reserve a record
+    uint64_t pos = __atomic_load_n ( &log_async.tail, __ATOMIC_RELAXED );
+    log_record_t * record;
+    for ( ;; ) {
+        record = &log_async.records [ pos & ( LOG_ASYNC_RECORDS - 1 ) ];
+        const uint64_t seq = __atomic_load_n ( &record->seq, __ATOMIC_ACQUIRE );
+        const int64_t diff = ( int64_t ) ( seq - pos );
+        if ( diff == 0 ) {
+            if ( __atomic_compare_exchange_n ( &log_async.tail, &pos, pos + 1,
+                                               true, __ATOMIC_RELAXED,
+                                               __ATOMIC_RELAXED ) )
+                break;
+        } else if ( diff < 0 ) {
+            // full
+            __atomic_add_fetch ( &log_async.dropped, 1, __ATOMIC_RELAXED );
+            return false;
+        } else {
+            pos = __atomic_load_n ( &log_async.tail, __ATOMIC_RELAXED );
+        }
+    }
+
+    // (the newline always fits)
+    int len = vsnprintf ( record->text, LOG_ASYNC_RECORD_SIZE - 1, format, ap );
+    if ( len < 0 )
+        len = 0;
+    else if ( len > LOG_ASYNC_RECORD_SIZE - 2 )
+        len = LOG_ASYNC_RECORD_SIZE - 2;
+    record->text [ len++ ] = '\n';
+    record->len = ( unsigned ) len;
+
+    __atomic_store_n ( &record->seq, pos + 1, __ATOMIC_RELEASE );
+
+    // wake up the thread if waiting (the fence orders the publishing
+    // of the record with the check)
+    __atomic_thread_fence ( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n ( &log_async.idle, __ATOMIC_RELAXED ) ) {
+        pthread_mutex_lock ( &log_async.lock );
+        pthread_cond_signal ( &log_async.wakeup );
+        pthread_mutex_unlock ( &log_async.lock );
+    }
+    return true;
+}
+
+
+uint64_t log_async_dropped ( void )
+{
+    return __atomic_load_n ( &log_async.dropped, __ATOMIC_RELAXED );
+}
+
+
+static bool log_async_is_empty ( void )
+{
+    const log_record_t * const record =
+        &log_async.records [ log_async.head & ( LOG_ASYNC_RECORDS - 1 ) ];
+    return __atomic_load_n ( &record->seq, __ATOMIC_ACQUIRE ) != log_async.head + 1;
+}
+
+
+static void * log_async_thread ( void * arg )
+{
+    (void) arg;
+
+    for ( ;; ) {
+        // collect the written records into a batch
+        size_t batch_len = 0;
+        while ( ! log_async_is_empty() ) {
+            log_record_t * const record =
+                &log_async.records [ log_async.head & ( LOG_ASYNC_RECORDS - 1 ) ];
+            if ( batch_len + record->len > LOG_ASYNC_BATCH_SIZE )
+                break;
+            memcpy ( log_async.batch + batch_len, record->text, record->len );
+            batch_len += record->len;
+            __atomic_store_n ( &record->seq, log_async.head + LOG_ASYNC_RECORDS,
+                               __ATOMIC_RELEASE );
+            log_async.head++;
+        }
+
+        const uint64_t dropped = log_async_dropped();
+        if ( dropped != log_async.dropped_reported ) {
+            fprintf ( log_async.flog, "[log: %llu message(s) dropped]\n",
+                      ( unsigned long long ) ( dropped - log_async.dropped_reported ) );
+            log_async.dropped_reported = dropped;
+        }
+
+        if ( batch_len > 0 ) {
+            fwrite ( log_async.batch, 1, batch_len, log_async.flog );
+            fflush ( log_async.flog );
+            continue;
+        }
+
+        // nothing to write - wait for more
+        pthread_mutex_lock ( &log_async.lock );
+        __atomic_store_n ( &log_async.idle, true, __ATOMIC_RELAXED );
+        __atomic_thread_fence ( __ATOMIC_SEQ_CST );
+        if ( log_async_is_empty() ) {
+            if ( log_async.stopping ) {
+                pthread_mutex_unlock ( &log_async.lock );
+                break;
+            }
+            struct timespec deadline;
+            clock_gettime ( CLOCK_REALTIME, &deadline );
+            deadline.tv_nsec += LOG_ASYNC_IDLE_WAIT_MS * 1000000L;
+            if ( deadline.tv_nsec >= 1000000000L ) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait ( &log_async.wakeup, &log_async.lock, &deadline );
+        }
+        __atomic_store_n ( &log_async.idle, false, __ATOMIC_RELAXED );
+        pthread_mutex_unlock ( &log_async.lock );
+    }
+
+    fflush ( log_async.flog );
+    return NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef LOG_ASYNC_H
+#define LOG_ASYNC_H
+
+/*
+ * Asynchronous logging
+ *
+ * Messages are formatted by the caller into fixed-size records of a (lock-free,
+ * multi-producer) ring buffer, a background thread writes them out
+ * to the log file in batches. Logging never blocks the caller - if the ring
+ * is full, the message is dropped (and the number of dropped messages
+ * is written to the log later).
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_ASYNC_RECORD_SIZE   512     // (longer messages are truncated)
+#define LOG_ASYNC_RECORDS       2048    // (must be a power of 2)
+
+// starts the writing thread (must be done in the process which is going
+// to log, ie. not before daemonizing)
+bool log_async_start ( FILE * const flog );
+
+// writes out all queued messages and stops the thread
+void log_async_stop ( void );
+
+bool log_async_is_running ( void );
+
+// queue a message (a newline is appended), false if not running
+// or the ring is full
+bool log_async_vinfo ( const char * const format,
+                       va_list            ap );
+
+uint64_t log_async_dropped ( void );
+
+#endif
@@ -2,6 +2,8 @@
 #ifndef FUSEADF_UTIL_H
 #define FUSEADF_UTIL_H
 
+#include "adffs_arena.h"
+
 #include <assert.h>
 
 static inline void pathstr_remove_trailing_slashes ( char * const path )
@@ -93,41 +95,27 @@ typedef struct path_s {
 } path_t;
 
 
+// (the buffers taken from the per-request arena - released with it,
+//  see adffs_arena.h)
 static inline path_t * path_create ( const char * const path_str )
 {
     assert ( path_str != NULL );
     //const char * const path_relative = pathstr_get_relative ( path_str );
 
-    path_t * const path = malloc ( sizeof ( path_t ) );
+    path_t * const path = adffs_arena_alloc ( sizeof ( path_t ) );
     if ( path == NULL )
         return NULL;
 
-    path->dirpath_buf   = strdup ( path_str );
-    if ( path->dirpath_buf == NULL ) {
-        free ( path );
+    path->dirpath_buf   = adffs_arena_strdup ( path_str );
+    path->entryname_buf = adffs_arena_strdup ( path_str );
+    if ( path->dirpath_buf == NULL || path->entryname_buf == NULL )
         return NULL;
-    }
     path->dirpath       = dirname ( path->dirpath_buf );
-
-    path->entryname_buf = strdup ( path_str );
-    if ( path->entryname_buf == NULL ) {
-        free ( path->dirpath_buf );
-        free ( path );
-        return NULL;
-    }
     path->entryname     = basename ( path->entryname_buf );
 
     return path;
 }
 
-static inline void path_free ( path_t ** const path )
-{
-    free ( (*path)->dirpath_buf );
-    free ( (*path)->entryname_buf );
-    free ( *path );
-    *path = NULL;
-}
-
 static inline bool path_is_dirpath_non_empty ( const path_t * const path )
 {
     assert ( path != NULL );
@@ -0,0 +1,465 @@
+#!/usr/bin/env python3
+#
+# make_dms_modes.py - generating the DMS test file dms_modes.dms
+#
+# Usage: make_dms_modes.py <output.dms> [<output.adf>]
+#
+# Packs the first 13 tracks of a disk (sectors with text and some binary
+# data, the rest of the disk - empty) with all the DMS modes - the tracks
+# listed in test_adfdev.c, also chained with NORESET and reusing
+# the HEAVY trees. The encoders are simple (a greedy search for matches,
+# randomly not taken), but write the formats as decoded by xDMS (and
+# dms_unpack.c) - also the positions of the text buffers between tracks.
+# With the fixed seed, the output is always the same (the committed file).
+# The optional 2nd file - the whole unpacked disk (for comparing).
+#
+
+import heapq
+import random
+import struct
+import sys
+
+TRACK_SIZE = 11264          # 22 sectors of 512 bytes
+DISK_TRACKS = 80
+SEED = 49
+
+# modes, flags
+QUICK, MEDIUM, DEEP, HEAVY1, HEAVY2 = 2, 3, 4, 5, 6
+NORESET, NEWTREES, RLE = 1, 2, 4
+
+PLAN = [ ( QUICK, NORESET ), ( QUICK, 0 ),
+         ( MEDIUM, NORESET ), ( MEDIUM, 0 ),
+         ( DEEP, NORESET ), ( DEEP, NORESET ), ( DEEP, 0 ),
+         ( HEAVY1, NEWTREES | RLE ), ( HEAVY1, RLE ),
+         ( HEAVY2, NEWTREES ), ( HEAVY2, NORESET | NEWTREES | RLE ),
+         ( HEAVY2, RLE ),
+         ( QUICK, 0 ) ]
+
+# the end of a track advances the text position of the next one (NORESET)
+TEXT_GAP = { QUICK: 5, MEDIUM: 66, DEEP: 60 }
+
+
+#
+# track data
+#
+
+def sector ( t, s ):
+    line = ( 'fuseadf DMS fixture: track %02u, sector %02u\n' % ( t, s ) ).encode()
+    b = bytearray ( line * 4 )
+    b += bytes ( ( ( t * 31 + s * 7 + i * i ) & 0xff ) for i in range ( 16 ) )
+    b += b'\x90' * 5        # (the RLE marker)
+    b += bytes ( 512 - len ( b ) )
+    return bytes ( b )
+
+
+def track_data ( t ):
+    return b''.join ( sector ( t, s ) for s in range ( 22 ) )
+
+
+def crc16 ( data ):
+    crc = 0
+    for x in data:
+        crc ^= x
+        for _ in range ( 8 ):
+            crc = ( crc >> 1 ) ^ 0xa001 if crc & 1 else crc >> 1
+    return crc
+
+
+#
+# bit writer, RLE, matches
+#
+
+class BitWriter:
+    def __init__ ( self ):
+        self.bits = []
+
+    def put ( self, value, n ):
+        for i in range ( n - 1, -1, -1 ):
+            self.bits.append ( ( value >> i ) & 1 )
+
+    def data ( self ):
+        b = self.bits + [ 0 ] * ( ( -len ( self.bits ) ) % 8 )
+        return bytes ( int ( ''.join ( map ( str, b [ i : i + 8 ] ) ), 2 )
+                       for i in range ( 0, len ( b ), 8 ) )
+
+
+def rle ( raw ):
+    out = bytearray()
+    i = 0
+    while i < len ( raw ):
+        a = raw [ i ]
+        n = 1
+        while i + n < len ( raw ) and raw [ i + n ] == a and n < 65535:
+            n += 1
+        if n >= 4:
+            if n < 255:
+                out += bytes ( [ 0x90, n, a ] )
+            else:
+                out += bytes ( [ 0x90, 0xff, a, n >> 8, n & 255 ] )
+            i += n
+        else:
+            if a == 0x90:
+                out += bytes ( [ 0x90, 0 ] )
+            else:
+                out.append ( a )
+            i += 1
+    return bytes ( out )
+
+
+# the longest match (length, distance) for data[ i ] - with the overlapping
+# copies, None in data (the gaps) not matching; taken with probability 0.9
+def find_match ( data, i, maxlen, maxdist, minlen, ok = lambda l, d: True ):
+    if random.random() >= 0.9:
+        return None
+    best = None
+    for d in range ( 1, min ( maxdist, i ) + 1 ):
+        l = 0
+        while l < maxlen and i + l < len ( data ) and data [ i + l - d ] == data [ i + l ]:
+            l += 1
+        while l >= minlen and not ok ( l, d ):
+            l -= 1
+        if l >= minlen and ( best is None or l > best [ 0 ] ):
+            best = ( l, d )
+    return best
+
+
+# the text of the previous track (NORESET), then the gap, then the data
+def text_buffer ( prev, data, gap ):
+    return list ( prev ) + [ None ] * ( gap if prev else 0 ) + list ( data )
+
+
+#
+# QUICK, MEDIUM
+#
+
+# MEDIUM / DEEP position codes
+D_CODE = [ 0 ] * 32 + [ 1 ] * 16 + [ 2 ] * 16 + [ 3 ] * 16
+for v in range ( 4, 12 ):
+    D_CODE += [ v ] * 8
+for v in range ( 12, 24 ):
+    D_CODE += [ v ] * 4
+for v in range ( 24, 48 ):
+    D_CODE += [ v ] * 2
+for v in range ( 48, 64 ):
+    D_CODE += [ v ]
+D_LEN = [ 3 ] * 32 + [ 4 ] * 48 + [ 5 ] * 64 + [ 6 ] * 48 + [ 7 ] * 48 + [ 8 ] * 16
+
+
+def encode_quick ( prev, data ):
+    buf = text_buffer ( prev [ -256 : ], data, TEXT_GAP [ QUICK ] )
+    bw = BitWriter()
+    i = len ( buf ) - len ( data )
+    while i < len ( buf ):
+        m = find_match ( buf, i, 5, 256, 2 )
+        if m:
+            l, d = m
+            bw.put ( 0, 1 ); bw.put ( l - 2, 2 ); bw.put ( d - 1, 8 )
+            i += l
+        else:
+            bw.put ( 1, 1 ); bw.put ( buf [ i ], 8 )
+            i += 1
+    return bw.data()
+
+
+# (length, position) - the bits to write
+MEDIUM_CODES = {}
+for c in range ( 256 ):
+    u = D_LEN [ c ]
+    for x in range ( 1 << u ):
+        c2 = ( ( c << u ) | x ) & 0xff
+        u2 = D_LEN [ c2 ]
+        for y in range ( 1 << u2 ):
+            pos = ( D_CODE [ c2 ] << 8 ) | ( ( ( c2 << u2 ) | y ) & 0xff )
+            key = ( D_CODE [ c ] + 3, pos )
+            if key not in MEDIUM_CODES:
+                MEDIUM_CODES [ key ] = ( c, u, x, u2, y )
+
+
+def encode_medium ( prev, data ):
+    buf = text_buffer ( prev, data, TEXT_GAP [ MEDIUM ] )
+    bw = BitWriter()
+    i = len ( buf ) - len ( data )
+    while i < len ( buf ):
+        m = find_match ( buf, i, 66, 300, 3,
+                         lambda l, d: ( l, d - 1 ) in MEDIUM_CODES )
+        if m:
+            l, d = m
+            c, u, x, u2, y = MEDIUM_CODES [ ( l, d - 1 ) ]
+            bw.put ( 0, 1 ); bw.put ( c, 8 ); bw.put ( x, u ); bw.put ( y, u2 )
+            i += l
+        else:
+            bw.put ( 1, 1 ); bw.put ( buf [ i ], 8 )
+            i += 1
+    return bw.data()
+
+
+#
+# DEEP - adaptive Huffman (as LZHUF), kept between the tracks with NORESET
+#
+
+DEEP_F = 60
+DEEP_THRESHOLD = 2
+DEEP_NCHAR = 256 - DEEP_THRESHOLD + DEEP_F
+DEEP_T = DEEP_NCHAR * 2 - 1
+DEEP_R = DEEP_T - 1
+
+# position - the bits to write
+DEEP_POSITIONS = {}
+for i in range ( 256 ):
+    j = D_LEN [ i ]
+    for x in range ( 1 << j ):
+        pos = ( D_CODE [ i ] << 8 ) | ( ( ( i << j ) | x ) & 0xff )
+        DEEP_POSITIONS.setdefault ( pos, ( i, j, x ) )
+
+
+class Deep:
+    def __init__ ( self ):
+        T, NCHAR, R = DEEP_T, DEEP_NCHAR, DEEP_R
+        self.freq = [ 0 ] * ( T + 1 )
+        self.prnt = [ 0 ] * ( T + NCHAR )
+        self.son  = [ 0 ] * T
+        for i in range ( NCHAR ):
+            self.freq [ i ] = 1
+            self.son [ i ] = i + T
+            self.prnt [ i + T ] = i
+        i = 0
+        j = NCHAR
+        while j <= R:
+            self.freq [ j ] = self.freq [ i ] + self.freq [ i + 1 ]
+            self.son [ j ] = i
+            self.prnt [ i ] = self.prnt [ i + 1 ] = j
+            i += 2
+            j += 1
+        self.freq [ T ] = 0xffff
+        self.prnt [ R ] = 0
+
+    def reconstruct ( self ):
+        T, NCHAR = DEEP_T, DEEP_NCHAR
+        freq, son, prnt = self.freq, self.son, self.prnt
+        j = 0
+        for i in range ( T ):
+            if son [ i ] >= T:
+                freq [ j ] = ( freq [ i ] + 1 ) // 2
+                son [ j ] = son [ i ]
+                j += 1
+        i = 0
+        j = NCHAR
+        while j < T:
+            f = freq [ j ] = freq [ i ] + freq [ i + 1 ]
+            k = j - 1
+            while f < freq [ k ]:
+                k -= 1
+            k += 1
+            freq [ k + 1 : j + 1 ] = freq [ k : j ]
+            freq [ k ] = f
+            son [ k + 1 : j + 1 ] = son [ k : j ]
+            son [ k ] = i
+            i += 2
+            j += 1
+        for i in range ( T ):
+            k = son [ i ]
+            if k >= T:
+                prnt [ k ] = i
+            else:
+                prnt [ k ] = prnt [ k + 1 ] = i
+
+    def update ( self, c ):
+        T, R = DEEP_T, DEEP_R
+        freq, son, prnt = self.freq, self.son, self.prnt
+        if freq [ R ] == 0x8000:
+            self.reconstruct()
+        c = prnt [ c + T ]
+        while True:
+            freq [ c ] += 1
+            k = freq [ c ]
+            l = c + 1
+            if k > freq [ l ]:
+                l += 1
+                while k > freq [ l ]:
+                    l += 1
+                l -= 1
+                freq [ c ] = freq [ l ]
+                freq [ l ] = k
+                i = son [ c ]
+                prnt [ i ] = l
+                if i < T:
+                    prnt [ i + 1 ] = l
+                j = son [ l ]
+                son [ l ] = i
+                prnt [ j ] = c
+                if j < T:
+                    prnt [ j + 1 ] = c
+                son [ c ] = j
+                c = l
+            c = prnt [ c ]
+            if c == 0:
+                break
+
+    def put_char ( self, bw, c ):
+        bits = []
+        k = self.prnt [ c + DEEP_T ]
+        while k != DEEP_R:
+            parent = self.prnt [ k ]
+            bits.append ( k - self.son [ parent ] )
+            k = parent
+        for b in reversed ( bits ):
+            bw.put ( b, 1 )
+        self.update ( c )
+
+
+def encode_deep ( deep, prev, data ):
+    buf = text_buffer ( prev, data, TEXT_GAP [ DEEP ] )
+    bw = BitWriter()
+    i = len ( buf ) - len ( data )
+    while i < len ( buf ):
+        m = find_match ( buf, i, 60, 300, 3, lambda l, d: ( d - 1 ) in DEEP_POSITIONS )
+        if m:
+            l, d = m
+            deep.put_char ( bw, l + 253 )
+            c, j, x = DEEP_POSITIONS [ d - 1 ]
+            bw.put ( c, 8 ); bw.put ( x, j )
+            i += l
+        else:
+            deep.put_char ( bw, buf [ i ] )
+            i += 1
+    return bw.data()
+
+
+#
+# HEAVY - static Huffman trees (written with NEWTREES, else kept)
+#
+
+def huffman_lengths ( freqs, maxlen ):
+    while True:
+        heap = [ ( f, i, None ) for i, f in enumerate ( freqs ) if f > 0 ]
+        heapq.heapify ( heap )
+        uid = len ( freqs )
+        while len ( heap ) > 1:
+            a = heapq.heappop ( heap )
+            b = heapq.heappop ( heap )
+            heapq.heappush ( heap, ( a [ 0 ] + b [ 0 ], uid, ( a, b ) ) )
+            uid += 1
+        lengths = [ 0 ] * len ( freqs )
+
+        def walk ( node, depth ):
+            if node [ 2 ] is None:
+                lengths [ node [ 1 ] ] = max ( depth, 1 )
+            else:
+                walk ( node [ 2 ] [ 0 ], depth + 1 )
+                walk ( node [ 2 ] [ 1 ], depth + 1 )
+        walk ( heap [ 0 ], 0 )
+        if max ( lengths ) <= maxlen:
+            return lengths
+        freqs = [ ( f + 1 ) // 2 + ( 1 if f else 0 ) for f in freqs ]
+
+
+def canonical_codes ( lengths ):
+    codes = {}
+    code = 0
+    for l in range ( 1, 33 ):
+        for s, length in enumerate ( lengths ):
+            if length == l:
+                codes [ s ] = ( code, l )
+                code += 1
+        code <<= 1
+    return codes
+
+
+class Heavy:
+    def __init__ ( self ):
+        self.codes = None
+
+
+def encode_heavy ( heavy, prev, data, heavy2, newtrees ):
+    npositions = 15 if heavy2 else 14
+    maxdist = 8192 if heavy2 else 4096
+    bw = BitWriter()
+    if newtrees:
+        char_freqs = [ max ( 1, int ( 2000 / ( i % 300 + 1 ) ) ) if i < 256 else
+                       max ( 1, int ( 400 / ( i - 255 ) ) ) for i in range ( 510 ) ]
+        random.shuffle ( char_freqs )
+        char_lengths = huffman_lengths ( char_freqs, 20 )
+        pos_freqs = [ max ( 1, int ( 100 / ( i + 1 ) ) ) for i in range ( npositions ) ]
+        pos_lengths = huffman_lengths ( pos_freqs, 15 )
+        bw.put ( 510, 9 )
+        for l in char_lengths:
+            bw.put ( l, 5 )
+        bw.put ( npositions, 5 )
+        for l in pos_lengths:
+            bw.put ( l, 4 )
+        heavy.codes = ( canonical_codes ( char_lengths ),
+                        canonical_codes ( pos_lengths ) )
+    char_codes, pos_codes = heavy.codes
+
+    buf = list ( prev ) + list ( data )
+    i = len ( prev )
+    while i < len ( buf ):
+        m = find_match ( buf, i, 256, min ( maxdist, 400 ), 3 )
+        if m:
+            l, d = m
+            bw.put ( *char_codes [ l + 253 ] )
+            p = d - 1
+            j = 0 if p == 0 else p.bit_length()
+            bw.put ( *pos_codes [ j ] )
+            if j > 1:
+                bw.put ( p & ( ( 1 << ( j - 1 ) ) - 1 ), j - 1 )
+            i += l
+        else:
+            bw.put ( *char_codes [ buf [ i ] ] )
+            i += 1
+    return bw.data()
+
+
+#
+# DMS file
+#
+
+def main():
+    if len ( sys.argv ) not in ( 2, 3 ):
+        sys.exit ( 'Usage: %s <output.dms> [<output.adf>]' % sys.argv [ 0 ] )
+
+    random.seed ( SEED )
+    deep = Deep()
+    heavy = Heavy()
+    prev = b''
+    body = bytearray()
+    for t, ( mode, flags ) in enumerate ( PLAN ):
+        raw = track_data ( t )
+        if mode == QUICK:
+            text = rle ( raw )
+            packed = encode_quick ( prev, text )
+        elif mode == MEDIUM:
+            text = rle ( raw )
+            packed = encode_medium ( prev, text )
+        elif mode == DEEP:
+            text = rle ( raw )
+            packed = encode_deep ( deep, prev, text )
+        else:
+            text = rle ( raw ) if flags & RLE else raw
+            packed = encode_heavy ( heavy, prev, text, mode == HEAVY2,
+                                    flags & NEWTREES )
+        prev = text if flags & NORESET else b''
+        if not flags & NORESET:
+            deep = Deep()
+
+        header = b'TR' + struct.pack ( '>HHHHHBBHH', t, 0, len ( packed ), len ( text ),
+                                       len ( raw ), flags, mode,
+                                       sum ( raw ) & 0xffff, crc16 ( packed ) )
+        header += struct.pack ( '>H', crc16 ( header ) )
+        body += header + packed
+
+    # (the info header - only the last track set)
+    header = bytearray ( b'DMS!' + bytes ( 50 ) )
+    header [ 18 : 20 ] = struct.pack ( '>H', DISK_TRACKS - 1 )
+    header += struct.pack ( '>H', crc16 ( header [ 4 : 54 ] ) )
+    with open ( sys.argv [ 1 ], 'wb' ) as f:
+        f.write ( header + body )
+
+    if len ( sys.argv ) == 3:
+        with open ( sys.argv [ 2 ], 'wb' ) as f:
+            f.write ( b''.join ( track_data ( t ) for t in range ( len ( PLAN ) ) ) +
+                      bytes ( ( DISK_TRACKS - len ( PLAN ) ) * TRACK_SIZE ) )
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Performance regression check - the block I/O per operation
+# of bench_adfimage on generated images, compared with the baselines
+# (perf_baseline_*.json)
+#
+# Usage: perf_adfimage.sh [bench_adfimage [source_dir]]
+#
+# After an intended change, update the baselines with:
+#   PERF_UPDATE_BASELINE=1 tests/perf_adfimage.sh bench/bench_adfimage tests
+#
+
+BENCH=${1:-../bench/bench_adfimage}
+SRC_DIR=${2:-${srcdir:-.}}
+THRESHOLD=${PERF_THRESHOLD:-5}
+
+
+check()
+{
+    NAME=$1
+    shift
+    BASELINE="${SRC_DIR}/perf_baseline_${NAME}.json"
+    echo "${NAME}: $*"
+    if [ -n "${PERF_UPDATE_BASELINE}" ] ; then
+        "${BENCH}" "$@" -o "${BASELINE}" || exit 1
+        echo "Baseline written: ${BASELINE}"
+    else
+        "${BENCH}" "$@" -o "perf_adfimage_${NAME}.json" \
+            -c "${BASELINE}" -T ${THRESHOLD} || exit 1
+    fi
+}
+
+
+check dd_ofs       -t dd -f ofs -d 4 -l 2 -n 8 -s 2048 -N 500
+check hdf_ffs      -t hdf -m 20 -f ffs -d 8 -l 2 -n 16 -N 1000
+check hdf_dircache -t hdf -m 20 -f dircache -d 8 -l 2 -n 16 -N 1000
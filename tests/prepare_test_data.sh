@@ -15,7 +15,8 @@ download_fred_fish_disks()
     FFDISK49="Amiga Library Disk #0049 (1987)(Fred Fish)(PD)[WB]"
     unzip "${FFDISK49}.zip"
     mv -v "${FFDISK49}.adf" ffdisk0049.adf
-    rm -fv "${FFDISK49}.zip"
+    # (kept for testing mounting images from ZIP archives)
+    mv -v "${FFDISK49}.zip" ffdisk0049.zip
 }
 
 
@@ -36,6 +37,13 @@ download_adflib_test_images()
 }
 
 
+# compressed copies of the images
+create_compressed_images()
+{
+    gzip -9 -c testffs.adf > testffs.adz
+    gzip -9 -c ffdisk0049.adf > ffdisk0049.adf.gz
+}
+
 
 CUR_DIR=`pwd`
 
@@ -45,4 +53,5 @@ CUR_DIR=`pwd`
 cd testdata
 download_fred_fish_disks
 download_adflib_test_images
+create_compressed_images
 cd "${CUR_DIR}"
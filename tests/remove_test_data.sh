@@ -3,5 +3,5 @@
 
 CUR_DIR=`pwd`
 cd testdata
-rm *.adf log
+rm *.adf *.adz *.gz *.zip log
 cd "${CUR_DIR}"
@@ -0,0 +1,212 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/adfcollection.h"
+
+
+START_TEST ( test_adfcollection_open_fail )
+{
+    adfcollection_t * coll = adfcollection_open ( "nonexistent_dir", 2, 0, true, true );
+    ck_assert_ptr_null ( coll );
+}
+END_TEST
+
+
+START_TEST ( test_adfcollection_open_close )
+{
+    adfcollection_t * coll = adfcollection_open ( "testdata", 2, 0, true, true );
+    ck_assert_ptr_nonnull ( coll );
+
+    // testdata: ffdisk0049.adf and the ADFlib test images
+    ck_assert_uint_ge ( coll->nentries, 6 );
+    ck_assert_uint_eq ( coll->nopen, 0 );
+
+    // entries are sorted
+    for ( unsigned i = 1 ; i < coll->nentries ; i++ )
+        ck_assert_int_lt ( strcmp ( coll->entries [ i - 1 ].name,
+                                    coll->entries [ i ].name ), 0 );
+
+    adfcollection_close ( &coll );
+    ck_assert_ptr_null ( coll );
+}
+END_TEST
+
+
+START_TEST ( test_adfcollection_find )
+{
+    adfcollection_t * coll = adfcollection_open ( "testdata", 2, 0, true, true );
+    ck_assert_ptr_nonnull ( coll );
+
+    adfcollection_entry_t * entry = adfcollection_find ( coll, "testffs.adf", 11 );
+    ck_assert_ptr_nonnull ( entry );
+    ck_assert_str_eq ( entry->name, "testffs.adf" );
+
+    // name followed by a path within the image
+    const char * const path = "testofs.adf/dir/file";
+    entry = adfcollection_find ( coll, path, 11 );
+    ck_assert_ptr_nonnull ( entry );
+    ck_assert_str_eq ( entry->name, "testofs.adf" );
+
+    entry = adfcollection_find ( coll, "testffs", 7 );
+    ck_assert_ptr_null ( entry );
+
+    entry = adfcollection_find ( coll, "nonexistent.adf", 15 );
+    ck_assert_ptr_null ( entry );
+
+    adfcollection_close ( &coll );
+}
+END_TEST
+
+
+START_TEST ( test_adfcollection_lru )
+{
+    adfcollection_t * coll = adfcollection_open ( "testdata", 2, 0, true, true );
+    ck_assert_ptr_nonnull ( coll );
+
+    adfcollection_entry_t
+        * const ffdisk  = adfcollection_find ( coll, "ffdisk0049.adf", 14 ),
+        * const testffs = adfcollection_find ( coll, "testffs.adf", 11 ),
+        * const testofs = adfcollection_find ( coll, "testofs.adf", 11 );
+    ck_assert_ptr_nonnull ( ffdisk );
+    ck_assert_ptr_nonnull ( testffs );
+    ck_assert_ptr_nonnull ( testofs );
+
+    ck_assert_ptr_nonnull ( adfcollection_get_image ( coll, ffdisk ) );
+    ck_assert_ptr_nonnull ( adfcollection_get_image ( coll, testffs ) );
+    ck_assert_uint_eq ( coll->nopen, 2 );
+
+    // use ffdisk again, so testffs becomes the least recently used
+    ck_assert_ptr_nonnull ( adfcollection_get_image ( coll, ffdisk ) );
+
+    ck_assert_ptr_nonnull ( adfcollection_get_image ( coll, testofs ) );
+    ck_assert_uint_eq ( coll->nopen, 2 );
+    ck_assert_ptr_nonnull ( ffdisk->adfimage );
+    ck_assert_ptr_null ( testffs->adfimage );
+    ck_assert_ptr_nonnull ( testofs->adfimage );
+
+    // images still usable after others were closed
+    adfimage_dentry_t dentry = adfimage_getdentry ( ffdisk->adfimage, "Plot" );
+    ck_assert_int_eq ( dentry.type, ADFVOLUME_DENTRY_DIRECTORY );
+
+    adfcollection_close ( &coll );
+}
+END_TEST
+
+
+START_TEST ( test_adfcollection_volumes )
+{
+    adfcollection_t * coll = adfcollection_open_volumes ( "testdata/testffs.adf",
+                                                          2, true, true );
+    ck_assert_ptr_nonnull ( coll );
+    ck_assert_ptr_nonnull ( coll->dev );
+
+    // a floppy - one volume only
+    ck_assert_uint_eq ( coll->nentries, 1 );
+    ck_assert_uint_eq ( coll->entries [ 0 ].volume, 0 );
+
+    adfcollection_entry_t * const entry = &coll->entries [ 0 ];
+    adfimage_t * const adf = adfcollection_get_image ( coll, entry );
+    ck_assert_ptr_nonnull ( adf );
+    ck_assert_ptr_eq ( adf->dev, coll->dev );
+    ck_assert ( ! adf->dev_owner );
+
+    adfimage_dentry_t dentry = adfimage_getdentry ( adf, "dir_1" );
+    ck_assert_int_eq ( dentry.type, ADFVOLUME_DENTRY_DIRECTORY );
+
+    adfcollection_close ( &coll );
+    ck_assert_ptr_null ( coll );
+}
+END_TEST
+
+
+// a hard disk with volumes of the same names ("A.2" also as a suffixed one)
+START_TEST ( test_adfcollection_volume_names )
+{
+    const char * const names[] = { "A", "A.2", "A" };
+    struct AdfPartition parts [ 3 ];
+    const struct AdfPartition * part_list [ 3 ];
+    for ( unsigned i = 0 ; i < 3 ; i++ ) {
+        parts [ i ] = ( struct AdfPartition ) {
+            .startCyl = 2 + ( int32_t ) i * 8,
+            .lenCyl   = 8,
+            .volName  = ( char * ) names [ i ],
+            .volType  = ADF_DOSFS_FFS
+        };
+        part_list [ i ] = &parts [ i ];
+    }
+    ck_assert_int_eq ( adfLibInit(), ADF_RC_OK );
+    struct AdfDevice * const dev = adfDevCreate ( "dump", "testdata/volnames.hdf",
+                                                  30, 2, 32 );
+    ck_assert_ptr_nonnull ( dev );
+    ck_assert_int_eq ( adfCreateHd ( dev, 3, part_list ), ADF_RC_OK );
+    adfDevClose ( dev );
+    adfLibCleanUp();
+
+    adfcollection_t * coll = adfcollection_open_volumes ( "testdata/volnames.hdf",
+                                                          2, true, true );
+    ck_assert_ptr_nonnull ( coll );
+    ck_assert_uint_eq ( coll->nentries, 3 );
+
+    // all different - each one found
+    for ( unsigned i = 0 ; i < coll->nentries ; i++ ) {
+        const char * const name = coll->entries [ i ].name;
+        for ( unsigned j = 0 ; j < i ; j++ )
+            ck_assert_str_ne ( coll->entries [ j ].name, name );
+        ck_assert_ptr_eq ( adfcollection_find ( coll, name, strlen ( name ) ),
+                           &coll->entries [ i ] );
+    }
+    ck_assert_ptr_nonnull ( adfcollection_find ( coll, "A", 1 ) );
+    ck_assert_ptr_nonnull ( adfcollection_find ( coll, "A.2", 3 ) );
+
+    adfcollection_close ( &coll );
+    unlink ( "testdata/volnames.hdf" );
+}
+END_TEST
+
+
+Suite * adfcollection_suite ( void )
+{
+    Suite * s = suite_create ( "adfcollection" );
+
+    TCase * tc = tcase_create ( "adfcollection open nonexistent - fail" );
+    tcase_add_test ( tc, test_adfcollection_open_fail );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfcollection open close" );
+    tcase_add_test ( tc, test_adfcollection_open_close );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfcollection find" );
+    tcase_add_test ( tc, test_adfcollection_find );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfcollection lru" );
+    tcase_add_test ( tc, test_adfcollection_lru );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfcollection volumes" );
+    tcase_add_test ( tc, test_adfcollection_volumes );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfcollection volume names" );
+    tcase_add_test ( tc, test_adfcollection_volume_names );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adfcollection_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
@@ -0,0 +1,495 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../src/adfdev_dms.h"
+#include "../src/adfdev_gzip.h"
+#include "../src/adfdev_ram.h"
+#include "../src/adfimage.h"
+#include "../src/dms_unpack.h"
+
+// (the directory with the checked-in test files)
+#ifndef TESTS_SRCDIR
+#define TESTS_SRCDIR "."
+#endif
+
+// DMS file with tracks packed with all the modes (the rest of the disk
+// - empty):
+//    0  QUICK  (NORESET)           7  HEAVY1 (NEWTREES, RLE)
+//    1  QUICK                      8  HEAVY1 (RLE - the trees of 7)
+//    2  MEDIUM (NORESET)           9  HEAVY2 (NEWTREES)
+//    3  MEDIUM                    10  HEAVY2 (NORESET, NEWTREES, RLE)
+//    4  DEEP   (NORESET)          11  HEAVY2 (RLE)
+//    5  DEEP   (NORESET)          12  QUICK
+//    6  DEEP
+// (the tracks after one with NORESET refer also to its data)
+// - generated with make_dms_modes.py (the same file on every run):
+//   $ python3 make_dms_modes.py dms_modes.dms
+#define DMS_FIXTURE          TESTS_SRCDIR "/dms_modes.dms"
+#define DMS_FIXTURE_TRACKS   13
+
+
+// compare all blocks of a compressed image with the original
+static void compare_images ( char * const original,
+                             char * const compressed )
+{
+    struct AdfDevice * dev_orig = adfimage_dev_open ( original, true, true );
+    ck_assert_ptr_nonnull ( dev_orig );
+    struct AdfDevice * dev_comp = adfimage_dev_open ( compressed, true, true );
+    ck_assert_ptr_nonnull ( dev_comp );
+
+    ck_assert_uint_eq ( dev_comp->sizeBlocks, dev_orig->sizeBlocks );
+    ck_assert_int_eq ( dev_comp->devType, dev_orig->devType );
+
+    uint8_t block_orig [ 512 ],
+            block_comp [ 512 ];
+    // backwards - to not read the data sequentially only
+    for ( uint32_t i = dev_orig->sizeBlocks ; i > 0 ; i-- ) {
+        ck_assert_int_eq ( adfDevReadBlock ( dev_orig, i - 1, 512, block_orig ),
+                           ADF_RC_OK );
+        ck_assert_int_eq ( adfDevReadBlock ( dev_comp, i - 1, 512, block_comp ),
+                           ADF_RC_OK );
+        ck_assert_mem_eq ( block_comp, block_orig, 512 );
+    }
+
+    adfimage_dev_close ( &dev_comp );
+    adfimage_dev_close ( &dev_orig );
+}
+
+
+START_TEST ( test_adfdev_gzip_read )
+{
+    compare_images ( "testdata/testffs.adf", "testdata/testffs.adz" );
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.adf.gz" );
+}
+END_TEST
+
+
+// (in the sidecar file: the header - 56 bytes, each point - out, in,
+//  bits, size of the compressed window and the window)
+#define GZIDX_HEADER_SIZE   56
+#define GZIDX_SPAN_OFFSET   48
+#define GZIDX_POINT_SIZE    24
+
+static void patch_sidecar ( const char * const filename,
+                            const long         offset,
+                            const uint64_t     value )
+{
+    FILE * const f = fopen ( filename, "r+b" );
+    ck_assert_ptr_nonnull ( f );
+    ck_assert_int_eq ( fseek ( f, offset, SEEK_SET ), 0 );
+    ck_assert_uint_eq ( fwrite ( &value, sizeof ( value ), 1, f ), 1 );
+    fclose ( f );
+}
+
+
+START_TEST ( test_adfdev_gzip_index_sidecar )
+{
+    unlink ( "testdata/ffdisk0049.adf.gz.gzidx" );
+    adfdev_gzip_set_index_sidecar ( true );
+
+    // the 1st open creates the index file, the 2nd uses it
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.adf.gz" );
+    ck_assert_int_eq ( access ( "testdata/ffdisk0049.adf.gz.gzidx", R_OK ), 0 );
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.adf.gz" );
+
+    // invalid points (the 2nd after the end, the 1st not at the start)
+    // and span - the index rebuilt
+    const char * const sidecar = "testdata/ffdisk0049.adf.gz.gzidx";
+    FILE * const f = fopen ( sidecar, "rb" );
+    ck_assert_ptr_nonnull ( f );
+    uint32_t window_size;
+    ck_assert_int_eq ( fseek ( f, GZIDX_HEADER_SIZE + 20, SEEK_SET ), 0 );
+    ck_assert_uint_eq ( fread ( &window_size, sizeof ( window_size ), 1, f ), 1 );
+    fclose ( f );
+
+    patch_sidecar ( sidecar, GZIDX_HEADER_SIZE + GZIDX_POINT_SIZE + window_size,
+                    UINT64_MAX );
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.adf.gz" );
+    patch_sidecar ( sidecar, GZIDX_HEADER_SIZE, 512 );
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.adf.gz" );
+    patch_sidecar ( sidecar, GZIDX_SPAN_OFFSET, 0 );
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.adf.gz" );
+
+    adfdev_gzip_set_index_sidecar ( false );
+    unlink ( "testdata/ffdisk0049.adf.gz.gzidx" );
+}
+END_TEST
+
+
+START_TEST ( test_adfdev_gzip_read_only )
+{
+    // compressed images are always read-only
+    adfimage_t * adf = adfimage_open ( "testdata/testffs.adz", 0, false, true );
+    ck_assert_ptr_nonnull ( adf );
+    ck_assert ( adf->dev->readOnly );
+
+    adfimage_dentry_t dentry = adfimage_getdentry ( adf, "dir_1" );
+    ck_assert_int_eq ( dentry.type, ADFVOLUME_DENTRY_DIRECTORY );
+
+    adfimage_close ( &adf );
+    ck_assert_ptr_null ( adf );
+}
+END_TEST
+
+
+static void put_be16 ( uint8_t * const p,
+                       const uint16_t  value )
+{
+    p [ 0 ] = ( uint8_t ) ( value >> 8 );
+    p [ 1 ] = ( uint8_t ) value;
+}
+
+
+// simple RLE (as in DMS), returns the size of the packed data
+static size_t rle_pack ( const uint8_t * const data,
+                         const size_t          size,
+                         uint8_t * const       packed )
+{
+    size_t pksize = 0;
+    for ( size_t i = 0 ; i < size ; ) {
+        size_t n = 1;
+        while ( i + n < size && n < 254 && data [ i + n ] == data [ i ] )
+            n++;
+        if ( n >= 4 ) {
+            packed [ pksize++ ] = 0x90;
+            packed [ pksize++ ] = ( uint8_t ) n;
+            packed [ pksize++ ] = data [ i ];
+            i += n;
+            continue;
+        }
+        packed [ pksize++ ] = data [ i ];
+        if ( data [ i ] == 0x90 )
+            packed [ pksize++ ] = 0;
+        i++;
+    }
+    return pksize;
+}
+
+
+// create a DMS file from a floppy image (with tracks not compressed
+// and compressed with RLE)
+static void create_dms ( const char * const adf_filename,
+                         const char * const dms_filename )
+{
+    enum { TRACK_SIZE = 2 * 11 * 512 };
+    FILE * const adf = fopen ( adf_filename, "rb" );
+    ck_assert_ptr_nonnull ( adf );
+    FILE * const dms = fopen ( dms_filename, "wb" );
+    ck_assert_ptr_nonnull ( dms );
+
+    uint8_t header [ 56 ];
+    memset ( header, 0, sizeof ( header ) );
+    memcpy ( header, "DMS!", 4 );
+    put_be16 ( header + 18, 79 );
+    put_be16 ( header + 54, dms_crc16 ( header + 4, 50 ) );
+    ck_assert_uint_eq ( fwrite ( header, sizeof ( header ), 1, dms ), 1 );
+
+    static uint8_t track [ TRACK_SIZE ],
+                   packed [ 2 * TRACK_SIZE ];
+    for ( uint16_t number = 0 ; number < 80 ; number++ ) {
+        ck_assert_uint_eq ( fread ( track, TRACK_SIZE, 1, adf ), 1 );
+
+        const uint8_t cmode = ( number % 2 ) ? DMS_CMODE_SIMPLE :
+                                               DMS_CMODE_NOCOMP;
+        size_t pksize = TRACK_SIZE;
+        if ( cmode == DMS_CMODE_SIMPLE )
+            pksize = rle_pack ( track, TRACK_SIZE, packed );
+        else
+            memcpy ( packed, track, TRACK_SIZE );
+
+        uint8_t theader [ 20 ];
+        memset ( theader, 0, sizeof ( theader ) );
+        theader [ 0 ] = 'T';
+        theader [ 1 ] = 'R';
+        put_be16 ( theader + 2, number );
+        put_be16 ( theader + 6, ( uint16_t ) pksize );
+        put_be16 ( theader + 8, ( uint16_t ) pksize );
+        put_be16 ( theader + 10, TRACK_SIZE );
+        theader [ 13 ] = cmode;
+        put_be16 ( theader + 14, dms_checksum ( track, TRACK_SIZE ) );
+        put_be16 ( theader + 16, dms_crc16 ( packed, pksize ) );
+        put_be16 ( theader + 18, dms_crc16 ( theader, 18 ) );
+
+        ck_assert_uint_eq ( fwrite ( theader, sizeof ( theader ), 1, dms ), 1 );
+        ck_assert_uint_eq ( fwrite ( packed, pksize, 1, dms ), 1 );
+    }
+
+    fclose ( dms );
+    fclose ( adf );
+}
+
+
+START_TEST ( test_adfdev_dms_read )
+{
+    create_dms ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.dms" );
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.dms" );
+    unlink ( "testdata/ffdisk0049.dms" );
+}
+END_TEST
+
+
+// a sector of the DMS fixture: a line of text 4 times, 16 "random"
+// bytes, 5 bytes 0x90 (the RLE escape), zeros
+static void dms_fixture_sector ( const unsigned  track,
+                                 const unsigned  sector,
+                                 uint8_t * const block )
+{
+    memset ( block, 0, 512 );
+    if ( track >= DMS_FIXTURE_TRACKS )
+        return;
+
+    char line [ 64 ];
+    const int len = snprintf ( line, sizeof ( line ),
+                               "fuseadf DMS fixture: track %02u, sector %02u\n",
+                               track, sector );
+    uint8_t * p = block;
+    for ( unsigned i = 0 ; i < 4 ; i++, p += len )
+        memcpy ( p, line, ( size_t ) len );
+    for ( unsigned i = 0 ; i < 16 ; i++ )
+        *p++ = ( uint8_t ) ( track * 31 + sector * 7 + i * i );
+    memset ( p, 0x90, 5 );
+}
+
+
+static void check_dms_track ( adfdev_t * const dev,
+                              const unsigned   track )
+{
+    uint8_t block [ 512 ], expected [ 512 ];
+    for ( unsigned sector = 0 ; sector < 22 ; sector++ ) {
+        ck_assert_int_eq ( adfdev_dms_backend.read (
+            dev, ( uint64_t ) ( track * 22 + sector ) * 512, 512, block ), ADF_RC_OK );
+        dms_fixture_sector ( track, sector, expected );
+        ck_assert_msg ( memcmp ( block, expected, 512 ) == 0,
+                        "track %u, sector %u", track, sector );
+    }
+}
+
+
+START_TEST ( test_adfdev_dms_modes )
+{
+    adfdev_t dev;
+    memset ( &dev, 0, sizeof ( dev ) );
+    ck_assert ( adfdev_dms_backend.probe ( DMS_FIXTURE ) );
+
+    // each track read first - unpacked with the ones it depends on
+    for ( unsigned track = 0 ; track <= DMS_FIXTURE_TRACKS ; track++ ) {
+        ck_assert_int_eq ( adfdev_dms_backend.open ( &dev, DMS_FIXTURE ), ADF_RC_OK );
+        ck_assert_uint_eq ( dev.size, 80 * 22 * 512 );
+        check_dms_track ( &dev, track );
+        adfdev_dms_backend.close ( &dev );
+    }
+
+    // backwards (from the end of the chains), then the whole disk at once
+    ck_assert_int_eq ( adfdev_dms_backend.open ( &dev, DMS_FIXTURE ), ADF_RC_OK );
+    for ( unsigned track = 80 ; track > 0 ; track-- )
+        check_dms_track ( &dev, track - 1 );
+
+    static uint8_t disk [ 80 * 22 * 512 ];
+    ck_assert_int_eq ( adfdev_dms_backend.read ( &dev, 0, sizeof ( disk ), disk ),
+                       ADF_RC_OK );
+    for ( unsigned block = 0 ; block < 80 * 22 ; block++ ) {
+        uint8_t expected [ 512 ];
+        dms_fixture_sector ( block / 22, block % 22, expected );
+        ck_assert_msg ( memcmp ( disk + block * 512, expected, 512 ) == 0,
+                        "block %u", block );
+    }
+    adfdev_dms_backend.close ( &dev );
+}
+END_TEST
+
+
+static void put_le16 ( uint8_t * const p,
+                       const uint16_t  value )
+{
+    p [ 0 ] = ( uint8_t ) value;
+    p [ 1 ] = ( uint8_t ) ( value >> 8 );
+}
+
+static void put_le32 ( uint8_t * const p,
+                       const uint32_t  value )
+{
+    put_le16 ( p, ( uint16_t ) value );
+    put_le16 ( p + 2, ( uint16_t ) ( value >> 16 ) );
+}
+
+
+// create a ZIP archive with the image stored (not compressed)
+static void create_zip_stored ( const char * const adf_filename,
+                                const char * const zip_filename )
+{
+    static uint8_t data [ 2 * 11 * 512 * 80 ];
+    FILE * const adf = fopen ( adf_filename, "rb" );
+    ck_assert_ptr_nonnull ( adf );
+    const size_t size = fread ( data, 1, sizeof ( data ), adf );
+    fclose ( adf );
+    ck_assert_uint_eq ( size, sizeof ( data ) );
+
+    const char name[] = "disk.adf";
+    const uint16_t namelen = sizeof ( name ) - 1;
+    const uint32_t crc = ( uint32_t ) crc32 ( 0, data, sizeof ( data ) );
+
+    uint8_t local [ 30 ],
+            central [ 46 ],
+            eocd [ 22 ];
+    memset ( local, 0, sizeof ( local ) );
+    memcpy ( local, "PK\x03\x04", 4 );
+    put_le16 ( local + 4, 10 );
+    put_le32 ( local + 14, crc );
+    put_le32 ( local + 18, sizeof ( data ) );
+    put_le32 ( local + 22, sizeof ( data ) );
+    put_le16 ( local + 26, namelen );
+
+    memset ( central, 0, sizeof ( central ) );
+    memcpy ( central, "PK\x01\x02", 4 );
+    put_le16 ( central + 4, 10 );
+    put_le16 ( central + 6, 10 );
+    put_le32 ( central + 16, crc );
+    put_le32 ( central + 20, sizeof ( data ) );
+    put_le32 ( central + 24, sizeof ( data ) );
+    put_le16 ( central + 28, namelen );
+
+    const uint32_t cd_offset = ( uint32_t ) ( sizeof ( local ) + namelen +
+                                              sizeof ( data ) );
+    memset ( eocd, 0, sizeof ( eocd ) );
+    memcpy ( eocd, "PK\x05\x06", 4 );
+    put_le16 ( eocd + 8, 1 );
+    put_le16 ( eocd + 10, 1 );
+    put_le32 ( eocd + 12, ( uint32_t ) sizeof ( central ) + namelen );
+    put_le32 ( eocd + 16, cd_offset );
+
+    FILE * const zip = fopen ( zip_filename, "wb" );
+    ck_assert_ptr_nonnull ( zip );
+    ck_assert_uint_eq ( fwrite ( local, sizeof ( local ), 1, zip ), 1 );
+    ck_assert_uint_eq ( fwrite ( name, namelen, 1, zip ), 1 );
+    ck_assert_uint_eq ( fwrite ( data, sizeof ( data ), 1, zip ), 1 );
+    ck_assert_uint_eq ( fwrite ( central, sizeof ( central ), 1, zip ), 1 );
+    ck_assert_uint_eq ( fwrite ( name, namelen, 1, zip ), 1 );
+    ck_assert_uint_eq ( fwrite ( eocd, sizeof ( eocd ), 1, zip ), 1 );
+    fclose ( zip );
+}
+
+
+START_TEST ( test_adfdev_zip_read )
+{
+    // deflated (as downloaded)
+    compare_images ( "testdata/ffdisk0049.adf", "testdata/ffdisk0049.zip" );
+
+    // stored
+    create_zip_stored ( "testdata/testffs.adf", "testdata/testffs_stored.zip" );
+    compare_images ( "testdata/testffs.adf", "testdata/testffs_stored.zip" );
+    unlink ( "testdata/testffs_stored.zip" );
+}
+END_TEST
+
+
+static void copy_file ( const char * const src,
+                        const char * const dst )
+{
+    static uint8_t data [ 2 * 11 * 512 * 80 ];
+    FILE * const in = fopen ( src, "rb" );
+    ck_assert_ptr_nonnull ( in );
+    const size_t size = fread ( data, 1, sizeof ( data ), in );
+    fclose ( in );
+
+    FILE * const out = fopen ( dst, "wb" );
+    ck_assert_ptr_nonnull ( out );
+    ck_assert_uint_eq ( fwrite ( data, 1, size, out ), size );
+    fclose ( out );
+}
+
+
+START_TEST ( test_adfdev_ram_write_back )
+{
+    copy_file ( "testdata/testffs.adf", "testdata/testffs_ram.adf" );
+    adfdev_ram_enable ( true, ( uint64_t ) ADFDEV_RAM_MAX_MIB_DEFAULT * 1024 * 1024 );
+
+    adfimage_t * adf = adfimage_open ( "testdata/testffs_ram.adf", 0, false, true );
+    ck_assert_ptr_nonnull ( adf );
+    ck_assert ( ! adf->dev->readOnly );
+    ck_assert_str_eq ( adf->dev->drv->name, ADFDEV_DRIVER_NAME );
+
+    ck_assert_int_eq ( adfimage_mkdir ( adf, "ram_dir", 0755 ), 0 );
+    ck_assert ( adfimage_flush ( adf ) );
+
+    // after flushing, the file has all blocks modified in memory
+    FILE * const file = fopen ( "testdata/testffs_ram.adf", "rb" );
+    ck_assert_ptr_nonnull ( file );
+    uint8_t block_mem [ 512 ],
+            block_file [ 512 ];
+    for ( uint32_t i = 0 ; i < adf->dev->sizeBlocks ; i++ ) {
+        ck_assert_int_eq ( adfDevReadBlock ( adf->dev, i, 512, block_mem ),
+                           ADF_RC_OK );
+        ck_assert_uint_eq ( fread ( block_file, 512, 1, file ), 1 );
+        ck_assert_mem_eq ( block_file, block_mem, 512 );
+    }
+    fclose ( file );
+
+    // the rest is written back on close
+    ck_assert_int_eq ( adfimage_mkdir ( adf, "ram_dir/subdir", 0755 ), 0 );
+    adfimage_close ( &adf );
+    adfdev_ram_enable ( false, 0 );
+
+    adf = adfimage_open ( "testdata/testffs_ram.adf", 0, true, true );
+    ck_assert_ptr_nonnull ( adf );
+    ck_assert_str_ne ( adf->dev->drv->name, ADFDEV_DRIVER_NAME );
+    adfimage_dentry_t dentry = adfimage_getdentry ( adf, "ram_dir/subdir" );
+    ck_assert_int_eq ( dentry.type, ADFVOLUME_DENTRY_DIRECTORY );
+    adfimage_close ( &adf );
+
+    unlink ( "testdata/testffs_ram.adf" );
+}
+END_TEST
+
+
+Suite * adfdev_suite ( void )
+{
+    Suite * s = suite_create ( "adfdev" );
+
+    TCase * tc = tcase_create ( "adfdev gzip read" );
+    tcase_add_test ( tc, test_adfdev_gzip_read );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfdev gzip index sidecar" );
+    tcase_add_test ( tc, test_adfdev_gzip_index_sidecar );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfdev gzip read-only" );
+    tcase_add_test ( tc, test_adfdev_gzip_read_only );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfdev dms read" );
+    tcase_add_test ( tc, test_adfdev_dms_read );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfdev dms modes" );
+    tcase_add_test ( tc, test_adfdev_dms_modes );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfdev zip read" );
+    tcase_add_test ( tc, test_adfdev_zip_read );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfdev ram write back" );
+    tcase_add_test ( tc, test_adfdev_ram_write_back );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adfdev_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
@@ -0,0 +1,122 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/adffs_arena.h"
+
+
+START_TEST ( test_adffs_arena_alloc )
+{
+    adffs_arena_reset();
+    for ( size_t size = 1 ; size < 100 ; size += 7 ) {
+        char * const ptr = adffs_arena_alloc ( size );
+        ck_assert_ptr_nonnull ( ptr );
+        ck_assert_uint_eq ( ( uintptr_t ) ptr % sizeof ( max_align_t ), 0 );
+        memset ( ptr, 0xaa, size );
+    }
+
+    char * const str = adffs_arena_strdup ( "/dir/subdir/file" );
+    ck_assert_ptr_nonnull ( str );
+    ck_assert_str_eq ( str, "/dir/subdir/file" );
+    adffs_arena_reset();
+}
+END_TEST
+
+
+START_TEST ( test_adffs_arena_release )
+{
+    adffs_arena_reset();
+    char * const first = adffs_arena_strdup ( "first" );
+
+    const adffs_arena_mark_t mark = adffs_arena_mark();
+    char * const second = adffs_arena_strdup ( "second" );
+    ck_assert_ptr_ne ( second, first );
+    adffs_arena_release ( mark );
+
+    // (the same memory again - the first one kept)
+    ck_assert_ptr_eq ( adffs_arena_strdup ( "third" ), second );
+    ck_assert_str_eq ( first, "first" );
+
+    adffs_arena_reset();
+    ck_assert_ptr_eq ( adffs_arena_strdup ( "fourth" ), first );
+    adffs_arena_reset();
+}
+END_TEST
+
+
+START_TEST ( test_adffs_arena_overflow )
+{
+    adffs_arena_reset();
+    char * const first = adffs_arena_strdup ( "in the buffer" );
+
+    const adffs_arena_mark_t mark = adffs_arena_mark();
+    ck_assert_ptr_null ( mark.chunk );
+    char * const next = adffs_arena_strdup ( "next" );
+    adffs_arena_release ( mark );
+
+    // (more than the buffer - from the heap)
+    char * const big = adffs_arena_alloc ( 3 * ADFFS_ARENA_SIZE );
+    ck_assert_ptr_nonnull ( big );
+    memset ( big, 0x55, 3 * ADFFS_ARENA_SIZE );
+    for ( unsigned i = 0 ; i < 100 ; i++ ) {
+        char * const ptr = adffs_arena_alloc ( ADFFS_ARENA_SIZE / 4 );
+        ck_assert_ptr_nonnull ( ptr );
+        ck_assert_uint_eq ( ( uintptr_t ) ptr % sizeof ( max_align_t ), 0 );
+        memset ( ptr, 0x33, ADFFS_ARENA_SIZE / 4 );
+    }
+    adffs_arena_release ( mark );
+
+    // (back in the buffer)
+    ck_assert_ptr_eq ( adffs_arena_strdup ( "again" ), next );
+    ck_assert_str_eq ( first, "in the buffer" );
+
+    // (also a mark in a chunk from the heap)
+    ck_assert_ptr_nonnull ( adffs_arena_alloc ( ADFFS_ARENA_SIZE ) );
+    ck_assert_ptr_nonnull ( adffs_arena_alloc ( ADFFS_ARENA_SIZE / 2 ) );
+    const adffs_arena_mark_t chunk_mark = adffs_arena_mark();
+    ck_assert_ptr_nonnull ( chunk_mark.chunk );
+    char * const in_chunk = adffs_arena_strdup ( "in a chunk" );
+    ck_assert_ptr_nonnull ( adffs_arena_alloc ( 2 * ADFFS_ARENA_SIZE ) );
+    adffs_arena_release ( chunk_mark );
+    ck_assert_ptr_eq ( adffs_arena_strdup ( "in a chunk" ), in_chunk );
+
+    adffs_arena_reset();
+    ck_assert_ptr_eq ( adffs_arena_strdup ( "in the buffer" ), first );
+    adffs_arena_reset();
+}
+END_TEST
+
+
+Suite * adffs_arena_suite ( void )
+{
+    Suite * s = suite_create ( "adffs_arena" );
+
+    TCase * tc = tcase_create ( "adffs_arena alloc" );
+    tcase_add_test ( tc, test_adffs_arena_alloc );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adffs_arena release" );
+    tcase_add_test ( tc, test_adffs_arena_release );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adffs_arena overflow" );
+    tcase_add_test ( tc, test_adffs_arena_overflow );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adffs_arena_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
@@ -0,0 +1,193 @@
+#include <check.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/adffs_stats.h"
+
+
+START_TEST ( test_adffs_stats_counts )
+{
+    adffs_stats_reset();
+
+    ck_assert_int_eq ( adffs_stats_end ( ADFFS_OP_GETATTR,
+                                         adffs_stats_start(), 0 ), 0 );
+    ck_assert_int_eq ( adffs_stats_end ( ADFFS_OP_GETATTR,
+                                         adffs_stats_start(), -2 ), -2 );
+
+    // ~2ms
+    const uint64_t start = adffs_stats_start();
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = 2000000 };
+    nanosleep ( &delay, NULL );
+    adffs_stats_end ( ADFFS_OP_READ, start, 512 );
+
+    adffs_op_stats_t stats;
+    adffs_stats_get ( ADFFS_OP_GETATTR, &stats );
+    ck_assert_uint_eq ( stats.count, 2 );
+    ck_assert_uint_eq ( stats.errors, 1 );
+
+    adffs_stats_get ( ADFFS_OP_READ, &stats );
+    ck_assert_uint_eq ( stats.count, 1 );
+    ck_assert_uint_eq ( stats.errors, 0 );
+    ck_assert_uint_ge ( stats.max_ns, 2000000 );
+    ck_assert_uint_eq ( stats.total_ns, stats.max_ns );
+
+    // (buckets below 1024us)
+    uint64_t nslower = 0;
+    for ( unsigned i = 0 ; i < 11 ; i++ )
+        nslower += stats.histogram [ i ];
+    ck_assert_uint_eq ( nslower, 0 );
+
+    adffs_stats_get ( ADFFS_OP_WRITE, &stats );
+    ck_assert_uint_eq ( stats.count, 0 );
+}
+END_TEST
+
+
+START_TEST ( test_adffs_stats_report )
+{
+    adffs_stats_reset();
+    adffs_stats_end ( ADFFS_OP_READDIR, adffs_stats_start(), 0 );
+
+    size_t size;
+    char * const report = adffs_stats_report ( &size );
+    ck_assert_ptr_nonnull ( report );
+    ck_assert_uint_eq ( strlen ( report ), size );
+    ck_assert_ptr_nonnull ( strstr ( report, "readdir" ) );
+    ck_assert_ptr_nonnull ( strstr ( report, "utimens" ) );
+    ck_assert_ptr_nonnull ( strstr ( report, "latency" ) );
+    free ( report );
+}
+END_TEST
+
+
+START_TEST ( test_adffs_stats_io )
+{
+    adffs_stats_reset();
+
+    adffs_io_stats_t io_before;
+    adffs_stats_get_io ( &io_before );
+
+    // only the I/O done during the operation is accounted to it
+    adffs_stats_io_read ( 512 );
+
+    const uint64_t start = adffs_stats_start();
+    adffs_stats_io_read ( 512 );
+    adffs_stats_io_read ( 512 );
+    adffs_stats_io_write ( 488 );
+    adffs_stats_cache_miss();
+    adffs_stats_cache_hit();
+    adffs_stats_cache_hit();
+    adffs_stats_end ( ADFFS_OP_WRITE, start, 488 );
+
+    adffs_op_stats_t stats;
+    adffs_stats_get ( ADFFS_OP_WRITE, &stats );
+    ck_assert_uint_eq ( stats.io.reads, 2 );
+    ck_assert_uint_eq ( stats.io.bytes_read, 1024 );
+    ck_assert_uint_eq ( stats.io.writes, 1 );
+    ck_assert_uint_eq ( stats.io.bytes_written, 488 );
+    ck_assert_uint_eq ( stats.io.cache_hits, 2 );
+    ck_assert_uint_eq ( stats.io.cache_misses, 1 );
+
+    adffs_stats_get ( ADFFS_OP_READ, &stats );
+    ck_assert_uint_eq ( stats.io.reads, 0 );
+
+    adffs_io_stats_t io;
+    adffs_stats_get_io ( &io );
+    ck_assert_uint_eq ( io.reads - io_before.reads, 3 );
+    ck_assert_uint_eq ( io.bytes_read - io_before.bytes_read, 1536 );
+    ck_assert_uint_eq ( io.writes - io_before.writes, 1 );
+
+    size_t size;
+    char * const report = adffs_stats_report ( &size );
+    ck_assert_ptr_nonnull ( report );
+    ck_assert_ptr_nonnull ( strstr ( report, "device_io" ) );
+    free ( report );
+}
+END_TEST
+
+
+START_TEST ( test_adffs_stats_path )
+{
+    ck_assert ( adffs_stats_is_path ( "/.fuseadf" ) );
+    ck_assert ( adffs_stats_is_path ( "/.fuseadf/stats" ) );
+    ck_assert ( adffs_stats_is_path ( "/.fuseadf/other" ) );
+    ck_assert ( ! adffs_stats_is_path ( "/.fuseadfx" ) );
+    ck_assert ( ! adffs_stats_is_path ( "/dir/.fuseadf" ) );
+    ck_assert ( ! adffs_stats_is_path ( "/" ) );
+}
+END_TEST
+
+
+START_TEST ( test_adffs_stats_signal )
+{
+    adffs_stats_reset();
+    adffs_stats_end ( ADFFS_OP_OPEN, adffs_stats_start(), 0 );
+
+    FILE * const out = tmpfile();
+    ck_assert_ptr_nonnull ( out );
+    ck_assert ( adffs_stats_signal_start ( out ) );
+
+    kill ( getpid(), SIGUSR1 );
+    long size = 0;
+    for ( unsigned i = 0 ; i < 100 && size == 0 ; i++ ) {
+        usleep ( 10000 );
+        fseek ( out, 0, SEEK_END );
+        size = ftell ( out );
+    }
+    adffs_stats_signal_stop();
+    ck_assert_int_gt ( size, 0 );
+
+    char buf [ 256 ];
+    rewind ( out );
+    ck_assert_ptr_nonnull ( fgets ( buf, sizeof ( buf ), out ) );
+    ck_assert_ptr_nonnull ( fgets ( buf, sizeof ( buf ), out ) );
+    ck_assert_ptr_nonnull ( strstr ( buf, "statistics" ) );
+    fclose ( out );
+}
+END_TEST
+
+
+Suite * adffs_stats_suite ( void )
+{
+    Suite * s = suite_create ( "adffs_stats" );
+
+    TCase * tc = tcase_create ( "adffs_stats counts" );
+    tcase_add_test ( tc, test_adffs_stats_counts );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adffs_stats report" );
+    tcase_add_test ( tc, test_adffs_stats_report );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adffs_stats io" );
+    tcase_add_test ( tc, test_adffs_stats_io );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adffs_stats path" );
+    tcase_add_test ( tc, test_adffs_stats_path );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adffs_stats signal" );
+    tcase_add_test ( tc, test_adffs_stats_signal );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adffs_stats_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
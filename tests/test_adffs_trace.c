@@ -0,0 +1,128 @@
+#include <check.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/adffs_trace.h"
+
+// (instead of the real log)
+static unsigned nlogged = 0;
+static char     last_logged [ 256 ];
+
+void adffs_log_info ( const char * const format, ... )
+{
+    va_list ap;
+    va_start ( ap, format );
+    vsnprintf ( last_logged, sizeof ( last_logged ), format, ap );
+    va_end ( ap );
+    nlogged++;
+}
+
+
+static void set ( const char * const spec )
+{
+    ck_assert ( adffs_trace_set ( spec, strlen ( spec ) ) );
+}
+
+
+static const char * get ( void )
+{
+    static char buf [ 64 ];
+    const size_t len = adffs_trace_get ( buf, sizeof ( buf ) );
+    ck_assert_uint_eq ( len, strlen ( buf ) );
+    return buf;
+}
+
+
+START_TEST ( test_adffs_trace_set )
+{
+    set ( "none" );
+    ck_assert_str_eq ( get(), "none\n" );
+
+    set ( "read,write" );
+    ck_assert_uint_eq ( adffs_trace_categories,
+                        ADFFS_TRACE_READ | ADFFS_TRACE_WRITE );
+    ck_assert_str_eq ( get(), "read,write\n" );
+
+    // a list replaces, +/- modify
+    set ( "lookup\n" );
+    ck_assert_str_eq ( get(), "lookup\n" );
+    set ( "+device +alloc -lookup" );
+    ck_assert_str_eq ( get(), "alloc,device\n" );
+
+    set ( "all" );
+    ck_assert_uint_eq ( adffs_trace_categories, ADFFS_TRACE_ALL );
+    set ( "-write" );
+    ck_assert_str_eq ( get(), "lookup,read,alloc,device\n" );
+
+    // (as from "echo > trace")
+    set ( "\n" );
+    ck_assert_uint_eq ( adffs_trace_categories, 0 );
+
+    // errors - nothing changed
+    set ( "read" );
+    ck_assert ( ! adffs_trace_set ( "write,bogus", 11 ) );
+    ck_assert ( ! adffs_trace_set ( "+", 1 ) );
+    ck_assert_str_eq ( get(), "read\n" );
+
+    // not terminated
+    ck_assert ( adffs_trace_set ( "devicexyz", 6 ) );
+    ck_assert_str_eq ( get(), "device\n" );
+
+    set ( "none" );
+}
+END_TEST
+
+
+START_TEST ( test_adffs_trace_log )
+{
+    set ( "none" );
+    nlogged = 0;
+    adffs_trace ( ADFFS_TRACE_READ, "read %d", 1 );
+    ck_assert_uint_eq ( nlogged, 0 );
+
+    set ( "read,device" );
+    adffs_trace ( ADFFS_TRACE_READ, "read %d", 2 );
+    ck_assert_uint_eq ( nlogged, 1 );
+    ck_assert_str_eq ( last_logged, "read 2" );
+    adffs_trace ( ADFFS_TRACE_WRITE, "write %d", 3 );
+    ck_assert_uint_eq ( nlogged, 1 );
+    adffs_trace ( ADFFS_TRACE_DEVICE, "device" );
+    ck_assert_uint_eq ( nlogged, 2 );
+
+    ck_assert ( adffs_trace_on ( ADFFS_TRACE_READ ) );
+    ck_assert ( ! adffs_trace_on ( ADFFS_TRACE_LOOKUP ) );
+    set ( "none" );
+}
+END_TEST
+
+
+Suite * adffs_trace_suite ( void )
+{
+    Suite * s = suite_create ( "adffs_trace" );
+
+    TCase * tc = tcase_create ( "adffs_trace set" );
+    tcase_add_test ( tc, test_adffs_trace_set );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adffs_trace log" );
+    tcase_add_test ( tc, test_adffs_trace_log );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adffs_trace_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
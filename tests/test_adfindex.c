@@ -0,0 +1,243 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/adfimage.h"
+#include "../src/adfindex.h"
+
+
+static void copy_file ( const char * const src,
+                        const char * const dst )
+{
+    static uint8_t data [ 2 * 11 * 512 * 80 ];
+    FILE * const in = fopen ( src, "rb" );
+    ck_assert_ptr_nonnull ( in );
+    const size_t size = fread ( data, 1, sizeof ( data ), in );
+    fclose ( in );
+
+    FILE * const out = fopen ( dst, "wb" );
+    ck_assert_ptr_nonnull ( out );
+    ck_assert_uint_eq ( fwrite ( data, 1, size, out ), size );
+    fclose ( out );
+}
+
+
+// compare (recursively) the index with the on-disk metadata and data
+static void compare_dir ( adfimage_t * const             adf,
+                          const adfindex_entry_t * const dir,
+                          const char * const             dirpath )
+{
+    ck_assert_int_eq ( ( int ) dir->nchildren,
+                       adfimage_count_dir_entries ( adf, ( *dirpath != '\0' ) ?
+                                                         dirpath : "/" ) );
+    adfimage_chdir ( adf, "/" );
+
+    for ( uint32_t i = 0 ; i < dir->nchildren ; i++ ) {
+        const adfindex_entry_t * const entry =
+            adfindex_get_child ( adf->index, dir, i );
+        char path [ ADFIMAGE_MAX_PATH ];
+        snprintf ( path, sizeof ( path ), "%s/%s", dirpath,
+                   adfindex_get_name ( adf->index, entry ) );
+
+        const adfindex_entry_t * found;
+        ck_assert_int_eq ( adfindex_lookup ( adf->index, path, &found ),
+                           ADFINDEX_FOUND );
+        ck_assert_ptr_eq ( found, entry );
+
+        const adfimage_dentry_t dentry = adfimage_getdentry ( adf, path + 1 );
+        const adfimage_dentry_t identry = adfindex_get_dentry ( adf->index, entry );
+        ck_assert_int_eq ( identry.type, dentry.type );
+        ck_assert_int_eq ( identry.adflib_entry.sector, dentry.adflib_entry.sector );
+        ck_assert_int_eq ( identry.adflib_entry.access, dentry.adflib_entry.access );
+        ck_assert_int_eq ( identry.adflib_entry.days, dentry.adflib_entry.days );
+        ck_assert_int_eq ( identry.adflib_entry.mins, dentry.adflib_entry.mins );
+
+        if ( entry->type == ADF_ST_DIR ) {
+            compare_dir ( adf, entry, path );
+
+        } else if ( entry->type == ADF_ST_FILE ) {
+            ck_assert_uint_eq ( entry->size, dentry.adflib_entry.size );
+
+            char * const data_disk  = malloc ( entry->size + 1 ),
+                 * const data_index = malloc ( entry->size + 1 );
+            ck_assert_int_eq ( adfimage_read ( adf, path, data_disk,
+                                               entry->size, 0 ),
+                               ( int ) entry->size );
+            ck_assert_int_eq ( adfindex_read ( adf->index, adf->vol, entry,
+                                               data_index, entry->size, 0 ),
+                               ( int ) entry->size );
+            ck_assert_mem_eq ( data_index, data_disk, entry->size );
+
+            // not aligned to blocks
+            if ( entry->size > 1000 ) {
+                ck_assert_int_eq ( adfindex_read ( adf->index, adf->vol, entry,
+                                                   data_index, 700, 333 ), 700 );
+                ck_assert_mem_eq ( data_index, data_disk + 333, 700 );
+            }
+            ck_assert_int_eq ( adfindex_read ( adf->index, adf->vol, entry,
+                                               data_index, 10, entry->size ), 0 );
+            free ( data_disk );
+            free ( data_index );
+        }
+    }
+}
+
+
+static void check_index ( const char * const filename )
+{
+    adfimage_t * adf = adfimage_open ( ( char * ) filename, 0, true, true );
+    ck_assert_ptr_nonnull ( adf );
+    ck_assert_ptr_nonnull ( adf->index );
+
+    // (if prescanning - no-op otherwise)
+    ck_assert ( adfindex_prescan_start ( adf->index ) );
+    ck_assert ( adfindex_prescan_wait ( adf->index ) );
+
+    const adfindex_entry_t * root;
+    ck_assert_int_eq ( adfindex_lookup ( adf->index, "/", &root ), ADFINDEX_FOUND );
+    ck_assert_int_eq ( root->type, ADF_ST_ROOT );
+    compare_dir ( adf, root, "" );
+
+    const adfindex_entry_t * entry;
+    ck_assert_int_eq ( adfindex_lookup ( adf->index, "/nonexistent", &entry ),
+                       ADFINDEX_NOT_FOUND );
+
+    adfimage_close ( &adf );
+}
+
+
+START_TEST ( test_adfindex_build_load )
+{
+    unlink ( "testdata/ffdisk0049.adf.0.adfidx" );
+    adfindex_enable ( true );
+
+    // the 1st open builds and saves the index, the 2nd loads it
+    check_index ( "testdata/ffdisk0049.adf" );
+    ck_assert_int_eq ( access ( "testdata/ffdisk0049.adf.0.adfidx", R_OK ), 0 );
+    check_index ( "testdata/ffdisk0049.adf" );
+
+    adfindex_enable ( false );
+    unlink ( "testdata/ffdisk0049.adf.0.adfidx" );
+}
+END_TEST
+
+
+START_TEST ( test_adfindex_ffs )
+{
+    unlink ( "testdata/testffs.adf.0.adfidx" );
+    adfindex_enable ( true );
+
+    check_index ( "testdata/testffs.adf" );
+    check_index ( "testdata/testffs.adf" );
+
+    adfindex_enable ( false );
+    unlink ( "testdata/testffs.adf.0.adfidx" );
+}
+END_TEST
+
+
+START_TEST ( test_adfindex_stale )
+{
+    copy_file ( "testdata/testffs.adf", "testdata/testffs_idx.adf" );
+    adfindex_enable ( true );
+    check_index ( "testdata/testffs_idx.adf" );
+
+    // modify the image - the index must be rebuilt
+    adfimage_t * adf = adfimage_open ( "testdata/testffs_idx.adf", 0, false, true );
+    ck_assert_ptr_nonnull ( adf );
+    ck_assert_ptr_null ( adf->index );     // (not for read-write volumes)
+    ck_assert_int_eq ( adfimage_mkdir ( adf, "idx_dir", 0755 ), 0 );
+    adfimage_close ( &adf );
+
+    check_index ( "testdata/testffs_idx.adf" );
+    adf = adfimage_open ( "testdata/testffs_idx.adf", 0, true, true );
+    const adfindex_entry_t * entry;
+    ck_assert_int_eq ( adfindex_lookup ( adf->index, "/idx_dir", &entry ),
+                       ADFINDEX_FOUND );
+    ck_assert_int_eq ( entry->type, ADF_ST_DIR );
+    adfimage_close ( &adf );
+
+    adfindex_enable ( false );
+    unlink ( "testdata/testffs_idx.adf.0.adfidx" );
+    unlink ( "testdata/testffs_idx.adf" );
+}
+END_TEST
+
+
+START_TEST ( test_adfindex_prescan )
+{
+    unlink ( "testdata/ffdisk0049.adf.0.adfidx" );
+    unlink ( "testdata/testffs.adf.0.adfidx" );
+    adfindex_set_prescan ( 4 );
+
+    // only in memory (the root block read like the others - by its type)
+    check_index ( "testdata/ffdisk0049.adf" );
+    check_index ( "testdata/testffs.adf" );
+    check_index ( "testdata/testofs.adf" );
+    ck_assert_int_ne ( access ( "testdata/testffs.adf.0.adfidx", F_OK ), 0 );
+
+    // not started - the on-disk metadata is used
+    adfimage_t * adf = adfimage_open ( "testdata/testffs.adf", 0, true, true );
+    ck_assert_ptr_nonnull ( adf->index );
+    const adfindex_entry_t * entry;
+    ck_assert_int_eq ( adfindex_lookup ( adf->index, "/", &entry ),
+                       ADFINDEX_UNKNOWN );
+    adfimage_close ( &adf );
+
+    // closing while prescanning
+    adf = adfimage_open ( "testdata/testffs.adf", 0, true, true );
+    ck_assert ( adfindex_prescan_start ( adf->index ) );
+    adfimage_close ( &adf );
+
+    // prescanned and saved
+    adfindex_enable ( true );
+    check_index ( "testdata/testffs.adf" );
+    ck_assert_int_eq ( access ( "testdata/testffs.adf.0.adfidx", R_OK ), 0 );
+    check_index ( "testdata/testffs.adf" );
+
+    adfindex_enable ( false );
+    adfindex_set_prescan ( 0 );
+    unlink ( "testdata/testffs.adf.0.adfidx" );
+}
+END_TEST
+
+
+Suite * adfindex_suite ( void )
+{
+    Suite * s = suite_create ( "adfindex" );
+
+    TCase * tc = tcase_create ( "adfindex build and load" );
+    tcase_add_test ( tc, test_adfindex_build_load );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfindex ffs" );
+    tcase_add_test ( tc, test_adfindex_ffs );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfindex stale" );
+    tcase_add_test ( tc, test_adfindex_stale );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfindex prescan" );
+    tcase_add_test ( tc, test_adfindex_prescan );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adfindex_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
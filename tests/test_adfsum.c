@@ -0,0 +1,150 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/adfsum.h"
+
+static const adfsum_impl_t impls[] = { ADFSUM_SCALAR, ADFSUM_SSE2, ADFSUM_AVX2 };
+#define NIMPLS ( sizeof ( impls ) / sizeof ( impls [ 0 ] ) )
+
+
+static uint32_t be32 ( const uint8_t * const p )
+{
+    return ( uint32_t ) p [ 0 ] << 24 | ( uint32_t ) p [ 1 ] << 16 |
+           ( uint32_t ) p [ 2 ] << 8  | ( uint32_t ) p [ 3 ];
+}
+
+
+// (as AmigaDOS computes it - the carry added after each addition)
+static uint32_t boot_sum_reference ( const uint8_t * const boot )
+{
+    uint32_t sum = 0;
+    for ( unsigned i = 0 ; i < 1024 ; i += 4 ) {
+        const uint32_t prev = sum;
+        sum += be32 ( boot + i );
+        if ( sum < prev )
+            sum++;
+    }
+    return sum;
+}
+
+
+static void fill ( uint8_t * const data,
+                   const size_t    size,
+                   const unsigned  pattern )
+{
+    uint64_t x = 0x9e3779b97f4a7c15ULL + pattern;
+    for ( size_t i = 0 ; i < size ; i++ ) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        switch ( pattern ) {
+        case 0:  data [ i ] = 0;    break;
+        case 1:  data [ i ] = 0xff; break;
+        default: data [ i ] = ( uint8_t ) x;
+        }
+    }
+}
+
+
+START_TEST ( test_adfsum_same_sums )
+{
+    uint8_t data [ 1024 + 3 ];
+    for ( unsigned pattern = 0 ; pattern < 20 ; pattern++ ) {
+        fill ( data, sizeof ( data ), pattern );
+
+        // (also not aligned)
+        for ( unsigned offset = 0 ; offset < 4 ; offset += 3 ) {
+            ck_assert ( adfsum_set_impl ( ADFSUM_SCALAR ) );
+            const uint32_t block = adfsum_block ( data + offset ),
+                           boot  = adfsum_boot ( data + offset );
+            ck_assert_uint_eq ( boot, boot_sum_reference ( data + offset ) );
+
+            for ( unsigned i = 0 ; i < NIMPLS ; i++ ) {
+                if ( ! adfsum_set_impl ( impls [ i ] ) )
+                    continue;
+                ck_assert_uint_eq ( adfsum_block ( data + offset ), block );
+                ck_assert_uint_eq ( adfsum_boot ( data + offset ), boot );
+            }
+        }
+    }
+    ck_assert ( adfsum_set_impl ( ADFSUM_AUTO ) );
+}
+END_TEST
+
+
+START_TEST ( test_adfsum_set )
+{
+    uint8_t block [ 512 ],
+            boot [ 1024 ];
+    for ( unsigned i = 0 ; i < NIMPLS ; i++ ) {
+        if ( ! adfsum_set_impl ( impls [ i ] ) )
+            continue;
+        for ( unsigned pattern = 0 ; pattern < 10 ; pattern++ ) {
+            fill ( block, sizeof ( block ), pattern );
+            adfsum_set ( block, 20 );
+            ck_assert ( adfsum_is_valid ( block ) );
+            block [ 100 ] ^= 1;
+            ck_assert ( ! adfsum_is_valid ( block ) );
+
+            // (bitmap blocks - the checksum first)
+            adfsum_set ( block, 0 );
+            ck_assert ( adfsum_is_valid ( block ) );
+
+            fill ( boot, sizeof ( boot ), pattern );
+            adfsum_set_boot ( boot );
+            ck_assert ( adfsum_is_boot_valid ( boot ) );
+            ck_assert_uint_eq ( boot_sum_reference ( boot ), 0xffffffff );
+            boot [ 1000 ] ^= 1;
+            ck_assert ( ! adfsum_is_boot_valid ( boot ) );
+        }
+    }
+    ck_assert ( adfsum_set_impl ( ADFSUM_AUTO ) );
+}
+END_TEST
+
+
+START_TEST ( test_adfsum_auto )
+{
+    ck_assert ( adfsum_set_impl ( ADFSUM_AUTO ) );
+    const adfsum_impl_t impl = adfsum_get_impl();
+    ck_assert_int_ne ( impl, ADFSUM_AUTO );
+    ck_assert ( adfsum_is_supported ( impl ) );
+    printf ( "adfsum: %s\n", adfsum_impl_name ( impl ) );
+}
+END_TEST
+
+
+Suite * adfsum_suite ( void )
+{
+    Suite * s = suite_create ( "adfsum" );
+
+    TCase * tc = tcase_create ( "adfsum same sums" );
+    tcase_add_test ( tc, test_adfsum_same_sums );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfsum set" );
+    tcase_add_test ( tc, test_adfsum_set );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfsum auto" );
+    tcase_add_test ( tc, test_adfsum_auto );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adfsum_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
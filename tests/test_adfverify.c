@@ -0,0 +1,169 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/adfimage.h"
+#include "../src/adfverify.h"
+
+
+static void copy_file ( const char * const src,
+                        const char * const dst )
+{
+    static uint8_t data [ 2 * 11 * 512 * 80 ];
+    FILE * const in = fopen ( src, "rb" );
+    ck_assert_ptr_nonnull ( in );
+    const size_t size = fread ( data, 1, sizeof ( data ), in );
+    fclose ( in );
+
+    FILE * const out = fopen ( dst, "wb" );
+    ck_assert_ptr_nonnull ( out );
+    ck_assert_uint_eq ( fwrite ( data, 1, size, out ), size );
+    fclose ( out );
+}
+
+
+static uint32_t read_long ( FILE * const   f,
+                            const long     offset )
+{
+    uint8_t b [ 4 ];
+    ck_assert_int_eq ( fseek ( f, offset, SEEK_SET ), 0 );
+    ck_assert_uint_eq ( fread ( b, 1, 4, f ), 4 );
+    return ( uint32_t ) b [ 0 ] << 24 | ( uint32_t ) b [ 1 ] << 16 |
+           ( uint32_t ) b [ 2 ] << 8  | ( uint32_t ) b [ 3 ];
+}
+
+
+static void write_long ( FILE * const   f,
+                         const long     offset,
+                         const uint32_t value )
+{
+    const uint8_t b [ 4 ] = { ( uint8_t ) ( value >> 24 ), ( uint8_t ) ( value >> 16 ),
+                              ( uint8_t ) ( value >> 8 ),  ( uint8_t ) value };
+    ck_assert_int_eq ( fseek ( f, offset, SEEK_SET ), 0 );
+    ck_assert_uint_eq ( fwrite ( b, 1, 4, f ), 4 );
+}
+
+
+static adfverify_report_t verify ( const char * const filename,
+                                   const unsigned     nthreads )
+{
+    adfimage_t * adf = adfimage_open ( ( char * ) filename, 0, true, true );
+    ck_assert_ptr_nonnull ( adf );
+
+    const adfverify_options_t options = {
+        .nthreads    = nthreads,
+        .data_blocks = true,
+        .errors      = stdout
+    };
+    adfverify_report_t report;
+    ck_assert ( adfverify_volume ( adf->vol, filename, &options, &report ) );
+    adfimage_close ( &adf );
+    return report;
+}
+
+
+START_TEST ( test_adfverify_clean )
+{
+    const char * const images[] = { "testdata/testffs.adf",
+                                    "testdata/testofs.adf" };
+    for ( unsigned i = 0 ; i < sizeof ( images ) / sizeof ( char * ) ; i++ ) {
+        const adfverify_report_t report = verify ( images [ i ], 4 );
+        ck_assert ( adfverify_is_clean ( &report ) );
+        ck_assert_uint_gt ( report.blocks, 1 );
+
+        // the same with one thread
+        const adfverify_report_t report1 = verify ( images [ i ], 1 );
+        ck_assert ( adfverify_is_clean ( &report1 ) );
+        ck_assert_uint_eq ( report1.blocks, report.blocks );
+        ck_assert_uint_eq ( report1.files, report.files );
+        ck_assert_uint_eq ( report1.dirs, report.dirs );
+        ck_assert_uint_eq ( report1.data_blocks, report.data_blocks );
+    }
+}
+END_TEST
+
+
+START_TEST ( test_adfverify_compressed )
+{
+    // (read through ADFlib)
+    const adfverify_report_t report = verify ( "testdata/testffs.adz", 4 ),
+                             raw    = verify ( "testdata/testffs.adf", 4 );
+    ck_assert ( adfverify_is_clean ( &report ) );
+    ck_assert_uint_eq ( report.nthreads, 1 );
+    ck_assert_uint_eq ( report.blocks, raw.blocks );
+    ck_assert_uint_eq ( report.files, raw.files );
+    ck_assert_uint_eq ( report.data_blocks, raw.data_blocks );
+}
+END_TEST
+
+
+START_TEST ( test_adfverify_errors )
+{
+    copy_file ( "testdata/testffs.adf", "testdata/testffs_verify.adf" );
+
+    // (a floppy - the root block in the middle)
+    const long root = 880 * 512;
+    FILE * const f = fopen ( "testdata/testffs_verify.adf", "r+b" );
+    ck_assert_ptr_nonnull ( f );
+
+    // a checksum error in the first entry of the root directory
+    int32_t entry = 0;
+    for ( unsigned i = 0 ; i < ADF_HT_SIZE && entry == 0 ; i++ )
+        entry = ( int32_t ) read_long ( f, root + 24 + 4 * i );
+    ck_assert_int_gt ( entry, 0 );
+    const long date = entry * 512 + 0x1a4;
+    write_long ( f, date, read_long ( f, date ) + 1 );
+
+    // the root block marked as free in the bitmap
+    const uint32_t bitmap = read_long ( f, root + 0x13c ),
+                   bit    = 880 - 2;
+    const long     word   = ( long ) bitmap * 512 + 4 + bit / 32 * 4;
+    write_long ( f, word, read_long ( f, word ) | 1u << ( bit % 32 ) );
+    fclose ( f );
+
+    const adfverify_report_t report = verify ( "testdata/testffs_verify.adf", 4 );
+    ck_assert ( ! adfverify_is_clean ( &report ) );
+    // (the bitmap block too - its checksum is not updated)
+    ck_assert_uint_eq ( report.checksum_errors, 2 );
+    ck_assert_uint_eq ( report.bitmap_errors, 1 );
+    ck_assert_uint_eq ( report.structure_errors, 0 );
+
+    unlink ( "testdata/testffs_verify.adf" );
+}
+END_TEST
+
+
+Suite * adfverify_suite ( void )
+{
+    Suite * s = suite_create ( "adfverify" );
+
+    TCase * tc = tcase_create ( "adfverify clean" );
+    tcase_add_test ( tc, test_adfverify_clean );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfverify compressed" );
+    tcase_add_test ( tc, test_adfverify_compressed );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfverify errors" );
+    tcase_add_test ( tc, test_adfverify_errors );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adfverify_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
@@ -0,0 +1,209 @@
+#include <check.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/log_async.h"
+
+#define NTHREADS    4
+#define NMESSAGES   10000
+
+
+static bool log_msg ( const char * const format, ... )
+{
+    va_list ap;
+    va_start ( ap, format );
+    const bool queued = log_async_vinfo ( format, ap );
+    va_end ( ap );
+    return queued;
+}
+
+
+static uint64_t not_queued = 0;
+
+
+static void * log_thread ( void * arg )
+{
+    const unsigned id = ( unsigned ) ( uintptr_t ) arg;
+    for ( unsigned i = 0 ; i < NMESSAGES ; i++ ) {
+        // (retry if the ring is full)
+        while ( ! log_msg ( "thread %u message %u", id, i ) )
+            __atomic_add_fetch ( &not_queued, 1, __ATOMIC_RELAXED );
+    }
+    return NULL;
+}
+
+
+START_TEST ( test_log_async_not_running )
+{
+    ck_assert ( ! log_async_is_running() );
+    ck_assert ( ! log_msg ( "lost" ) );
+    ck_assert ( ! log_async_start ( NULL ) );
+}
+END_TEST
+
+
+START_TEST ( test_log_async_messages )
+{
+    FILE * const out = tmpfile();
+    ck_assert_ptr_nonnull ( out );
+    ck_assert ( log_async_start ( out ) );
+    ck_assert ( log_async_is_running() );
+    ck_assert ( ! log_async_start ( out ) );
+
+    ck_assert ( log_msg ( "first %d", 1 ) );
+
+    char long_msg [ 2 * LOG_ASYNC_RECORD_SIZE ];
+    memset ( long_msg, 'x', sizeof ( long_msg ) - 1 );
+    long_msg [ sizeof ( long_msg ) - 1 ] = '\0';
+    ck_assert ( log_msg ( "%s", long_msg ) );
+
+    log_async_stop();
+    ck_assert ( ! log_async_is_running() );
+
+    char line [ 2 * LOG_ASYNC_RECORD_SIZE ];
+    rewind ( out );
+    ck_assert_ptr_nonnull ( fgets ( line, sizeof ( line ), out ) );
+    ck_assert_str_eq ( line, "first 1\n" );
+
+    // truncated
+    ck_assert_ptr_nonnull ( fgets ( line, sizeof ( line ), out ) );
+    ck_assert_uint_eq ( strlen ( line ), LOG_ASYNC_RECORD_SIZE - 1 );
+    ck_assert_int_eq ( line [ LOG_ASYNC_RECORD_SIZE - 2 ], '\n' );
+
+    ck_assert_ptr_null ( fgets ( line, sizeof ( line ), out ) );
+    fclose ( out );
+}
+END_TEST
+
+
+START_TEST ( test_log_async_threads )
+{
+    FILE * const out = tmpfile();
+    ck_assert_ptr_nonnull ( out );
+    ck_assert ( log_async_start ( out ) );
+
+    pthread_t threads [ NTHREADS ];
+    for ( unsigned i = 0 ; i < NTHREADS ; i++ )
+        ck_assert_int_eq ( pthread_create ( &threads [ i ], NULL, log_thread,
+                                            ( void * ) ( uintptr_t ) i ), 0 );
+    for ( unsigned i = 0 ; i < NTHREADS ; i++ )
+        pthread_join ( threads [ i ], NULL );
+    log_async_stop();
+
+    // all messages, in order for each thread (except reports of drops)
+    unsigned next [ NTHREADS ] = { 0 };
+    char line [ 128 ];
+    unsigned long long reported = 0;
+    rewind ( out );
+    while ( fgets ( line, sizeof ( line ), out ) != NULL ) {
+        unsigned id, n;
+        unsigned long long dropped;
+        if ( sscanf ( line, "[log: %llu message(s) dropped]", &dropped ) == 1 ) {
+            reported += dropped;
+            continue;
+        }
+        ck_assert_int_eq ( sscanf ( line, "thread %u message %u", &id, &n ), 2 );
+        ck_assert_uint_lt ( id, NTHREADS );
+        ck_assert_uint_eq ( n, next [ id ] );
+        next [ id ]++;
+    }
+    for ( unsigned i = 0 ; i < NTHREADS ; i++ )
+        ck_assert_uint_eq ( next [ i ], NMESSAGES );
+
+    // dropped - only the messages not queued (all reported)
+    ck_assert_uint_eq ( log_async_dropped(), not_queued );
+    ck_assert_uint_eq ( reported, not_queued );
+    fclose ( out );
+}
+END_TEST
+
+
+// the writer must not take signals meant for other threads (eg. SIGUSR1
+// for the statistics - with the default action terminating the process)
+START_TEST ( test_log_async_signals )
+{
+    // started with SIGUSR1 not blocked, then blocked in this thread
+    // (as by adffs_stats_signal_start())
+    FILE * const out = tmpfile();
+    ck_assert_ptr_nonnull ( out );
+    ck_assert ( log_async_start ( out ) );
+
+    sigset_t set, saved;
+    sigemptyset ( &set );
+    sigaddset ( &set, SIGUSR1 );
+    ck_assert_int_eq ( pthread_sigmask ( SIG_BLOCK, &set, &saved ), 0 );
+
+    // to each of the other threads - the writer (left pending there, the
+    // kernel could pick any thread for a signal to the process)
+    DIR * const tasks = opendir ( "/proc/self/task" );
+    ck_assert_ptr_nonnull ( tasks );
+    const pid_t self = ( pid_t ) syscall ( SYS_gettid );
+    unsigned sent = 0;
+    struct dirent * entry;
+    while ( ( entry = readdir ( tasks ) ) != NULL ) {
+        const pid_t tid = ( pid_t ) atoi ( entry->d_name );
+        if ( tid <= 0 || tid == self )
+            continue;
+        ck_assert_int_eq ( syscall ( SYS_tgkill, getpid(), tid, SIGUSR1 ), 0 );
+        sent++;
+    }
+    closedir ( tasks );
+    ck_assert_uint_ge ( sent, 1 );
+
+    for ( int i = 0 ; i < 100 ; i++ )
+        ck_assert ( log_msg ( "message %d", i ) );
+    log_async_stop();
+
+    // and to the process (left pending - for this thread)
+    ck_assert_int_eq ( kill ( getpid(), SIGUSR1 ), 0 );
+    const struct timespec timeout = { .tv_sec = 2, .tv_nsec = 0 };
+    ck_assert_int_eq ( sigtimedwait ( &set, NULL, &timeout ), SIGUSR1 );
+    ck_assert_int_eq ( pthread_sigmask ( SIG_SETMASK, &saved, NULL ), 0 );
+    fclose ( out );
+}
+END_TEST
+
+
+Suite * log_async_suite ( void )
+{
+    Suite * s = suite_create ( "log_async" );
+
+    TCase * tc = tcase_create ( "log_async not running" );
+    tcase_add_test ( tc, test_log_async_not_running );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "log_async messages" );
+    tcase_add_test ( tc, test_log_async_messages );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "log_async threads" );
+    tcase_add_test ( tc, test_log_async_threads );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "log_async signals" );
+    tcase_add_test ( tc, test_log_async_signals );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = log_async_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
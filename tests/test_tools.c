@@ -0,0 +1,591 @@
+#include <check.h>
+#include <dirent.h>
+#include <errno.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/adfimage.h"
+#include "../src/adfverify.h"
+
+// (the tools run from their build directory - next to the tests one,
+//  ADFTOOLS_DIR to use another)
+#define TOOLS_DIR_DEFAULT "../tools"
+
+#define NAMES_MAX 1024
+
+// (blocks of a volume with the bitmap listed in the root block - 25 pages)
+#define ROOT_BITMAP_BLOCKS_MAX ( 25 * 127 * 32 )
+
+typedef struct names {
+    unsigned n;
+    char     name [ NAMES_MAX ][ ADF_MAXNAMELEN + 1 ];
+} names_t;
+
+
+// (the output of the tool - to the file, NULL to discard it)
+static int run_tool ( const char * const tool,
+                      const char * const args,
+                      const char * const output )
+{
+    const char * tools_dir = getenv ( "ADFTOOLS_DIR" );
+    if ( tools_dir == NULL )
+        tools_dir = TOOLS_DIR_DEFAULT;
+
+    char cmd [ 2 * ADFIMAGE_MAX_PATH ];
+    snprintf ( cmd, sizeof ( cmd ), "%s/%s %s > %s", tools_dir, tool, args,
+               ( output != NULL ) ? output : "/dev/null" );
+    const int status = system ( cmd );
+    ck_assert_msg ( status != -1 && WIFEXITED ( status ), "cannot run: %s", cmd );
+    return WEXITSTATUS ( status );
+}
+
+
+static void remove_tree ( const char * const path )
+{
+    char cmd [ ADFIMAGE_MAX_PATH ];
+    snprintf ( cmd, sizeof ( cmd ), "rm -rf '%s'", path );
+    ck_assert_int_eq ( system ( cmd ), 0 );
+}
+
+
+static void copy_file ( const char * const src,
+                        const char * const dst )
+{
+    char cmd [ 2 * ADFIMAGE_MAX_PATH ];
+    snprintf ( cmd, sizeof ( cmd ), "cp '%s' '%s'", src, dst );
+    ck_assert_int_eq ( system ( cmd ), 0 );
+}
+
+
+static bool add_name ( void * const       data,
+                       const char * const name )
+{
+    names_t * const names = data;
+    ck_assert_uint_lt ( names->n, NAMES_MAX );
+    snprintf ( names->name [ names->n++ ], ADF_MAXNAMELEN + 1, "%s", name );
+    return true;
+}
+
+
+static unsigned count_host_entries ( const char * const dirpath )
+{
+    DIR * const dir = opendir ( dirpath );
+    ck_assert_ptr_nonnull ( dir );
+    unsigned n = 0;
+    const struct dirent * de;
+    while ( ( de = readdir ( dir ) ) != NULL ) {
+        if ( strcmp ( de->d_name, "." ) != 0 && strcmp ( de->d_name, ".." ) != 0 )
+            n++;
+    }
+    closedir ( dir );
+    return n;
+}
+
+
+static void compare_file ( adfimage_t * const adf,
+                           const char * const path,
+                           const char * const host_path,
+                           const size_t       size )
+{
+    char * const data_image = malloc ( size + 1 ),
+         * const data_host  = malloc ( size + 1 );
+    ck_assert_ptr_nonnull ( data_image );
+    ck_assert_ptr_nonnull ( data_host );
+
+    FILE * const f = fopen ( host_path, "rb" );
+    ck_assert_ptr_nonnull ( f );
+    ck_assert_uint_eq ( fread ( data_host, 1, size + 1, f ), size );
+    fclose ( f );
+
+    ck_assert_int_eq ( adfimage_read ( adf, path, data_image, size, 0 ), ( int ) size );
+    ck_assert_mem_eq ( data_image, data_host, size );
+
+    free ( data_image );
+    free ( data_host );
+}
+
+
+// compare (recursively) a directory of the image with one on the host
+// (files, directories and soft links - hard links are not extracted)
+static void compare_dir ( adfimage_t * const adf,
+                          const char * const dirpath,
+                          const char * const host_dirpath )
+{
+    ck_assert ( adfimage_chdir ( adf, ( *dirpath != '\0' ) ? dirpath : "/" ) );
+    names_t * const names = malloc ( sizeof ( names_t ) );
+    ck_assert_ptr_nonnull ( names );
+    names->n = 0;
+    ck_assert_int_ge ( adfimage_foreach_cwd_entry ( adf, add_name, names ), 0 );
+
+    unsigned nhard_links = 0;
+    for ( unsigned i = 0 ; i < names->n ; i++ ) {
+        char path [ ADFIMAGE_MAX_PATH ], host_path [ ADFIMAGE_MAX_PATH ];
+        snprintf ( path, sizeof ( path ), "%s/%s", dirpath, names->name [ i ] );
+        snprintf ( host_path, sizeof ( host_path ), "%s/%s", host_dirpath,
+                   names->name [ i ] );
+
+        adfimage_chdir ( adf, "/" );
+        const adfimage_dentry_t dentry = adfimage_getdentry ( adf, path + 1 );
+        struct stat st;
+        const int host_status = lstat ( host_path, &st );
+
+        switch ( dentry.type ) {
+        case ADFVOLUME_DENTRY_DIRECTORY:
+            ck_assert_msg ( host_status == 0 && S_ISDIR ( st.st_mode ),
+                            "%s: not a directory", host_path );
+            compare_dir ( adf, path, host_path );
+            break;
+
+        case ADFVOLUME_DENTRY_FILE:
+            ck_assert_msg ( host_status == 0 && S_ISREG ( st.st_mode ),
+                            "%s: not a file", host_path );
+            ck_assert_uint_eq ( ( size_t ) st.st_size, dentry.adflib_entry.size );
+            compare_file ( adf, path, host_path, dentry.adflib_entry.size );
+            break;
+
+        case ADFVOLUME_DENTRY_SOFTLINK:
+            ck_assert_msg ( host_status == 0 && S_ISLNK ( st.st_mode ),
+                            "%s: not a symbolic link", host_path );
+            break;
+
+        case ADFVOLUME_DENTRY_LINKFILE:
+        case ADFVOLUME_DENTRY_LINKDIR:
+            ck_assert_msg ( host_status != 0 && errno == ENOENT,
+                            "%s: hard link extracted", host_path );
+            nhard_links++;
+            break;
+
+        default:
+            ck_abort_msg ( "%s: invalid entry type %d", path, dentry.type );
+        }
+    }
+    ck_assert_uint_eq ( count_host_entries ( host_dirpath ), names->n - nhard_links );
+    free ( names );
+}
+
+
+static void compare_image ( const char * const filename,
+                            const char * const host_dirpath )
+{
+    adfimage_t * adf = adfimage_open ( ( char * ) filename, 0, true, false );
+    ck_assert_ptr_nonnull ( adf );
+    compare_dir ( adf, "", host_dirpath );
+    adfimage_close ( &adf );
+}
+
+
+static void write_file ( const char * const path,
+                         const size_t       size,
+                         const unsigned     seed )
+{
+    FILE * const f = fopen ( path, "wb" );
+    ck_assert_ptr_nonnull ( f );
+    for ( size_t i = 0 ; i < size ; i++ )
+        fputc ( ( int ) ( ( i * 7 + seed ) & 0xff ), f );
+    ck_assert_int_eq ( fclose ( f ), 0 );
+}
+
+
+// a small tree - files from empty to ones needing extension blocks,
+// nested directories
+static void make_tree ( const char * const path )
+{
+    static const struct {
+        const char * name;
+        size_t       size;
+    } files[] = {
+        { "empty",              0 },
+        { "small",            100 },
+        { "ofs_block",        488 },
+        { "ffs_block",        512 },
+        { "data",            5000 },
+        { "big",           200000 },
+        { "sub/file",        3000 },
+        { "sub/deep/file",      1 },
+        { "sub/deep/big",   80000 }
+    };
+
+    char p [ ADFIMAGE_MAX_PATH ];
+    remove_tree ( path );
+    ck_assert_int_eq ( mkdir ( path, 0755 ), 0 );
+    snprintf ( p, sizeof ( p ), "%s/sub", path );
+    ck_assert_int_eq ( mkdir ( p, 0755 ), 0 );
+    snprintf ( p, sizeof ( p ), "%s/sub/deep", path );
+    ck_assert_int_eq ( mkdir ( p, 0755 ), 0 );
+    for ( unsigned i = 0 ; i < sizeof ( files ) / sizeof ( files [ 0 ] ) ; i++ ) {
+        snprintf ( p, sizeof ( p ), "%s/%s", path, files [ i ].name );
+        write_file ( p, files [ i ].size, i );
+    }
+}
+
+
+// compare (recursively) a directory of an adfgen image with the options
+// (dirN subdirectories up to the depth, fileN files with byte i
+// = ( i + sum of the bytes of the name ) & 0xff)
+static void compare_generated ( adfimage_t * const adf,
+                                const char * const dirpath,
+                                const unsigned     level,
+                                const unsigned     depth,
+                                const unsigned     ndirs,
+                                const unsigned     nfiles )
+{
+    ck_assert ( adfimage_chdir ( adf, ( *dirpath != '\0' ) ? dirpath : "/" ) );
+    names_t * const names = malloc ( sizeof ( names_t ) );
+    ck_assert_ptr_nonnull ( names );
+    names->n = 0;
+    ck_assert_int_ge ( adfimage_foreach_cwd_entry ( adf, add_name, names ), 0 );
+
+    unsigned dirs = 0, files = 0;
+    for ( unsigned i = 0 ; i < names->n ; i++ ) {
+        const char * const name = names->name [ i ];
+        char path [ ADFIMAGE_MAX_PATH ];
+        snprintf ( path, sizeof ( path ), "%s/%s", dirpath, name );
+
+        adfimage_chdir ( adf, "/" );
+        const adfimage_dentry_t dentry = adfimage_getdentry ( adf, path + 1 );
+        if ( dentry.type == ADFVOLUME_DENTRY_DIRECTORY ) {
+            ck_assert_msg ( strncmp ( name, "dir", 3 ) == 0, "%s: unexpected", path );
+            compare_generated ( adf, path, level + 1, depth, ndirs, nfiles );
+            dirs++;
+            continue;
+        }
+        ck_assert_msg ( dentry.type == ADFVOLUME_DENTRY_FILE &&
+                        strncmp ( name, "file", 4 ) == 0, "%s: unexpected", path );
+        files++;
+
+        unsigned name_sum = 0;
+        for ( const char * c = name ; *c != '\0' ; c++ )
+            name_sum += ( uint8_t ) *c;
+        const size_t size = dentry.adflib_entry.size;
+        uint8_t * const data = malloc ( size + 1 );
+        ck_assert_ptr_nonnull ( data );
+        ck_assert_int_eq ( adfimage_read ( adf, path, ( char * ) data, size, 0 ),
+                           ( int ) size );
+        for ( size_t j = 0 ; j < size ; j++ )
+            ck_assert_msg ( data [ j ] == ( ( j + name_sum ) & 0xff ),
+                            "%s: byte %zu", path, j );
+        free ( data );
+    }
+    ck_assert_uint_eq ( dirs, ( level < depth ) ? ndirs : 0 );
+    ck_assert_uint_eq ( files, nfiles );
+    free ( names );
+}
+
+
+static adfverify_report_t verify_image ( const char * const filename )
+{
+    adfimage_t * adf = adfimage_open ( ( char * ) filename, 0, true, false );
+    ck_assert_ptr_nonnull ( adf );
+
+    const adfverify_options_t options = {
+        .nthreads    = 4,
+        .data_blocks = true,
+        .errors      = stdout
+    };
+    adfverify_report_t report;
+    ck_assert ( adfverify_volume ( adf->vol, filename, &options, &report ) );
+    ck_assert_msg ( adfverify_is_clean ( &report ), "%s: not clean", filename );
+    ck_assert_uint_eq ( report.lost_blocks, 0 );
+    adfimage_close ( &adf );
+    return report;
+}
+
+
+static void check_extract ( const char * const filename,
+                            const unsigned     nthreads )
+{
+    const char * const dest = "testdata/extracted";
+    remove_tree ( dest );
+
+    // (the metadata in a sidecar - extended attributes may be unsupported)
+    char args [ ADFIMAGE_MAX_PATH ];
+    snprintf ( args, sizeof ( args ), "-j %u -m testdata/extracted.meta '%s' '%s'",
+               nthreads, filename, dest );
+    ck_assert_msg ( run_tool ( "adfextract", args, NULL ) == 0,
+                    "adfextract failed: %s", args );
+    compare_image ( filename, dest );
+
+    remove_tree ( dest );
+    unlink ( "testdata/extracted.meta" );
+}
+
+
+START_TEST ( test_adfextract )
+{
+    glob_t images;
+    ck_assert_int_eq ( glob ( "testdata/*.adf", 0, NULL, &images ), 0 );
+    ck_assert_uint_gt ( images.gl_pathc, 0 );
+
+    // prescanned (by threads) and built through ADFlib (no threads)
+    for ( size_t i = 0 ; i < images.gl_pathc ; i++ ) {
+        check_extract ( images.gl_pathv [ i ], 4 );
+        check_extract ( images.gl_pathv [ i ], 0 );
+    }
+    globfree ( &images );
+
+    // compressed (no prescan)
+    check_extract ( "testdata/testffs.adz", 4 );
+}
+END_TEST
+
+
+// names leading out of the destination (skipped as errors), a file
+// existing there as a symbolic link (not followed)
+START_TEST ( test_adfextract_names )
+{
+    const char * const image  = "testdata/names.adf",
+               * const dest   = "testdata/extracted",
+               * const target = "testdata/victim";
+    copy_file ( "testdata/testffs.adf", image );
+
+    adfimage_t * adf = adfimage_open ( ( char * ) image, 0, false, false );
+    ck_assert_ptr_nonnull ( adf );
+    struct AdfVolume * const vol = adf->vol;
+    struct AdfFileHeaderBlock fhdr;
+    ck_assert_int_eq ( adfCreateFile ( vol, vol->curDirPtr, "../escaped", &fhdr ),
+                       ADF_RC_OK );
+    ck_assert_int_eq ( adfCreateDir ( vol, vol->curDirPtr, ".." ), ADF_RC_OK );
+    ck_assert_int_eq ( adfCreateDir ( vol, vol->curDirPtr, "." ), ADF_RC_OK );
+    ck_assert_int_eq ( adfCreateFile ( vol, vol->curDirPtr, "victim", &fhdr ),
+                       ADF_RC_OK );
+    adfimage_close ( &adf );
+
+    remove_tree ( dest );
+    unlink ( "testdata/escaped" );
+    ck_assert_int_eq ( mkdir ( dest, 0755 ), 0 );
+    ck_assert_int_eq ( symlink ( "../victim", "testdata/extracted/victim" ), 0 );
+    FILE * const f = fopen ( target, "w" );
+    ck_assert_ptr_nonnull ( f );
+    fputs ( "not to be overwritten\n", f );
+    fclose ( f );
+
+    const char * const output = "testdata/names.out";
+    char args [ ADFIMAGE_MAX_PATH ];
+    snprintf ( args, sizeof ( args ), "-n '%s' '%s'", image, dest );
+    ck_assert_int_ne ( run_tool ( "adfextract", args, output ), 0 );
+
+    // (the 3 names and the link)
+    char line [ 1024 ];
+    FILE * const out = fopen ( output, "r" );
+    ck_assert_ptr_nonnull ( out );
+    ck_assert_ptr_nonnull ( fgets ( line, sizeof ( line ), out ) );
+    fclose ( out );
+    ck_assert_msg ( strstr ( line, " 4 errors" ) != NULL, "%s", line );
+
+    struct stat st;
+    ck_assert_int_ne ( lstat ( "testdata/escaped", &st ), 0 );
+    ck_assert_int_eq ( lstat ( target, &st ), 0 );
+    ck_assert_uint_eq ( st.st_size, strlen ( "not to be overwritten\n" ) );
+
+    remove_tree ( dest );
+    unlink ( target );
+    unlink ( output );
+    unlink ( image );
+}
+END_TEST
+
+
+START_TEST ( test_adfbuild )
+{
+    static const struct {
+        const char * options;
+        bool         bitmap_ext;        // (needs bitmap extension blocks)
+    } images[] = {
+        { "-t dd -f ofs",        false },
+        { "-t dd -f ffs",        false },
+        { "-t hdf -m 64 -f ffs", true  }
+    };
+    const char * const src = "testdata/build_src",
+               * const image = "testdata/build.adf";
+    make_tree ( src );
+
+    for ( unsigned i = 0 ; i < sizeof ( images ) / sizeof ( images [ 0 ] ) ; i++ ) {
+        unlink ( image );
+        char args [ ADFIMAGE_MAX_PATH ];
+        snprintf ( args, sizeof ( args ), "%s %s %s", images [ i ].options, src, image );
+        ck_assert_msg ( run_tool ( "adfbuild", args, NULL ) == 0,
+                        "adfbuild failed: %s", args );
+
+        const adfverify_report_t report = verify_image ( image );
+        ck_assert_uint_eq ( report.dirs, 2 );
+        ck_assert_uint_eq ( report.files, 9 );
+
+        adfimage_t * adf = adfimage_open ( ( char * ) image, 0, true, false );
+        ck_assert_ptr_nonnull ( adf );
+        const int32_t nblocks = adf->vol->lastBlock - adf->vol->firstBlock + 1;
+        ck_assert ( ( nblocks > ROOT_BITMAP_BLOCKS_MAX ) == images [ i ].bitmap_ext );
+        compare_dir ( adf, "", src );
+        adfimage_close ( &adf );
+    }
+
+    unlink ( image );
+    remove_tree ( src );
+}
+END_TEST
+
+
+START_TEST ( test_adfgen )
+{
+    // (3 subdirectories in 2 levels - 12 directories, 4 files in each one)
+    static const char * const images[] = {
+        "-t dd -f ofs -s 0-3000",
+        "-t dd -f ffs -s 0-3000 -F 4",
+        "-t hdf -m 64 -f dircache -s 0-40000 -F 8"
+    };
+    const char * const image = "testdata/gen.adf";
+
+    for ( unsigned i = 0 ; i < sizeof ( images ) / sizeof ( images [ 0 ] ) ; i++ ) {
+        unlink ( image );
+        char args [ ADFIMAGE_MAX_PATH ];
+        snprintf ( args, sizeof ( args ), "%s -d 3 -l 2 -n 4 %s", images [ i ], image );
+        ck_assert_msg ( run_tool ( "adfgen", args, NULL ) == 0,
+                        "adfgen failed: %s", args );
+
+        const adfverify_report_t report = verify_image ( image );
+        ck_assert_uint_eq ( report.dirs, 12 );
+        ck_assert_uint_eq ( report.files, 4 * 13 );
+
+        adfimage_t * adf = adfimage_open ( ( char * ) image, 0, true, false );
+        ck_assert_ptr_nonnull ( adf );
+        compare_generated ( adf, "", 0, 2, 3, 4 );
+        adfimage_close ( &adf );
+    }
+    unlink ( image );
+}
+END_TEST
+
+
+// optimize the image (in place if output is NULL), returning the number
+// of fragmented files before
+static unsigned optimize ( const char * const image,
+                           const char * const output )
+{
+    const char * const report = "testdata/optimize.out";
+    char args [ ADFIMAGE_MAX_PATH ];
+    snprintf ( args, sizeof ( args ), "-q %s %s", image,
+               ( output != NULL ) ? output : "" );
+    ck_assert_msg ( run_tool ( "adfoptimize", args, report ) == 0,
+                    "adfoptimize failed: %s", args );
+
+    // <image>: <n> files, fragmented: <before> -> <after>, ...
+    char line [ ADFIMAGE_MAX_PATH ];
+    FILE * const f = fopen ( report, "r" );
+    ck_assert_ptr_nonnull ( f );
+    ck_assert_ptr_nonnull ( fgets ( line, sizeof ( line ), f ) );
+    fclose ( f );
+    unlink ( report );
+    const char * const summary = strstr ( line, "fragmented:" );
+    ck_assert_ptr_nonnull ( summary );
+    unsigned before, after;
+    ck_assert_int_eq ( sscanf ( summary, "fragmented: %u -> %u", &before, &after ), 2 );
+    ck_assert_uint_eq ( after, 0 );
+    return before;
+}
+
+
+START_TEST ( test_adfoptimize )
+{
+    static const char * const images[] = {
+        "-t dd -f ofs -s 0-12000",
+        "-t dd -f ffs -s 0-12000",
+        "-t hdf -m 64 -f ffs -s 0-40000"
+    };
+    const char * const image  = "testdata/frag.adf",
+               * const output = "testdata/optimized.adf";
+
+    // fragmented (files written 8 at once) - to a new image and in place,
+    // then again (nothing to do)
+    for ( unsigned i = 0 ; i < sizeof ( images ) / sizeof ( images [ 0 ] ) ; i++ ) {
+        unlink ( image );
+        unlink ( output );
+        char args [ ADFIMAGE_MAX_PATH ];
+        snprintf ( args, sizeof ( args ), "%s -d 3 -l 2 -n 4 -F 8 %s",
+                   images [ i ], image );
+        ck_assert_msg ( run_tool ( "adfgen", args, NULL ) == 0,
+                        "adfgen failed: %s", args );
+
+        ck_assert_uint_gt ( optimize ( image, output ), 0 );
+        ck_assert_uint_gt ( optimize ( image, NULL ), 0 );
+        ck_assert_uint_eq ( optimize ( image, NULL ), 0 );
+
+        for ( unsigned j = 0 ; j < 2 ; j++ ) {
+            const char * const optimized = ( j == 0 ) ? output : image;
+            const adfverify_report_t report = verify_image ( optimized );
+            ck_assert_uint_eq ( report.dirs, 12 );
+            ck_assert_uint_eq ( report.files, 4 * 13 );
+
+            adfimage_t * adf = adfimage_open ( ( char * ) optimized, 0, true, false );
+            ck_assert_ptr_nonnull ( adf );
+            compare_generated ( adf, "", 0, 2, 3, 4 );
+            adfimage_close ( &adf );
+        }
+    }
+    unlink ( image );
+    unlink ( output );
+
+    // hard and soft links kept (compared with the extracted original)
+    adfimage_t * adf = adfimage_open ( "testdata/links.adf", 0, true, false );
+    ck_assert_ptr_nonnull ( adf );
+    const bool dircache = adfDosFsHasDIRCACHE ( adf->vol->fs.type );
+    adfimage_close ( &adf );
+    if ( dircache )
+        return;     // (not supported by adfoptimize)
+
+    const char * const dest = "testdata/extracted";
+    remove_tree ( dest );
+    ck_assert ( run_tool ( "adfextract", "-n testdata/links.adf testdata/extracted",
+                           NULL ) == 0 );
+    optimize ( "testdata/links.adf", output );
+    verify_image ( output );
+    compare_image ( output, dest );
+    remove_tree ( dest );
+    unlink ( output );
+}
+END_TEST
+
+
+Suite * tools_suite ( void )
+{
+    Suite * s = suite_create ( "tools" );
+
+    TCase * tc = tcase_create ( "adfextract" );
+    tcase_set_timeout ( tc, 60 );
+    tcase_add_test ( tc, test_adfextract );
+    tcase_add_test ( tc, test_adfextract_names );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfbuild" );
+    tcase_set_timeout ( tc, 60 );
+    tcase_add_test ( tc, test_adfbuild );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfgen" );
+    tcase_set_timeout ( tc, 60 );
+    tcase_add_test ( tc, test_adfgen );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adfoptimize" );
+    tcase_set_timeout ( tc, 60 );
+    tcase_add_test ( tc, test_adfoptimize );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = tools_suite();
+    SRunner * sr = srunner_create ( s );
+
+    srunner_run_all ( sr, CK_VERBOSE ); //CK_NORMAL );
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
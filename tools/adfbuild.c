@@ -0,0 +1,480 @@
+/*
+ * adfbuild - building an image from a directory (without mounting it)
+ *
+ * Plans the layout of the whole tree first and writes the finished image
+ * in one pass - the blocks, the hash tables and the bitmap are built
+ * in memory (see adflayout.h): the headers of the entries of a directory
+ * in one run of blocks, followed by the data of its files (each file
+ * contiguous) and by its subdirectories, so listing a directory or reading
+ * a file (through fuseadf or adfextract) touches a few adjacent runs
+ * of blocks. The same tree gives always the same image (the dates are
+ * those of the files and of the directory).
+ *
+ * The protection flags and comments are taken from extended attributes
+ * (user.amiga.protection, user.amiga.comment - as saved by adfextract),
+ * without them the flags are set from the permissions. Symbolic links
+ * and special files are skipped.
+ */
+
+#include "adffs_util.h"
+#include "adflayout.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUILD_HDF_MAX_MB    2047
+#define BUILD_XATTR_PROTECTION  "user.amiga.protection"
+#define BUILD_XATTR_COMMENT     "user.amiga.comment"
+
+typedef enum {
+    BUILD_DEV_DD,               // floppy 880K
+    BUILD_DEV_HD,               // floppy 1.76M
+    BUILD_DEV_HDF               // hardfile
+} build_dev_type_t;
+
+typedef struct build_options {
+    const char *     source;
+    const char *     image;
+    const char *     label;             // (NULL - the name of the source)
+    build_dev_type_t dev_type;
+    unsigned         hdf_size_mb;       // (0 - the smallest fitting)
+    uint8_t          fs_type;
+    bool             no_metadata,
+                     verbose;
+} build_options_t;
+
+typedef struct build_stats {
+    uint64_t files,
+             dirs,
+             skipped,
+             bytes;
+} build_stats_t;
+
+static build_options_t opts = {
+    .source      = NULL,
+    .image       = NULL,
+    .label       = NULL,
+    .dev_type    = BUILD_DEV_DD,
+    .hdf_size_mb = 0,
+    .fs_type     = ADF_DOSFS_FFS,
+    .no_metadata = false,
+    .verbose     = false
+};
+
+static build_stats_t stats = { 0 };
+static adflayout_t   layout;
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+static bool scan_dir ( adflayout_node_t * const dir,
+                       const char * const       path );
+
+static void amiga_date ( const time_t  t,
+                         int32_t * const date );
+
+static void set_label ( void );
+
+static bool plan_volume ( void );
+
+static bool write_image ( void );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    adffs_util_init();
+
+    if ( access ( opts.image, F_OK ) == 0 ) {
+        fprintf ( stderr, "%s already exists.\n", opts.image );
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+
+    // (the root - the volume, named as the directory by default)
+    struct stat st;
+    if ( stat ( opts.source, &st ) != 0 || ! S_ISDIR ( st.st_mode ) ) {
+        fprintf ( stderr, "%s is not a directory.\n", opts.source );
+        return EXIT_FAILURE;
+    }
+    adflayout_init ( &layout, opts.fs_type );
+    layout.verbose = opts.verbose;
+    amiga_date ( st.st_mtime, layout.root.date );
+    set_label();
+
+    int status = EXIT_FAILURE;
+    if ( ! scan_dir ( &layout.root, opts.source ) || ! plan_volume() ||
+         ! write_image() )
+    {
+        goto main_error_free_layout;
+    }
+
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    const double secs = ( double ) ( end.tv_sec - start.tv_sec ) +
+                        ( double ) ( end.tv_nsec - start.tv_nsec ) / 1e9;
+    printf ( "%s: %" PRIu64 " files (%" PRIu64 " bytes), %" PRIu64 " directories, "
+             "%" PRIu64 " skipped, %" PRIu32 " blocks (%.3f s)\n",
+             opts.image, stats.files, stats.bytes, stats.dirs, stats.skipped,
+             layout.nblocks, secs );
+    status = EXIT_SUCCESS;
+
+main_error_free_layout:
+    adflayout_free ( &layout );
+    return status;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  adfbuild [options] directory image\n\n"
+             "Creates an image with the files of the directory (a new image,\n"
+             "with the data of each file in contiguous blocks).\n\n"
+             "Options:\n"
+             "  -t type      type: dd (default), hd, hdf\n"
+             "  -m size      size of the hardfile in MiB (default: the smallest\n"
+             "               the files fit in)\n"
+             "  -f fs        filesystem: ofs, ffs (default), ofs-intl, ffs-intl\n"
+             "  -L label     volume name (default: the name of the directory)\n"
+             "  -n           do not take the protection flags and comments\n"
+             "               from extended attributes\n"
+             "  -v           list the files\n"
+             "  -h           show this help\n\n" );
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "t:m:f:L:nvh" ) ) != -1 ) {
+        switch ( opt ) {
+        case 't':
+            if ( strcmp ( optarg, "dd" ) == 0 )
+                opts.dev_type = BUILD_DEV_DD;
+            else if ( strcmp ( optarg, "hd" ) == 0 )
+                opts.dev_type = BUILD_DEV_HD;
+            else if ( strcmp ( optarg, "hdf" ) == 0 )
+                opts.dev_type = BUILD_DEV_HDF;
+            else
+                return false;
+            break;
+        case 'm':
+            opts.hdf_size_mb = ( unsigned ) strtoul ( optarg, NULL, 10 );
+            if ( opts.hdf_size_mb == 0 || opts.hdf_size_mb > BUILD_HDF_MAX_MB )
+                return false;
+            break;
+        case 'f':
+            if ( strcmp ( optarg, "ofs" ) == 0 )
+                opts.fs_type = 0;
+            else if ( strcmp ( optarg, "ffs" ) == 0 )
+                opts.fs_type = ADF_DOSFS_FFS;
+            else if ( strcmp ( optarg, "ofs-intl" ) == 0 )
+                opts.fs_type = ADF_DOSFS_INTL;
+            else if ( strcmp ( optarg, "ffs-intl" ) == 0 )
+                opts.fs_type = ADF_DOSFS_FFS | ADF_DOSFS_INTL;
+            else
+                return false;
+            break;
+        case 'L':
+            opts.label = optarg;
+            if ( strlen ( optarg ) == 0 || strlen ( optarg ) > ADF_MAXNAMELEN )
+                return false;
+            break;
+        case 'n':
+            opts.no_metadata = true;
+            break;
+        case 'v':
+            opts.verbose = true;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if ( optind != argc - 2 )
+        return false;
+    opts.source = argv [ optind ];
+    opts.image  = argv [ optind + 1 ];
+    return true;
+}
+
+
+
+
+/*****
+ * The tree (on the host)
+ *****/
+
+// the protection flags and the comment (from the extended attributes
+// or the permissions), the date
+static void read_metadata ( adflayout_node_t * const  node,
+                            const char * const        path,
+                            const struct stat * const st )
+{
+    amiga_date ( st->st_mtime, node->date );
+    node->access = ( ( st->st_mode & S_IRUSR ) ? 0 : ADF_ACCMASK_R ) |
+                   ( ( st->st_mode & S_IWUSR ) ? 0 : ADF_ACCMASK_W | ADF_ACCMASK_D ) |
+                   ( ( node->type == ADFLAYOUT_DIR || ( st->st_mode & S_IXUSR ) ) ?
+                     0 : ADF_ACCMASK_E );
+    if ( opts.no_metadata )
+        return;
+
+    // (hsparwed, '-' - not set; the rwed bits are set when denied)
+    char protection [ 8 ];
+    if ( getxattr ( path, BUILD_XATTR_PROTECTION, protection,
+                    sizeof ( protection ) ) == ( ssize_t ) sizeof ( protection ) )
+    {
+        node->access = 0;
+        for ( unsigned i = 0 ; i < 8 ; i++ ) {
+            const unsigned bit = 7 - i;
+            const bool     set = ( protection [ i ] != '-' );
+            if ( ( bit >= 4 ) ? set : ! set )
+                node->access |= ( int32_t ) ( 1u << bit );
+        }
+    }
+
+    const ssize_t len = getxattr ( path, BUILD_XATTR_COMMENT, node->comment,
+                                   ADF_MAXCMMTLEN );
+    if ( len >= 0 ) {
+        node->comment [ len ] = '\0';
+    } else if ( errno == ERANGE ) {
+        fprintf ( stderr, "%s: the comment is too long (max. %d) - skipped\n",
+                  path, ADF_MAXCMMTLEN );
+    }
+}
+
+
+static bool valid_name ( const char * const name )
+{
+    const size_t len = strlen ( name );
+    return ( len > 0 && len <= ADF_MAXNAMELEN && strchr ( name, ':' ) == NULL );
+}
+
+
+static bool scan_dir ( adflayout_node_t * const dir,
+                       const char * const       path )
+{
+    DIR * const d = opendir ( path );
+    if ( d == NULL ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", path, strerror ( errno ) );
+        return false;
+    }
+
+    struct dirent * de;
+    while ( ( de = readdir ( d ) ) != NULL ) {
+        if ( strcmp ( de->d_name, "." ) == 0 || strcmp ( de->d_name, ".." ) == 0 )
+            continue;
+
+        char child_path [ PATH_MAX ];
+        snprintf ( child_path, sizeof ( child_path ), "%s/%s", path, de->d_name );
+        struct stat st;
+        if ( lstat ( child_path, &st ) != 0 ) {
+            fprintf ( stderr, "Cannot stat %s: %s\n", child_path, strerror ( errno ) );
+            goto scan_dir_error;
+        }
+        if ( ! S_ISDIR ( st.st_mode ) && ! S_ISREG ( st.st_mode ) ) {
+            fprintf ( stderr, "%s - skipped (not a file or a directory)\n", child_path );
+            stats.skipped++;
+            continue;
+        }
+        if ( ! valid_name ( de->d_name ) ) {
+            fprintf ( stderr, "%s - invalid name on AmigaDOS "
+                      "(max. %d characters, no ':')\n", child_path, ADF_MAXNAMELEN );
+            goto scan_dir_error;
+        }
+        if ( S_ISREG ( st.st_mode ) && ( uint64_t ) st.st_size > UINT32_MAX ) {
+            fprintf ( stderr, "%s - too large (max. 4 GiB)\n", child_path );
+            goto scan_dir_error;
+        }
+
+        // (the path on the host - the source of the data)
+        adflayout_node_t * const node = adflayout_add (
+            dir, S_ISDIR ( st.st_mode ) ? ADFLAYOUT_DIR : ADFLAYOUT_FILE, de->d_name );
+        if ( node == NULL || ( node->source = strdup ( child_path ) ) == NULL ) {
+            fprintf ( stderr, "Out of memory.\n" );
+            goto scan_dir_error;
+        }
+        node->size = S_ISREG ( st.st_mode ) ? ( uint64_t ) st.st_size : 0;
+        read_metadata ( node, child_path, &st );
+    }
+    closedir ( d );
+
+    // (names differing only in case - the same on AmigaDOS)
+    if ( ! adflayout_sort_dir ( &layout, dir ) ) {
+        fprintf ( stderr, "Cannot build %s (in %s).\n", opts.image, path );
+        return false;
+    }
+
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        if ( node->type == ADFLAYOUT_DIR ) {
+            if ( ! scan_dir ( node, node->source ) )
+                return false;
+            stats.dirs++;
+        } else {
+            stats.files++;
+            stats.bytes += node->size;
+        }
+    }
+    return true;
+
+scan_dir_error:
+    closedir ( d );
+    return false;
+}
+
+
+// (days since 1978-01-01, minutes and ticks - in the local time)
+static void amiga_date ( const time_t  t,
+                         int32_t * const date )
+{
+    struct tm tm;
+    localtime_r ( &t, &tm );
+    const time_t day = gmtime_to_time_t ( tm.tm_year + 1900, tm.tm_mon + 1,
+                                          tm.tm_mday, 0, 0, 0 );
+    date [ 0 ] = ( day > 252460800 ) ? ( int32_t ) ( ( day - 252460800 ) / 86400 ) : 0;
+    date [ 1 ] = tm.tm_hour * 60 + tm.tm_min;
+    date [ 2 ] = tm.tm_sec * 50;
+}
+
+
+// the name of the directory by default (without the trailing slashes)
+static void set_label ( void )
+{
+    char path [ PATH_MAX ];
+    const char * label = opts.label;
+    if ( label == NULL ) {
+        snprintf ( path, sizeof ( path ), "%s", opts.source );
+        size_t len = strlen ( path );
+        while ( len > 1 && path [ len - 1 ] == '/' )
+            path [ --len ] = '\0';
+        const char * const base = strrchr ( path, '/' );
+        label = ( base != NULL ) ? base + 1 : path;
+        if ( ! valid_name ( label ) )
+            label = "adfbuild";
+    }
+    snprintf ( layout.label, sizeof ( layout.label ), "%.*s", ADF_MAXNAMELEN, label );
+}
+
+
+/*****
+ * The image
+ *****/
+
+static bool plan_volume ( void )
+{
+    uint32_t nblocks;
+    if ( opts.dev_type == BUILD_DEV_DD ) {
+        nblocks = 1760;
+    } else if ( opts.dev_type == BUILD_DEV_HD ) {
+        nblocks = 3520;
+    } else {
+        // (2 heads x 32 sectors - 32 cylinders per MiB, as adfgen;
+        // the smallest the files fit in, if not given)
+        unsigned mb = ( opts.hdf_size_mb > 0 ) ? opts.hdf_size_mb : 1;
+        while ( opts.hdf_size_mb == 0 && mb < BUILD_HDF_MAX_MB &&
+                adflayout_blocks_needed ( &layout, mb * 2048 ) > mb * 2048 - 2 )
+        {
+            mb++;
+        }
+        nblocks = mb * 2048;
+    }
+    return adflayout_plan ( &layout, nblocks, ( int32_t ) ( nblocks / 2 ) );
+}
+
+
+static int source_fd = -1;
+
+static bool source_open ( adflayout_node_t * const node,
+                          void * const             ctx )
+{
+    (void) ctx;
+    source_fd = open ( node->source, O_RDONLY );
+    if ( source_fd < 0 ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", ( char * ) node->source,
+                  strerror ( errno ) );
+        return false;
+    }
+    return true;
+}
+
+
+// (the whole piece - the file changed while building otherwise)
+static bool source_read ( uint8_t * const buf,
+                          const size_t    size,
+                          void * const    ctx )
+{
+    (void) ctx;
+    size_t done = 0;
+    while ( done < size ) {
+        const ssize_t n = read ( source_fd, buf + done, size - done );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return false;
+        done += ( size_t ) n;
+    }
+    return true;
+}
+
+
+static void source_close ( void * const ctx )
+{
+    (void) ctx;
+    close ( source_fd );
+    source_fd = -1;
+}
+
+
+static bool write_image ( void )
+{
+    const adflayout_source_t source = {
+        .open  = source_open,
+        .read  = source_read,
+        .close = source_close,
+        .ctx   = NULL
+    };
+    if ( ! adflayout_build ( &layout, &source ) )
+        return false;
+
+    // (the whole image at once)
+    const int fd = open ( opts.image, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+    if ( fd < 0 ) {
+        fprintf ( stderr, "Cannot create %s: %s\n", opts.image, strerror ( errno ) );
+        return false;
+    }
+    const size_t size = ( size_t ) layout.nblocks * 512;
+    size_t done = 0;
+    while ( done < size ) {
+        const ssize_t n = write ( fd, layout.image + done, size - done );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            break;
+        done += ( size_t ) n;
+    }
+    if ( close ( fd ) != 0 || done < size ) {
+        fprintf ( stderr, "Error writing %s: %s\n", opts.image, strerror ( errno ) );
+        unlink ( opts.image );
+        return false;
+    }
+    return true;
+}
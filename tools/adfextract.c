@@ -0,0 +1,705 @@
+/*
+ * adfextract - extracting all files of a volume (without mounting it)
+ *
+ * Walks the metadata index of the volume (see adfindex.h - built by
+ * a pool of threads) and extracts the files with a pool of threads,
+ * reading their data by the block maps - contiguous data blocks with
+ * one (large) pread from the image file. Images which cannot be read
+ * directly (compressed) are read through ADFlib (one thread at a time).
+ *
+ * Dates are kept (as mtime), the protection flags and comments are
+ * saved as extended attributes (user.amiga.protection, user.amiga.comment)
+ * or in a sidecar file (-m). Soft links are extracted as symbolic links,
+ * hard links are skipped.
+ *
+ * Entries with names unusable on the host (empty, "." and "..", or with
+ * a '/' - leading out of the destination) are skipped as errors, files
+ * are not created through (existing) symbolic links.
+ */
+
+#include "adfdev.h"
+#include "adffs_util.h"
+#include "adfimage.h"
+#include "adfindex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EXTRACT_CHUNK_BLOCKS    2048        // (max. blocks of one pread)
+#define EXTRACT_XATTR_PROTECTION    "user.amiga.protection"
+#define EXTRACT_XATTR_COMMENT       "user.amiga.comment"
+
+typedef struct extract_item {
+    const adfindex_entry_t * entry;
+    char *                   path;          // (relative to the destination)
+    char                     comment [ ADF_MAXCMMTLEN + 1 ];
+} extract_item_t;
+
+typedef struct extract_list {
+    extract_item_t * items;
+    size_t           n,
+                     size;
+} extract_list_t;
+
+typedef struct extract_options {
+    char *       image;
+    const char * dest;
+    unsigned     volume,
+                 nthreads;
+    const char * sidecar;           // (NULL - extended attributes)
+    bool         no_metadata,
+                 ignore_checksum_errors,
+                 verbose;
+} extract_options_t;
+
+typedef struct extract_stats {
+    uint64_t files,
+             dirs,
+             links,
+             skipped,
+             errors,
+             bytes;
+} extract_stats_t;
+
+static extract_options_t opts = {
+    .image                  = NULL,
+    .dest                   = NULL,
+    .volume                 = 0,
+    .nthreads               = 0,
+    .sidecar                = NULL,
+    .no_metadata            = false,
+    .ignore_checksum_errors = false,
+    .verbose                = false
+};
+
+static adfimage_t *     adf = NULL;
+static adfindex_t *     idx = NULL;
+static int              image_fd = -1;      // (-1 - read through ADFlib)
+static uint64_t         volume_offset;      // (in the image file)
+static pthread_mutex_t  adflib_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static extract_list_t   files = { 0 },
+                        others = { 0 };     // directories and links
+static size_t           next_file = 0;      // (the next one to extract)
+static extract_stats_t  stats = { 0 };
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+static bool walk_dir ( const adfindex_entry_t * const dir,
+                       const char * const             path );
+
+static void * extract_thread ( void * arg );
+
+static void set_metadata ( const extract_item_t * const item,
+                           const bool                   link );
+
+static bool write_sidecar ( void );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    adffs_util_init();
+
+    struct timespec start, end;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+
+    // (the metadata index - built by a pool of threads if the image
+    // can be read directly)
+    adfindex_set_prescan ( opts.nthreads );
+    adf = adfimage_open ( opts.image, opts.volume, true,
+                          opts.ignore_checksum_errors );
+    if ( adf == NULL ) {
+        fprintf ( stderr, "Cannot open volume %u of %s.\n", opts.volume, opts.image );
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_FAILURE;
+    if ( adf->index == NULL ||
+         ! adfindex_prescan_start ( adf->index ) ||
+         ! adfindex_prescan_wait ( adf->index ) )
+    {
+        // no prescan (-j 0) or it failed - the index built now (through ADFlib)
+        adfindex_close ( &adf->index );
+        adfindex_set_prescan ( 0 );
+        adf->index = adfindex_open ( adf->vol, opts.image, opts.volume,
+                                     &adf->fstat );
+    }
+    idx = adf->index;
+    if ( idx == NULL ) {
+        fprintf ( stderr, "Cannot read the metadata of %s.\n", opts.image );
+        goto main_error_close_image;
+    }
+
+    if ( adfdev_is_raw ( adf->vol->dev ) ) {
+        image_fd = open ( opts.image, O_RDONLY );
+        volume_offset = ( uint64_t ) adf->vol->firstBlock * 512;
+    }
+
+    if ( mkdir ( opts.dest, 0755 ) != 0 && errno != EEXIST ) {
+        fprintf ( stderr, "Cannot create %s: %s\n", opts.dest, strerror ( errno ) );
+        goto main_error_close_image;
+    }
+
+    // directories created and links extracted while walking the tree,
+    // the files - by the threads
+    const adfindex_entry_t * root;
+    if ( adfindex_lookup ( idx, "/", &root ) != ADFINDEX_FOUND ||
+         ! walk_dir ( root, "" ) )
+    {
+        goto main_error_free_lists;
+    }
+
+    pthread_t threads [ ADFINDEX_PRESCAN_THREADS_MAX ];
+    unsigned nthreads = 0;
+    while ( nthreads < opts.nthreads &&
+            pthread_create ( &threads [ nthreads ], NULL, extract_thread, NULL ) == 0 )
+    {
+        nthreads++;
+    }
+    if ( nthreads == 0 )
+        extract_thread ( NULL );
+    for ( unsigned i = 0 ; i < nthreads ; i++ )
+        pthread_join ( threads [ i ], NULL );
+
+    // (the dates of directories set after their contents - deepest first)
+    for ( size_t i = others.n ; i > 0 ; i-- ) {
+        const extract_item_t * const item = &others.items [ i - 1 ];
+        set_metadata ( item, item->entry->type == ADF_ST_LSOFT );
+    }
+    if ( opts.sidecar != NULL && ! write_sidecar() )
+        stats.errors++;
+
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    const double secs = ( double ) ( end.tv_sec - start.tv_sec ) +
+                        ( double ) ( end.tv_nsec - start.tv_nsec ) / 1e9;
+    printf ( "%s: %" PRIu64 " files (%" PRIu64 " bytes), %" PRIu64 " directories, "
+             "%" PRIu64 " links, %" PRIu64 " skipped, %" PRIu64 " errors "
+             "(%.3f s, %u threads)\n",
+             opts.image, stats.files, stats.bytes, stats.dirs, stats.links,
+             stats.skipped, stats.errors, secs, nthreads );
+    status = ( stats.errors == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+main_error_free_lists:
+    for ( size_t i = 0 ; i < files.n ; i++ )
+        free ( files.items [ i ].path );
+    for ( size_t i = 0 ; i < others.n ; i++ )
+        free ( others.items [ i ].path );
+    free ( files.items );
+    free ( others.items );
+
+main_error_close_image:
+    if ( image_fd >= 0 )
+        close ( image_fd );
+    adfimage_close ( &adf );
+    return status;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  adfextract [options] image destination\n\n"
+             "Extracts all files of a volume of the image to the destination\n"
+             "directory (created if it does not exist).\n\n"
+             "Options:\n"
+             "  -p volume    volume (partition) number, default: 0\n"
+             "  -j threads   threads reading the metadata and extracting\n"
+             "               the files (default: the number of CPUs, max. %u,\n"
+             "               0: no threads, the metadata read through ADFlib)\n"
+             "  -m file      save the protection flags and comments in the file\n"
+             "               (tab-separated: path, flags, date, comment)\n"
+             "               instead of extended attributes\n"
+             "  -n           do not save the protection flags and comments\n"
+             "  -i           ignore checksum errors\n"
+             "  -v           list the extracted files\n"
+             "  -h           show this help\n\n",
+             ADFINDEX_PRESCAN_THREADS_MAX );
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    const long ncpus = sysconf ( _SC_NPROCESSORS_ONLN );
+    opts.nthreads = ( ncpus > 0 ) ? ( unsigned ) ncpus : 1;
+
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "p:j:m:nivh" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'p':
+            opts.volume = ( unsigned ) strtoul ( optarg, NULL, 10 );
+            break;
+        case 'j':
+            opts.nthreads = ( unsigned ) strtoul ( optarg, NULL, 10 );
+            break;
+        case 'm':
+            opts.sidecar = optarg;
+            break;
+        case 'n':
+            opts.no_metadata = true;
+            break;
+        case 'i':
+            opts.ignore_checksum_errors = true;
+            break;
+        case 'v':
+            opts.verbose = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    if ( opts.nthreads > ADFINDEX_PRESCAN_THREADS_MAX )
+        opts.nthreads = ADFINDEX_PRESCAN_THREADS_MAX;
+
+    if ( optind != argc - 2 )
+        return false;
+    opts.image = argv [ optind ];
+    opts.dest  = argv [ optind + 1 ];
+    return true;
+}
+
+
+/*****
+ * Reading the image
+ *****/
+
+static inline uint32_t be32 ( const uint8_t * const p )
+{
+    return ( uint32_t ) p [ 0 ] << 24 | ( uint32_t ) p [ 1 ] << 16 |
+           ( uint32_t ) p [ 2 ] << 8  | ( uint32_t ) p [ 3 ];
+}
+
+
+// read count blocks of the volume (from the sector)
+static bool read_blocks ( const int32_t   sector,
+                          const uint32_t  count,
+                          uint8_t * const buf )
+{
+    struct AdfVolume * const vol = adf->vol;
+    if ( sector <= 0 || ( int64_t ) sector + count - 1 > vol->lastBlock - vol->firstBlock )
+        return false;
+
+    if ( image_fd >= 0 ) {
+        const size_t size = ( size_t ) count * 512;
+        return ( pread ( image_fd, buf, size, ( off_t ) ( volume_offset +
+                         ( uint64_t ) sector * 512 ) ) == ( ssize_t ) size );
+    }
+
+    // (through ADFlib - not thread-safe)
+    bool ok = true;
+    pthread_mutex_lock ( &adflib_lock );
+    for ( uint32_t i = 0 ; i < count && ok ; i++ )
+        ok = ( adfDevReadBlock ( vol->dev, ( uint32_t ) ( vol->firstBlock + sector ) + i,
+                                 512, buf + ( size_t ) i * 512 ) == ADF_RC_OK );
+    pthread_mutex_unlock ( &adflib_lock );
+    return ok;
+}
+
+
+// the comment of a file or a directory (from its header block)
+static bool read_comment ( const adfindex_entry_t * const entry,
+                           char * const                   comment )
+{
+    uint8_t header [ 512 ];
+    if ( ! read_blocks ( entry->sector, 1, header ) )
+        return false;
+    const unsigned len = ( header [ 0x148 ] < ADF_MAXCMMTLEN ) ?
+        header [ 0x148 ] : ADF_MAXCMMTLEN;
+    memcpy ( comment, header + 0x149, len );
+    comment [ len ] = '\0';
+    return true;
+}
+
+
+/*****
+ * The tree
+ *****/
+
+// (as one component of a host path)
+static bool name_is_valid ( const char * const name )
+{
+    return name [ 0 ] != '\0' &&
+           strcmp ( name, "." ) != 0 &&
+           strcmp ( name, ".." ) != 0 &&
+           strchr ( name, '/' ) == NULL;
+}
+
+
+static extract_item_t * list_add ( extract_list_t * const         list,
+                                   const adfindex_entry_t * const entry,
+                                   const char * const             path )
+{
+    if ( list->n == list->size ) {
+        const size_t size = ( list->size == 0 ) ? 256 : list->size * 2;
+        extract_item_t * const items = realloc ( list->items,
+                                                 size * sizeof ( extract_item_t ) );
+        if ( items == NULL )
+            return NULL;
+        list->items = items;
+        list->size  = size;
+    }
+    extract_item_t * const item = &list->items [ list->n ];
+    item->entry = entry;
+    item->path  = strdup ( path );
+    if ( item->path == NULL )
+        return NULL;
+    item->comment [ 0 ] = '\0';
+    list->n++;
+    return item;
+}
+
+
+static bool walk_dir ( const adfindex_entry_t * const dir,
+                       const char * const             path )
+{
+    char child_path [ ADFIMAGE_MAX_PATH ];
+    for ( uint32_t i = 0 ; i < dir->nchildren ; i++ ) {
+        const adfindex_entry_t * const entry = adfindex_get_child ( idx, dir, i );
+        const char * const name = adfindex_get_name ( idx, entry );
+        if ( ! name_is_valid ( name ) ) {
+            fprintf ( stderr, "Invalid name \"%s\" in /%s - skipped\n", name, path );
+            stats.errors++;
+            continue;
+        }
+        snprintf ( child_path, sizeof ( child_path ), "%s%s%s", path,
+                   ( path [ 0 ] != '\0' ) ? "/" : "", name );
+
+        char out [ PATH_MAX ];
+        snprintf ( out, sizeof ( out ), "%s/%s", opts.dest, child_path );
+
+        extract_item_t * item = NULL;
+        switch ( entry->type ) {
+        case ADF_ST_FILE:
+            if ( list_add ( &files, entry, child_path ) == NULL )
+                goto walk_dir_error_memory;
+            break;
+
+        case ADF_ST_DIR: {
+            // (an existing one - only a directory, not a link to one)
+            struct stat st;
+            if ( mkdir ( out, 0755 ) != 0 &&
+                 ( errno != EEXIST || lstat ( out, &st ) != 0 ||
+                   ! S_ISDIR ( st.st_mode ) ) )
+            {
+                fprintf ( stderr, "Cannot create %s: %s\n", out,
+                          ( errno == EEXIST ) ? "not a directory" : strerror ( errno ) );
+                stats.errors++;
+                continue;
+            }
+            if ( ( item = list_add ( &others, entry, child_path ) ) == NULL )
+                goto walk_dir_error_memory;
+            if ( ! opts.no_metadata )
+                read_comment ( entry, item->comment );
+            stats.dirs++;
+            if ( ! walk_dir ( entry, child_path ) )
+                return false;
+            break;
+        }
+
+        case ADF_ST_LSOFT: {
+            // (the target - the name in the link block)
+            uint8_t block [ 512 ];
+            char target [ 65 ];
+            if ( ! read_blocks ( entry->sector, 1, block ) ) {
+                fprintf ( stderr, "Cannot read the link %s\n", child_path );
+                stats.errors++;
+                continue;
+            }
+            memcpy ( target, block + 0x18, 64 );
+            target [ 64 ] = '\0';
+            if ( symlink ( target, out ) != 0 ) {
+                fprintf ( stderr, "Cannot create %s: %s\n", out, strerror ( errno ) );
+                stats.errors++;
+                continue;
+            }
+            if ( list_add ( &others, entry, child_path ) == NULL )
+                goto walk_dir_error_memory;
+            stats.links++;
+            break;
+        }
+
+        default:
+            // (hard links - not in the index)
+            if ( opts.verbose )
+                printf ( "%s - skipped (hard link)\n", child_path );
+            stats.skipped++;
+            continue;
+        }
+
+        if ( opts.verbose )
+            printf ( "%s\n", child_path );
+    }
+    return true;
+
+walk_dir_error_memory:
+    fprintf ( stderr, "Out of memory.\n" );
+    return false;
+}
+
+
+/*****
+ * Extracting the files
+ *****/
+
+static bool write_all ( const int          fd,
+                        const void * const buf,
+                        const size_t       size )
+{
+    size_t done = 0;
+    while ( done < size ) {
+        const ssize_t n = write ( fd, ( const uint8_t * ) buf + done, size - done );
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            return false;
+        }
+        done += ( size_t ) n;
+    }
+    return true;
+}
+
+
+// the data by the block map - runs of contiguous blocks read at once
+static bool extract_data ( const adfindex_entry_t * const entry,
+                           const int                      fd,
+                           uint8_t * const                chunk )
+{
+    const unsigned block_data_size = adf->vol->datablockSize;
+    const bool     ofs = ( block_data_size != 512 );    // (data blocks
+                                                        //  with a header)
+    const uint32_t nblocks = ( uint32_t ) ( ( ( uint64_t ) entry->size +
+                                              block_data_size - 1 ) / block_data_size );
+    const int32_t * const blocks = adfindex_get_blocks ( idx, entry );
+    if ( blocks == NULL || entry->nblocks < nblocks )
+        return false;
+
+    uint64_t left = entry->size;
+    for ( uint32_t i = 0 ; i < nblocks ; ) {
+        uint32_t run = 1;
+        while ( i + run < nblocks && run < EXTRACT_CHUNK_BLOCKS &&
+                blocks [ i + run ] == blocks [ i ] + ( int32_t ) run )
+        {
+            run++;
+        }
+        if ( ! read_blocks ( blocks [ i ], run, chunk ) )
+            return false;
+
+        if ( ! ofs ) {
+            const size_t size = ( left < ( uint64_t ) run * 512 ) ?
+                ( size_t ) left : ( size_t ) run * 512;
+            if ( ! write_all ( fd, chunk, size ) )
+                return false;
+            left -= size;
+        } else {
+            // (the data packed in place - skipping the headers)
+            size_t size = 0;
+            for ( uint32_t b = 0 ; b < run && left > 0 ; b++ ) {
+                const uint8_t * const block = chunk + ( size_t ) b * 512;
+                if ( be32 ( block ) != ADF_T_DATA )
+                    return false;
+                const size_t n = ( left < block_data_size ) ? ( size_t ) left :
+                                                              block_data_size;
+                memmove ( chunk + size, block + 24, n );
+                size += n;
+                left -= n;
+            }
+            if ( ! write_all ( fd, chunk, size ) )
+                return false;
+        }
+        i += run;
+    }
+    return true;
+}
+
+
+// (files without a block map - read through ADFlib)
+static bool extract_data_adflib ( const extract_item_t * const item,
+                                  const int                    fd,
+                                  uint8_t * const              chunk )
+{
+    char path [ ADFIMAGE_MAX_PATH + 1 ];
+    snprintf ( path, sizeof ( path ), "/%s", item->path );
+
+    const size_t chunk_size = EXTRACT_CHUNK_BLOCKS * 512;
+    for ( uint64_t offset = 0 ; offset < item->entry->size ; ) {
+        pthread_mutex_lock ( &adflib_lock );
+        const int n = adfimage_read ( adf, path, ( char * ) chunk, chunk_size,
+                                      ( off_t ) offset );
+        pthread_mutex_unlock ( &adflib_lock );
+        if ( n <= 0 || ! write_all ( fd, chunk, ( size_t ) n ) )
+            return false;
+        offset += ( uint64_t ) n;
+    }
+    return true;
+}
+
+
+static void * extract_thread ( void * arg )
+{
+    (void) arg;
+
+    uint8_t * const chunk = malloc ( EXTRACT_CHUNK_BLOCKS * 512 );
+    if ( chunk == NULL ) {
+        fprintf ( stderr, "Out of memory.\n" );
+        __atomic_fetch_add ( &stats.errors, 1, __ATOMIC_RELAXED );
+        return NULL;
+    }
+
+    char out [ PATH_MAX ];
+    while ( true ) {
+        const size_t i = __atomic_fetch_add ( &next_file, 1, __ATOMIC_RELAXED );
+        if ( i >= files.n )
+            break;
+        extract_item_t * const item = &files.items [ i ];
+        const adfindex_entry_t * const entry = item->entry;
+
+        snprintf ( out, sizeof ( out ), "%s/%s", opts.dest, item->path );
+        const int fd = open ( out, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644 );
+        if ( fd < 0 ) {
+            fprintf ( stderr, "Cannot create %s: %s\n", out, strerror ( errno ) );
+            __atomic_fetch_add ( &stats.errors, 1, __ATOMIC_RELAXED );
+            continue;
+        }
+
+        const bool ok = ( entry->size == 0 ) ||
+            ( ( adfindex_get_blocks ( idx, entry ) != NULL ) ?
+              extract_data ( entry, fd, chunk ) :
+              extract_data_adflib ( item, fd, chunk ) );
+        if ( close ( fd ) != 0 || ! ok ) {
+            fprintf ( stderr, "Error extracting %s\n", item->path );
+            __atomic_fetch_add ( &stats.errors, 1, __ATOMIC_RELAXED );
+            continue;
+        }
+
+        if ( ! opts.no_metadata )
+            read_comment ( entry, item->comment );
+        set_metadata ( item, false );
+        __atomic_fetch_add ( &stats.files, 1, __ATOMIC_RELAXED );
+        __atomic_fetch_add ( &stats.bytes, entry->size, __ATOMIC_RELAXED );
+    }
+
+    free ( chunk );
+    return NULL;
+}
+
+
+/*****
+ * Metadata
+ *****/
+
+// AmigaDOS protection flags as listed by "list" (hsparwed, '-' - not set;
+// the rwed bits are set when denied)
+static void protection_string ( const int32_t access,
+                                char * const  str )
+{
+    static const char flags [] = "hsparwed";
+    for ( unsigned i = 0 ; i < 8 ; i++ ) {
+        const unsigned bit = 7 - i;
+        const bool     set = ( ( uint32_t ) access >> bit ) & 1;
+        str [ i ] = ( ( bit >= 4 ) ? set : ! set ) ? flags [ i ] : '-';
+    }
+    str [ 8 ] = '\0';
+}
+
+
+static void set_metadata ( const extract_item_t * const item,
+                           const bool                   link )
+{
+    const adfindex_entry_t * const entry = item->entry;
+    char out [ PATH_MAX ];
+    snprintf ( out, sizeof ( out ), "%s/%s", opts.dest, item->path );
+
+    // (extended attributes in the user namespace - not on links)
+    if ( ! opts.no_metadata && opts.sidecar == NULL && ! link ) {
+        char protection [ 9 ];
+        protection_string ( entry->access, protection );
+        if ( lsetxattr ( out, EXTRACT_XATTR_PROTECTION, protection,
+                         strlen ( protection ), 0 ) != 0 ||
+             ( item->comment [ 0 ] != '\0' &&
+               lsetxattr ( out, EXTRACT_XATTR_COMMENT, item->comment,
+                           strlen ( item->comment ), 0 ) != 0 ) )
+        {
+            fprintf ( stderr, "Cannot set extended attributes of %s: %s\n",
+                      out, strerror ( errno ) );
+            __atomic_fetch_add ( &stats.errors, 1, __ATOMIC_RELAXED );
+        }
+    }
+
+    const time_t mtime = localtime_to_time_t ( entry->year, entry->month,
+                                               entry->days, entry->hour,
+                                               entry->mins, entry->secs );
+    const struct timespec times [ 2 ] = { { mtime, 0 }, { mtime, 0 } };
+    if ( utimensat ( AT_FDCWD, out, times, AT_SYMLINK_NOFOLLOW ) != 0 ) {
+        fprintf ( stderr, "Cannot set the date of %s: %s\n", out, strerror ( errno ) );
+        __atomic_fetch_add ( &stats.errors, 1, __ATOMIC_RELAXED );
+    }
+}
+
+
+// (tabs, newlines and backslashes escaped)
+static void write_escaped ( FILE * const       f,
+                            const char * const str )
+{
+    for ( const char * c = str ; *c != '\0' ; c++ ) {
+        switch ( *c ) {
+        case '\t': fputs ( "\\t", f );  break;
+        case '\n': fputs ( "\\n", f );  break;
+        case '\\': fputs ( "\\\\", f ); break;
+        default:   fputc ( *c, f );
+        }
+    }
+}
+
+
+static void write_sidecar_list ( FILE * const                 f,
+                                 const extract_list_t * const list )
+{
+    for ( size_t i = 0 ; i < list->n ; i++ ) {
+        const extract_item_t * const item = &list->items [ i ];
+        const adfindex_entry_t * const entry = item->entry;
+        char protection [ 9 ];
+        protection_string ( entry->access, protection );
+        write_escaped ( f, item->path );
+        fprintf ( f, "\t%s\t%04d-%02d-%02d %02d:%02d:%02d\t",
+                  ( entry->type == ADF_ST_LSOFT ) ? "--------" : protection,
+                  entry->year, entry->month, entry->days,
+                  entry->hour, entry->mins, entry->secs );
+        write_escaped ( f, item->comment );
+        fputc ( '\n', f );
+    }
+}
+
+
+static bool write_sidecar ( void )
+{
+    FILE * const f = fopen ( opts.sidecar, "w" );
+    if ( f == NULL ) {
+        fprintf ( stderr, "Cannot create %s: %s\n", opts.sidecar, strerror ( errno ) );
+        return false;
+    }
+    fprintf ( f, "# path\tprotection\tdate\tcomment\n" );
+    write_sidecar_list ( f, &others );
+    write_sidecar_list ( f, &files );
+    if ( fclose ( f ) != 0 ) {
+        fprintf ( stderr, "Error writing %s: %s\n", opts.sidecar, strerror ( errno ) );
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,469 @@
+/*
+ * adfgen - generator of synthetic images (for benchmarks and tests)
+ *
+ * Creates a floppy (DD/HD) or a hardfile image with an OFS/FFS/DIRCACHE
+ * filesystem and fills it with a tree of directories and files of the given
+ * shape - also the cases hard to find in real images: fragmented files
+ * (with interleaved data blocks) and long hash chains (many names
+ * with the same hash in a directory). The same parameters (and seed)
+ * give always the same image.
+ */
+
+#include <adflib.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ADFGEN_MAX_FRAGMENTATION    64
+
+typedef enum {
+    ADFGEN_DEV_DD,              // floppy 880K
+    ADFGEN_DEV_HD,              // floppy 1.76M
+    ADFGEN_DEV_HDF              // hardfile
+} adfgen_dev_type_t;
+
+typedef struct adfgen_options {
+    const char *      image;
+    const char *      label;
+    adfgen_dev_type_t dev_type;
+    unsigned          hdf_size_mb;
+    uint8_t           fs_type;
+    unsigned          dirs,             // subdirectories in each directory
+                      depth,            // levels of subdirectories
+                      files,            // files in each directory
+                      size_min,         // (sizes of the files - random
+                      size_max,         //  in the range)
+                      fragmentation,    // files written interleaved
+                      chain,            // files with the same hash
+                      seed;
+    bool              verbose;
+} adfgen_options_t;
+
+typedef struct adfgen_stats {
+    unsigned dirs,
+             files;
+    uint64_t bytes;
+} adfgen_stats_t;
+
+static uint64_t rnd_state;
+
+static void usage ( void );
+
+static bool parse_options ( int                argc,
+                            char **            argv,
+                            adfgen_options_t * opts );
+
+static bool populate_dir ( struct AdfVolume * const       vol,
+                           const char * const             path,
+                           const unsigned                 level,
+                           const adfgen_options_t * const opts,
+                           adfgen_stats_t * const         stats );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    adfgen_options_t opts = {
+        .image         = NULL,
+        .label         = "adfgen",
+        .dev_type      = ADFGEN_DEV_DD,
+        .hdf_size_mb   = 10,
+        .fs_type       = ADF_DOSFS_FFS,
+        .dirs          = 4,
+        .depth         = 1,
+        .files         = 8,
+        .size_min      = 0,
+        .size_max      = 4096,
+        .fragmentation = 1,
+        .chain         = 0,
+        .seed          = 1,
+        .verbose       = false
+    };
+    if ( ! parse_options ( argc, argv, &opts ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    rnd_state = opts.seed + 0x9e3779b97f4a7c15ULL;     // (never 0)
+
+    if ( access ( opts.image, F_OK ) == 0 ) {
+        fprintf ( stderr, "%s already exists.\n", opts.image );
+        return EXIT_FAILURE;
+    }
+
+    if ( adfLibInit() != ADF_RC_OK ) {
+        fprintf ( stderr, "Cannot initialize ADFlib.\n" );
+        return EXIT_FAILURE;
+    }
+
+    uint32_t cylinders = 80,
+             heads     = 2,
+             sectors   = 11;
+    if ( opts.dev_type == ADFGEN_DEV_HD ) {
+        sectors = 22;
+    } else if ( opts.dev_type == ADFGEN_DEV_HDF ) {
+        // (2 heads x 32 sectors - 32 cylinders per MiB)
+        sectors   = 32;
+        cylinders = opts.hdf_size_mb * 32;
+    }
+
+    int status = EXIT_FAILURE;
+    struct AdfDevice * const dev = adfDevCreate ( "dump", opts.image, cylinders,
+                                                  heads, sectors );
+    if ( dev == NULL ) {
+        fprintf ( stderr, "Cannot create %s.\n", opts.image );
+        goto main_error_cleanup;
+    }
+
+    const ADF_RETCODE rc = ( opts.dev_type == ADFGEN_DEV_HDF ) ?
+        adfCreateHdFile ( dev, opts.label, opts.fs_type ) :
+        adfCreateFlop ( dev, opts.label, opts.fs_type );
+    if ( rc != ADF_RC_OK ) {
+        fprintf ( stderr, "Cannot create the filesystem on %s.\n", opts.image );
+        goto main_error_close_dev;
+    }
+
+    struct AdfVolume * const vol = adfVolMount ( dev, 0, ADF_ACCESS_MODE_READWRITE );
+    if ( vol == NULL ) {
+        fprintf ( stderr, "Cannot mount the volume of %s.\n", opts.image );
+        goto main_error_close_dev;
+    }
+
+    adfgen_stats_t stats = { 0 };
+    const bool populated = populate_dir ( vol, "", 0, &opts, &stats );
+    adfVolUnMount ( vol );
+    if ( ! populated ) {
+        fprintf ( stderr, "Cannot populate %s (too small?).\n", opts.image );
+        goto main_error_close_dev;
+    }
+
+    printf ( "%s: %u directories, %u files, %" PRIu64 " bytes\n",
+             opts.image, stats.dirs, stats.files, stats.bytes );
+    status = EXIT_SUCCESS;
+
+main_error_close_dev:
+    adfDevClose ( dev );
+    if ( status != EXIT_SUCCESS )
+        unlink ( opts.image );
+
+main_error_cleanup:
+    adfLibCleanUp();
+    return status;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  adfgen [options] image\n\n"
+             "Creates a synthetic image (the same for the same options).\n\n"
+             "Options:\n"
+             "  -t type      type: dd (default), hd, hdf\n"
+             "  -m size      size of a hardfile (in MiB, default 10)\n"
+             "  -f fs        filesystem: ofs, ffs (default), dircache\n"
+             "  -L label     volume name (default \"adfgen\")\n"
+             "  -d dirs      subdirectories in each directory (default 4)\n"
+             "  -l levels    levels of subdirectories (default 1)\n"
+             "  -n files     files in each directory (default 8)\n"
+             "  -s min[-max] size of the files - random in the range\n"
+             "               (default 0-4096)\n"
+             "  -F count     fragmentation - files of a directory written\n"
+             "               at once, with interleaved data blocks\n"
+             "               (default 1 - not fragmented, max. %u)\n"
+             "  -c count     additional files in each directory with names\n"
+             "               in one hash chain (default 0)\n"
+             "  -S seed      seed of the random sizes (default 1)\n"
+             "  -v           list the created directories and files\n"
+             "  -h           show this help\n\n"
+             "Names: dirN, fileN (and chainN for -c). Byte i of a file\n"
+             "is ( i + sum of the bytes of its name ) & 0xff.\n\n",
+             ADFGEN_MAX_FRAGMENTATION );
+}
+
+
+static bool parse_unsigned ( const char * const str,
+                             unsigned * const   value,
+                             char ** const      end )
+{
+    char * e;
+    errno = 0;
+    const unsigned long v = strtoul ( str, &e, 10 );
+    if ( errno != 0 || e == str || v > UINT32_MAX ||
+         ( end == NULL && *e != '\0' ) )
+    {
+        return false;
+    }
+    *value = ( unsigned ) v;
+    if ( end != NULL )
+        *end = e;
+    return true;
+}
+
+
+static bool parse_options ( int                argc,
+                            char **            argv,
+                            adfgen_options_t * opts )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "t:m:f:L:d:l:n:s:F:c:S:vh" ) ) != -1 ) {
+        bool ok = true;
+        char * end;
+        switch ( opt ) {
+        case 't':
+            if ( strcmp ( optarg, "dd" ) == 0 )
+                opts->dev_type = ADFGEN_DEV_DD;
+            else if ( strcmp ( optarg, "hd" ) == 0 )
+                opts->dev_type = ADFGEN_DEV_HD;
+            else if ( strcmp ( optarg, "hdf" ) == 0 )
+                opts->dev_type = ADFGEN_DEV_HDF;
+            else
+                ok = false;
+            break;
+        case 'm':
+            ok = parse_unsigned ( optarg, &opts->hdf_size_mb, NULL ) &&
+                opts->hdf_size_mb > 0;
+            break;
+        case 'f':
+            if ( strcmp ( optarg, "ofs" ) == 0 )
+                opts->fs_type = 0;
+            else if ( strcmp ( optarg, "ffs" ) == 0 )
+                opts->fs_type = ADF_DOSFS_FFS;
+            else if ( strcmp ( optarg, "dircache" ) == 0 )
+                opts->fs_type = ADF_DOSFS_FFS | ADF_DOSFS_INTL | ADF_DOSFS_DIRCACHE;
+            else
+                ok = false;
+            break;
+        case 'L':
+            opts->label = optarg;
+            ok = ( strlen ( optarg ) > 0 && strlen ( optarg ) <= ADF_MAXNAMELEN );
+            break;
+        case 'd':
+            ok = parse_unsigned ( optarg, &opts->dirs, NULL );
+            break;
+        case 'l':
+            ok = parse_unsigned ( optarg, &opts->depth, NULL );
+            break;
+        case 'n':
+            ok = parse_unsigned ( optarg, &opts->files, NULL );
+            break;
+        case 's':
+            ok = parse_unsigned ( optarg, &opts->size_min, &end );
+            if ( ! ok )
+                break;
+            if ( *end == '-' ) {
+                ok = parse_unsigned ( end + 1, &opts->size_max, NULL ) &&
+                    opts->size_max >= opts->size_min;
+            } else {
+                ok = ( *end == '\0' );
+                opts->size_max = opts->size_min;
+            }
+            break;
+        case 'F':
+            ok = parse_unsigned ( optarg, &opts->fragmentation, NULL ) &&
+                opts->fragmentation > 0 &&
+                opts->fragmentation <= ADFGEN_MAX_FRAGMENTATION;
+            break;
+        case 'c':
+            ok = parse_unsigned ( optarg, &opts->chain, NULL );
+            break;
+        case 'S':
+            ok = parse_unsigned ( optarg, &opts->seed, NULL );
+            break;
+        case 'v':
+            opts->verbose = true;
+            break;
+        default:
+            ok = false;
+        }
+        if ( ! ok )
+            return false;
+    }
+
+    if ( optind != argc - 1 )
+        return false;
+    opts->image = argv [ optind ];
+    return true;
+}
+
+
+/*****
+ * Contents
+ *****/
+
+// xorshift64* (the same sequence for the same seed)
+static uint64_t rnd ( void )
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return rnd_state * 2685821657736338717ULL;
+}
+
+
+static unsigned random_size ( const adfgen_options_t * const opts )
+{
+    return opts->size_min + ( unsigned ) ( rnd() % ( ( uint64_t ) opts->size_max -
+                                                     opts->size_min + 1 ) );
+}
+
+
+static uint8_t name_sum ( const char * const name )
+{
+    unsigned sum = 0;
+    for ( const char * c = name ; *c != '\0' ; c++ )
+        sum += ( unsigned char ) *c;
+    return ( uint8_t ) sum;
+}
+
+
+// next name (after "chain<*n>") with the given hash
+static bool chain_name ( char * const     name,
+                         const size_t     size,
+                         unsigned * const n,
+                         const unsigned   hash,
+                         const bool       intl )
+{
+    while ( *n < UINT32_MAX ) {
+        snprintf ( name, size, "chain%u", ++( *n ) );
+        if ( adfGetHashValue ( ( const uint8_t * ) name, intl ) == hash )
+            return true;
+    }
+    return false;
+}
+
+
+/*****
+ * Files and directories
+ *****/
+
+typedef struct adfgen_file {
+    struct AdfFile * file;
+    char             name [ ADF_MAXNAMELEN + 1 ];
+    unsigned         size,
+                     written;
+    uint8_t          sum;
+} adfgen_file_t;
+
+
+// write a group of files (in the current directory) at once, a data block
+// of each in turn - fragmented if more than one
+static bool write_files ( struct AdfVolume * const       vol,
+                          const char * const             path,
+                          adfgen_file_t * const          files,
+                          const unsigned                 nfiles,
+                          const adfgen_options_t * const opts,
+                          adfgen_stats_t * const         stats )
+{
+    bool ok = true;
+    unsigned i;
+    for ( i = 0 ; i < nfiles ; i++ ) {
+        struct AdfFileHeaderBlock fhdr;
+        if ( adfCreateFile ( vol, vol->curDirPtr, files [ i ].name,
+                             &fhdr ) != ADF_RC_OK )
+        {
+            ok = false;
+            break;
+        }
+        files [ i ].file = adfFileOpen ( vol, files [ i ].name, ADF_FILE_MODE_WRITE );
+        if ( files [ i ].file == NULL ) {
+            ok = false;
+            break;
+        }
+        files [ i ].written = 0;
+        files [ i ].sum = name_sum ( files [ i ].name );
+    }
+    const unsigned nopen = i;
+
+    uint8_t data [ 512 ];
+    const unsigned chunk = vol->datablockSize;
+    for ( bool more = ok ; more && ok ; ) {
+        more = false;
+        for ( i = 0 ; i < nopen ; i++ ) {
+            adfgen_file_t * const f = &files [ i ];
+            if ( f->written == f->size )
+                continue;
+            const unsigned n = ( f->size - f->written < chunk ) ?
+                f->size - f->written : chunk;
+            for ( unsigned j = 0 ; j < n ; j++ )
+                data [ j ] = ( uint8_t ) ( f->written + j + f->sum );
+            if ( adfFileWrite ( f->file, n, data ) != n ) {
+                ok = false;
+                break;
+            }
+            f->written += n;
+            more = more || ( f->written < f->size );
+        }
+    }
+
+    for ( i = 0 ; i < nopen ; i++ ) {
+        adfFileClose ( files [ i ].file );
+        if ( ok && opts->verbose )
+            printf ( "%s/%s %u\n", path, files [ i ].name, files [ i ].size );
+        stats->files++;
+        stats->bytes += files [ i ].written;
+    }
+    return ok;
+}
+
+
+static bool populate_dir ( struct AdfVolume * const       vol,
+                           const char * const             path,
+                           const unsigned                 level,
+                           const adfgen_options_t * const opts,
+                           adfgen_stats_t * const         stats )
+{
+    const bool intl = adfDosFsIsINTL ( opts->fs_type ) ||
+                      adfDosFsHasDIRCACHE ( opts->fs_type );
+    adfgen_file_t group [ ADFGEN_MAX_FRAGMENTATION ];
+    unsigned ngroup = 0;
+
+    // (the chain of names with the same hash as "chain0")
+    const unsigned chain_hash = adfGetHashValue ( ( const uint8_t * ) "chain0", intl );
+    unsigned chain_n = 0;
+
+    const unsigned nfiles = opts->files + opts->chain;
+    for ( unsigned i = 0 ; i < nfiles ; i++ ) {
+        adfgen_file_t * const f = &group [ ngroup++ ];
+        if ( i < opts->files ) {
+            snprintf ( f->name, sizeof ( f->name ), "file%u", i );
+        } else if ( i == opts->files ) {
+            snprintf ( f->name, sizeof ( f->name ), "chain0" );
+        } else if ( ! chain_name ( f->name, sizeof ( f->name ), &chain_n,
+                                   chain_hash, intl ) )
+        {
+            return false;
+        }
+        f->size = random_size ( opts );
+
+        if ( ngroup == opts->fragmentation || i == nfiles - 1 ) {
+            if ( ! write_files ( vol, path, group, ngroup, opts, stats ) )
+                return false;
+            ngroup = 0;
+        }
+    }
+
+    if ( level >= opts->depth )
+        return true;
+
+    char name [ ADF_MAXNAMELEN + 1 ],
+         subpath [ 1024 ];
+    for ( unsigned i = 0 ; i < opts->dirs ; i++ ) {
+        snprintf ( name, sizeof ( name ), "dir%u", i );
+        snprintf ( subpath, sizeof ( subpath ), "%s/%s", path, name );
+        if ( adfCreateDir ( vol, vol->curDirPtr, name ) != ADF_RC_OK ||
+             adfChangeDir ( vol, name ) != ADF_RC_OK )
+        {
+            return false;
+        }
+        if ( opts->verbose )
+            printf ( "%s/\n", subpath );
+        stats->dirs++;
+
+        const bool ok = populate_dir ( vol, subpath, level + 1, opts, stats );
+        adfParentDir ( vol );
+        if ( ! ok )
+            return false;
+    }
+    return true;
+}
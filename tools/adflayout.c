@@ -0,0 +1,622 @@
+#include "adflayout.h"
+
+#include "adfsum.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADFLAYOUT_BM_PAGES      25      // (bitmap blocks listed in the root block)
+#define ADFLAYOUT_BM_LONGS      127     // (longwords of the bitmap in a bitmap block)
+#define ADFLAYOUT_BM_EXT_PAGES  127     // (bitmap blocks listed in an extension)
+
+static void free_node ( adflayout_node_t * const node );
+
+static bool plan_dir ( adflayout_t * const      layout,
+                       adflayout_node_t * const dir );
+
+static void plan_links ( adflayout_node_t * const dir );
+
+static bool write_dir ( adflayout_t * const              layout,
+                        adflayout_node_t * const         dir,
+                        const char * const               path,
+                        const adflayout_source_t * const source );
+
+static void write_root_and_bitmap ( adflayout_t * const layout );
+
+
+void adflayout_init ( adflayout_t * const layout,
+                      const uint8_t       fs_type )
+{
+    memset ( layout, 0, sizeof ( adflayout_t ) );
+    layout->fs_type         = fs_type;
+    layout->root.type       = ADFLAYOUT_DIR;
+    layout->data_block_size = adfDosFsIsFFS ( fs_type ) ? 512 : 488;
+}
+
+
+void adflayout_free ( adflayout_t * const layout )
+{
+    free_node ( &layout->root );
+    free ( layout->image );
+    free ( layout->bitmap );
+    free ( layout->bitmap_sectors );
+    layout->image          = NULL;
+    layout->bitmap         = NULL;
+    layout->bitmap_sectors = NULL;
+}
+
+
+static void free_node ( adflayout_node_t * const node )
+{
+    for ( size_t i = 0 ; i < node->nchildren ; i++ )
+        free_node ( &node->children [ i ] );
+    free ( node->children );
+    free ( node->name );
+    free ( node->raw );
+    free ( node->source );
+    free ( node->blocks );
+    node->children  = NULL;
+    node->nchildren = 0;
+    node->name      = NULL;
+    node->raw       = NULL;
+    node->source    = NULL;
+    node->blocks    = NULL;
+}
+
+
+adflayout_node_t * adflayout_add ( adflayout_node_t * const dir,
+                                   const adflayout_type_t   type,
+                                   const char * const       name )
+{
+    if ( dir->nchildren == dir->children_size ) {
+        const size_t size = ( dir->children_size == 0 ) ? 16 : dir->children_size * 2;
+        adflayout_node_t * const children = realloc ( dir->children,
+                                                      size * sizeof ( adflayout_node_t ) );
+        if ( children == NULL )
+            return NULL;
+        dir->children      = children;
+        dir->children_size = size;
+    }
+    adflayout_node_t * const node = &dir->children [ dir->nchildren ];
+    memset ( node, 0, sizeof ( adflayout_node_t ) );
+    node->type = type;
+    node->name = strdup ( name );
+    if ( node->name == NULL )
+        return NULL;
+    dir->nchildren++;
+    return node;
+}
+
+
+/*****
+ * Names
+ *****/
+
+// (case-insensitive, the international mode also for the Latin-1 letters)
+static uint8_t amiga_toupper ( const uint8_t c,
+                               const bool    intl )
+{
+    if ( c >= 'a' && c <= 'z' )
+        return ( uint8_t ) ( c - ( 'a' - 'A' ) );
+    if ( intl && c >= 224 && c <= 254 && c != 247 )
+        return ( uint8_t ) ( c - ( 224 - 192 ) );
+    return c;
+}
+
+
+int adflayout_compare_names ( const adflayout_t * const layout,
+                              const char * const        name1,
+                              const char * const        name2 )
+{
+    const bool intl = adfDosFsIsINTL ( layout->fs_type );
+    const uint8_t * n1 = ( const uint8_t * ) name1,
+                  * n2 = ( const uint8_t * ) name2;
+    while ( *n1 != '\0' && amiga_toupper ( *n1, intl ) == amiga_toupper ( *n2, intl ) ) {
+        n1++;
+        n2++;
+    }
+    return ( int ) amiga_toupper ( *n1, intl ) - ( int ) amiga_toupper ( *n2, intl );
+}
+
+
+// (qsort has no context)
+static const adflayout_t * sort_layout = NULL;
+
+static int compare_nodes ( const void * const node1,
+                           const void * const node2 )
+{
+    const adflayout_node_t * const n1 = node1,
+                           * const n2 = node2;
+    const int cmp = adflayout_compare_names ( sort_layout, n1->name, n2->name );
+    return ( cmp != 0 ) ? cmp : strcmp ( n1->name, n2->name );
+}
+
+
+bool adflayout_sort_dir ( const adflayout_t * const layout,
+                          adflayout_node_t * const  dir )
+{
+    sort_layout = layout;
+    qsort ( dir->children, dir->nchildren, sizeof ( adflayout_node_t ), compare_nodes );
+    for ( size_t i = 1 ; i < dir->nchildren ; i++ ) {
+        if ( adflayout_compare_names ( layout, dir->children [ i - 1 ].name,
+                                       dir->children [ i ].name ) == 0 )
+        {
+            fprintf ( stderr, "%s and %s - the same name on AmigaDOS\n",
+                      dir->children [ i - 1 ].name, dir->children [ i ].name );
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*****
+ * Planning
+ *****/
+
+static uint32_t file_data_blocks ( const adflayout_t * const layout,
+                                   const uint64_t            size )
+{
+    return ( uint32_t ) ( ( size + layout->data_block_size - 1 ) /
+                          layout->data_block_size );
+}
+
+
+static uint32_t file_ext_blocks ( const uint32_t ndata )
+{
+    return ( ndata > ADF_MAX_DATABLK ) ?
+        ( ndata - ADF_MAX_DATABLK + ADF_MAX_DATABLK - 1 ) / ADF_MAX_DATABLK : 0;
+}
+
+
+// (the blocks of the entries of a directory and of all its subdirectories)
+static uint64_t count_blocks ( const adflayout_t * const      layout,
+                               const adflayout_node_t * const dir )
+{
+    uint64_t count = 0;
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        const adflayout_node_t * const node = &dir->children [ i ];
+        count++;
+        if ( node->type == ADFLAYOUT_DIR ) {
+            count += count_blocks ( layout, node );
+        } else if ( node->type == ADFLAYOUT_FILE ) {
+            const uint32_t ndata = file_data_blocks ( layout, node->size );
+            count += ( uint64_t ) file_ext_blocks ( ndata ) + ndata;
+        }
+    }
+    return count;
+}
+
+
+// the bitmap blocks and their extension blocks of a volume
+static void bitmap_blocks ( const uint32_t   nblocks,
+                            uint32_t * const nbitmap,
+                            uint32_t * const nbitmap_ext )
+{
+    // (the boot blocks are not in the bitmap)
+    const uint32_t bits = ADFLAYOUT_BM_LONGS * 32;
+    *nbitmap     = ( nblocks - 2 + bits - 1 ) / bits;
+    *nbitmap_ext = ( *nbitmap > ADFLAYOUT_BM_PAGES ) ?
+        ( *nbitmap - ADFLAYOUT_BM_PAGES + ADFLAYOUT_BM_EXT_PAGES - 1 ) /
+        ADFLAYOUT_BM_EXT_PAGES : 0;
+}
+
+
+uint64_t adflayout_blocks_needed ( const adflayout_t * const layout,
+                                   const uint32_t            nblocks )
+{
+    uint32_t nbitmap, nbitmap_ext;
+    bitmap_blocks ( nblocks, &nbitmap, &nbitmap_ext );
+    return 1 + nbitmap + nbitmap_ext + count_blocks ( layout, &layout->root );
+}
+
+
+// the next free block - from the root block up, then from the start
+// of the volume (as AmigaDOS allocates)
+static int32_t alloc_block ( adflayout_t * const layout )
+{
+    const int32_t sector = layout->next_free++;
+    if ( layout->next_free == ( int32_t ) layout->nblocks )
+        layout->next_free = 2;
+    const uint32_t bit = ( uint32_t ) sector - 2;
+    layout->bitmap [ bit / 32 ] &= ~( 1u << ( bit % 32 ) );
+    return sector;
+}
+
+
+bool adflayout_plan ( adflayout_t * const layout,
+                      const uint32_t      nblocks,
+                      const int32_t       root_sector )
+{
+    const uint64_t needed = adflayout_blocks_needed ( layout, nblocks );
+    if ( needed > nblocks - 2 ) {
+        fprintf ( stderr, "The files do not fit in the volume (%" PRIu64 " blocks "
+                  "needed, %" PRIu32 " available).\n", needed, nblocks - 2 );
+        return false;
+    }
+    layout->nblocks     = nblocks;
+    layout->root_sector = root_sector;
+    bitmap_blocks ( nblocks, &layout->nbitmap, &layout->nbitmap_ext );
+
+    const size_t bitmap_size = ( size_t ) layout->nbitmap * ADFLAYOUT_BM_LONGS *
+                               sizeof ( uint32_t );
+    layout->image          = calloc ( nblocks, 512 );
+    layout->bitmap         = calloc ( 1, bitmap_size );
+    layout->bitmap_sectors = malloc ( ( size_t ) ( layout->nbitmap +
+                                                   layout->nbitmap_ext ) *
+                                      sizeof ( int32_t ) );
+    if ( layout->image == NULL || layout->bitmap == NULL ||
+         layout->bitmap_sectors == NULL )
+    {
+        fprintf ( stderr, "Out of memory.\n" );
+        return false;
+    }
+
+    // (all free - without the bits past the end of the volume)
+    for ( uint32_t bit = 0 ; bit < nblocks - 2 ; bit++ )
+        layout->bitmap [ bit / 32 ] |= 1u << ( bit % 32 );
+
+    // the root block, the bitmap after it, then the tree
+    layout->next_free   = root_sector;
+    layout->root.sector = alloc_block ( layout );
+    for ( uint32_t i = 0 ; i < layout->nbitmap + layout->nbitmap_ext ; i++ )
+        layout->bitmap_sectors [ i ] = alloc_block ( layout );
+    if ( ! plan_dir ( layout, &layout->root ) )
+        return false;
+    plan_links ( &layout->root );
+    return true;
+}
+
+
+static bool plan_dir ( adflayout_t * const      layout,
+                       adflayout_node_t * const dir )
+{
+    // the headers of the entries together (listing the directory),
+    // then the data of the files, then the subdirectories
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ )
+        dir->children [ i ].sector = alloc_block ( layout );
+
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        if ( node->type != ADFLAYOUT_FILE || node->size == 0 )
+            continue;
+        node->ndata  = file_data_blocks ( layout, node->size );
+        node->next   = file_ext_blocks ( node->ndata );
+        node->blocks = malloc ( ( size_t ) ( node->next + node->ndata ) *
+                                sizeof ( int32_t ) );
+        if ( node->blocks == NULL ) {
+            fprintf ( stderr, "Out of memory.\n" );
+            return false;
+        }
+        for ( uint32_t b = 0 ; b < node->next + node->ndata ; b++ )
+            node->blocks [ b ] = alloc_block ( layout );
+    }
+
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        if ( node->type == ADFLAYOUT_DIR && ! plan_dir ( layout, node ) )
+            return false;
+    }
+    return true;
+}
+
+
+// (the chains of hard links - from the entries linked)
+static void plan_links ( adflayout_node_t * const dir )
+{
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        if ( node->type == ADFLAYOUT_HARD_LINK && node->real != NULL ) {
+            node->next_link       = node->real->next_link;
+            node->real->next_link = node->sector;
+        } else if ( node->type == ADFLAYOUT_DIR ) {
+            plan_links ( node );
+        }
+    }
+}
+
+
+uint32_t adflayout_fragments ( const int32_t * const blocks,
+                               const uint32_t        nblocks )
+{
+    uint32_t fragments = ( nblocks > 0 ) ? 1 : 0;
+    for ( uint32_t i = 1 ; i < nblocks ; i++ ) {
+        if ( blocks [ i ] != blocks [ i - 1 ] + 1 )
+            fragments++;
+    }
+    return fragments;
+}
+
+
+double adflayout_fragmentation ( const int32_t * const blocks,
+                                 const uint32_t        nblocks )
+{
+    return ( nblocks > 1 ) ?
+        ( double ) ( adflayout_fragments ( blocks, nblocks ) - 1 ) /
+        ( double ) ( nblocks - 1 ) : 0.0;
+}
+
+
+/*****
+ * Building the blocks
+ *****/
+
+static inline uint8_t * block_at ( const adflayout_t * const layout,
+                                   const int32_t             sector )
+{
+    return layout->image + ( size_t ) sector * 512;
+}
+
+
+static inline void put32 ( uint8_t * const block,
+                           const unsigned  offset,
+                           const int32_t   value )
+{
+    const uint32_t v = ( uint32_t ) value;
+    block [ offset ]     = ( uint8_t ) ( v >> 24 );
+    block [ offset + 1 ] = ( uint8_t ) ( v >> 16 );
+    block [ offset + 2 ] = ( uint8_t ) ( v >> 8 );
+    block [ offset + 3 ] = ( uint8_t ) v;
+}
+
+
+static void set_name ( uint8_t * const    block,
+                       const char * const name )
+{
+    const size_t len = strlen ( name );
+    block [ 0x1b0 ] = ( uint8_t ) len;
+    memcpy ( block + 0x1b1, name, len );
+}
+
+
+// the hash table of a directory (the chains in the order of the blocks)
+static void set_hash_table ( const adflayout_t * const layout,
+                             uint8_t * const           block,
+                             adflayout_node_t * const  dir )
+{
+    const bool intl = adfDosFsIsINTL ( layout->fs_type );
+    int32_t table [ ADF_HT_SIZE ] = { 0 };
+    for ( size_t i = dir->nchildren ; i > 0 ; i-- ) {
+        adflayout_node_t * const node = &dir->children [ i - 1 ];
+        const unsigned hash = adfGetHashValue ( ( const uint8_t * ) node->name, intl );
+        node->hash_chain = table [ hash ];
+        table [ hash ]   = node->sector;
+    }
+    for ( unsigned i = 0 ; i < ADF_HT_SIZE ; i++ )
+        put32 ( block, 24 + i * 4, table [ i ] );
+}
+
+
+// the header block of an entry - copied from the original one (the fields
+// of the layout cleared) or made of the node
+static uint8_t * start_header ( const adflayout_t * const      layout,
+                                const adflayout_node_t * const node,
+                                const int32_t                  parent )
+{
+    uint8_t * const block = block_at ( layout, node->sector );
+    if ( node->raw != NULL ) {
+        memcpy ( block, node->raw, 512 );
+        // (the block table / hash table - not the target of a soft link)
+        if ( node->type != ADFLAYOUT_SOFT_LINK )
+            memset ( block + 8, 0, 0x138 - 8 );
+    } else {
+        put32 ( block, 0x140, node->access );
+        block [ 0x148 ] = ( uint8_t ) strlen ( node->comment );
+        memcpy ( block + 0x149, node->comment, strlen ( node->comment ) );
+        put32 ( block, 0x1a4, node->date [ 0 ] );
+        put32 ( block, 0x1a8, node->date [ 1 ] );
+        put32 ( block, 0x1ac, node->date [ 2 ] );
+        set_name ( block, node->name );
+        put32 ( block, 0x1fc, ( node->type == ADFLAYOUT_DIR ) ? ADF_ST_DIR :
+                              ADF_ST_FILE );
+    }
+    put32 ( block, 0, ADF_T_HEADER );
+    put32 ( block, 4, node->sector );
+    put32 ( block, 0x1d4, ( node->type == ADFLAYOUT_HARD_LINK && node->real != NULL ) ?
+                          node->real->sector : 0 );
+    put32 ( block, 0x1d8, node->next_link );
+    put32 ( block, 0x1f0, node->hash_chain );
+    put32 ( block, 0x1f4, parent );
+    put32 ( block, 0x1f8, 0 );
+    return block;
+}
+
+
+// the data of a file - FFS: read in place (runs of contiguous blocks),
+// OFS: after the header of each block
+static bool write_data ( const adflayout_t * const        layout,
+                         adflayout_node_t * const         node,
+                         const adflayout_source_t * const source )
+{
+    if ( ! source->open ( node, source->ctx ) )
+        return false;
+
+    const int32_t * const data = node->blocks + node->next;
+    uint64_t left = node->size;
+    bool ok = true;
+    for ( uint32_t i = 0 ; i < node->ndata && ok ; ) {
+        if ( layout->data_block_size == 512 ) {
+            uint32_t run = 1;
+            while ( i + run < node->ndata && data [ i + run ] == data [ i ] + ( int32_t ) run )
+                run++;
+            const size_t size = ( left < ( uint64_t ) run * 512 ) ?
+                ( size_t ) left : ( size_t ) run * 512;
+            ok = source->read ( block_at ( layout, data [ i ] ), size, source->ctx );
+            left -= size;
+            i += run;
+        } else {
+            uint8_t * const block = block_at ( layout, data [ i ] );
+            const size_t size = ( left < layout->data_block_size ) ?
+                ( size_t ) left : layout->data_block_size;
+            ok = source->read ( block + 24, size, source->ctx );
+            put32 ( block, 0,  ADF_T_DATA );
+            put32 ( block, 4,  node->sector );
+            put32 ( block, 8,  ( int32_t ) ( i + 1 ) );
+            put32 ( block, 12, ( int32_t ) size );
+            put32 ( block, 16, ( i + 1 < node->ndata ) ? data [ i + 1 ] : 0 );
+            adfsum_set ( block, 20 );
+            left -= size;
+            i++;
+        }
+    }
+    source->close ( source->ctx );
+    return ok;
+}
+
+
+// the header block and the extension blocks of a file (the data block
+// pointers in reverse order)
+static void write_file_headers ( const adflayout_t * const layout,
+                                 adflayout_node_t * const  node,
+                                 const int32_t             parent )
+{
+    const int32_t * const data = ( node->blocks != NULL ) ?
+        node->blocks + node->next : NULL;
+    for ( uint32_t e = 0 ; e <= node->next ; e++ ) {
+        uint8_t * block;
+        if ( e == 0 ) {
+            block = start_header ( layout, node, parent );
+            put32 ( block, 16, ( node->ndata > 0 ) ? data [ 0 ] : 0 );
+            put32 ( block, 0x144, ( int32_t ) node->size );
+        } else {
+            block = block_at ( layout, node->blocks [ e - 1 ] );
+            put32 ( block, 0, ADF_T_LIST );
+            put32 ( block, 4, node->blocks [ e - 1 ] );
+            put32 ( block, 0x1f4, node->sector );
+            put32 ( block, 0x1fc, ADF_ST_FILE );
+        }
+        const uint32_t first = e * ADF_MAX_DATABLK,
+                       count = ( node->ndata - first < ADF_MAX_DATABLK ) ?
+                                   node->ndata - first : ADF_MAX_DATABLK;
+        put32 ( block, 8, ( int32_t ) count );
+        for ( uint32_t i = 0 ; i < count ; i++ )
+            put32 ( block, 24 + ( ADF_MAX_DATABLK - 1 - i ) * 4, data [ first + i ] );
+        put32 ( block, 0x1f8, ( e < node->next ) ? node->blocks [ e ] : 0 );
+        adfsum_set ( block, 20 );
+    }
+}
+
+
+static bool write_dir ( adflayout_t * const              layout,
+                        adflayout_node_t * const         dir,
+                        const char * const               path,
+                        const adflayout_source_t * const source )
+{
+    set_hash_table ( layout, block_at ( layout, dir->sector ), dir );
+
+    char child_path [ PATH_MAX ];
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        snprintf ( child_path, sizeof ( child_path ), "%s%s%s", path,
+                   ( path [ 0 ] != '\0' ) ? "/" : "", node->name );
+        if ( layout->verbose )
+            printf ( "%s\n", child_path );
+
+        switch ( node->type ) {
+        case ADFLAYOUT_FILE:
+            if ( node->ndata > 0 && ! write_data ( layout, node, source ) ) {
+                fprintf ( stderr, "Error reading %s\n", child_path );
+                return false;
+            }
+            write_file_headers ( layout, node, dir->sector );
+            break;
+
+        case ADFLAYOUT_DIR: {
+            // (the header after the entries - the hash table set first)
+            uint8_t saved [ ADF_HT_SIZE * 4 ];
+            if ( ! write_dir ( layout, node, child_path, source ) )
+                return false;
+            uint8_t * const block = block_at ( layout, node->sector );
+            memcpy ( saved, block + 24, sizeof ( saved ) );
+            start_header ( layout, node, dir->sector );
+            memcpy ( block + 24, saved, sizeof ( saved ) );
+            adfsum_set ( block, 20 );
+            break;
+        }
+
+        default:
+            adfsum_set ( start_header ( layout, node, dir->sector ), 20 );
+        }
+    }
+    return true;
+}
+
+
+bool adflayout_build ( adflayout_t * const              layout,
+                       const adflayout_source_t * const source )
+{
+    if ( ! write_dir ( layout, &layout->root, "", source ) )
+        return false;
+    write_root_and_bitmap ( layout );
+    return true;
+}
+
+
+static void write_root_and_bitmap ( adflayout_t * const layout )
+{
+    // (the boot blocks - kept or not bootable)
+    if ( layout->has_boot ) {
+        memcpy ( layout->image, layout->boot, sizeof ( layout->boot ) );
+    } else {
+        memcpy ( layout->image, "DOS", 3 );
+        layout->image [ 3 ] = layout->fs_type;
+        put32 ( layout->image, 8, layout->root_sector );
+    }
+
+    // (the root block - the hash table already set)
+    uint8_t * const block = block_at ( layout, layout->root_sector );
+    if ( layout->root.raw != NULL ) {
+        uint8_t saved [ ADF_HT_SIZE * 4 ];
+        memcpy ( saved, block + 24, sizeof ( saved ) );
+        memcpy ( block, layout->root.raw, 512 );
+        memset ( block + 8, 0, 0x1a4 - 8 );
+        memcpy ( block + 24, saved, sizeof ( saved ) );
+    } else {
+        put32 ( block, 0x1a4, layout->root.date [ 0 ] );
+        put32 ( block, 0x1a8, layout->root.date [ 1 ] );
+        put32 ( block, 0x1ac, layout->root.date [ 2 ] );
+        set_name ( block, layout->label );
+        for ( unsigned i = 0 ; i < 3 ; i++ ) {
+            put32 ( block, 0x1d8 + i * 4, layout->root.date [ i ] );
+            put32 ( block, 0x1e4 + i * 4, layout->root.date [ i ] );
+        }
+    }
+    put32 ( block, 0, ADF_T_HEADER );
+    put32 ( block, 4, 0 );
+    put32 ( block, 12, ADF_HT_SIZE );
+    put32 ( block, 0x138, -1 );             // (the bitmap valid)
+    for ( uint32_t i = 0 ; i < layout->nbitmap && i < ADFLAYOUT_BM_PAGES ; i++ )
+        put32 ( block, 0x13c + i * 4, layout->bitmap_sectors [ i ] );
+    put32 ( block, 0x1a0, ( layout->nbitmap_ext > 0 ) ?
+                          layout->bitmap_sectors [ layout->nbitmap ] : 0 );
+    put32 ( block, 0x1f0, 0 );
+    put32 ( block, 0x1f4, 0 );
+    put32 ( block, 0x1f8, 0 );
+    put32 ( block, 0x1fc, ADF_ST_ROOT );
+    adfsum_set ( block, 20 );
+
+    // the bitmap blocks (the checksum - the first longword)
+    for ( uint32_t i = 0 ; i < layout->nbitmap ; i++ ) {
+        uint8_t * const bm = block_at ( layout, layout->bitmap_sectors [ i ] );
+        for ( unsigned l = 0 ; l < ADFLAYOUT_BM_LONGS ; l++ )
+            put32 ( bm, 4 + l * 4,
+                    ( int32_t ) layout->bitmap [ i * ADFLAYOUT_BM_LONGS + l ] );
+        adfsum_set ( bm, 0 );
+    }
+
+    // (the bitmap blocks past the root block - listed in extension blocks)
+    for ( uint32_t e = 0 ; e < layout->nbitmap_ext ; e++ ) {
+        uint8_t * const ext = block_at ( layout,
+                                         layout->bitmap_sectors [ layout->nbitmap + e ] );
+        for ( uint32_t i = 0 ; i < ADFLAYOUT_BM_EXT_PAGES ; i++ ) {
+            const uint32_t page = ADFLAYOUT_BM_PAGES + e * ADFLAYOUT_BM_EXT_PAGES + i;
+            if ( page < layout->nbitmap )
+                put32 ( ext, i * 4, layout->bitmap_sectors [ page ] );
+        }
+        put32 ( ext, 0x1fc, ( e + 1 < layout->nbitmap_ext ) ?
+                            layout->bitmap_sectors [ layout->nbitmap + e + 1 ] : 0 );
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef ADFLAYOUT_H
+#define ADFLAYOUT_H
+
+/*
+ * adflayout - planning the layout of a whole volume and building its blocks
+ * in memory (for the tools writing volumes at once: adfbuild, adfoptimize)
+ *
+ * The tree of the entries is laid out from the root block up (then from
+ * the start of the volume - as AmigaDOS allocates): the headers
+ * of the entries of a directory in one run of blocks, followed by the data
+ * of its files (each file: its extension blocks, then all its data blocks -
+ * contiguous) and by its subdirectories. The hash tables, the hash chains,
+ * the links and the bitmap are computed in memory.
+ */
+
+#include <adflib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    ADFLAYOUT_FILE,
+    ADFLAYOUT_DIR,
+    ADFLAYOUT_SOFT_LINK,            // (from the raw header only)
+    ADFLAYOUT_HARD_LINK
+} adflayout_type_t;
+
+typedef struct adflayout_node adflayout_node_t;
+
+struct adflayout_node {
+    adflayout_type_t   type;
+    char *             name;
+    uint64_t           size;                // (files)
+    int32_t            access,
+                       date [ 3 ];          // days, minutes, ticks
+    char               comment [ ADF_MAXCMMTLEN + 1 ];
+    adflayout_node_t * real;                // (hard links - the entry linked)
+    adflayout_node_t * children;            // (directories)
+    size_t             nchildren,
+                       children_size;
+
+    // the original header block (or NULL) - copied, with the fields
+    // of the layout (blocks, hash table, chains, links) replaced
+    uint8_t *          raw;
+    void *             source;              // (for the data source - freed
+                                            //  with the node)
+
+    // the layout
+    int32_t            sector,              // header block
+                       hash_chain,
+                       next_link;           // (the chain of hard links)
+    int32_t *          blocks;              // extension blocks, then data blocks
+    uint32_t           next,
+                       ndata;
+};
+
+// reading the data of the files - each file sequentially, in pieces
+// of any size (up to the rest of the file)
+typedef struct adflayout_source {
+    bool ( * open )  ( adflayout_node_t * const node,
+                       void * const             ctx );
+
+    bool ( * read )  ( uint8_t * const buf,
+                       const size_t    size,
+                       void * const    ctx );
+
+    void ( * close ) ( void * const ctx );
+
+    void * ctx;
+} adflayout_source_t;
+
+typedef struct adflayout {
+    uint8_t          fs_type;
+    adflayout_node_t root;                  // (root->raw - the root block)
+    char             label [ ADF_MAXNAMELEN + 1 ];  // (without the root block)
+    bool             has_boot;              // (boot - the boot blocks to keep)
+    uint8_t          boot [ 1024 ];
+    bool             verbose;               // (list the entries written)
+
+    // the volume (after planning)
+    uint32_t         nblocks;
+    int32_t          root_sector;
+    uint8_t *        image;
+    unsigned         data_block_size;       // (488 - OFS, 512 - FFS)
+    uint32_t *       bitmap;                // (a bit set - a free block)
+    uint32_t         nbitmap,               // bitmap blocks
+                     nbitmap_ext;           //  and their extension blocks
+    int32_t *        bitmap_sectors;
+    int32_t          next_free;             // (the allocation cursor)
+} adflayout_t;
+
+void adflayout_init ( adflayout_t * const layout,
+                      const uint8_t       fs_type );
+
+// frees the tree and the blocks
+void adflayout_free ( adflayout_t * const layout );
+
+// a new entry of the directory (NULL if out of memory)
+adflayout_node_t * adflayout_add ( adflayout_node_t * const dir,
+                                   const adflayout_type_t   type,
+                                   const char * const       name );
+
+// sorts the entries of the directory, false if two names are the same
+// on AmigaDOS (case-insensitive)
+bool adflayout_sort_dir ( const adflayout_t * const layout,
+                          adflayout_node_t * const  dir );
+
+// (the same as AmigaDOS compares the names)
+int adflayout_compare_names ( const adflayout_t * const layout,
+                              const char * const        name1,
+                              const char * const        name2 );
+
+// the blocks needed for the tree on a volume of nblocks (all, with the root
+// block and the bitmap)
+uint64_t adflayout_blocks_needed ( const adflayout_t * const layout,
+                                   const uint32_t            nblocks );
+
+// plans the layout on a volume of nblocks, false if it does not fit
+// (or out of memory)
+bool adflayout_plan ( adflayout_t * const layout,
+                      const uint32_t      nblocks,
+                      const int32_t       root_sector );
+
+// builds the blocks of the volume in layout->image (nblocks x 512 bytes)
+bool adflayout_build ( adflayout_t * const              layout,
+                       const adflayout_source_t * const source );
+
+// the number of runs of contiguous blocks (fragments) and the fragmentation
+// score: 0 - contiguous, 1 - no two blocks adjacent
+uint32_t adflayout_fragments ( const int32_t * const blocks,
+                               const uint32_t        nblocks );
+
+double adflayout_fragmentation ( const int32_t * const blocks,
+                                 const uint32_t        nblocks );
+
+#endif
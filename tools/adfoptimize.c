@@ -0,0 +1,718 @@
+/*
+ * adfoptimize - defragmenting a volume (offline)
+ *
+ * Reads the whole tree of the volume (all entries, with their header
+ * blocks and block maps) and writes it again with the layout of adfbuild
+ * (see adflayout.h): the headers of the entries of a directory together,
+ * the data blocks of each file contiguous, the bitmap rebuilt (blocks
+ * not reachable from the root are freed). The header blocks are kept
+ * as they are (names, dates, protection flags, comments, links) - only
+ * the block pointers change.
+ *
+ * The new volume is built in memory, then written at once - to a new image
+ * or in place (to a copy of the image, renamed over it when complete).
+ * For each file, the fragmentation of its data blocks (0 - contiguous,
+ * 1 - no two blocks adjacent) is reported before and after.
+ */
+
+#include "adfdev.h"
+#include "adffs_util.h"
+#include "adfimage.h"
+#include "adflayout.h"
+#include "adfsum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPTIMIZE_COPY_SIZE  ( 1024 * 1024 )
+
+typedef struct optimize_options {
+    char *       image;
+    const char * output;            // (NULL - in place)
+    unsigned     volume;
+    bool         dry_run,
+                 quiet,
+                 ignore_checksum_errors;
+} optimize_options_t;
+
+// the original location of an entry (the source of its data)
+typedef struct optimize_source {
+    int32_t  sector,                // header block
+             real;                  // (hard links - the entry linked)
+    uint32_t nblocks;
+    int32_t  blocks [];             // data blocks
+} optimize_source_t;
+
+typedef struct optimize_stats {
+    uint64_t files,
+             fragmented_before,
+             fragmented_after,
+             fragments_before,
+             fragments_after;
+    double   score_before,
+             score_after;
+} optimize_stats_t;
+
+static optimize_options_t opts = {
+    .image                  = NULL,
+    .output                 = NULL,
+    .volume                 = 0,
+    .dry_run                = false,
+    .quiet                  = false,
+    .ignore_checksum_errors = false
+};
+
+static adfimage_t *       adf = NULL;
+static int                image_fd = -1;
+static uint64_t           volume_offset;    // (in the image file)
+static uint32_t           volume_blocks;
+static uint8_t *          visited = NULL;   // (blocks of the tree - a loop
+                                            //  otherwise)
+static adflayout_t        layout;
+static optimize_stats_t   stats = { 0 };
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+static bool read_dir ( adflayout_node_t * const dir,
+                       const int32_t            sector,
+                       const char * const       path );
+
+static bool link_hard_links ( void );
+
+static void report ( const adflayout_node_t * const dir,
+                     const char * const             path );
+
+static bool write_volume ( void );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    adffs_util_init();
+
+    adf = adfimage_open ( opts.image, opts.volume, true,
+                          opts.ignore_checksum_errors );
+    if ( adf == NULL ) {
+        fprintf ( stderr, "Cannot open volume %u of %s.\n", opts.volume, opts.image );
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_FAILURE;
+    struct AdfVolume * const vol = adf->vol;
+    if ( ! adfdev_is_raw ( vol->dev ) ) {
+        fprintf ( stderr, "%s is compressed - only plain images can be optimized.\n",
+                  opts.image );
+        goto main_error_close_image;
+    }
+    if ( adfDosFsHasDIRCACHE ( vol->fs.type ) ) {
+        fprintf ( stderr, "DIRCACHE volumes are not supported.\n" );
+        goto main_error_close_image;
+    }
+    image_fd = open ( opts.image, O_RDONLY );
+    if ( image_fd < 0 ) {
+        fprintf ( stderr, "Cannot open %s: %s\n", opts.image, strerror ( errno ) );
+        goto main_error_close_image;
+    }
+    volume_offset = ( uint64_t ) vol->firstBlock * 512;
+    volume_blocks = ( uint32_t ) ( vol->lastBlock - vol->firstBlock + 1 );
+
+    // the tree (the header blocks kept - with the root and the boot blocks)
+    adflayout_init ( &layout, vol->fs.type );
+    layout.root.raw = malloc ( 512 );
+    visited = calloc ( ( volume_blocks + 7 ) / 8, 1 );
+    if ( layout.root.raw == NULL || visited == NULL ) {
+        fprintf ( stderr, "Out of memory.\n" );
+        goto main_error_free_layout;
+    }
+    layout.has_boot = true;
+    if ( pread ( image_fd, layout.boot, sizeof ( layout.boot ),
+                 ( off_t ) volume_offset ) != ( ssize_t ) sizeof ( layout.boot ) ||
+         pread ( image_fd, layout.root.raw, 512, ( off_t ) ( volume_offset +
+                 ( uint64_t ) vol->rootBlock * 512 ) ) != 512 ||
+         ! read_dir ( &layout.root, vol->rootBlock, "" ) ||
+         ! link_hard_links() )
+    {
+        fprintf ( stderr, "Cannot read the tree of %s.\n", opts.image );
+        goto main_error_free_layout;
+    }
+
+    // (the same volume - the same root block)
+    if ( ! adflayout_plan ( &layout, volume_blocks, vol->rootBlock ) )
+        goto main_error_free_layout;
+    report ( &layout.root, "" );
+    if ( ! opts.dry_run && ! write_volume() )
+        goto main_error_free_layout;
+
+    printf ( "%s: %" PRIu64 " files, fragmented: %" PRIu64 " -> %" PRIu64
+             ", fragments: %" PRIu64 " -> %" PRIu64 ", avg. score: %.3f -> %.3f%s\n",
+             ( opts.output != NULL ) ? opts.output : opts.image, stats.files,
+             stats.fragmented_before, stats.fragmented_after,
+             stats.fragments_before, stats.fragments_after,
+             ( stats.files > 0 ) ? stats.score_before / ( double ) stats.files : 0.0,
+             ( stats.files > 0 ) ? stats.score_after / ( double ) stats.files : 0.0,
+             opts.dry_run ? " (not written)" : "" );
+    status = EXIT_SUCCESS;
+
+main_error_free_layout:
+    adflayout_free ( &layout );
+    free ( visited );
+    close ( image_fd );
+
+main_error_close_image:
+    adfimage_close ( &adf );
+    return status;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  adfoptimize [options] image [output]\n\n"
+             "Defragments a volume of the image: the data of each file written\n"
+             "to contiguous blocks, the headers of the entries of each directory\n"
+             "together, the bitmap rebuilt - in place or to a new image (output).\n"
+             "Prints the fragmentation of each file before and after (0 - contiguous,\n"
+             "1 - no two blocks adjacent).\n\n"
+             "Options:\n"
+             "  -p volume    volume (partition) number, default: 0\n"
+             "  -n           only report (do not write anything)\n"
+             "  -q           print only the summary\n"
+             "  -i           ignore checksum errors\n"
+             "  -h           show this help\n\n" );
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "p:nqih" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'p':
+            opts.volume = ( unsigned ) strtoul ( optarg, NULL, 10 );
+            break;
+        case 'n':
+            opts.dry_run = true;
+            break;
+        case 'q':
+            opts.quiet = true;
+            break;
+        case 'i':
+            opts.ignore_checksum_errors = true;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if ( optind != argc - 1 && optind != argc - 2 )
+        return false;
+    opts.image = argv [ optind ];
+    if ( optind == argc - 2 )
+        opts.output = argv [ optind + 1 ];
+    return true;
+}
+
+
+/*****
+ * Reading the tree
+ *****/
+
+static inline uint32_t be32 ( const uint8_t * const p )
+{
+    return ( uint32_t ) p [ 0 ] << 24 | ( uint32_t ) p [ 1 ] << 16 |
+           ( uint32_t ) p [ 2 ] << 8  | ( uint32_t ) p [ 3 ];
+}
+
+
+// a block of the tree (not read before - false on a loop in the tree,
+// a bad checksum or a wrong type)
+static bool read_tree_block ( const int32_t   sector,
+                              const int32_t   type,
+                              uint8_t * const block )
+{
+    if ( sector < 2 || ( uint32_t ) sector >= volume_blocks ) {
+        fprintf ( stderr, "Invalid block number: %" PRId32 "\n", sector );
+        return false;
+    }
+    if ( visited [ sector / 8 ] & ( 1u << ( sector % 8 ) ) ) {
+        fprintf ( stderr, "Block %" PRId32 " used twice (a loop?)\n", sector );
+        return false;
+    }
+    visited [ sector / 8 ] |= ( uint8_t ) ( 1u << ( sector % 8 ) );
+
+    if ( pread ( image_fd, block, 512, ( off_t ) ( volume_offset +
+                 ( uint64_t ) sector * 512 ) ) != 512 )
+    {
+        fprintf ( stderr, "Cannot read block %" PRId32 "\n", sector );
+        return false;
+    }
+    if ( ! adfsum_is_valid ( block ) && ! opts.ignore_checksum_errors ) {
+        fprintf ( stderr, "Invalid checksum of block %" PRId32 "\n", sector );
+        return false;
+    }
+    if ( ( int32_t ) be32 ( block ) != type ||
+         ( type == ADF_T_HEADER && ( int32_t ) be32 ( block + 4 ) != sector ) )
+    {
+        fprintf ( stderr, "Invalid block %" PRId32 " (type %" PRIu32 ")\n",
+                  sector, be32 ( block ) );
+        return false;
+    }
+    return true;
+}
+
+
+// the data blocks of a file (from its header and extension blocks)
+static optimize_source_t * read_block_map ( const uint8_t * const header,
+                                            const int32_t         sector,
+                                            const char * const    path )
+{
+    const uint64_t size  = be32 ( header + 0x144 );
+    const uint32_t ndata = ( uint32_t ) ( ( size + layout.data_block_size - 1 ) /
+                                          layout.data_block_size );
+    optimize_source_t * const src = malloc ( sizeof ( optimize_source_t ) +
+                                             ndata * sizeof ( int32_t ) );
+    if ( src == NULL ) {
+        fprintf ( stderr, "Out of memory.\n" );
+        return NULL;
+    }
+    src->sector  = sector;
+    src->real    = 0;
+    src->nblocks = ndata;
+
+    uint8_t ext [ 512 ];
+    const uint8_t * block = header;
+    uint32_t n = 0;
+    while ( n < ndata ) {
+        const uint32_t count = be32 ( block + 8 );
+        for ( uint32_t i = 0 ; i < count && i < ADF_MAX_DATABLK && n < ndata ; i++ )
+            src->blocks [ n++ ] = ( int32_t ) be32 ( block + 24 +
+                                                     ( ADF_MAX_DATABLK - 1 - i ) * 4 );
+        const int32_t next = ( int32_t ) be32 ( block + 0x1f8 );
+        if ( n < ndata && ( next == 0 || ! read_tree_block ( next, ADF_T_LIST, ext ) ) )
+            break;
+        block = ext;
+    }
+    if ( n < ndata ) {
+        fprintf ( stderr, "%s: incomplete block map (%" PRIu32 " of %" PRIu32 " blocks)\n",
+                  path, n, ndata );
+        free ( src );
+        return NULL;
+    }
+
+    // (the data blocks - also not used twice)
+    for ( uint32_t i = 0 ; i < ndata ; i++ ) {
+        const int32_t b = src->blocks [ i ];
+        if ( b < 2 || ( uint32_t ) b >= volume_blocks ||
+             ( visited [ b / 8 ] & ( 1u << ( b % 8 ) ) ) )
+        {
+            fprintf ( stderr, "%s: invalid data block %" PRId32 "\n", path, b );
+            free ( src );
+            return NULL;
+        }
+        visited [ b / 8 ] |= ( uint8_t ) ( 1u << ( b % 8 ) );
+    }
+    return src;
+}
+
+
+static bool read_dir ( adflayout_node_t * const dir,
+                       const int32_t            sector,
+                       const char * const       path )
+{
+    uint8_t dir_block [ 512 ];
+    if ( pread ( image_fd, dir_block, 512, ( off_t ) ( volume_offset +
+                 ( uint64_t ) sector * 512 ) ) != 512 )
+    {
+        return false;
+    }
+
+    // (all hash chains)
+    char child_path [ PATH_MAX ];
+    for ( unsigned h = 0 ; h < ADF_HT_SIZE ; h++ ) {
+        int32_t next = ( int32_t ) be32 ( dir_block + 24 + h * 4 );
+        while ( next != 0 ) {
+            uint8_t * const raw = malloc ( 512 );
+            if ( raw == NULL || ! read_tree_block ( next, ADF_T_HEADER, raw ) ) {
+                free ( raw );
+                return false;
+            }
+
+            char name [ ADF_MAXNAMELEN + 1 ];
+            const unsigned len = ( raw [ 0x1b0 ] < ADF_MAXNAMELEN ) ?
+                raw [ 0x1b0 ] : ADF_MAXNAMELEN;
+            memcpy ( name, raw + 0x1b1, len );
+            name [ len ] = '\0';
+            snprintf ( child_path, sizeof ( child_path ), "%s/%s", path, name );
+
+            const int32_t sec_type = ( int32_t ) be32 ( raw + 0x1fc );
+            adflayout_type_t type;
+            switch ( sec_type ) {
+            case ADF_ST_FILE:  type = ADFLAYOUT_FILE;      break;
+            case ADF_ST_DIR:   type = ADFLAYOUT_DIR;       break;
+            case ADF_ST_LSOFT: type = ADFLAYOUT_SOFT_LINK; break;
+            case ADF_ST_LFILE:
+            case ADF_ST_LDIR:  type = ADFLAYOUT_HARD_LINK; break;
+            default:
+                fprintf ( stderr, "%s: unknown type %" PRId32 "\n", child_path, sec_type );
+                free ( raw );
+                return false;
+            }
+
+            optimize_source_t * const src = ( type == ADFLAYOUT_FILE ) ?
+                read_block_map ( raw, next, child_path ) :
+                malloc ( sizeof ( optimize_source_t ) );
+            adflayout_node_t * const node = ( src != NULL ) ?
+                adflayout_add ( dir, type, name ) : NULL;
+            if ( node == NULL ) {
+                free ( src );
+                free ( raw );
+                return false;
+            }
+            if ( type != ADFLAYOUT_FILE ) {
+                src->sector  = next;
+                src->real    = ( type == ADFLAYOUT_HARD_LINK ) ?
+                    ( int32_t ) be32 ( raw + 0x1d4 ) : 0;
+                src->nblocks = 0;
+            }
+            node->raw    = raw;
+            node->source = src;
+            node->size   = ( type == ADFLAYOUT_FILE ) ? be32 ( raw + 0x144 ) : 0;
+            next = ( int32_t ) be32 ( raw + 0x1f0 );
+        }
+    }
+
+    // (laid out sorted - as adfbuild)
+    if ( ! adflayout_sort_dir ( &layout, dir ) )
+        return false;
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        snprintf ( child_path, sizeof ( child_path ), "%s/%s", path, node->name );
+        if ( node->type == ADFLAYOUT_DIR &&
+             ! read_dir ( node, ( ( optimize_source_t * ) node->source )->sector,
+                          child_path ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// the entries by their original header blocks
+typedef struct optimize_entry {
+    int32_t            sector;
+    adflayout_node_t * node;
+} optimize_entry_t;
+
+static int compare_entries ( const void * const entry1,
+                             const void * const entry2 )
+{
+    const int32_t s1 = ( ( const optimize_entry_t * ) entry1 )->sector,
+                  s2 = ( ( const optimize_entry_t * ) entry2 )->sector;
+    return ( s1 > s2 ) - ( s1 < s2 );
+}
+
+
+static size_t collect_entries ( adflayout_node_t * const dir,
+                                optimize_entry_t * const entries,
+                                size_t                   n )
+{
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        if ( entries != NULL )
+            entries [ n ] = ( optimize_entry_t ) {
+                ( ( optimize_source_t * ) node->source )->sector, node };
+        n++;
+        if ( node->type == ADFLAYOUT_DIR )
+            n = collect_entries ( node, entries, n );
+    }
+    return n;
+}
+
+
+static bool resolve_links ( adflayout_node_t * const       dir,
+                            const optimize_entry_t * const entries,
+                            const size_t                   n )
+{
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        adflayout_node_t * const node = &dir->children [ i ];
+        if ( node->type == ADFLAYOUT_DIR && ! resolve_links ( node, entries, n ) )
+            return false;
+        if ( node->type != ADFLAYOUT_HARD_LINK )
+            continue;
+        const optimize_entry_t key = {
+            ( ( optimize_source_t * ) node->source )->real, NULL };
+        const optimize_entry_t * const real = bsearch ( &key, entries, n,
+                                                        sizeof ( optimize_entry_t ),
+                                                        compare_entries );
+        if ( real == NULL || real->node->type == ADFLAYOUT_HARD_LINK ||
+             real->node->type == ADFLAYOUT_SOFT_LINK )
+        {
+            fprintf ( stderr, "%s: the hard link to a missing entry (block %" PRId32 ")\n",
+                      node->name, key.sector );
+            return false;
+        }
+        node->real = real->node;
+    }
+    return true;
+}
+
+
+// (after the tree is complete - the nodes do not move anymore)
+static bool link_hard_links ( void )
+{
+    const size_t n = collect_entries ( &layout.root, NULL, 0 );
+    optimize_entry_t * const entries = malloc ( ( n + 1 ) * sizeof ( optimize_entry_t ) );
+    if ( entries == NULL )
+        return false;
+    collect_entries ( &layout.root, entries, 0 );
+    qsort ( entries, n, sizeof ( optimize_entry_t ), compare_entries );
+    const bool ok = resolve_links ( &layout.root, entries, n );
+    free ( entries );
+    return ok;
+}
+
+
+/*****
+ * Fragmentation
+ *****/
+
+static void report ( const adflayout_node_t * const dir,
+                     const char * const             path )
+{
+    char child_path [ PATH_MAX ];
+    for ( size_t i = 0 ; i < dir->nchildren ; i++ ) {
+        const adflayout_node_t * const node = &dir->children [ i ];
+        snprintf ( child_path, sizeof ( child_path ), "%s/%s", path, node->name );
+        if ( node->type == ADFLAYOUT_DIR ) {
+            report ( node, child_path );
+            continue;
+        }
+        if ( node->type != ADFLAYOUT_FILE )
+            continue;
+
+        const optimize_source_t * const src = node->source;
+        const int32_t * const after = ( node->blocks != NULL ) ?
+            node->blocks + node->next : NULL;
+        const uint32_t fragments_before = adflayout_fragments ( src->blocks,
+                                                                src->nblocks ),
+                       fragments_after  = adflayout_fragments ( after, node->ndata );
+        const double   score_before = adflayout_fragmentation ( src->blocks,
+                                                                src->nblocks ),
+                       score_after  = adflayout_fragmentation ( after, node->ndata );
+        stats.files++;
+        stats.fragmented_before += ( fragments_before > 1 );
+        stats.fragmented_after  += ( fragments_after > 1 );
+        stats.fragments_before  += fragments_before;
+        stats.fragments_after   += fragments_after;
+        stats.score_before      += score_before;
+        stats.score_after       += score_after;
+        if ( ! opts.quiet )
+            printf ( "%s: %" PRIu32 " blocks, fragments: %" PRIu32 " -> %" PRIu32
+                     ", score: %.3f -> %.3f\n", child_path + 1, node->ndata,
+                     fragments_before, fragments_after, score_before, score_after );
+    }
+}
+
+
+/*****
+ * Writing
+ *****/
+
+// reading the data of a file from its original blocks (OFS - the data
+// after the header of each block)
+typedef struct optimize_reader {
+    const optimize_source_t * src;
+    uint32_t                  block,        // (the current one - loaded)
+                              offset;       // (in its data)
+    bool                      loaded;
+    uint8_t                   data [ 512 ];
+} optimize_reader_t;
+
+static bool source_open ( adflayout_node_t * const node,
+                          void * const             ctx )
+{
+    optimize_reader_t * const reader = ctx;
+    reader->src    = node->source;
+    reader->block  = 0;
+    reader->offset = 0;
+    reader->loaded = false;
+    return true;
+}
+
+
+static bool source_read ( uint8_t *    buf,
+                          size_t       size,
+                          void * const ctx )
+{
+    optimize_reader_t * const reader = ctx;
+    const optimize_source_t * const src = reader->src;
+    const bool ffs = ( layout.data_block_size == 512 );
+    while ( size > 0 ) {
+        if ( reader->block >= src->nblocks )
+            return false;
+        const int32_t * const blocks = src->blocks + reader->block;
+
+        // (FFS - whole runs of contiguous blocks at once)
+        if ( ffs && reader->offset == 0 && size >= 512 ) {
+            uint32_t run = 1;
+            while ( reader->block + run < src->nblocks && ( run + 1 ) * 512 <= size &&
+                    blocks [ run ] == blocks [ 0 ] + ( int32_t ) run )
+            {
+                run++;
+            }
+            const size_t n = ( size_t ) run * 512;
+            if ( pread ( image_fd, buf, n, ( off_t ) ( volume_offset +
+                         ( uint64_t ) blocks [ 0 ] * 512 ) ) != ( ssize_t ) n )
+            {
+                return false;
+            }
+            reader->block += run;
+            buf  += n;
+            size -= n;
+            continue;
+        }
+
+        if ( ! reader->loaded ) {
+            if ( pread ( image_fd, reader->data, 512, ( off_t ) ( volume_offset +
+                         ( uint64_t ) blocks [ 0 ] * 512 ) ) != 512 ||
+                 ( ! ffs && be32 ( reader->data ) != ADF_T_DATA ) )
+            {
+                return false;
+            }
+            reader->loaded = true;
+        }
+        const uint32_t block_size = ffs ? 512 : be32 ( reader->data + 12 ),
+                       header     = ffs ? 0 : 24;
+        if ( block_size > layout.data_block_size || reader->offset >= block_size )
+            return false;
+        const size_t n = ( size < block_size - reader->offset ) ?
+            size : block_size - reader->offset;
+        memcpy ( buf, reader->data + header + reader->offset, n );
+        reader->offset += ( uint32_t ) n;
+        buf  += n;
+        size -= n;
+        if ( reader->offset == block_size ) {
+            reader->block++;
+            reader->offset = 0;
+            reader->loaded = false;
+        }
+    }
+    return true;
+}
+
+
+static void source_close ( void * const ctx )
+{
+    (void) ctx;
+}
+
+
+static bool write_all ( const int          fd,
+                        const void * const buf,
+                        const size_t       size,
+                        uint64_t           offset )
+{
+    size_t done = 0;
+    while ( done < size ) {
+        const ssize_t n = pwrite ( fd, ( const uint8_t * ) buf + done, size - done,
+                                   ( off_t ) ( offset + done ) );
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            return false;
+        }
+        done += ( size_t ) n;
+    }
+    return true;
+}
+
+
+// a copy of the image with the new volume (the other volumes and
+// the partition table - as they are)
+static bool write_image ( const char * const path,
+                          const int          flags )
+{
+    struct stat st;
+    if ( fstat ( image_fd, &st ) != 0 )
+        return false;
+    const int fd = open ( path, O_WRONLY | O_CREAT | flags, st.st_mode & 0777 );
+    if ( fd < 0 ) {
+        fprintf ( stderr, "Cannot create %s: %s\n", path, strerror ( errno ) );
+        return false;
+    }
+
+    bool ok = true;
+    uint8_t * const buf = malloc ( OPTIMIZE_COPY_SIZE );
+    const uint64_t volume_end = volume_offset + ( uint64_t ) volume_blocks * 512;
+    for ( uint64_t offset = 0 ; ok && offset < ( uint64_t ) st.st_size ; ) {
+        // (the volume skipped)
+        if ( offset >= volume_offset && offset < volume_end ) {
+            offset = volume_end;
+            continue;
+        }
+        size_t size = ( size_t ) ( ( uint64_t ) st.st_size - offset );
+        if ( size > OPTIMIZE_COPY_SIZE )
+            size = OPTIMIZE_COPY_SIZE;
+        if ( offset < volume_offset && offset + size > volume_offset )
+            size = ( size_t ) ( volume_offset - offset );
+        ok = ( buf != NULL &&
+               pread ( image_fd, buf, size, ( off_t ) offset ) == ( ssize_t ) size &&
+               write_all ( fd, buf, size, offset ) );
+        offset += size;
+    }
+    free ( buf );
+
+    ok = ok && write_all ( fd, layout.image, ( size_t ) volume_blocks * 512,
+                           volume_offset ) &&
+         fsync ( fd ) == 0;
+    if ( close ( fd ) != 0 || ! ok ) {
+        fprintf ( stderr, "Error writing %s: %s\n", path, strerror ( errno ) );
+        unlink ( path );
+        return false;
+    }
+    return true;
+}
+
+
+static bool write_volume ( void )
+{
+    optimize_reader_t reader;
+    const adflayout_source_t source = {
+        .open  = source_open,
+        .read  = source_read,
+        .close = source_close,
+        .ctx   = &reader
+    };
+    if ( ! adflayout_build ( &layout, &source ) )
+        return false;
+
+    if ( opts.output != NULL )
+        return write_image ( opts.output, O_EXCL );
+
+    // (in place - the original kept until the new one is complete)
+    char tmp [ PATH_MAX ];
+    snprintf ( tmp, sizeof ( tmp ), "%s.adfoptimize", opts.image );
+    if ( ! write_image ( tmp, O_EXCL ) )
+        return false;
+    if ( rename ( tmp, opts.image ) != 0 ) {
+        fprintf ( stderr, "Cannot replace %s: %s\n", opts.image, strerror ( errno ) );
+        unlink ( tmp );
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+/*
+ * adfverify - verifying volumes without mounting them (a read-only fsck)
+ *
+ * Checks the checksums, types and links of all metadata blocks of each
+ * volume with a pool of threads and compares the bitmap with the blocks
+ * reachable from the root (see adfverify.h). A directory given instead
+ * of an image - all images it contains are verified.
+ *
+ * Exit status: 0 - all volumes clean (lost blocks are only reported),
+ * 1 - errors found (or a volume could not be opened).
+ */
+
+#include "adfverify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct verify_options {
+    unsigned volume;
+    bool     all_volumes,
+             data_blocks,
+             quiet;
+    unsigned nthreads;
+} verify_options_t;
+
+static verify_options_t opts = {
+    .volume      = 0,
+    .all_volumes = false,
+    .data_blocks = false,
+    .quiet       = false,
+    .nthreads    = 0
+};
+
+static void usage ( void );
+
+static bool parse_options ( int    argc,
+                            char * argv[] );
+
+
+int main ( int    argc,
+           char * argv[] )
+{
+    if ( ! parse_options ( argc, argv ) ) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    const adfverify_options_t verify_options = {
+        .nthreads    = opts.nthreads,
+        .data_blocks = opts.data_blocks,
+        .errors      = opts.quiet ? NULL : stdout
+    };
+    bool clean = true;
+    for ( int i = optind ; i < argc ; i++ ) {
+        if ( ! adfverify_images ( argv [ i ], opts.volume, opts.all_volumes,
+                                  &verify_options, stdout ) )
+        {
+            clean = false;
+        }
+    }
+    return clean ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static void usage ( void )
+{
+    printf ( "\nUsage:  adfverify [options] image|directory...\n\n"
+             "Verifies volumes of the images (all images of a directory):\n"
+             "the checksums, types and links of the metadata blocks\n"
+             "and the bitmap (compared with the blocks in use).\n\n"
+             "Options:\n"
+             "  -p volume    volume (partition) number, default: 0\n"
+             "  -a           verify all volumes of the images\n"
+             "  -j threads   threads reading the metadata (default: the number\n"
+             "               of CPUs, max. %u)\n"
+             "  -d           check also the data blocks (OFS)\n"
+             "  -q           do not list the errors (only the summaries)\n"
+             "  -h           show this help\n\n",
+             ADFVERIFY_THREADS_MAX );
+}
+
+
+static bool parse_options ( int    argc,
+                            char * argv[] )
+{
+    const long ncpus = sysconf ( _SC_NPROCESSORS_ONLN );
+    opts.nthreads = ( ncpus > 0 ) ? ( unsigned ) ncpus : 1;
+
+    bool volume_set = false;
+    int opt;
+    while ( ( opt = getopt ( argc, argv, "p:aj:dqh" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'p':
+            opts.volume = ( unsigned ) strtoul ( optarg, NULL, 10 );
+            volume_set = true;
+            break;
+        case 'a':
+            opts.all_volumes = true;
+            break;
+        case 'j':
+            opts.nthreads = ( unsigned ) strtoul ( optarg, NULL, 10 );
+            if ( opts.nthreads == 0 )
+                return false;
+            break;
+        case 'd':
+            opts.data_blocks = true;
+            break;
+        case 'q':
+            opts.quiet = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    if ( opts.nthreads > ADFVERIFY_THREADS_MAX )
+        opts.nthreads = ADFVERIFY_THREADS_MAX;
+
+    return ( optind < argc && ! ( volume_set && opts.all_volumes ) );
+}